@@ -0,0 +1,673 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lib/protocol.h"
+#include "lib/server/phash.h"
+#include "lib/server/database.h"
+#include "lib/server/rooms.h"
+#include "lib/server/session.h"
+#include "lib/server/engine.h"
+#include "lib/server/logger.h"
+
+/**
+ * Microbenchmark dei percorsi critici del server: codifica e decodifica
+ *  dei messaggi, database degli utenti, ricerca dei nomi di una room e
+ *  delle sessioni, comandi eseguiti dal motore di gioco. Ogni misura
+ *  riporta i nanosecondi e le allocazioni (malloc, calloc e realloc) per
+ *  operazione, una riga JSON per misura
+ *  (o una tabella con -t), così i risultati possono essere confrontati
+ *  tra una versione e l'altra.
+ *
+ * Le allocazioni vengono contate sostituendo malloc & co. al momento del
+ *  link (-Wl,--wrap, vedi il makefile).
+ */
+
+/* Ogni misura viene ripetuta, raddoppiando le operazioni, finché non dura almeno tanto */
+#define BENCH_MIN_NS 2e8
+
+/* Una ricerca su dieci riguarda un nome che non esiste */
+#define MISS_RATE 10
+
+/* Lunghezza massima dei nomi generati */
+#define NAME_LENGTH_MAX 32
+
+/* Numero di richieste pregenerate per le ricerche (vengono riusate ciclicamente) */
+#define QUERIES 65536
+
+/* Allocazioni eseguite dall'avvio */
+static unsigned long g_allocs = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void *p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    g_allocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    g_allocs++;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void *p, size_t size) {
+    g_allocs++;
+    return __real_realloc(p, size);
+}
+
+/* Opzioni della riga di comando */
+static int g_text = 0;
+static int g_quick = 0;
+static const char *g_filter = NULL;
+
+/* Ritorna il tempo attuale in nanosecondi (orologio monotono) */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Generatore pseudo-casuale deterministico (xorshift32) */
+static unsigned int next_rand(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void* xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        fprintf(stderr, "memoria esaurita\n");
+        exit(-1);
+    }
+    return p;
+}
+
+/* Vero se la misura *name* va eseguita (il filtro è un prefisso) */
+static int selected(const char *name) {
+    return g_filter == NULL || strncmp(name, g_filter, strlen(g_filter)) == 0;
+}
+
+/**
+ * Una misura: *run* esegue *n* operazioni su *ctx* e ritorna un valore
+ *  che dipende dai risultati (così il compilatore non le elimina).
+ */
+typedef long (*bench_fn)(void *ctx, long n);
+
+static long g_sink = 0;
+
+/**
+ * Esegue e riporta la misura *name* con parametro *param* (la dimensione),
+ *  senza superare *max_ops* operazioni se è positivo.
+ */
+static void bench(const char *name, const char *variant, long param, long max_ops, bench_fn run, void *ctx) {
+    double start, elapsed;
+    unsigned long allocs;
+    long n = 1;
+
+    if (!selected(name)) {
+        return;
+    }
+
+    while (1) {
+        allocs = g_allocs;
+        start = now_ns();
+        g_sink += run(ctx, n);
+        elapsed = now_ns() - start;
+        allocs = g_allocs - allocs;
+        if (elapsed >= BENCH_MIN_NS || (max_ops > 0 && n * 2 > max_ops)) {
+            break;
+        }
+        n *= 2;
+    }
+
+    if (g_text) {
+        printf("%-20s %-8s %10ld %14.1f ns/op %8.2f allocs/op %12ld ops\n",
+            name, variant, param, elapsed / n, (double)allocs / n, n);
+    }
+    else {
+        printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"n\":%ld,\"ns_per_op\":%.1f,"
+            "\"allocs_per_op\":%.2f,\"ops\":%ld}\n",
+            name, variant, param, elapsed / n, (double)allocs / n, n);
+    }
+    fflush(stdout);
+}
+
+/* --------------------------- Protocollo --------------------------- */
+
+struct msg_ctx {
+    enum ACTION action;
+    int argc;
+    char *argv[ARGC_MAX];
+    char buffer[IO_BUFFER_SIZE];
+    int size;
+};
+
+static long run_encode(void *ctx, long n) {
+    struct msg_ctx *m = ctx;
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        sink += encode_message(m->buffer, IO_BUFFER_SIZE, m->action, m->argc, m->argv);
+    }
+    return sink;
+}
+
+static long run_decode(void *ctx, long n) {
+    struct msg_ctx *m = ctx;
+    char *argv[ARGC_MAX];
+    enum ACTION action;
+    long i, sink = 0;
+    int argc;
+
+    for (i = 0; i < n; i++) {
+        sink += decode_message(m->buffer, m->size, &action, &argc, argv) + argc;
+        free_argv(argv);
+    }
+    return sink;
+}
+
+/* Messaggi tipici: login, comandi, risposte con testo e riepilogo, lista delle room */
+static void bench_protocol(void) {
+    static char reply[] = "Si tratta di una moderna scrivania di legno con sopra un **computer** "
+        "ed un **router**. Vicino all'ingresso c'e' una ++scatola++ di cartone con dentro un "
+        "**cavo** ed una **tastiera**. Dietro di te c'e' una ++libreria++. Il tuo obbiettivo e' "
+        "quello di sbloccare il computer e connetterlo ad internet, i tuoi compagni si occuperanno "
+        "del resto.\n [Tempo rimasto: 597s, Token raccolti: 1/3]";
+    static char *login[] = { "utente_4242", "password_segreta" };
+    static char *use[] = { "cavo", "router" };
+    static char *replies[] = { reply, "-" };
+    static char *rooms[] = { "Red Teaming", "Laboratorio", "Biblioteca", "Cripta", "Osservatorio",
+        "Sala macchine", "Archivio", "Serra", "Cantina", "Torre" };
+    struct {
+        const char *name;
+        enum ACTION action;
+        int argc;
+        char **argv;
+    } mixes[] = {
+        { "login", CLIENT, 2, login },
+        { "command", USE, 2, use },
+        { "reply", SERVER, 2, replies },
+        { "rooms", SERVER, 10, rooms }
+    };
+    struct msg_ctx m;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(mixes) / sizeof(mixes[0])); i++) {
+        m.action = mixes[i].action;
+        m.argc = mixes[i].argc;
+        memcpy(m.argv, mixes[i].argv, sizeof(char *) * m.argc);
+        m.size = encode_message(m.buffer, IO_BUFFER_SIZE, m.action, m.argc, m.argv);
+
+        bench("encode", mixes[i].name, m.size, 0, run_encode, &m);
+        bench("decode", mixes[i].name, m.size, 0, run_decode, &m);
+    }
+}
+
+/* ---------------------------- Database ---------------------------- */
+
+struct db_ctx {
+    long users;     /* Utenti attualmente nel database: utente_0 ... */
+    unsigned int seed;
+};
+
+static long run_db_read(void *ctx, long n) {
+    struct db_ctx *d = ctx;
+    char username[CREDENTIALS_LENGTH_MAX];
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        unsigned int r = next_rand(&d->seed);
+
+        /* Le ricerche fallite scorrono tutto il database */
+        if (r % 100 < MISS_RATE) {
+            strcpy(username, "inesistente");
+        }
+        else {
+            sprintf(username, "utente_%ld", (long)((r >> 8) % d->users));
+        }
+        sink += db_read(username, "password");
+    }
+    return sink;
+}
+
+static long run_db_write(void *ctx, long n) {
+    struct db_ctx *d = ctx;
+    char username[CREDENTIALS_LENGTH_MAX];
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        sprintf(username, "utente_%ld", d->users++);
+        sink += db_write(username, "password");
+    }
+    return sink;
+}
+
+/**
+ * Il database non può essere svuotato: cresce fino a ciascuna dimensione
+ *  e la misura delle scritture aggiunge utenti oltre quella raggiunta
+ *  (al più un quarto, per non esaurire la memoria).
+ */
+static void bench_database(void) {
+    long sizes[] = { 1000, 10000, 100000, 1000000, 10000000 };
+    struct db_ctx d;
+    int i;
+
+    if (!selected("db_")) {
+        return;
+    }
+
+    d.users = 0;
+    d.seed = 42;
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        char username[CREDENTIALS_LENGTH_MAX];
+        long size = sizes[i];
+
+        if (g_quick && size > 100000) {
+            break;
+        }
+        while (d.users < size) {
+            sprintf(username, "utente_%ld", d.users++);
+            if (db_write(username, "password") == DB_WRITE_FAIL) {
+                fprintf(stderr, "memoria esaurita dopo %ld utenti\n", d.users);
+                return;
+            }
+        }
+        bench("db_read", "random", size, 0, run_db_read, &d);
+        bench("db_write", "append", size, size / 4, run_db_write, &d);
+    }
+}
+
+/* ----------------------------- Room ------------------------------- */
+
+struct room_ctx {
+    struct room *room;
+    struct session *session;
+    char **queries;
+    int *objects;
+};
+
+/**
+ * Scrive in *path* una room con *n_objects* oggetti divisi in locazioni
+ *  da 16, come farebbe un autore (il primo dà l'unico token).
+ */
+static int write_room(const char *path, int n_objects) {
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "room Benchmark\ntime_limit 10\n");
+    for (i = 0; i < n_objects; i++) {
+        if (i % 16 == 0) {
+            fprintf(f, "location locazione_%d\nlook Una locazione.\n", i / 16);
+        }
+        fprintf(f, "object oggetto_%d\ntake %s\nlocked_look Un oggetto.\n",
+            i, i == 0 ? "GIVE_TOKEN" : "UNLOCKED");
+    }
+    return fclose(f);
+}
+
+/* Carica il catalogo *path* senza i warning di load_catalogue(...) sullo stdout */
+static struct catalogue* load_quietly(const char *path) {
+    struct catalogue *c;
+    int saved, null_fd;
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    c = load_catalogue(path);
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return c;
+}
+
+static long run_get_object(void *ctx, long n) {
+    struct room_ctx *r = ctx;
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        sink += get_object(r->room, r->queries[i % QUERIES]);
+    }
+    return sink;
+}
+
+static long run_get_location(void *ctx, long n) {
+    struct room_ctx *r = ctx;
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        sink += get_location(r->room, r->queries[i % QUERIES]) != NULL;
+    }
+    return sink;
+}
+
+static long run_get_status(void *ctx, long n) {
+    struct room_ctx *r = ctx;
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        sink += get_status(r->session, r->objects[i % QUERIES])->state;
+    }
+    return sink;
+}
+
+/* Ricerca lineare, quella di get_location(...)/get_object(...) prima dell'hash perfetto */
+static long run_scan(void *ctx, long n) {
+    struct room_ctx *r = ctx;
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        const char *name = r->queries[i % QUERIES];
+        int k;
+
+        for (k = 0; k < r->room->tot_objects && strcmp(r->room->object_names[k], name) != 0; k++) ;
+        sink += k;
+    }
+    return sink;
+}
+
+/**
+ * Genera (vedi write_room(...)) e carica un catalogo con una sola room di
+ *  *n_objects* oggetti, che diventa la versione corrente.
+ */
+static struct catalogue* generate_catalogue(int n_objects) {
+    char path[] = "/tmp/bench_rooms_XXXXXX";
+    struct catalogue *c;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd == -1 || close(fd) == -1 || write_room(path, n_objects) == -1) {
+        fprintf(stderr, "impossibile scrivere %s\n", path);
+        exit(-1);
+    }
+    c = load_quietly(path);
+    remove(path);
+    if (c == NULL) {
+        fprintf(stderr, "impossibile caricare la room di %d oggetti\n", n_objects);
+        exit(-1);
+    }
+    g_catalogue = c;
+    return c;
+}
+
+/* Crea la sessione di un giocatore (con ID *sd*) ed inizia una partita nella room 0 */
+static struct session* enter_player(int sd) {
+    struct session *session = init_session(sd, "giocatore");
+
+    if (session == NULL) {
+        fprintf(stderr, "memoria esaurita\n");
+        exit(-1);
+    }
+    enter_room(session, 0);
+    session->start_time = (unsigned long)time(NULL);
+    session->entry_time = session->start_time;
+    if (load_statuses(session) == -1) {
+        fprintf(stderr, "memoria esaurita\n");
+        exit(-1);
+    }
+    return session;
+}
+
+static void bench_room(int n_objects) {
+    char (*storage)[NAME_LENGTH_MAX];
+    struct catalogue *c;
+    struct room_ctx r;
+    unsigned int seed = 42;
+    int i, n_locations;
+
+    if (!selected("get_") && !selected("scan")) {
+        return;
+    }
+
+    c = generate_catalogue(n_objects);
+    r.room = &c->rooms[0];
+    r.session = enter_player(0);
+
+    /* Metà delle richieste sono oggetti e metà locazioni, più i nomi inesistenti */
+    n_locations = r.room->n_locations;
+    storage = xmalloc(NAME_LENGTH_MAX * QUERIES);
+    r.queries = xmalloc(sizeof(char *) * QUERIES);
+    r.objects = xmalloc(sizeof(int) * QUERIES);
+    for (i = 0; i < QUERIES; i++) {
+        unsigned int x = next_rand(&seed);
+
+        if (x % 100 < MISS_RATE) {
+            strcpy(storage[i], "inesistente");
+        }
+        else if (x & 256) {
+            sprintf(storage[i], "oggetto_%d", (int)((x >> 9) % n_objects));
+        }
+        else {
+            sprintf(storage[i], "locazione_%d", (int)((x >> 9) % n_locations));
+        }
+        r.queries[i] = storage[i];
+        r.objects[i] = (x >> 9) % n_objects;
+    }
+
+    bench("get_object", "phash", n_objects, 0, run_get_object, &r);
+    bench("get_location", "phash", n_objects, 0, run_get_location, &r);
+    bench("get_status", "index", n_objects, 0, run_get_status, &r);
+    bench("scan_object", "linear", n_objects, 0, run_scan, &r);
+
+    destroy_session(r.session);
+    catalogue_release(c);
+    g_catalogue = NULL;
+    free(storage);
+    free(r.queries);
+    free(r.objects);
+}
+
+/* ----------------------------- Motore ----------------------------- */
+
+/* Comandi di un giro della sequenza eseguita da bench_engine(...) */
+#define ENGINE_ROUND 6
+
+struct engine_cmd {
+    enum ACTION action;
+    int argc;
+    char *argv[ARGC_MAX];
+};
+
+struct engine_ctx {
+    struct session *session;
+    struct engine_cmd *cmds;
+    int n_cmds;
+};
+
+/* Eventi ricevuti dal motore e byte dei loro testi */
+static long g_events = 0;
+static long g_event_bytes = 0;
+
+/* Al posto dei socket: gli eventi vengono solo contati */
+static int count_event(void *ctx, const struct engine_event *ev) {
+    g_events++;
+    if (ev->text != NULL) {
+        g_event_bytes += ev->text->size;
+    }
+    return 0;
+}
+
+static long run_engine(void *ctx, long n) {
+    struct engine_ctx *e = ctx;
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        struct engine_cmd *c = &e->cmds[i % e->n_cmds];
+        sink += engine_command(e->session, c->action, c->argc, c->argv);
+    }
+    return sink + g_events;
+}
+
+/**
+ * Comandi decodificati eseguiti dal motore, senza socket né syscall: un
+ *  giocatore prende, guarda e posa oggetti a caso della room (mai il primo,
+ *  che dà l'unico token e farebbe finire la partita), guarda locazioni e la
+ *  stanza ed elenca l'inventario.
+ */
+static void bench_engine(int n_objects) {
+    char (*storage)[NAME_LENGTH_MAX];
+    struct catalogue *c;
+    struct engine_ctx e;
+    unsigned int seed = 42;
+    int i;
+
+    if (!selected("engine")) {
+        return;
+    }
+
+    /* Il log resta in memoria (nessuno lo scrive), le informazioni non servono */
+    logger_set_level(LOG_WARNING);
+    engine_init(count_event, NULL);
+    c = generate_catalogue(n_objects);
+    e.session = enter_player(0);
+
+    e.n_cmds = QUERIES - QUERIES % ENGINE_ROUND;
+    e.cmds = xmalloc(sizeof(struct engine_cmd) * e.n_cmds);
+    storage = xmalloc(NAME_LENGTH_MAX * (e.n_cmds / ENGINE_ROUND) * 2);
+    for (i = 0; i < e.n_cmds; i += ENGINE_ROUND) {
+        unsigned int x = next_rand(&seed);
+        char *object = storage[i / ENGINE_ROUND * 2];
+        char *location = storage[i / ENGINE_ROUND * 2 + 1];
+        struct engine_cmd *round = &e.cmds[i];
+        enum ACTION actions[ENGINE_ROUND] = { TAKE, OBJS, LOOK, DROP, LOOK, LOOK };
+        int k;
+
+        sprintf(object, "oggetto_%d", 1 + (int)((x >> 9) % (n_objects - 1)));
+        sprintf(location, "locazione_%d", (int)((x >> 9) % c->rooms[0].n_locations));
+        for (k = 0; k < ENGINE_ROUND; k++) {
+            round[k].action = actions[k];
+            round[k].argc = 1;
+            round[k].argv[0] = object;
+        }
+        round[1].argc = 0;
+        round[4].argv[0] = location;
+        round[5].argc = 0;
+    }
+
+    bench("engine", "mixed", n_objects, 0, run_engine, &e);
+
+    destroy_session(e.session);
+    catalogue_release(c);
+    g_catalogue = NULL;
+    free(storage);
+    free(e.cmds);
+}
+
+/* ---------------------------- Sessioni ---------------------------- */
+
+struct session_ctx {
+    int n;
+    unsigned int seed;
+};
+
+static long run_by_sd(void *ctx, long n) {
+    struct session_ctx *s = ctx;
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        sink += get_session_by_sd(next_rand(&s->seed) % s->n) != NULL;
+    }
+    return sink;
+}
+
+static long run_by_username(void *ctx, long n) {
+    struct session_ctx *s = ctx;
+    char username[CREDENTIALS_LENGTH_MAX];
+    long i, sink = 0;
+
+    for (i = 0; i < n; i++) {
+        sprintf(username, "utente_%d", (int)(next_rand(&s->seed) % s->n));
+        sink += get_session_by_username(username) != NULL;
+    }
+    return sink;
+}
+
+static void bench_sessions(void) {
+    int sizes[] = { 16, 1000, 10000, 100000 };
+    struct session_ctx s;
+    int i, open = 0;
+
+    if (!selected("session_")) {
+        return;
+    }
+
+    s.seed = 42;
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        char username[CREDENTIALS_LENGTH_MAX];
+
+        if (g_quick && sizes[i] > 10000) {
+            break;
+        }
+        for (; open < sizes[i]; open++) {
+            sprintf(username, "utente_%d", open);
+            if (init_session(open, username) == NULL) {
+                fprintf(stderr, "memoria esaurita\n");
+                exit(-1);
+            }
+        }
+        s.n = sizes[i];
+        bench("session_by_sd", "list", s.n, 0, run_by_sd, &s);
+        bench("session_by_username", "list", s.n, 0, run_by_username, &s);
+    }
+
+    while (g_sessions != NULL) {
+        destroy_session(g_sessions);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int rooms[] = { 9, 64, 1024, 16384 };
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            g_text = 1;
+        }
+        else if (strcmp(argv[i], "-q") == 0) {
+            g_quick = 1;
+        }
+        else if (argv[i][0] != '-') {
+            g_filter = argv[i];
+        }
+        else {
+            printf("Uso: %s [-t] [-q] [prefisso]\n"
+                "  -t        tabella invece di una riga JSON per misura\n"
+                "  -q        dimensioni ridotte (database fino a 100000 utenti)\n"
+                "  prefisso  esegue solo le misure il cui nome inizia così\n"
+                "Misure: encode, decode, db_read, db_write, get_object, get_location,\n"
+                "  get_status, scan_object, engine, session_by_sd, session_by_username\n", argv[0]);
+            return -1;
+        }
+    }
+
+    bench_protocol();
+    for (i = 0; i < (int)(sizeof(rooms) / sizeof(rooms[0])); i++) {
+        if (!g_quick || rooms[i] <= 1024) {
+            bench_room(rooms[i]);
+            bench_engine(rooms[i]);
+        }
+    }
+    bench_sessions();
+
+    /* Per ultimo: il database non può essere svuotato */
+    bench_database();
+
+    return g_sink == 42 ? 1 : 0;
+}
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <sys/select.h>
 
 #include "lib/protocol.h"
 #include "lib/mystdlib.h"
@@ -42,8 +43,8 @@ enum RESPONSE login(int sd, char *username, char *password) {
     }
 
     /* Ricezione della risposta del server (la dimensione è nota) */
-    ret = recv(sd, &response, sizeof(response), 0);
-    if (ret <= 0) {
+    ret = recv_all(sd, &response, sizeof(response));
+    if (ret == -1) {
         return -1;
     }
 
@@ -126,6 +127,24 @@ void print_help(enum ACTION action) {
                 " # Sintassi: drop object\n"
                 " Posa l'oggetto precedentemente raccolto\n");
             break;
+        case RANK:
+            printf(
+                " # Sintassi: rank [room]\n"
+                " Mostra la classifica della room specificata,"
+                " o di quella in cui stai giocando\n");
+            break;
+        case SPECTATE:
+            printf(
+                " # Sintassi: spectate room\n"
+                " Guarda in diretta la partita in corso nella room"
+                " specificata, premi invio per smettere\n");
+            break;
+        case HINT:
+            printf(
+                " # Sintassi: hint\n"
+                " Suggerisce la prossima mossa per raccogliere"
+                " tutti i token\n");
+            break;
         case END:
             printf(
                 " # Sintassi: end\n"
@@ -140,6 +159,9 @@ void print_help(enum ACTION action) {
                 "  > use object1 [object2]\n"
                 "  > objs\n"
                 "  > drop\n"
+                "  > rank [room]\n"
+                "  > spectate room\n"
+                "  > hint\n"
                 "  > end\n"
                 " Per una descrizione più accurata puoi scrivere > help"
                     " comando\n");
@@ -147,8 +169,407 @@ void print_help(enum ACTION action) {
     }
 }
 
+/* Cosa sta aspettando il client, vedi main(...) */
+enum MODE {
+    MODE_COMMAND,   /* Un comando dallo stdin */
+    MODE_ANSWER,    /* La risposta ad una domanda del server, dallo stdin */
+    MODE_REPLY,     /* La risposta del server (intanto lo stdin non viene letto) */
+    MODE_WATCH,     /* Eventi della partita che si sta guardando, o invio per smettere */
+    MODE_STOPPING   /* La conferma che si è smesso di guardare */
+};
+
+/* Mostra la richiesta di input per *mode*, se ne serve una */
+void print_prompt(enum MODE mode) {
+    if (mode == MODE_COMMAND) {
+        printf("\n > ");
+    }
+    else if (mode == MODE_ANSWER) {
+        printf(" Risposta: ");
+    }
+    fflush(stdout);
+}
+
+/**
+ * Manifesto della room in cui si sta giocando (vedi MANIFEST in protocol.h)
+ *  ed inventario, aggiornato ad ogni risposta del server: permette di
+ *  rispondere a objs e di scartare i comandi sbagliati senza inviarli.
+ */
+struct manifest {
+    int loaded;             /* Vero se è stato ricevuto un manifesto */
+    int playing;            /* Vero se l'ultima risposta del server conteneva l'inventario */
+    int capacity;           /* Quanti oggetti si possono tenere in mano */
+
+    /* Argomenti del messaggio MANIFEST, i nomi puntano al loro interno */
+    char *location_list, *object_list, *flags;
+    char **locations, **objects;
+    int n_locations, n_objects;
+
+    /* held[i] vale 1 se l'oggetto i è nell'inventario */
+    unsigned char *held;
+    int n_held;
+};
+
+struct manifest g_manifest;
+
+/* Dimentica il manifesto ricevuto, i comandi verranno controllati dal server */
+void manifest_clear(void) {
+    free(g_manifest.location_list);
+    free(g_manifest.object_list);
+    free(g_manifest.flags);
+    free(g_manifest.locations);
+    free(g_manifest.objects);
+    free(g_manifest.held);
+    memset(&g_manifest, 0, sizeof(g_manifest));
+}
+
+/**
+ * Divide in nomi la lista *list* del manifesto, separati da uno spazio.
+ * Ritorna un vettore di puntatori in *list* e ne scrive la dimensione in *n*.
+ */
+char** split_names(char *list, int *n) {
+    char **names;
+    int i;
+
+    *n = 0;
+    if (strcmp(list, MANIFEST_EMPTY) == 0) {
+        return malloc(sizeof(char *));
+    }
+    for (i = 0; list[i] != '\0'; i++) {
+        *n += list[i] == ' ';
+    }
+    (*n)++;
+
+    names = malloc(sizeof(char *) * (*n));
+    if (names == NULL) {
+        return NULL;
+    }
+    names[0] = list;
+    for (i = 1; i < *n; i++) {
+        names[i] = strchr(names[i - 1], ' ');
+        *names[i]++ = '\0';
+    }
+    return names;
+}
+
+/**
+ * Aggiorna l'inventario con la lista di indici *inventory* inviata dal
+ *  server. Se non è valida il manifesto non viene più usato.
+ */
+void manifest_sync(const char *inventory) {
+    const char *p = inventory;
+
+    g_manifest.playing = g_manifest.loaded;
+    if (!g_manifest.playing) {
+        return;
+    }
+
+    memset(g_manifest.held, 0, g_manifest.n_objects + 1);
+    g_manifest.n_held = 0;
+    if (strcmp(inventory, MANIFEST_EMPTY) == 0) {
+        return;
+    }
+    while (*p != '\0') {
+        char *end;
+        long i = strtol(p, &end, 10);
+
+        if (end == p || i < 0 || i >= g_manifest.n_objects) {
+            manifest_clear();
+            return;
+        }
+        g_manifest.held[i] = 1;
+        g_manifest.n_held++;
+        for (p = end; *p == ' '; p++) ;
+    }
+}
+
+/**
+ * Memorizza il manifesto ricevuto dal server, prendendo possesso dei
+ *  suoi argomenti (in *argv* vengono sostituiti da NULL).
+ */
+void manifest_load(int argc, char *argv[ARGC_MAX]) {
+    manifest_clear();
+    if (argc != 5) {
+        return;
+    }
+
+    g_manifest.capacity = atoi(argv[0]);
+    g_manifest.location_list = argv[1];
+    g_manifest.object_list = argv[2];
+    g_manifest.flags = argv[3];
+    argv[1] = argv[2] = argv[3] = NULL;
+
+    g_manifest.locations = split_names(g_manifest.location_list, &g_manifest.n_locations);
+    g_manifest.objects = split_names(g_manifest.object_list, &g_manifest.n_objects);
+    g_manifest.held = malloc(g_manifest.n_objects + 1);
+    if (g_manifest.locations == NULL || g_manifest.objects == NULL || g_manifest.held == NULL ||
+        (g_manifest.n_objects > 0 && (int)strlen(g_manifest.flags) != g_manifest.n_objects)) {
+        manifest_clear();
+        return;
+    }
+
+    g_manifest.loaded = 1;
+    manifest_sync(argv[4]);
+}
+
+/* Ritorna l'indice di *name* in *names*, -1 se non c'è */
+int find_name(char **names, int n, const char *name) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Distanza di edit (Levenshtein) tra *a* e *b* */
+int edit_distance(const char *a, const char *b) {
+    int row[IO_BUFFER_SIZE];
+    int i, j, len_b = strlen(b);
+
+    if (len_b >= IO_BUFFER_SIZE) {
+        return IO_BUFFER_SIZE;
+    }
+    for (j = 0; j <= len_b; j++) {
+        row[j] = j;
+    }
+    for (i = 1; a[i - 1] != '\0'; i++) {
+        int diagonal = row[0];
+
+        row[0] = i;
+        for (j = 1; j <= len_b; j++) {
+            int best = diagonal + (a[i - 1] != b[j - 1]);
+
+            diagonal = row[j];
+            if (row[j] + 1 < best) {
+                best = row[j] + 1;
+            }
+            if (row[j - 1] + 1 < best) {
+                best = row[j - 1] + 1;
+            }
+            row[j] = best;
+        }
+    }
+    return row[len_b];
+}
+
+/**
+ * Cerca in *names* il nome più simile a *name*, se la distanza è minore
+ *  di *best_distance* aggiorna quest'ultima e *best*.
+ */
+void closest_name(char **names, int n, const char *name, const char **best, int *best_distance) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        int d = edit_distance(name, names[i]);
+        if (d < *best_distance) {
+            *best_distance = d;
+            *best = names[i];
+        }
+    }
+}
+
+/**
+ * Stampa *msg* come se fosse la risposta del server e, se tra gli oggetti
+ *  (e le locazioni, se *locations* è vero) c'è un nome abbastanza simile
+ *  a *name*, lo suggerisce.
+ */
+void local_reply(const char *msg, const char *name, int locations) {
+    const char *best = NULL;
+    int best_distance = 3;
+
+    printf(" %s\n", msg);
+    if (name == NULL) {
+        return;
+    }
+    closest_name(g_manifest.objects, g_manifest.n_objects, name, &best, &best_distance);
+    if (locations) {
+        closest_name(g_manifest.locations, g_manifest.n_locations, name, &best, &best_distance);
+    }
+    if (best != NULL && best_distance < (int)strlen(name)) {
+        printf(" Forse intendevi \"%s\"?\n", best);
+    }
+}
+
+/**
+ * Controlla il comando *action* con il manifesto della room in cui si
+ *  sta giocando: se il server lo rifiuterebbe, o se la risposta è già
+ *  nota (objs), la stampa e ritorna 1. Altrimenti ritorna 0 ed il comando
+ *  va inviato al server.
+ */
+int answer_locally(enum ACTION action, int argc, char *argv[ARGC_MAX]) {
+    int object, target, flags, i;
+
+    if (!g_manifest.playing) {
+        return 0;
+    }
+
+    if (action == OBJS) {
+        if (g_manifest.n_held == 0) {
+            local_reply("Non hai nessun oggetto.", NULL, 0);
+            return 1;
+        }
+        for (i = 0; i < g_manifest.n_objects; i++) {
+            if (g_manifest.held[i]) {
+                printf(" %s\n", g_manifest.objects[i]);
+            }
+        }
+        return 1;
+    }
+
+    if (argc < 1 || (action != LOOK && action != TAKE && action != USE && action != DROP)) {
+        return 0;
+    }
+
+    object = find_name(g_manifest.objects, g_manifest.n_objects, argv[0]);
+    if (action == LOOK) {
+        if (object == -1 && find_name(g_manifest.locations, g_manifest.n_locations, argv[0]) == -1) {
+            local_reply("Non c'è nessuna locazione od oggetto con questo nome.", argv[0], 1);
+            return 1;
+        }
+        return 0;
+    }
+    if (object == -1) {
+        local_reply(action == USE ? "Il primo oggetto specificato non esiste." :
+            "L'oggetto specificato non esiste.", argv[0], 0);
+        return 1;
+    }
+
+    if (action == TAKE) {
+        if (g_manifest.held[object]) {
+            local_reply("Hai già questo oggetto in mano.", NULL, 0);
+            return 1;
+        }
+        if (g_manifest.n_held >= g_manifest.capacity) {
+            local_reply("Hai troppi oggetti in mano, devi posarne qualcuno.", NULL, 0);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (action == DROP) {
+        if (!g_manifest.held[object]) {
+            local_reply("Puoi posare solamente oggetti che hai in mano.", NULL, 0);
+            return 1;
+        }
+        return 0;
+    }
+
+    /* USE: nessuno stato dell'oggetto prevede di usarlo in questo modo */
+    flags = g_manifest.flags[object] - '0';
+    if (argc < 2) {
+        if (!(flags & MANIFEST_USE_ALONE)) {
+            local_reply("Non sembra fare nulla.", NULL, 0);
+            return 1;
+        }
+        return 0;
+    }
+    target = find_name(g_manifest.objects, g_manifest.n_objects, argv[1]);
+    if (target == -1 && !(flags & MANIFEST_USE_UNKNOWN)) {
+        local_reply("Non sembra fare nulla.", argv[1], 0);
+        return 1;
+    }
+    if (target != -1 && !(flags & MANIFEST_USE_OBJECT)) {
+        local_reply("Non sembra fare nulla.", NULL, 0);
+        return 1;
+    }
+    return 0;
+}
+
+/* Token per riprendere la sessione se la connessione si interrompe, vuoto se non c'è */
+char g_token[TOKEN_LENGTH + 1] = "";
+
+/**
+ * Riceve la lista delle escape room, stampandola se *print* è vero,
+ *  ed il token per riprendere la sessione, che finisce in *g_token*.
+ * Ritorna il numero di escape room, -1 in caso di errore.
+ */
+int recv_rooms(int sd, int print) {
+
+    char *argv[ARGC_MAX];
+    enum ACTION action;
+    int argc, n_rooms, i;
+
+    if (recv_msg(sd, NULL, &n_rooms, argv) == -1) {
+        return -1;
+    }
+    if (print && n_rooms > 0) {
+        printf(" Le escape room disponibili sono:\n");
+        for (i = 0; i < n_rooms; i++) {
+            printf(" %d) %s\n", i, argv[i]);
+        }
+        printf("\n");
+    }
+    free_argv(argv);
+
+    /* Senza argomenti il server non è riuscito a generare il token */
+    if (recv_msg(sd, &action, &argc, argv) == -1 || action != RESUME) {
+        free_argv(argv);
+        return -1;
+    }
+    g_token[0] = '\0';
+    if (argc == 1 && strlen(argv[0]) == TOKEN_LENGTH) {
+        strcpy(g_token, argv[0]);
+    }
+    free_argv(argv);
+
+    return n_rooms;
+}
+
+/**
+ * Apre una nuova connessione con il server e riprende la sessione con
+ *  il token *g_token*, dopo aver chiuso quella interrotta *old_sd*.
+ * Ritorna il nuovo socket descriptor, -1 se non è stato possibile.
+ */
+int reconnect(int old_sd) {
+
+    enum RESPONSE response;
+    char *argv[1];
+    int sd, ret;
+
+    close(old_sd);
+    manifest_clear();
+    if (g_token[0] == '\0') {
+        return -1;
+    }
+
+    printf("\n Connessione interrotta, ripresa della sessione in corso...\n");
+    sd = init_connection(SERVER_IP, DEFAULT_SERVER_PORT);
+    if (sd == -1) {
+        return -1;
+    }
+
+    argv[0] = g_token;
+    ret = send_msg(sd, RESUME, 1, argv);
+    if (ret != -1) {
+        ret = recv_all(sd, &response, sizeof(response));
+    }
+    if (ret == -1 || ntohl(response) != RESUMED || recv_rooms(sd, 0) == -1) {
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+/**
+ * Chiamata quando la connessione con il server si interrompe: prova a
+ *  riprendere la sessione su una nuova connessione, se non ci riesce
+ *  termina il client. Ritorna il socket descriptor della nuova connessione.
+ */
+int connection_lost(int sd) {
+    sd = reconnect(sd);
+    if (sd == -1) {
+        printf(ANSI_COLOR_RED " [Errore]: Connessione interrotta\n" ANSI_COLOR_RESET);
+        exit(-1);
+    }
+    printf(" Sessione ripresa, l'ultimo comando potrebbe non essere stato eseguito\n");
+    return sd;
+}
+
 /**
- * Legge lo standard input interpretandone i caretteri 
+ * Interpreta la riga *buffer*, letta dallo standard input,
  *  come un comando per il client. I possibili comandi
  *  coincidono (quasi) con le azioni definite in enum ACTIONS
  *  di protocol.h.
@@ -160,14 +581,11 @@ void print_help(enum ACTION action) {
  * Se ci sono più di *argc_max* parole le ignora.
  * I buffer in *argv* devono deallocati con free-argv(...) dopo l'utilizzo.
  */ 
-void parse_command(enum ACTION *action, int *argc, char *argv[ARGC_MAX], int argc_max) {
+void parse_command(const char *buffer, enum ACTION *action, int *argc, char *argv[ARGC_MAX], int argc_max) {
     
-    char buffer[IO_BUFFER_SIZE];
     char command[IO_BUFFER_SIZE];
     int i, j;
 
-    fgetsnn(buffer, IO_BUFFER_SIZE, stdin);
-
     /* Versione leggermente modificata della decode_message(...) */
     *argc = 0;
     memset(argv, 0, sizeof(char *) * ARGC_MAX);
@@ -236,7 +654,15 @@ void parse_command(enum ACTION *action, int *argc, char *argv[ARGC_MAX], int arg
 int main(int argc, char *argv[]) {
 
     enum RESPONSE response;
-    int sd;
+    enum MODE mode;
+    int sd, ret;
+
+    /**
+     * Lo stdin viene controllato con la select insieme al socket: non deve
+     *  avere un buffer, altrimenti le righe già lette dalla libreria non
+     *  risulterebbero pronte.
+     */
+    setvbuf(stdin, NULL, _IONBF, 0);
 
     sd = init_connection(SERVER_IP, DEFAULT_SERVER_PORT);
     if (sd == -1) {
@@ -297,28 +723,14 @@ int main(int argc, char *argv[]) {
     printf("\n Benvenuto!\n\n");
 
     /* Ricezione delle escape room disponibili */
-    {
-        char *aux_argv[ARGC_MAX];
-        int ret, i, aux_argc;
-
-        ret = recv_msg(sd, NULL, &aux_argc, aux_argv);
-        if (ret == -1) {
-            printf(ANSI_COLOR_RED " [Errore]: Connessione interrotta\n" ANSI_COLOR_RESET);
-            exit(-1);
-        }
-
-        if (aux_argc == 0) {
-            printf(" Al momento non ci sono escape room disponibili\n");
-            exit(0);
-        }
-
-        printf(" Le escape room disponibili sono:\n");
-        for (i = 0; i < aux_argc; i++) {
-            printf(" %d) %s\n", i, aux_argv[i]);
-        }
-        printf("\n");
-
-        free_argv(aux_argv);
+    ret = recv_rooms(sd, 1);
+    if (ret == -1) {
+        printf(ANSI_COLOR_RED " [Errore]: Connessione interrotta\n" ANSI_COLOR_RESET);
+        exit(-1);
+    }
+    if (ret == 0) {
+        printf(" Al momento non ci sono escape room disponibili\n");
+        exit(0);
     }
 
     printf(
@@ -328,19 +740,130 @@ int main(int argc, char *argv[]) {
             " disponibili scrivendo > help\n"
     );
 
+    /**
+     * Un solo ciclo controlla sia lo stdin che il socket: le notifiche del
+     *  server vengono mostrate appena arrivano, anche mentre si scrive.
+     */
+    mode = MODE_COMMAND;
+    print_prompt(mode);
+
     while(1) {
 
-        enum ACTION action;
-        int ret;
+        fd_set read_fds;
 
-        printf("\n > ");
+        FD_ZERO(&read_fds);
+        FD_SET(sd, &read_fds);
+        if (mode == MODE_COMMAND || mode == MODE_ANSWER || mode == MODE_WATCH) {
+            FD_SET(STDIN_FILENO, &read_fds);
+        }
+
+        if (select(sd + 1, &read_fds, NULL, NULL, NULL) == -1) {
+            perror_fatal();
+            exit(-1);
+        }
 
-        /* Lettura del comando ed invio al server */
-        {
+        /* Messaggio del server: una notifica o la risposta che si stava aspettando */
+        if (FD_ISSET(sd, &read_fds)) {
             char *aux_argv[ARGC_MAX];
+            enum ACTION action;
             int aux_argc;
 
-            parse_command(&action, &aux_argc, aux_argv, ARGC_CLIENT_MAX);
+            if (recv_msg(sd, &action, &aux_argc, aux_argv) == -1 || aux_argc <= 0 ||
+                (action != QUESTION && action != SERVER && action != EVENT && action != NOTIFY &&
+                 action != MANIFEST)) {
+                free_argv(aux_argv);
+                sd = connection_lost(sd);
+                mode = MODE_COMMAND;
+                print_prompt(mode);
+                continue;
+            }
+
+            /* Arriva prima della risposta a start, non cambia cosa si sta aspettando */
+            if (action == MANIFEST) {
+                manifest_load(aux_argc, aux_argv);
+            }
+            else if (action == NOTIFY) {
+                /* La partita potrebbe essere finita, il manifesto torna valido alla prossima risposta */
+                g_manifest.playing = 0;
+                printf("\n" ANSI_COLOR_YELLOW " [Notifica]: %s" ANSI_COLOR_RESET "\n", aux_argv[0]);
+                print_prompt(mode);
+            }
+            else if (mode == MODE_WATCH || mode == MODE_STOPPING) {
+                printf("\n %s\n", aux_argv[0]);
+
+                /* Il primo messaggio che non è un EVENT conferma che si è smesso di guardare */
+                if (action != EVENT) {
+                    mode = MODE_COMMAND;
+                    print_prompt(mode);
+                }
+            }
+            else {
+                printf(" %s\n", aux_argv[0]);
+
+                /* Solo chi sta giocando riceve l'inventario */
+                if (aux_argc >= 2) {
+                    manifest_sync(aux_argv[1]);
+                }
+                else {
+                    g_manifest.playing = 0;
+                }
+
+                /* Il server ci ha iscritto agli eventi di una room, o ci ha posto una domanda */
+                if (action == EVENT) {
+                    mode = MODE_WATCH;
+                    printf(" (premi invio per smettere di guardare)\n");
+                }
+                else if (action == QUESTION) {
+                    mode = MODE_ANSWER;
+                }
+                else {
+                    mode = MODE_COMMAND;
+                }
+                print_prompt(mode);
+            }
+            free_argv(aux_argv);
+        }
+
+        if (FD_ISSET(STDIN_FILENO, &read_fds)) {
+            char buffer[IO_BUFFER_SIZE];
+            char *aux_argv[ARGC_MAX];
+            enum ACTION action;
+            int aux_argc;
+
+            /* Lo stdin è stato chiuso: come il comando end */
+            if (fgetsnn(buffer, IO_BUFFER_SIZE, stdin) == NULL) {
+                send_msg(sd, END, 0, NULL);
+                printf(" A presto!\n\n");
+                exit(0);
+            }
+
+            /* Qualsiasi riga smette di guardare la partita */
+            if (mode == MODE_WATCH) {
+                if (send_msg(sd, SPECTATE, 0, NULL) == -1) {
+                    sd = connection_lost(sd);
+                    mode = MODE_COMMAND;
+                    print_prompt(mode);
+                    continue;
+                }
+                mode = MODE_STOPPING;
+                continue;
+            }
+
+            /* Lettura della risposta dallo stdin ed invio di questa al server */
+            if (mode == MODE_ANSWER) {
+                aux_argv[0] = buffer;
+                if (send_msg(sd, ANSWER, 1, aux_argv) == -1) {
+                    sd = connection_lost(sd);
+                    mode = MODE_COMMAND;
+                    print_prompt(mode);
+                    continue;
+                }
+                mode = MODE_REPLY;
+                continue;
+            }
+
+            /* Lettura del comando ed invio al server */
+            parse_command(buffer, &action, &aux_argc, aux_argv, ARGC_CLIENT_MAX);
             if (action == HELP) {
                 /* Il client vuole ricevere aiuto su un comando preciso */
                 if (aux_argc >= 1) {
@@ -348,80 +871,46 @@ int main(int argc, char *argv[]) {
                 }
                 print_help(action);
                 free_argv(aux_argv);
+                print_prompt(mode);
                 continue;
             }
             
             /* Sintassi errata, per i seguenti comandi è necessario avere almeno un parametro */
             if (aux_argc < 1 &&
-                (action == START || action == TAKE || action == USE || action == DROP)) {
+                (action == START || action == TAKE || action == USE || action == DROP ||
+                 action == SPECTATE)) {
                 print_help(action);
                 free_argv(aux_argv);
+                print_prompt(mode);
                 continue;
             }
             
-            ret = send_msg(sd, action, aux_argc, aux_argv);
-            if (ret == -1) {
-                printf(ANSI_COLOR_RED " [Errore]: Connessione interrotta\n" ANSI_COLOR_RESET);
-                exit(-1);
+            /* Comandi a cui il manifesto della room basta per rispondere */
+            if (answer_locally(action, aux_argc, aux_argv)) {
+                free_argv(aux_argv);
+                print_prompt(mode);
+                continue;
             }
 
-            free_argv(aux_argv);
-        }
-        
-        if (action == END) {
-            printf(" A presto!\n\n");
-            exit(0); 
-        }
-
-        /* Lettura della risposta del server al comando */
-        {
-            char *aux_argv[ARGC_MAX];
-            int aux_argc;
-
-            ret = recv_msg(sd, &action, &aux_argc, aux_argv);
-            if (ret == -1 || aux_argc <= 0 || 
-                (action != QUESTION && action != SERVER)) {
-                printf(ANSI_COLOR_RED " [Errore]: Connessione interrotta\n" ANSI_COLOR_RESET);
-                exit(-1);
+            /* Il manifesto della nuova room arriverà insieme alla risposta */
+            if (action == START) {
+                manifest_clear();
             }
 
-            printf(" %s\n", aux_argv[0]);
+            ret = send_msg(sd, action, aux_argc, aux_argv);
             free_argv(aux_argv);
-        }
-
-        /* Il server ci ha posto una domanda */
-        if (action == QUESTION) {
-
-            char buffer[IO_BUFFER_SIZE];
-            char *aux_argv[ARGC_MAX];
-
-            /* Lettura della risposta dallo stdin ed invio di questa al server */
-            printf(" Risposta: ");
-            fgetsnn(buffer, IO_BUFFER_SIZE, stdin);
-            aux_argv[0] = buffer;
-
-            ret = send_msg(sd, ANSWER, 1, aux_argv);
-            if (ret == -1) {
-                printf(ANSI_COLOR_RED " [Errore]: Connessione interrotta\n" ANSI_COLOR_RESET);
-                exit(-1);
+            if (ret == -1 && action != END) {
+                sd = connection_lost(sd);
+                print_prompt(mode);
+                continue;
             }
 
-            /* Stampa della risposta del server */
-            {
-                char *aux_argv[ARGC_MAX];
-                int ret, aux_argc;
-
-                ret = recv_msg(sd, NULL, &aux_argc, aux_argv);
-                if (ret == -1) {
-                    printf(ANSI_COLOR_RED " [Errore]: Connessione interrotta\n" ANSI_COLOR_RESET);
-                    exit(-1);
-                }
-
-                printf(" %s\n", aux_argv[0]);
-                free_argv(aux_argv);
+            if (action == END) {
+                printf(" A presto!\n\n");
+                exit(0); 
             }
+            mode = MODE_REPLY;
         }
-
     }
 
     return 0;
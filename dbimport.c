@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lib/protocol.h"
+#include "lib/mystdlib.h"
+#include "lib/server/database.h"
+
+/**
+ * Prova un file di utenti prima di importarlo nel server (comando import).
+ *
+ * Importa i *file* nell'ordine in un database vuoto, come farebbe il
+ *  server, segnala le righe non valide e riporta per ciascuno gli utenti
+ *  importati, duplicati e già presenti ed il throughput in utenti al
+ *  secondo.
+ * Con -s gli utenti vengono invece registrati uno alla volta, come
+ *  durante il login (db_read(...) seguita da db_write(...)), per
+ *  confrontare i due percorsi; in questo caso il file deve essere già
+ *  valido.
+ * Con -g scrive in *file* *n* utenti di prova (torneoN, con password
+ *  casuali) e termina.
+ *
+ * Uso: dbimport [-s] file...
+ *      dbimport -g n file
+ * Esce con 0 se tutte le righe sono valide, 1 altrimenti.
+ */
+
+#define NS_PER_SEC 1000000000UL
+
+static unsigned long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * NS_PER_SEC + (unsigned long)ts.tv_nsec;
+}
+
+/* Scrive in *path* *n* utenti di prova */
+static int generate(const char *path, long n) {
+    FILE *f = fopen(path, "w");
+    long i;
+
+    if (f == NULL) {
+        printf("Impossibile scrivere %s\n", path);
+        return 1;
+    }
+    srand((unsigned int)n);
+    for (i = 0; i < n; i++) {
+        fprintf(f, "torneo%ld %08x\n", i, (unsigned int)rand());
+    }
+    if (fclose(f) != 0) {
+        printf("Impossibile scrivere %s\n", path);
+        return 1;
+    }
+    printf("%ld utenti scritti in %s\n", n, path);
+    return 0;
+}
+
+/* Registra gli utenti di *path* uno alla volta, come il login */
+static int register_each(const char *path, struct db_import_stats *stats) {
+    char buffer[IO_BUFFER_SIZE];
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        return -1;
+    }
+    memset(stats, 0, sizeof(struct db_import_stats));
+    while (fgetsnn(buffer, IO_BUFFER_SIZE, f) != NULL) {
+        char *username = strtok(buffer, " \t\r"), *password;
+
+        if (username == NULL || username[0] == '#') {
+            continue;
+        }
+        stats->lines++;
+        password = strtok(NULL, " \t\r");
+        if (password == NULL || db_validate(username, password) != DB_CREDENTIALS_VALID) {
+            stats->invalid++;
+        }
+        else if (db_read(username, password) != DB_USERNAME_DOES_NOT_EXIST) {
+            stats->existing++;
+        }
+        else if (db_write(username, password) == DB_WRITE_FAIL) {
+            fclose(f);
+            return -1;
+        }
+        else {
+            stats->imported++;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct db_import_stats stats;
+    int i, first = 1, one_by_one = 0, errors = 0;
+
+    if (argc == 4 && strcmp(argv[1], "-g") == 0 && atol(argv[2]) > 0) {
+        return generate(argv[3], atol(argv[2]));
+    }
+    if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+        one_by_one = 1;
+        first = 2;
+    }
+    if (first >= argc || argv[first][0] == '-') {
+        printf("Uso: %s [-s] file...\n     %s -g n file\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    for (i = first; i < argc; i++) {
+        unsigned long begin = now(), elapsed;
+        int ret = one_by_one ? register_each(argv[i], &stats) : db_import(argv[i], &stats);
+
+        elapsed = now() - begin;
+        if (ret == -1) {
+            printf("Impossibile importare %s\n", argv[i]);
+            return 1;
+        }
+        printf("%s: %ld righe, %ld importati, %ld duplicati, %ld già presenti, %ld non validi, "
+            "%.3f s, %.0f utenti/s\n", argv[i], stats.lines, stats.imported, stats.duplicates,
+            stats.existing, stats.invalid, elapsed / 1e9, elapsed > 0 ? stats.imported * 1e9 / elapsed : 0);
+        errors += stats.invalid > 0;
+    }
+    printf("%ld utenti in tutto\n", db_size());
+    return errors > 0;
+}
@@ -0,0 +1,552 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Proxy TCP che inietta guasti di rete, per provare client e server in
+ *  condizioni peggiori di quelle di localhost.
+ *
+ * Accetta connessioni su *porta* e le inoltra al server su *porta_server*
+ *  (in SERVER_IP), applicando ai byte in transito:
+ *      -l ms       latenza fissa
+ *      -j ms       jitter, un ritardo casuale aggiuntivo tra 0 e ms
+ *                  (l'ordine dei byte viene comunque rispettato)
+ *      -f byte     dimensione massima di ogni invio, 1 li consegna un byte alla volta
+ *      -g ms       pausa tra un invio e l'altro
+ *      -b byte/s   limite di banda: il proxy legge solo quello che riesce a
+ *                  consegnare, quindi dall'altra parte sembra un lettore lento
+ *      -P pct -p ms  probabilità che un blocco di dati resti fermo per ms (stallo)
+ *      -H pct      probabilità che la connessione venga chiusa in scrittura
+ *                  (shutdown) a metà di un blocco di dati
+ *      -R pct      probabilità che la connessione venga resettata (RST)
+ *                  a metà di un blocco di dati
+ *      -D verso    applica i guasti solo ai dati verso il server (up), solo
+ *                  a quelli verso il client (down) o ad entrambi (both, default)
+ *      -S seme     seme dei numeri casuali, stampato all'avvio per ripetere una prova
+ * Le probabilità sono percentuali (anche decimali) e valgono per ogni
+ *  blocco letto da un socket, quindi un guasto cade quasi sempre a metà
+ *  di un messaggio del protocollo.
+ *
+ * Termina con SIGINT o SIGTERM e stampa una riga di statistiche, con i
+ *  campi nella forma chiave=valore per chi lo usa da uno script:
+ *      connections=20 bytes_up=5120 bytes_down=81920 sends=86016 stalls=3 half_closes=0 resets=1
+ *
+ * Uso: faultproxy [-l ms] [-j ms] [-f byte] [-g ms] [-b byte/s] [-P pct] [-p ms]
+ *                 [-H pct] [-R pct] [-D verso] [-S seme] porta porta_server
+ */
+
+#define SERVER_IP "127.0.0.1"
+#define CONNS_MAX 512
+
+/* Byte letti con una recv, ed oltre i quali un verso smette di leggere */
+#define CHUNK_SIZE 4096
+#define QUEUE_MAX (16 * CHUNK_SIZE)
+
+#define DEFAULT_STALL_MS 1000
+
+#define NS_PER_MS 1000000UL
+#define NS_PER_SEC 1000000000UL
+
+enum FAULT {
+    FAULT_NONE,
+    FAULT_HALF_CLOSE,
+    FAULT_RESET
+};
+
+/* Blocco di dati letto da un socket, da consegnare all'altro dall'istante *at* */
+struct chunk {
+    unsigned long at;
+    int size, done;
+    enum FAULT fault;       /* Da applicare dopo aver consegnato *cut* byte */
+    int cut;
+    struct chunk *next;
+    char data[CHUNK_SIZE];
+};
+
+/* Un verso della connessione, da fd[from] a fd[to] */
+struct pipe {
+    int from, to;
+    int faulty;             /* I guasti si applicano a questo verso */
+    struct chunk *head, *tail;
+    int queued;
+    int eof;                /* *from* ha chiuso, o il verso è stato interrotto */
+    int shut;               /* *to* è stato chiuso in scrittura */
+    unsigned long last_at;  /* Istante di consegna dell'ultimo blocco, per mantenere l'ordine */
+    unsigned long next_send;
+};
+
+struct conn {
+    int used;
+    int connecting;         /* La connessione verso il server è in corso */
+    int fd[2];              /* Client e server */
+    struct pipe pipes[2];   /* Verso il server e verso il client */
+};
+
+static struct conn g_conns[CONNS_MAX];
+
+static unsigned long g_latency = 0, g_jitter = 0, g_gap = 0, g_stall_ms = DEFAULT_STALL_MS;
+static unsigned long g_bandwidth = 0;
+static int g_fragment = 0;
+static double g_stall = 0, g_half_close = 0, g_reset = 0;
+
+static struct sockaddr_in g_upstream;
+
+static unsigned long g_connections = 0, g_bytes[2] = { 0, 0 }, g_sends = 0;
+static unsigned long g_stalls = 0, g_half_closes = 0, g_resets = 0;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static unsigned long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * NS_PER_SEC + (unsigned long)ts.tv_nsec;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+/* Vero con probabilità *pct* percento */
+static int chance(double pct) {
+    return pct > 0 && rand() % 10000 < (int)(pct * 100);
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags == -1 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void free_chunks(struct pipe *p) {
+    while (p->head != NULL) {
+        struct chunk *next = p->head->next;
+        free(p->head);
+        p->head = next;
+    }
+    p->tail = NULL;
+    p->queued = 0;
+}
+
+/* Chiude *c*, con un reset invece della normale chiusura se *reset* è vero */
+static void close_conn(struct conn *c, int reset) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (reset) {
+            struct linger l;
+            l.l_onoff = 1;
+            l.l_linger = 0;
+            setsockopt(c->fd[i], SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        }
+        close(c->fd[i]);
+        free_chunks(&c->pipes[i]);
+    }
+    c->used = 0;
+}
+
+static void open_conn(int listener, int direction) {
+    struct conn *c;
+    int i, client, server;
+
+    client = accept(listener, NULL, NULL);
+    if (client == -1) {
+        return;
+    }
+    for (i = 0; i < CONNS_MAX && g_conns[i].used; i++);
+    server = i < CONNS_MAX ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+    if (server == -1 || set_nonblocking(client) == -1 || set_nonblocking(server) == -1 ||
+        (connect(server, (struct sockaddr *)&g_upstream, sizeof(g_upstream)) == -1 && errno != EINPROGRESS)) {
+        close(client);
+        if (server != -1) {
+            close(server);
+        }
+        return;
+    }
+
+    c = &g_conns[i];
+    memset(c, 0, sizeof(struct conn));
+    c->used = 1;
+    c->connecting = 1;
+    c->fd[0] = client;
+    c->fd[1] = server;
+    c->pipes[0].from = 0;
+    c->pipes[0].to = 1;
+    c->pipes[0].faulty = direction != 1;
+    c->pipes[1].from = 1;
+    c->pipes[1].to = 0;
+    c->pipes[1].faulty = direction != 0;
+    g_connections++;
+}
+
+/**
+ * Legge da fd[p->from] un blocco di dati e decide quando (e come) verrà consegnato.
+ * Ritorna -1 se la connessione va chiusa, 0 altrimenti.
+ */
+static int read_pipe(struct conn *c, struct pipe *p) {
+    struct chunk *ch = malloc(sizeof(struct chunk));
+    unsigned long t = now();
+    int n;
+
+    if (ch == NULL) {
+        return -1;
+    }
+    n = recv(c->fd[p->from], ch->data, CHUNK_SIZE, 0);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        free(ch);
+        return 0;
+    }
+    if (n <= 0) {
+        free(ch);
+        p->eof = 1;
+        return n == 0 ? 0 : -1;
+    }
+
+    ch->size = n;
+    ch->done = 0;
+    ch->next = NULL;
+    ch->fault = FAULT_NONE;
+    ch->cut = n;
+    ch->at = t;
+    if (p->faulty) {
+        ch->at += g_latency * NS_PER_MS;
+        if (g_jitter > 0) {
+            ch->at += (unsigned long)(rand() % (g_jitter + 1)) * NS_PER_MS;
+        }
+        if (chance(g_stall)) {
+            ch->at += g_stall_ms * NS_PER_MS;
+            g_stalls++;
+        }
+        if (chance(g_reset)) {
+            ch->fault = FAULT_RESET;
+        }
+        else if (chance(g_half_close)) {
+            ch->fault = FAULT_HALF_CLOSE;
+        }
+        if (ch->fault != FAULT_NONE) {
+            ch->cut = n > 1 ? 1 + rand() % (n - 1) : 0;
+        }
+    }
+    if (ch->at < p->last_at) {
+        ch->at = p->last_at;
+    }
+    p->last_at = ch->at;
+
+    if (p->tail != NULL) {
+        p->tail->next = ch;
+    }
+    else {
+        p->head = ch;
+    }
+    p->tail = ch;
+    p->queued += n;
+    return 0;
+}
+
+/* Il primo blocco di *p* si può consegnare all'istante *t* */
+static int due(const struct pipe *p, unsigned long t) {
+    return p->head != NULL && p->head->at <= t && p->next_send <= t;
+}
+
+/**
+ * Consegna a fd[p->to] quello che il primo blocco di *p* permette,
+ *  applicandone l'eventuale guasto.
+ * Ritorna -1 se la connessione va chiusa, 0 altrimenti.
+ */
+static int write_pipe(struct conn *c, struct pipe *p) {
+    struct chunk *ch = p->head;
+    unsigned long t = now();
+    int size = ch->cut - ch->done, n;
+
+    if (size > 0) {
+        if (p->faulty && g_fragment > 0 && size > g_fragment) {
+            size = g_fragment;
+        }
+        n = send(c->fd[p->to], ch->data + ch->done, size, MSG_NOSIGNAL);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        }
+        ch->done += n;
+        p->queued -= n;
+        g_bytes[p->from] += n;
+        g_sends++;
+        if (p->faulty) {
+            p->next_send = t + g_gap * NS_PER_MS;
+            if (g_bandwidth > 0) {
+                p->next_send += (unsigned long)n * NS_PER_SEC / g_bandwidth;
+            }
+        }
+    }
+    if (ch->done < ch->cut) {
+        return 0;
+    }
+
+    if (ch->fault == FAULT_RESET) {
+        g_resets++;
+        close_conn(c, 1);
+        return 1;
+    }
+    if (ch->fault == FAULT_HALF_CLOSE) {
+        /* Il resto del verso va perso, l'altro continua */
+        g_half_closes++;
+        shutdown(c->fd[p->to], SHUT_WR);
+        free_chunks(p);
+        p->eof = p->shut = 1;
+        return 0;
+    }
+    if (ch->done == ch->size) {
+        p->head = ch->next;
+        if (p->head == NULL) {
+            p->tail = NULL;
+        }
+        free(ch);
+    }
+    return 0;
+}
+
+/* Istante in cui il primo blocco di *p* si potrà consegnare, 0 se non ce n'è */
+static unsigned long next_due(const struct pipe *p) {
+    if (p->head == NULL) {
+        return 0;
+    }
+    return p->head->at > p->next_send ? p->head->at : p->next_send;
+}
+
+/**
+ * Gestisce gli eventi *revents* di fd[side] di *c*.
+ * Ritorna -1 se la connessione va chiusa, 1 se è già stata chiusa, 0 altrimenti.
+ */
+static int conn_ready(struct conn *c, int side, short revents) {
+    struct pipe *in = &c->pipes[side], *out = &c->pipes[1 - side];
+    int ret;
+
+    if (c->connecting && side == 1) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        if (!(revents & (POLLOUT | POLLERR | POLLHUP))) {
+            return 0;
+        }
+        if (getsockopt(c->fd[1], SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+            return -1;
+        }
+        c->connecting = 0;
+        return 0;
+    }
+
+    /* Prima si consegna, poi si legge: un socket chiuso può avere ancora dati da leggere */
+    if ((revents & (POLLOUT | POLLERR)) && due(out, now())) {
+        if ((ret = write_pipe(c, out)) != 0) {
+            return ret;
+        }
+    }
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) && !in->eof) {
+        return read_pipe(c, in);
+    }
+    return 0;
+}
+
+/* Propaga le chiusure in scrittura, ritorna vero se la connessione è finita */
+static int conn_done(struct conn *c) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        struct pipe *p = &c->pipes[i];
+        if (p->eof && !p->shut && p->head == NULL) {
+            shutdown(c->fd[p->to], SHUT_WR);
+            p->shut = 1;
+        }
+    }
+    return c->pipes[0].shut && c->pipes[1].shut;
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr;
+    struct pollfd fds[1 + 2 * CONNS_MAX];
+    struct conn *owners[1 + 2 * CONNS_MAX];
+    struct sigaction sa;
+    int port = -1, upstream = -1, direction = 2, n_ports = 0;
+    int i, listener, yes = 1;
+    unsigned int seed = (unsigned int)time(NULL);
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            g_latency = (unsigned long)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            g_jitter = (unsigned long)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            g_fragment = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            g_gap = (unsigned long)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            g_bandwidth = (unsigned long)atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            g_stall = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            g_stall_ms = (unsigned long)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            g_half_close = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            g_reset = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+            i++;
+            direction = strcmp(argv[i], "up") == 0 ? 0 : strcmp(argv[i], "down") == 0 ? 1 :
+                strcmp(argv[i], "both") == 0 ? 2 : -1;
+        }
+        else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            seed = (unsigned int)atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && n_ports < 2) {
+            if (n_ports++ == 0) {
+                port = atoi(argv[i]);
+            }
+            else {
+                upstream = atoi(argv[i]);
+            }
+        }
+        else {
+            port = -1;
+            break;
+        }
+    }
+    if (port <= 0 || port > 65535 || upstream <= 0 || upstream > 65535 || direction == -1 ||
+        g_fragment < 0 || g_stall < 0 || g_half_close < 0 || g_reset < 0) {
+        printf("Uso: %s [-l ms] [-j ms] [-f byte] [-g ms] [-b byte/s] [-P pct] [-p ms] "
+            "[-H pct] [-R pct] [-D verso] [-S seme] porta porta_server\n", argv[0]);
+        return 1;
+    }
+    srand(seed);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    memset(&g_upstream, 0, sizeof(g_upstream));
+    g_upstream.sin_family = AF_INET;
+    g_upstream.sin_port = htons(upstream);
+    inet_pton(AF_INET, SERVER_IP, &g_upstream.sin_addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (listener == -1 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listener, CONNS_MAX) == -1 || set_nonblocking(listener) == -1) {
+        perror("listen");
+        return 1;
+    }
+    printf("In ascolto su %d, inoltro a %d, seme %u\n", port, upstream, seed);
+    fflush(stdout);
+
+    while (!g_stop) {
+        unsigned long t = now(), wake = 0;
+        int n_fds = 1, timeout;
+
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        for (i = 0; i < CONNS_MAX; i++) {
+            struct conn *c = &g_conns[i];
+            int side;
+
+            if (!c->used) {
+                continue;
+            }
+            for (side = 0; side < 2; side++) {
+                struct pipe *in = &c->pipes[side], *out = &c->pipes[1 - side];
+                unsigned long at = next_due(out);
+
+                fds[n_fds].fd = c->fd[side];
+                fds[n_fds].events = 0;
+                if (c->connecting) {
+                    fds[n_fds].events = side == 1 ? POLLOUT : 0;
+                }
+                else {
+                    if (!in->eof && in->queued < QUEUE_MAX) {
+                        fds[n_fds].events |= POLLIN;
+                    }
+                    if (at != 0 && at <= t) {
+                        fds[n_fds].events |= POLLOUT;
+                    }
+                    else if (at != 0 && (wake == 0 || at < wake)) {
+                        wake = at;
+                    }
+                }
+                if (fds[n_fds].events == 0) {
+                    /* Ignorato da poll, altrimenti un socket già chiuso la farebbe ritornare subito */
+                    fds[n_fds].fd = -1;
+                }
+                fds[n_fds].revents = 0;
+                owners[n_fds++] = c;
+            }
+        }
+
+        timeout = wake == 0 ? -1 : wake > t ? (int)((wake - t + NS_PER_MS - 1) / NS_PER_MS) : 0;
+        if (poll(fds, n_fds, timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        for (i = 1; i < n_fds; i++) {
+            struct conn *c = owners[i];
+            int side = (i - 1) % 2, ret;
+
+            if (!c->used || fds[i].revents == 0) {
+                continue;
+            }
+            ret = conn_ready(c, side, fds[i].revents);
+            if (ret == -1) {
+                close_conn(c, 0);
+            }
+        }
+        /* Anche le connessioni senza eventi possono aver finito di consegnare */
+        for (i = 0; i < CONNS_MAX; i++) {
+            if (g_conns[i].used && !g_conns[i].connecting && conn_done(&g_conns[i])) {
+                close_conn(&g_conns[i], 0);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            open_conn(listener, direction);
+        }
+    }
+
+    for (i = 0; i < CONNS_MAX; i++) {
+        if (g_conns[i].used) {
+            close_conn(&g_conns[i], 0);
+        }
+    }
+    close(listener);
+
+    printf("connections=%lu bytes_up=%lu bytes_down=%lu sends=%lu stalls=%lu half_closes=%lu resets=%lu\n",
+        g_connections, g_bytes[0], g_bytes[1], g_sends, g_stalls, g_half_closes, g_resets);
+    return 0;
+}
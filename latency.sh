@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# Confronta la latenza dei comandi (RTT misurato da loadgen, in microsecondi)
+# del server col profilo normale e con quello a bassa latenza (comando lowlatency).
+#
+# Per ogni profilo avvia un server sulla porta indicata, lo carica con loadgen
+# (sessioni che seguono lo script di default, con una pausa tra un comando e
+# l'altro come farebbe un giocatore) e riporta la riga ALL di loadgen.
+# Con pochi processori server e loadgen si contendono la CPU, e lo spin del
+# profilo a bassa latenza può peggiorare i risultati invece di migliorarli:
+# il confronto ha senso su una macchina con almeno un processore libero.
+#
+# Uso: ./latency.sh [porta] [sessioni] [durata] [pausa ms] [cpu]
+
+PORT=${1:-4300}
+SESSIONS=${2:-8}
+DURATION=${3:-10}
+THINK=${4:-1}
+CPU=${5:-}
+
+make server loadgen > /dev/null || exit 1
+
+# $1: nome del profilo, $2: porta, $3: comandi da dare al server prima di start
+run() {
+    ( sleep 0.3; printf "$3"; echo start; sleep $((DURATION + 8)); echo stop ) | ./server $2 > /dev/null 2>&1 &
+    sleep 1
+    ./loadgen -c $SESSIONS -d $DURATION -t $THINK -u lat $2 |
+        awk -v name="$1" '$1 == "ALL" { printf " %-12s %9s %9s %9s %9s %9s %9s\n", name, $2, $3, $4, $5, $6, $7 }'
+    # Il server termina con stop, a meno che qualcuno non stia ancora giocando
+    kill $! 2> /dev/null
+    sleep 1
+}
+
+printf "\n %-12s %9s %9s %9s %9s %9s %9s\n" profilo numero "media us" p50 p99 p999 max
+run normale $PORT ""
+# Un'altra porta: quella di prima può essere ancora occupata (PORT + 1 è delle metriche)
+run lowlatency $((PORT + 2)) "lowlatency${CPU:+ $CPU}\n"
+echo
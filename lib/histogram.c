@@ -0,0 +1,64 @@
+#include "histogram.h"
+
+#define SUB_COUNT (1UL << HIST_SUB_BITS)
+
+/* Scaglione di un valore *v* */
+static int bucket(unsigned long v) {
+    int e;
+
+    if (v < SUB_COUNT) {
+        return (int)v;
+    }
+    /* Posizione del bit più significativo */
+    e = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl(v);
+    if (e >= HIST_EXP_MAX) {
+        return HIST_BUCKETS - 1;
+    }
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int)((v >> (e - HIST_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+void hist_record(struct histogram *h, unsigned long v) {
+    h->buckets[bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+double hist_bucket_limit(int i) {
+    int e, sub;
+
+    if (i < (int)SUB_COUNT) {
+        return i + 1;
+    }
+    e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    sub = i & (SUB_COUNT - 1);
+    return (double)(SUB_COUNT + sub + 1) * (double)(1UL << (e - HIST_SUB_BITS));
+}
+
+double hist_quantile(const struct histogram *h, double q) {
+    unsigned long target = (unsigned long)(q * h->count), seen = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > target) {
+            return hist_bucket_limit(i);
+        }
+    }
+    return hist_bucket_limit(HIST_BUCKETS - 1);
+}
+
+void hist_merge(struct histogram *h, const struct histogram *other) {
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        h->buckets[i] += other->buckets[i];
+    }
+    h->count += other->count;
+    h->sum += other->sum;
+    if (other->max > h->max) {
+        h->max = other->max;
+    }
+}
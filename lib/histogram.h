@@ -0,0 +1,33 @@
+#ifndef LIB_HISTOGRAM_H
+#define LIB_HISTOGRAM_H
+
+/**
+ * Istogrammi in stile HDR: ogni potenza di 2 (in nanosecondi) è divisa in
+ *  2^HIST_SUB_BITS parti uguali, l'errore relativo è quindi al più
+ *  1/2^HIST_SUB_BITS. Si arriva a 2^HIST_EXP_MAX ns (circa 18 minuti).
+ */
+#define HIST_SUB_BITS 4
+#define HIST_EXP_MAX 40
+#define HIST_BUCKETS ((HIST_EXP_MAX - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/* Un istogramma azzerato (ad esempio con memset) è vuoto */
+struct histogram {
+    unsigned long buckets[HIST_BUCKETS];
+    unsigned long count;
+    unsigned long max;
+    double sum;
+};
+
+/* Registra il valore *v* (registrare costa qualche operazione sui bit) */
+void hist_record(struct histogram *h, unsigned long v);
+
+/* Il più piccolo valore che non fa parte dello scaglione *i* */
+double hist_bucket_limit(int i);
+
+/* Valore (limite superiore) sotto cui cade la frazione *q* dei campioni di *h* */
+double hist_quantile(const struct histogram *h, double q);
+
+/* Aggiunge ad *h* i campioni di *other* */
+void hist_merge(struct histogram *h, const struct histogram *other);
+
+#endif
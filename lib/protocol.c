@@ -3,13 +3,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "protocol.h"
 
+struct protocol_stats g_protocol_stats;
+
 const char* const action_to_str[] = {
     "SERVER",
     "CLIENT",
@@ -23,6 +27,13 @@ const char* const action_to_str[] = {
     "OBJS",
     "DROP",
     "END",
+    "RANK",
+    "SPECTATE",
+    "EVENT",
+    "NOTIFY",
+    "RESUME",
+    "MANIFEST",
+    "HINT",
     "ACTION_MAX"
 };
 
@@ -45,9 +56,18 @@ enum ACTION str_to_action(char *buffer) {
     if (strcmp(buffer, "drop") == 0) {
         return DROP;
     }
+    if (strcmp(buffer, "rank") == 0) {
+        return RANK;
+    }
+    if (strcmp(buffer, "spectate") == 0) {
+        return SPECTATE;
+    }
     if (strcmp(buffer, "end") == 0) {
         return END;
     }
+    if (strcmp(buffer, "hint") == 0) {
+        return HINT;
+    }
     return HELP;
 }
 
@@ -58,7 +78,9 @@ const char* const response_to_str[] = {
     "ALREADY_LOGGED_IN",
     "LOGIN_SUCCESS",
     "REGISTERED",
-    "SERVER_FULL"
+    "SERVER_FULL",
+    "RESUMED",
+    "RESUME_FAILED"
 };
 
 int encode_message(char *buffer, int size, enum ACTION action, int argc, char *argv[]) {
@@ -162,60 +184,92 @@ void free_argv(char *argv[ARGC_MAX]) {
     }
 }
 
+int send_all(int sd, const void *buffer, int size) {
+
+    const char *p = buffer;
+    int done = 0;
+
+    while (done < size) {
+        int ret = send(sd, p + done, size - done, MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+int recv_all(int sd, void *buffer, int size) {
+
+    char *p = buffer;
+    int done = 0;
+
+    /* MSG_WAITALL può comunque ritornare prima, ad esempio per un segnale */
+    while (done < size) {
+        int ret = recv(sd, p + done, size - done, MSG_WAITALL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
 int send_msg(int sd, enum ACTION action, int argc, char *argv[]) {
 
-    char buffer[IO_BUFFER_SIZE];
-    uint16_t n_length, h_length;
+    char buffer[2 + IO_BUFFER_SIZE];
+    uint16_t h_length;
     int ret;
 
 #ifdef NDEBUG
     printf("\n\t#SENT\n\taction: %d\n\targc: %d\n\targv[0]: %s\n\targv[1]: %s\n", action, argc, argv[0], argv[1]);
 #endif
 
-    /* Codifica del messaggio */
-    ret = encode_message(buffer, IO_BUFFER_SIZE, action, argc, argv);
+    /* Codifica del messaggio, preceduto dalla sua dimensione (su 2 byte) */
+    ret = encode_message(buffer + 2, IO_BUFFER_SIZE, action, argc, argv);
+    if (ret == -1) {
+        return -1;
+    }
     h_length = ret;
-    n_length = htons(h_length);
+    buffer[0] = (uint8_t)(h_length >> 8);
+    buffer[1] = (uint8_t)h_length;
 
 #ifdef NDEBUG
-    printf("\n\t#RAW BUFFER SENT\n\tlength: %d\n\taction: %d\n\tbuffer: %s\n\tret: %d\n", h_length, buffer[0], buffer + 1, ret);
+    printf("\n\t#RAW BUFFER SENT\n\tlength: %d\n\taction: %d\n\tbuffer: %s\n\tret: %d\n", h_length, buffer[2], buffer + 3, ret);
 #endif
 
-    /* Invio (su 2 byte) della dimensione del messaggio codificato */
-    ret = send(sd, &n_length, sizeof(n_length), MSG_NOSIGNAL);
-    if (ret == -1) {
-        return -1;
-    }
-
-    /* Invio del messaggio codificato */
-    ret = send(sd, &buffer, h_length, MSG_NOSIGNAL);
-    if (ret == -1) {
+    /* Dimensione e messaggio insieme, anche se il socket ne accetta solo una parte */
+    if (send_all(sd, buffer, 2 + h_length) == -1) {
         return -1;
     }
 
+    g_protocol_stats.bytes_sent += 2 + h_length;
     return 0;
 }
 
-int recv_msg(int sd, enum ACTION *action, int *argc, char *argv[ARGC_MAX]) {
+int recv_frame(int sd, char buffer[IO_BUFFER_SIZE]) {
 
-    char buffer[IO_BUFFER_SIZE];
     uint16_t n_length, h_length;
-    int ret;
 
-    /* Ricezione della dimensione del messaggio codificato */
-    ret = recv(sd, &n_length, sizeof(n_length), 0);
-    if (ret <= 0) {
+    /* Ricezione della dimensione del messaggio codificato, che può arrivare in più segmenti TCP */
+    if (recv_all(sd, &n_length, sizeof(n_length)) == -1) {
         return -1;
     }
 
     h_length = ntohs(n_length);
-    if (h_length > IO_BUFFER_SIZE) {
+    if (h_length == 0 || h_length > IO_BUFFER_SIZE) {
+        g_protocol_stats.decode_failures++;
         return -1;
     }
 
     /* Ricezione del messaggio codificato */
-    ret = recv(sd, &buffer, h_length, 0);
-    if (ret <= 0) {
+    if (recv_all(sd, buffer, h_length) == -1) {
         return -1;
     }
 
@@ -223,7 +277,23 @@ int recv_msg(int sd, enum ACTION *action, int *argc, char *argv[ARGC_MAX]) {
     printf("\n\t#RAW BUFFER RECEIVED\n\tlength: %d\n\taction: %d\n\tbuffer: %s\n", h_length, buffer[0], buffer + 1);
 #endif
 
-    ret = decode_message(buffer, h_length, action, argc, argv);
+    g_protocol_stats.bytes_received += sizeof(n_length) + h_length;
+    return h_length;
+}
+
+int decode_frame(const char *buffer, int size, enum ACTION *action, int *argc, char *argv[ARGC_MAX]) {
+
+    int ret;
+
+    /* Così in caso di errore free_argv(...) rimane innocua */
+    memset(argv, 0, sizeof(char *) * ARGC_MAX);
+
+    ret = decode_message(buffer, size, action, argc, argv);
+    if (ret == -1) {
+        g_protocol_stats.decode_failures++;
+        free_argv(argv);
+        memset(argv, 0, sizeof(char *) * ARGC_MAX);
+    }
 
 #ifdef NDEBUG
     if (action == NULL) { printf("\n\t#RECEIVED\n\taction: NULL\n\targc: %d\n\targv[0]: %s\n\targv[1]: %s\n\tret: %d\n", *argc, argv[0], argv[1], ret); }
@@ -232,3 +302,102 @@ int recv_msg(int sd, enum ACTION *action, int *argc, char *argv[ARGC_MAX]) {
 
     return ret;
 }
+
+int recv_msg(int sd, enum ACTION *action, int *argc, char *argv[ARGC_MAX]) {
+
+    char buffer[IO_BUFFER_SIZE];
+    int size;
+
+    size = recv_frame(sd, buffer);
+    if (size == -1) {
+        /* Così in caso di errore free_argv(...) rimane innocua */
+        memset(argv, 0, sizeof(char *) * ARGC_MAX);
+        return -1;
+    }
+    return decode_frame(buffer, size, action, argc, argv);
+}
+
+void make_fragment(struct fragment *f, const char *text) {
+    f->data = text;
+    f->size = text != NULL ? strlen(text) : 0;
+}
+
+int send_fragments(int sd, enum ACTION action, const struct fragment *text, const struct fragment *suffix) {
+
+    char header[3];
+    struct iovec iov[4];
+    struct msghdr msg;
+    ssize_t sent;
+    int length, n_iov = 0;
+
+    /* Azione, argomento e '\\0' finale, come in encode_message(...) */
+    length = 1 + text->size + (suffix != NULL ? suffix->size : 0) + 1;
+    if (length > IO_BUFFER_SIZE) {
+        return -1;
+    }
+
+    /* Dimensione (su 2 byte) ed azione precedono l'argomento */
+    header[0] = (uint8_t)(length >> 8);
+    header[1] = (uint8_t)length;
+    header[2] = (uint8_t)action;
+
+    iov[n_iov].iov_base = header;
+    iov[n_iov++].iov_len = sizeof(header);
+    if (text->size > 0) {
+        iov[n_iov].iov_base = (void *)text->data;
+        iov[n_iov++].iov_len = text->size;
+    }
+    if (suffix != NULL && suffix->size > 0) {
+        iov[n_iov].iov_base = (void *)suffix->data;
+        iov[n_iov++].iov_len = suffix->size;
+    }
+    iov[n_iov].iov_base = "";
+    iov[n_iov++].iov_len = 1;
+
+#ifdef NDEBUG
+    printf("\n\t#SENT (FRAGMENTS)\n\taction: %d\n\tlength: %d\n\ttext: %.*s\n", action, length, text->size, text->data);
+#endif
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n_iov;
+
+    do {
+        sent = sendmsg(sd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    if (sent == -1) {
+        return -1;
+    }
+
+    /* Il socket ha accettato solo una parte del messaggio: il resto passa da una copia */
+    if (sent < 2 + length) {
+        char buffer[2 + IO_BUFFER_SIZE];
+
+        frame_fragments(buffer, sizeof(buffer), action, text, suffix);
+        if (send_all(sd, buffer + sent, 2 + length - (int)sent) == -1) {
+            return -1;
+        }
+    }
+    g_protocol_stats.bytes_sent += 2 + length;
+    return 0;
+}
+
+int frame_fragments(char *buffer, int size, enum ACTION action, const struct fragment *text, const struct fragment *suffix) {
+
+    int length, suffix_size = suffix != NULL ? suffix->size : 0;
+
+    length = 1 + text->size + suffix_size + 1;
+    if (length > IO_BUFFER_SIZE || 2 + length > size) {
+        return -1;
+    }
+
+    buffer[0] = (uint8_t)(length >> 8);
+    buffer[1] = (uint8_t)length;
+    buffer[2] = (uint8_t)action;
+    memcpy(buffer + 3, text->data, text->size);
+    if (suffix_size > 0) {
+        memcpy(buffer + 3 + text->size, suffix->data, suffix_size);
+    }
+    buffer[2 + length - 1] = '\0';
+    return 2 + length;
+}
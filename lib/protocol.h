@@ -14,6 +14,17 @@
 /* Massimo numero di parametri che si possono codificare in un unico messaggio */
 #define ARGC_MAX 10
 
+/* Caratteri (esadecimali) di un token per riprendere una sessione, vedi RESUME */
+#define TOKEN_LENGTH 32
+
+/* Proprietà degli oggetti nel manifesto di una room (vedi MANIFEST) */
+#define MANIFEST_USE_ALONE 1    /* Può essere usato da solo */
+#define MANIFEST_USE_OBJECT 2   /* Può essere usato su un altro oggetto */
+#define MANIFEST_USE_UNKNOWN 4  /* Risponde se usato su un nome sconosciuto */
+
+/* Lista vuota nel manifesto (un argomento non può essere vuoto) */
+#define MANIFEST_EMPTY "-"
+
 enum ACTION {
     SERVER,     /* Generico messaggio del server */
     CLIENT,     /* Generico messaggio del client */
@@ -30,6 +41,50 @@ enum ACTION {
     DROP,
     END,        /* Fine dei comandi del client */
 
+    /**
+     * Azioni aggiunte in seguito: vengono dopo END così i valori delle
+     *  azioni precedenti, che client e journal già esistenti usano, non cambiano.
+     */
+    RANK,       /* Classifica di una room */
+    SPECTATE,   /* Inizia (con un argomento) o smette (senza) di guardare una room */
+    EVENT,      /* Il server invia ad uno spettatore un evento della partita che sta guardando */
+
+    /**
+     * Notifica che il server invia di sua iniziativa ad un giocatore (tempo
+     *  in scadenza o scaduto, sabotaggi), può arrivare in qualsiasi momento.
+     * Viene dopo END così i valori delle azioni precedenti non cambiano.
+     */
+    NOTIFY,
+
+    /**
+     * Dopo il login il server invia al client un token (un argomento,
+     *  nessuno se non è stato possibile generarlo). Se la connessione si
+     *  interrompe il client può riconnettersi ed inviare come primo messaggio
+     *  RESUME~token invece del login: il server risponde come al login (con
+     *  RESUMED o RESUME_FAILED) e gli restituisce la sessione, partita compresa.
+     */
+    RESUME,
+
+    /**
+     * Manifesto della room in cui il giocatore ha appena iniziato (o
+     *  ripreso) a giocare, inviato dal server prima della risposta:
+     *  capienza dell'inventario~locazioni~oggetti~proprietà~inventario.
+     * Locazioni ed oggetti sono nomi separati da uno spazio, le proprietà
+     *  un carattere '0' + MANIFEST_USE_* per ogni oggetto, l'inventario
+     *  gli indici degli oggetti posseduti separati da uno spazio. Le liste
+     *  vuote valgono MANIFEST_EMPTY.
+     * Finché gioca, ogni risposta del server ha come secondo argomento
+     *  l'inventario aggiornato: il client può controllare i comandi e
+     *  rispondere a objs senza interpellare il server.
+     */
+    MANIFEST,
+
+    /**
+     * Il client chiede la prossima mossa per raccogliere tutti i token,
+     *  il server risponde come agli altri comandi di gioco.
+     */
+    HINT,
+
     ACTION_MAX  /* Per i controlli nella decode_messsage(...) */
 };
 
@@ -38,7 +93,7 @@ extern const char* const action_to_str[];
 
 /**
  * Prova a tardurre *buffer* in uno tra:
- *  START, LOOK, TAKE, USE, OBJS, DROP, END.
+ *  START, LOOK, TAKE, USE, OBJS, DROP, RANK, SPECTATE, END, HINT.
  * Se non ci riesce ritorna HELP.
  */ 
 enum ACTION str_to_action(char *buffer);
@@ -57,7 +112,11 @@ enum RESPONSE {
     /* L'username non esiste, l'utente è stato registrato */    
     REGISTERED,   
     /* L'username non esiste, ma il server ha esaurito la memoria per registrarlo */          
-    SERVER_FULL             
+    SERVER_FULL,
+    /* Il token era valido, la sessione è stata ripresa */
+    RESUMED,
+    /* Token sconosciuto, scaduto o di una sessione ancora connessa */
+    RESUME_FAILED
 };
 
 /* Converte gli elementi letterali del tipo RESPONSE in stringhe */
@@ -106,6 +165,16 @@ void free_argv(char *argv[ARGC_MAX]);
  *  codificata dal tipo enumerazione RESPONSE.
  */ 
 
+/**
+ * Inviano e ricevono esattamente *size* byte su *sd*, ripetendo la
+ *  chiamata finché il socket ne accetta o ne consegna solo una parte
+ *  (o viene interrotta da un segnale): TCP non garantisce che un
+ *  messaggio arrivi in un solo segmento, né che parta tutto insieme.
+ * In caso di errore o di connessione chiusa ritornano -1, 0 altrimenti.
+ */
+int send_all(int sd, const void *buffer, int size);
+int recv_all(int sd, void *buffer, int size);
+
 /**
  * Invia un messaggio sul socket *sd* seguendo il protocollo descritto sopra.
  * In caso di errore ritorna -1, 0 altrimenti.
@@ -124,4 +193,58 @@ int send_msg(int sd, enum ACTION action, int argc, char *argv[]);
  */
 int recv_msg(int sd, enum ACTION *action, int *argc, char *argv[ARGC_MAX]);
 
+/**
+ * Le due metà di recv_msg(...), per chi vuole distinguerle.
+ * recv_frame(...) riceve in *buffer* un messaggio codificato e ne ritorna
+ *  la dimensione, -1 in caso di errore.
+ * decode_frame(...) lo decodifica come farebbe recv_msg(...), con gli
+ *  stessi valori di ritorno.
+ */
+int recv_frame(int sd, char buffer[IO_BUFFER_SIZE]);
+int decode_frame(const char *buffer, int size, enum ACTION *action, int *argc, char *argv[ARGC_MAX]);
+
+/**
+ * Statistiche dei messaggi scambiati con send_msg(...), recv_msg(...)
+ *  e send_fragments(...), chi invia dati in altro modo le aggiorna da sé.
+ */
+struct protocol_stats {
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    unsigned long decode_failures;  /* Messaggi ricevuti interamente ma non validi */
+};
+
+extern struct protocol_stats g_protocol_stats;
+
+/**
+ * Frammento di un messaggio già codificato: sono i byte di un argomento
+ *  (senza il '\\0' finale), che con un solo argomento coincidono con la
+ *  sua codifica. I testi che non cambiano vengono codificati una volta
+ *  sola e le risposte si compongono affiancando i frammenti, senza copie.
+ */
+struct fragment {
+    const char *data;   /* NULL se il frammento non ha un testo */
+    int size;
+};
+
+/* Frammento di una stringa letterale, calcolato a tempo di compilazione */
+#define FRAGMENT(literal) { literal, sizeof(literal) - 1 }
+
+/* Inizializza *f* con il testo *text* (che può essere NULL), senza copiarlo */
+void make_fragment(struct fragment *f, const char *text);
+
+/**
+ * Invia sul socket *sd* un messaggio con azione *action* ed un solo
+ *  argomento, formato da *text* seguito da *suffix* (che può essere NULL).
+ * Sul socket arrivano gli stessi byte di send_msg(...), ma con una sola
+ *  chiamata di sistema e senza ricopiare i testi.
+ * Se il messaggio supera IO_BUFFER_SIZE o in caso di errore ritorna -1, 0 altrimenti.
+ */
+int send_fragments(int sd, enum ACTION action, const struct fragment *text, const struct fragment *suffix);
+
+/**
+ * Come send_fragments(...), ma scrive il messaggio in *buffer* (di *size*
+ *  byte) invece di inviarlo. Ritorna i byte scritti, -1 se non entra.
+ */
+int frame_fragments(char *buffer, int size, enum ACTION action, const struct fragment *text, const struct fragment *suffix);
+
 #endif
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "analytics.h"
+
+/* Dimensione di una linea di cache */
+#define CACHE_LINE 64
+
+/* Thread che possono registrare eventi, ciascuno nel proprio shard */
+#define ANALYTICS_SHARDS 8
+
+/* Lunghezza massima (compreso '\0') dei nomi delle room, quelli più lunghi vengono troncati */
+#define ANALYTICS_NAME_MAX 64
+
+/**
+ * Un enigma è identificato dai nomi dell'oggetto e dello stato da cui
+ *  parte la transizione che lo pone: gli indici cambiano da una versione
+ *  all'altra del catalogo, i nomi di solito no.
+ */
+struct puzzle_stats {
+    char object[ANALYTICS_NAME_MAX], state[ANALYTICS_NAME_MAX];
+    unsigned long attempts, failures;
+};
+
+struct room_stats {
+    unsigned long counters[AN_COUNTERS_MAX];
+    int n_puzzles;
+    struct puzzle_stats puzzles[ANALYTICS_PUZZLES_MAX];
+};
+
+/**
+ * Contatori di un thread. Lo scrive solo lui, analytics_flush(...) lo
+ *  legge mentre viene scritto: per questo i valori vengono letti e
+ *  scritti in modo atomico (senza ordinamento, costa quanto un accesso
+ *  normale), tranne n_puzzles, che pubblica i nuovi enigmi.
+ */
+struct shard {
+    struct room_stats rooms[ANALYTICS_ROOMS_MAX];
+} __attribute__((aligned(CACHE_LINE)));
+
+static struct shard g_shards[ANALYTICS_SHARDS];
+static int g_n_shards = 0;
+static pthread_key_t g_shard_key;
+static pthread_once_t g_shard_once = PTHREAD_ONCE_INIT;
+
+/* Nomi delle room con un indice, in ordine di prima apparizione */
+static char g_names[ANALYTICS_ROOMS_MAX][ANALYTICS_NAME_MAX];
+static int g_n_names = 0;
+static pthread_mutex_t g_names_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Scrittura di un contatore da parte del thread proprietario */
+#define ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#define LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static void create_key(void) {
+    pthread_key_create(&g_shard_key, NULL);
+}
+
+/* Lo shard del thread chiamante, NULL se sono già stati assegnati tutti */
+static struct shard* my_shard(void) {
+    struct shard *shard;
+    int i;
+
+    pthread_once(&g_shard_once, create_key);
+    shard = pthread_getspecific(g_shard_key);
+    if (shard != NULL) {
+        return shard;
+    }
+    i = __atomic_fetch_add(&g_n_shards, 1, __ATOMIC_RELAXED);
+    if (i >= ANALYTICS_SHARDS) {
+        return NULL;
+    }
+    shard = &g_shards[i];
+    pthread_setspecific(g_shard_key, shard);
+    return shard;
+}
+
+/* Indice delle statistiche di *room*, -1 se non c'è più posto per room nuove */
+static int room_index(struct room *room) {
+    int i = __atomic_load_n(&room->stats, __ATOMIC_ACQUIRE);
+
+    if (i != -1) {
+        return i;
+    }
+
+    /* Solo la prima volta per ogni versione della room */
+    pthread_mutex_lock(&g_names_lock);
+    for (i = 0; i < g_n_names && strncmp(g_names[i], room->name, ANALYTICS_NAME_MAX - 1) != 0; i++);
+    if (i == g_n_names) {
+        if (i == ANALYTICS_ROOMS_MAX) {
+            pthread_mutex_unlock(&g_names_lock);
+            return -1;
+        }
+        strncpy(g_names[i], room->name, ANALYTICS_NAME_MAX - 1);
+        __atomic_store_n(&g_n_names, i + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_names_lock);
+
+    __atomic_store_n(&room->stats, i, __ATOMIC_RELEASE);
+    return i;
+}
+
+/* I contatori di *room* del thread chiamante, NULL se non ci sono */
+static struct room_stats* my_stats(struct room *room) {
+    struct shard *shard = my_shard();
+    int i;
+
+    if (shard == NULL || (i = room_index(room)) == -1) {
+        return NULL;
+    }
+    return &shard->rooms[i];
+}
+
+void analytics_count(struct room *room, enum ANALYTICS_COUNTER counter, unsigned long n) {
+    struct room_stats *rs = my_stats(room);
+
+    if (rs != NULL) {
+        ADD(rs->counters[counter], n);
+    }
+}
+
+/* Lo stato di partenza della transizione *transition*, che sono ordinate per stato */
+static int source_state(const struct puzzle *pz, int transition) {
+    int lo = 0, hi = pz->n_states - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (pz->dispatch[mid * EV_MAX] <= transition) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/* Indice dell'enigma *object*, *state* tra i primi *n* di *puzzles*, *n* se non c'è */
+static int find_puzzle(const struct puzzle_stats *puzzles, int n, const char *object, const char *state) {
+    int i;
+    for (i = 0; i < n && (strncmp(puzzles[i].object, object, ANALYTICS_NAME_MAX - 1) != 0 ||
+        strncmp(puzzles[i].state, state, ANALYTICS_NAME_MAX - 1) != 0); i++);
+    return i;
+}
+
+void analytics_answer(struct room *room, int object, int transition, int right) {
+    struct room_stats *rs = my_stats(room);
+    struct puzzle_stats *ps;
+    const char *object_name, *state_name;
+    int i;
+
+    if (rs == NULL) {
+        return;
+    }
+    object_name = room->object_names[object];
+    state_name = room->puzzle.state_names[source_state(&room->puzzle, transition)];
+    i = find_puzzle(rs->puzzles, rs->n_puzzles, object_name, state_name);
+    if (i == ANALYTICS_PUZZLES_MAX) {
+        return;
+    }
+    ps = &rs->puzzles[i];
+    if (i == rs->n_puzzles) {
+        strncpy(ps->object, object_name, ANALYTICS_NAME_MAX - 1);
+        strncpy(ps->state, state_name, ANALYTICS_NAME_MAX - 1);
+        ps->attempts = ps->failures = 0;
+        __atomic_store_n(&rs->n_puzzles, i + 1, __ATOMIC_RELEASE);
+    }
+    ADD(ps->attempts, 1);
+    if (!right) {
+        ADD(ps->failures, 1);
+    }
+}
+
+/* Rapporto tra *a* e *b*, 0 se *b* è 0 */
+static double ratio(unsigned long a, unsigned long b) {
+    return b == 0 ? 0.0 : (double)a / (double)b;
+}
+
+/* Somma degli shard per la room di indice *r* */
+static void merge(int r, struct room_stats *total) {
+    int n_shards = __atomic_load_n(&g_n_shards, __ATOMIC_RELAXED);
+    int s, i, j, c;
+
+    memset(total, 0, sizeof(*total));
+    if (n_shards > ANALYTICS_SHARDS) {
+        n_shards = ANALYTICS_SHARDS;
+    }
+
+    for (s = 0; s < n_shards; s++) {
+        struct room_stats *rs = &g_shards[s].rooms[r];
+        int n_puzzles = __atomic_load_n(&rs->n_puzzles, __ATOMIC_ACQUIRE);
+
+        for (c = 0; c < AN_COUNTERS_MAX; c++) {
+            total->counters[c] += LOAD(rs->counters[c]);
+        }
+        for (i = 0; i < n_puzzles; i++) {
+            struct puzzle_stats *ps = &rs->puzzles[i];
+
+            j = find_puzzle(total->puzzles, total->n_puzzles, ps->object, ps->state);
+            if (j == ANALYTICS_PUZZLES_MAX) {
+                continue;
+            }
+            if (j == total->n_puzzles) {
+                strcpy(total->puzzles[j].object, ps->object);
+                strcpy(total->puzzles[j].state, ps->state);
+                total->n_puzzles++;
+            }
+            total->puzzles[j].attempts += LOAD(ps->attempts);
+            total->puzzles[j].failures += LOAD(ps->failures);
+        }
+    }
+}
+
+int analytics_flush(const char *path) {
+    char tmp[256];
+    struct room_stats total;
+    FILE *f;
+    int n_names = __atomic_load_n(&g_n_names, __ATOMIC_ACQUIRE);
+    int r, i, ok;
+
+    if (strlen(path) + 5 > sizeof(tmp)) {
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        return -1;
+    }
+
+    for (r = 0; r < n_names; r++) {
+        unsigned long *c = total.counters;
+
+        merge(r, &total);
+        fprintf(f, "room\t%s\tgames=%lu\tsolved=%lu\ttimeouts=%lu\ttimeout_rate=%.2f\t"
+            "tokens=%lu\ttoken_gap_avg=%.1f\ttakes=%lu\tdrops=%lu\tuseless_drops=%lu\t"
+            "sabotages=%lu\tsabotage_hits=%lu\tsabotage_rate=%.2f\thints=%lu\n",
+            g_names[r], c[AN_GAMES], c[AN_SOLVED], c[AN_TIMEOUTS], ratio(c[AN_TIMEOUTS], c[AN_GAMES]),
+            c[AN_TOKENS], ratio(c[AN_TOKEN_SECONDS], c[AN_TOKENS]), c[AN_TAKES], c[AN_DROPS],
+            c[AN_USELESS_DROPS], c[AN_SABOTAGES], c[AN_SABOTAGE_HITS], ratio(c[AN_SABOTAGE_HITS], c[AN_SABOTAGES]),
+            c[AN_HINTS]);
+
+        for (i = 0; i < total.n_puzzles; i++) {
+            struct puzzle_stats *ps = &total.puzzles[i];
+
+            fprintf(f, "puzzle\t%s\t%s\t%s\tattempts=%lu\tfailures=%lu\tfailure_rate=%.2f\n",
+                g_names[r], ps->object, ps->state, ps->attempts, ps->failures, ratio(ps->failures, ps->attempts));
+        }
+    }
+
+    ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, path) == -1) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
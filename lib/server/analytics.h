@@ -0,0 +1,70 @@
+#ifndef LIB_SERVER_ANALYTICS_H
+#define LIB_SERVER_ANALYTICS_H
+
+#include "rooms.h"
+
+/* File in cui vengono scritti i riepiloghi */
+#define ANALYTICS_FILE "analytics.txt"
+
+/* Ogni quanti secondi il server riscrive ANALYTICS_FILE */
+#define ANALYTICS_FLUSH_SECONDS 30
+
+/* Room diverse (per nome, anche tra una ricarica e l'altra) di cui si tiene il conto */
+#define ANALYTICS_ROOMS_MAX 32
+
+/* Enigmi per room di cui si tiene il conto, gli altri vengono ignorati */
+#define ANALYTICS_PUZZLES_MAX 16
+
+/**
+ * Statistiche di gioco per chi progetta le room: dove i giocatori si
+ *  bloccano, quanto tempo passa tra un token e l'altro, quali oggetti
+ *  raccolgono e posano senza usarli, quanto spesso il tempo scade,
+ *  quanto riescono i sabotaggi e quanti suggerimenti vengono chiesti.
+ *
+ * Ogni thread scrive in un proprio shard, allineato alla linea di cache
+ *  perché thread diversi non si contendano la stessa: registrare un
+ *  evento costa un incremento senza lock, tutto il resto viene fatto da
+ *  analytics_flush(...), che somma gli shard.
+ * Le room sono identificate dal nome, quindi i conteggi proseguono
+ *  anche dopo una ricarica del catalogo; gli enigmi dai nomi dell'oggetto
+ *  e dello stato da cui parte la transizione che li pone.
+ *
+ * ANALYTICS_FILE ha una riga per room ed una per enigma, con i campi
+ *  separati da tabulazioni (la seconda colonna è il nome della room):
+ *
+ *   room    <nome>  games=3  solved=1  timeouts=1  timeout_rate=0.33  ...
+ *   puzzle  <nome>  <oggetto>  <stato>  attempts=5  failures=3  ...
+ *
+ * e si interroga con awk, ad esempio gli enigmi più sbagliati:
+ *  awk -F'\t' '$1 == "puzzle"' analytics.txt | sort -t= -k3 -n -r
+ */
+
+enum ANALYTICS_COUNTER {
+    AN_GAMES,           /* Partite iniziate */
+    AN_SOLVED,          /* Partite risolte */
+    AN_TIMEOUTS,        /* Partite perse per tempo scaduto */
+    AN_TOKENS,          /* Token raccolti */
+    AN_TOKEN_SECONDS,   /* Secondi trascorsi prima di ogni token (dall'inizio o dal precedente) */
+    AN_TAKES,           /* Oggetti raccolti con TAKE */
+    AN_DROPS,           /* Oggetti posati */
+    AN_USELESS_DROPS,   /* Oggetti posati senza essere mai stati usati (USE) */
+    AN_SABOTAGES,       /* Risposte alla domanda per entrare in questa room, occupata */
+    AN_SABOTAGE_HITS,   /* ...di cui giuste */
+    AN_HINTS,           /* Suggerimenti chiesti con HINT */
+    AN_COUNTERS_MAX
+};
+
+/* Aggiunge *n* al contatore *counter* di *room* */
+void analytics_count(struct room *room, enum ANALYTICS_COUNTER counter, unsigned long n);
+
+/* Registra una risposta (giusta se *right* è vero) all'enigma posto dalla transizione *transition* su *object* */
+void analytics_answer(struct room *room, int object, int transition, int right);
+
+/**
+ * Scrive in *path* i riepiloghi per room, sommando gli shard di tutti i
+ *  thread. Il file viene sostituito solo a scrittura completata.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+int analytics_flush(const char *path);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef LIB_SERVER_COROUTINE_H
+#define LIB_SERVER_COROUTINE_H
+
+/**
+ * Coroutine senza stack, alla maniera del Duff's device.
+ *
+ * Una coroutine è una funzione il cui corpo sta tra CO_BEGIN(...) e
+ *  CO_END(...) e che ricorda in un int (*pc*, 0 alla prima chiamata) il
+ *  punto a cui è arrivata: CO_YIELD(...) lo aggiorna e ritorna, la
+ *  chiamata successiva riprende subito dopo. Nessun thread resta bloccato
+ *  ad aspettare e nessuno stack viene conservato, quindi le variabili
+ *  locali si perdono: quello che serve dopo una sospensione va tenuto
+ *  insieme a *pc*.
+ * Due CO_YIELD(...) non possono stare sulla stessa riga, né dentro uno
+ *  switch della coroutine.
+ */
+
+/* Valore di *pc* di una coroutine terminata */
+#define CO_DONE (-1)
+
+#define CO_BEGIN(pc) switch (pc) { case 0:
+
+/* Sospende la coroutine ritornando *ret*, la prossima chiamata riprende da qui */
+#define CO_YIELD(pc, ret) do { (pc) = __LINE__; return (ret); case __LINE__:; } while (0)
+
+/* Termina la coroutine, va seguito dal return finale */
+#define CO_END(pc) } (pc) = CO_DONE
+
+#endif
@@ -1,9 +1,10 @@
-
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "database.h"
 #include "../protocol.h"
+#include "../mystdlib.h"
 
 /**
  * Astrazione di un database, realizzata tramite 
@@ -17,9 +18,51 @@ struct record {
 
 struct record *g_db = NULL;
 
+/* Credenziali nell'indice ordinato, senza puntatori: 64 byte ciascuna */
+struct entry {
+    char username[CREDENTIALS_LENGTH_MAX];
+    char password[CREDENTIALS_LENGTH_MAX];
+};
+
+static struct entry *g_index = NULL;
+static long g_n_index = 0;
+static long g_n_db = 0;    /* Record nella lista */
+
+/* Credenziali da ordinare durante un'importazione, *seq* è -1 per quelle già registrate */
+struct pending {
+    struct entry entry;
+    long seq;
+};
+
+/* Il record di *username* nell'indice, NULL se non c'è */
+static struct entry* index_find(const char *username) {
+    long lo = 0, hi = g_n_index;
+
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(g_index[mid].username, username);
+
+        if (cmp == 0) {
+            return &g_index[mid];
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
 enum DB_RESPONSE db_read(const char *username, const char *password) {
 
     struct record *r = g_db;
+    struct entry *e = index_find(username);
+
+    if (e != NULL) {
+        return strcmp(e->password, password) == 0 ? DB_READ_SUCCESS : DB_READ_FAIL;
+    }
 
     while (r != NULL && strcmp(r->username, username) != 0) {
         r = r->next;
@@ -48,6 +91,174 @@ enum DB_RESPONSE db_write(const char *username, const char *password) {
 
     r->next = g_db;
     g_db = r;
+    g_n_db++;
     
     return DB_READ_SUCCESS;
 }
+
+enum DB_RESPONSE db_validate(const char *username, const char *password) {
+
+    int username_len, password_len;
+
+    username_len = ssstrlen(username, CREDENTIALS_LENGTH_MAX);
+    password_len = ssstrlen(password, CREDENTIALS_LENGTH_MAX);
+
+    if (username_len == -1 || password_len == -1) {
+        return DB_CREDENTIALS_TOO_LONG;
+    }
+
+    if (username_len < CREDENTIALS_LENGTH_MIN - 1 ||
+        password_len < CREDENTIALS_LENGTH_MIN - 1) {
+        return DB_CREDENTIALS_TOO_SHORT;
+    }
+
+    return DB_CREDENTIALS_VALID;
+}
+
+long db_size(void) {
+    return g_n_index + g_n_db;
+}
+
+/* Ordina per username e, a parità, per *seq*: vince chi è già registrato, poi la prima riga */
+static int compare_pending(const void *a, const void *b) {
+    const struct pending *pa = a, *pb = b;
+    int cmp = strcmp(pa->entry.username, pb->entry.username);
+
+    if (cmp != 0) {
+        return cmp;
+    }
+    return pa->seq < pb->seq ? -1 : pa->seq > pb->seq;
+}
+
+/* Aggiunge a *all* (di *n* elementi e spazio per *size*) le credenziali, ingrandendolo se serve */
+static int push_pending(struct pending **all, long *n, long *size,
+    const char *username, const char *password, long seq) {
+
+    struct pending *p;
+
+    if (*n == *size) {
+        long new_size = *size == 0 ? 1024 : 2 * *size;
+
+        p = realloc(*all, new_size * sizeof(struct pending));
+        if (p == NULL) {
+            return -1;
+        }
+        *all = p;
+        *size = new_size;
+    }
+    p = &(*all)[(*n)++];
+    strcpy(p->entry.username, username);
+    strcpy(p->entry.password, password);
+    p->seq = seq;
+    return 0;
+}
+
+/* Legge le credenziali di *f* in *all*, aggiornando *stats* */
+static int read_credentials(FILE *f, const char *path, struct pending **all, long *n, long *size,
+    struct db_import_stats *stats) {
+
+    char buffer[IO_BUFFER_SIZE];
+    int line = 0;
+
+    while (fgetsnn(buffer, IO_BUFFER_SIZE, f) != NULL) {
+        char *username, *password;
+
+        line++;
+        username = strtok(buffer, " \t\r");
+        if (username == NULL || username[0] == '#') {
+            continue;
+        }
+        stats->lines++;
+
+        password = strtok(NULL, " \t\r");
+        if (password == NULL || strtok(NULL, " \t\r") != NULL ||
+            db_validate(username, password) != DB_CREDENTIALS_VALID) {
+            printf(ANSI_COLOR_YELLOW "[Warning]: %s:%d: credenziali non valide\n" ANSI_COLOR_RESET, path, line);
+            stats->invalid++;
+            continue;
+        }
+        if (push_pending(all, n, size, username, password, stats->lines) == -1) {
+            return -1;
+        }
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+int db_import(const char *path, struct db_import_stats *stats) {
+
+    struct db_import_stats local;
+    struct pending *all = NULL;
+    struct entry *index;
+    struct record *r;
+    long n = 0, size = 0, n_index = 0, kept = 0, i;
+    FILE *f;
+
+    if (stats == NULL) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(struct db_import_stats));
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    /* Gli utenti già registrati entrano nell'ordinamento come tutti gli altri */
+    for (i = 0; i < g_n_index; i++) {
+        if (push_pending(&all, &n, &size, g_index[i].username, g_index[i].password, -1) == -1) {
+            fclose(f);
+            free(all);
+            return -1;
+        }
+    }
+    for (r = g_db; r != NULL; r = r->next) {
+        if (push_pending(&all, &n, &size, r->username, r->password, -1) == -1) {
+            fclose(f);
+            free(all);
+            return -1;
+        }
+    }
+    if (read_credentials(f, path, &all, &n, &size, stats) == -1) {
+        fclose(f);
+        free(all);
+        return -1;
+    }
+    fclose(f);
+
+    qsort(all, n, sizeof(struct pending), compare_pending);
+
+    /* Una sola passata: di ogni username resta il primo */
+    index = malloc((n > 0 ? n : 1) * sizeof(struct entry));
+    if (index == NULL) {
+        free(all);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (n_index > 0 && strcmp(index[n_index - 1].username, all[i].entry.username) == 0) {
+            if (kept == -1) {
+                stats->existing++;
+            }
+            else {
+                stats->duplicates++;
+            }
+            continue;
+        }
+        index[n_index++] = all[i].entry;
+        kept = all[i].seq;
+        if (kept != -1) {
+            stats->imported++;
+        }
+    }
+    free(all);
+
+    free(g_index);
+    g_index = index;
+    g_n_index = n_index;
+    while (g_db != NULL) {
+        r = g_db->next;
+        free(g_db);
+        g_db = r;
+    }
+    g_n_db = 0;
+    return 0;
+}
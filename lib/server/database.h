@@ -7,9 +7,28 @@ enum DB_RESPONSE {
     DB_READ_FAIL,               /* L'username esiste ma la password è sbagliata */
     DB_READ_SUCCESS,            /* L'username esiste e la password è corretta */
     DB_WRITE_FAIL,              /* Il database non ha abbastanza memoria per inserire il record */
-    DB_WRITE_SUCCESS            /* La scrittura del nuovo record è avvenuta con successo */
+    DB_WRITE_SUCCESS,           /* La scrittura del nuovo record è avvenuta con successo */
+    DB_CREDENTIALS_TOO_SHORT,   /* Username o password sotto CREDENTIALS_LENGTH_MIN */
+    DB_CREDENTIALS_TOO_LONG,    /* Username o password oltre CREDENTIALS_LENGTH_MAX */
+    DB_CREDENTIALS_VALID
 };
 
+/**
+ * Il database tiene gli utenti in un indice ordinato per username, in cui
+ *  si cerca per bisezione, più una lista degli utenti registrati dopo
+ *  l'ultima importazione: db_import(...) li fonde tutti nell'indice.
+ */
+
+/**
+ * Controlla le lunghezze di *username* e *password*, con le stesse
+ *  regole usate per il login.
+ * Ritorna uno tra:
+ *  - DB_CREDENTIALS_TOO_SHORT
+ *  - DB_CREDENTIALS_TOO_LONG
+ *  - DB_CREDENTIALS_VALID
+ */
+enum DB_RESPONSE db_validate(const char *username, const char *password);
+
 /**
  * Cerca nel database il record (*username*, *password*).
  * Ritorna uno tra:
@@ -28,4 +47,30 @@ enum DB_RESPONSE db_read(const char *username, const char *password);
  */
 enum DB_RESPONSE db_write(const char *username, const char *password);
 
+/* Esito di db_import(...), in numero di righe del file */
+struct db_import_stats {
+    long lines;         /* Righe con delle credenziali (esclusi commenti e righe vuote) */
+    long imported;      /* Utenti aggiunti al database */
+    long duplicates;    /* Username ripetuti nel file, vale la prima riga */
+    long existing;      /* Username già registrati, la password resta quella che avevano */
+    long invalid;       /* Righe malformate o con credenziali non valide (vedi db_validate(...)) */
+};
+
+/**
+ * Registra in blocco gli utenti elencati in *path*, una riga
+ *  "username password" per utente; le righe vuote e quelle che iniziano
+ *  con '#' vengono ignorate, quelle non valide vengono segnalate e saltate.
+ * Invece di una db_write(...) per utente (ognuna preceduta da una
+ *  db_read(...)), le credenziali vengono ordinate insieme a quelle già
+ *  presenti e l'indice viene ricostruito con una sola passata, che scarta
+ *  i duplicati.
+ * Scrive in *stats* (se non è NULL) l'esito dell'importazione.
+ * Ritorna -1 se il file non può essere letto o la memoria non basta,
+ *  e in quel caso il database resta com'era, 0 altrimenti.
+ */
+int db_import(const char *path, struct db_import_stats *stats);
+
+/* Numero di utenti registrati */
+long db_size(void);
+
 #endif
@@ -0,0 +1,1000 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "engine.h"
+#include "coroutine.h"
+#include "rooms.h"
+#include "leaderboard.h"
+#include "analytics.h"
+#include "hints.h"
+#include "logger.h"
+
+const struct fragment g_messages[] = {
+    FRAGMENT("Attualmente non sei in nessuna stanza"),
+    FRAGMENT("Questo comando richiede almeno un parametro."),
+    FRAGMENT("La room inserita non esiste."),
+    FRAGMENT("Sei già in questa stanza."),
+    FRAGMENT("C'è già un giocatore in questa stanza. Se rispondi bene alla seguente domanda gli verrà tolto del tempo, altrimenti gliene verrà aggiunto! "),
+    FRAGMENT("Non c'è nessuna locazione od oggetto con questo nome."),
+    FRAGMENT("Hai raccolto tutti i token in tempo! Bel lavoro."),
+    FRAGMENT("L'oggetto specificato non esiste."),
+    FRAGMENT("Il primo oggetto specificato non esiste."),
+    FRAGMENT("Hai già questo oggetto in mano."),
+    FRAGMENT("Hai troppi oggetti in mano, devi posarne qualcuno."),
+    FRAGMENT("L'oggetto è bloccato..."),
+    FRAGMENT("Non sembra fare nulla."),
+    FRAGMENT("Non hai nessun oggetto."),
+    FRAGMENT("Puoi posare solamente oggetti che hai in mano."),
+    FRAGMENT("Oggetto posato."),
+    FRAGMENT("Il giocatore è uscito dalla stanza prima che tu rispondessi."),
+    FRAGMENT("Risposta corretta!"),
+    FRAGMENT("Risposta sbagliata."),
+    FRAGMENT("Il tempo è scaduto, hai perso!"),
+    FRAGMENT("Hai smesso di guardare la partita."),
+    FRAGMENT("Non puoi guardare una partita mentre stai giocando."),
+    FRAGMENT("Manca meno di un minuto alla fine del tempo!"),
+    FRAGMENT("Non ci sono suggerimenti per questa room."),
+    FRAGMENT("Da qui non è più possibile raccogliere tutti i token.")
+};
+
+unsigned long g_next_timer = 0;
+
+/* Chi riceve gli eventi, vedi engine_init(...) */
+static engine_sink g_sink;
+static void *g_sink_ctx;
+
+/**
+ * Consegna a chi usa il motore l'evento *kind*, vedi struct engine_event.
+ * Ritorna -1 se non è stato possibile consegnarlo, 0 altrimenti.
+ */
+static int emit(enum ENGINE_EVENT kind, struct session *session, enum ACTION action,
+    const char *room, const struct fragment *text, const struct fragment *suffix) {
+    struct engine_event ev;
+
+    ev.kind = kind;
+    ev.session = session;
+    ev.action = action;
+    ev.room = room;
+    ev.text = text;
+    ev.suffix = suffix;
+    ev.delta = 0;
+    return g_sink(g_sink_ctx, &ev);
+}
+
+/* Risponde a *session* con *text* e *suffix* così come sono */
+static int write_reply(struct session *session, enum ACTION action, const struct fragment *text, const struct fragment *suffix) {
+    return emit(ENGINE_REPLY, session, action, NULL, text, suffix);
+}
+
+/**
+ * Scrive in *buffer* (di almeno INVENTORY_LENGTH_MAX byte) l'inventario di
+ *  *session* nel formato del manifesto, vedi MANIFEST.
+ */
+static void write_inventory(struct session *session, char *buffer) {
+    int tot_objects = session_room(session)->tot_objects;
+    int i, held = 0, n = 0;
+
+    /* Ci si può fermare all'ultimo oggetto in mano */
+    for (i = 0; i < tot_objects && held < session->game.n_objects; i++) {
+        if (session->game.objects[i].in_inventory) {
+            n += sprintf(buffer + n, n > 0 ? " %d" : "%d", i);
+            held++;
+        }
+    }
+    if (n == 0) {
+        strcpy(buffer, MANIFEST_EMPTY);
+    }
+}
+
+int engine_send_manifest(struct session *session) {
+    char buffer[INVENTORY_LENGTH_MAX];
+    struct fragment inventory;
+    struct room *room = session_room(session);
+
+    if (room->manifest_frag.data == NULL) {
+        return 0;
+    }
+    write_inventory(session, buffer);
+    make_fragment(&inventory, buffer);
+    return emit(ENGINE_MANIFEST, session, MANIFEST, NULL, &room->manifest_frag, &inventory);
+}
+
+/* Pubblica per gli spettatori di *room* l'effetto del comando di *session* */
+static void publish(const char *room, struct session *session, const struct fragment *text, const struct fragment *suffix) {
+    emit(ENGINE_PUBLISH, session, EVENT, room, text, suffix);
+}
+
+/**
+ * Invia la risposta *text*, seguita da *suffix* (che può essere NULL),
+ *  al client di *session*; se questo sta giocando la pubblica anche per
+ *  gli spettatori della sua room ed aggiunge per lui l'inventario come
+ *  secondo argomento (vedi MANIFEST).
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int reply(struct session *session, enum ACTION action, const struct fragment *text, const struct fragment *suffix) {
+    char buffer[STATUS_LENGTH_MAX + 1 + INVENTORY_LENGTH_MAX];
+    struct fragment tail;
+    int len = suffix != NULL ? suffix->size : 0;
+
+    if (session->room == -1) {
+        return write_reply(session, action, text, suffix);
+    }
+    publish(session_room(session)->name, session, text, suffix);
+
+    if (len >= STATUS_LENGTH_MAX) {
+        return write_reply(session, action, text, suffix);
+    }
+    memcpy(buffer, suffix != NULL ? suffix->data : "", len);
+    buffer[len] = SEPARATOR;
+    write_inventory(session, buffer + len + 1);
+    make_fragment(&tail, buffer);
+    return write_reply(session, action, text, &tail);
+}
+
+unsigned long engine_remaining_time(struct session *session) {
+    unsigned long end_time = session->start_time + session_room(session)->time_limit * 60;
+    return end_time - (unsigned long)time(NULL);
+}
+
+/**
+ * Invia a *session* una notifica, senza che l'abbia chiesta.
+ * Un eventuale errore verrà scoperto da chi usa il motore.
+ */
+static void notify(struct session *session, const struct fragment *text) {
+    log_event(LOG_DEBUG, "Notifica per %d: %s", session->sd, text->data);
+    emit(ENGINE_NOTIFY, session, NOTIFY, NULL, text, NULL);
+}
+
+/* Termina la partita di *session*, che ha esaurito il tempo, per lei e per gli spettatori */
+static void time_over(struct session *session) {
+    log_event(LOG_INFO, "%d ha esaurito il tempo nella room %d", session->sd, session->room);
+    emit(ENGINE_TIME_OVER, session, SERVER, NULL, NULL, NULL);
+    analytics_count(session_room(session), AN_TIMEOUTS, 1);
+    publish(session_room(session)->name, session, &g_messages[MSG_TIME_OVER], NULL);
+    leave_room(session);
+}
+
+/* Istante in cui serve il prossimo controllo del tempo di *session*, NO_TIMER se non gioca */
+static unsigned long session_timer(struct session *session) {
+    unsigned long end_time;
+
+    if (session->room == -1) {
+        return NO_TIMER;
+    }
+    end_time = session->start_time + session_room(session)->time_limit * 60;
+
+    /* Il tempo scade quando ne rimane meno di 0 */
+    return session->warned ? end_time + 1 : end_time - NOTIFY_WARNING_SECONDS;
+}
+
+/* Come engine_check_timers(...), per la sola *session* */
+static void check_session(struct session *session, unsigned long now) {
+    long left;
+
+    if (now < session_timer(session)) {
+        return;
+    }
+    left = (long)(session->start_time + session_room(session)->time_limit * 60) - (long)now;
+
+    if (left < 0) {
+        /* Il comando che ha fatto scadere il tempo non c'è, gli spettatori vedono solo il risultato */
+        session->command[0] = '\0';
+        time_over(session);
+        notify(session, &g_messages[MSG_TIME_OVER]);
+    }
+    else if (!session->warned) {
+        session->warned = 1;
+        notify(session, &g_messages[MSG_TIME_WARNING]);
+    }
+}
+
+unsigned long engine_check_timers(unsigned long now) {
+    struct session *s;
+    unsigned long next = NO_TIMER;
+
+    for (s = g_sessions; s != NULL; s = s->next) {
+        unsigned long wake;
+
+        check_session(s, now);
+        wake = session_timer(s);
+        if (wake < next) {
+            next = wake;
+        }
+    }
+    return next;
+}
+
+void engine_sabotage(struct session *session, const char *room, long delta, const struct fragment *text) {
+    /* Nel frattempo potrebbe aver finito la partita */
+    if (session->room == -1 || strcmp(session_room(session)->name, room) != 0) {
+        return;
+    }
+    session->start_time += delta;
+    if (delta < 0) {
+        session->sabotages++;
+    }
+    session->warned = 0;
+    g_next_timer = 0;
+    notify(session, text);
+}
+
+/**
+ * Invia il testo *text* al client.
+ * Appende alla risposta il tempo rimasto ed i token raccolti: solo
+ *  questo riepilogo viene composto, il testo viene inviato così com'è.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int send_text(const struct fragment *text, struct session *session) {
+    char buffer[STATUS_LENGTH_MAX];
+    struct fragment status;
+
+    sprintf(buffer, "\n [Tempo rimasto: %lus, Token raccolti: %d/%d]",
+        engine_remaining_time(session), session->game.n_tokens, session_room(session)->n_tokens);
+
+    make_fragment(&status, buffer);
+    return reply(session, SERVER, text, &status);
+}
+
+/**
+ * Invia il testo *text* al client.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int send_text_without_info(enum ACTION action, const struct fragment *text, struct session *session) {
+    return reply(session, action, text, NULL);
+}
+
+int engine_reply(struct session *session, enum ACTION action, const struct fragment *text) {
+    return reply(session, action, text, NULL);
+}
+
+/**
+ * Come send_text(...), per un testo composto al momento in *str*.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int send_string(const char *str, struct session *session) {
+    struct fragment text;
+
+    make_fragment(&text, str);
+    return send_text(&text, session);
+}
+
+int engine_parse_room(const char *str) {
+    /** 
+     * atoi ritorna 0 in caso di errore, va differenziato dal caso
+     *  in cui è stato effettivamente tradotto il numero 0.
+     */
+    int room = atoi(str);
+    if ((room == 0 && str[0] != '0') || room < 0 || room >= g_catalogue->n_rooms) {
+        return -1;
+    }
+    return room;
+}
+
+/**
+ * Esegue il dialogo in corso con *session* fino alla prossima domanda
+ *  (o alla fine), passandogli la risposta in *argc* / *argv*.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int run_dialogue(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    struct dialogue *d = &session->dialogue;
+    int ret = d->resume(session, argc, argv);
+
+    if (d->pc == CO_DONE) {
+        end_dialogue(session);
+    }
+    return ret;
+}
+
+/**
+ * Sostituisce il dialogo in corso con *session* con la coroutine *resume*,
+ *  il cui stato (vedi struct dialogue) va preparato prima, e la esegue
+ *  fino alla prima domanda.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int begin_dialogue(struct session *session, int (*resume)(struct session*, int, char*[ARGC_MAX])) {
+    end_dialogue(session);
+    session->dialogue.resume = resume;
+    session->dialogue.pc = 0;
+    return run_dialogue(session, 0, NULL);
+}
+
+/**
+ * Dialogo con chi vuole entrare nella room occupata session->dialogue.room:
+ *  gli pone la domanda della room e, in base alla risposta, toglie o
+ *  aggiunge tempo a chi ci sta giocando. Il client non entra nella room
+ *  in nessun caso, potrà riprovarci quando si libera.
+ */
+static int entry_question(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    struct dialogue *d = &session->dialogue;
+    char buffer[IO_BUFFER_SIZE], notice[IO_BUFFER_SIZE];
+    struct fragment text;
+    struct session *s;
+    struct room *r;
+    long delta = 0;
+    int ret = 0;
+
+    CO_BEGIN(d->pc);
+
+    /* I testi restano quelli di questa versione del catalogo fino alla risposta */
+    d->catalogue = catalogue_acquire();
+    r = &d->catalogue->rooms[d->room];
+    CO_YIELD(d->pc, write_reply(session, QUESTION, &g_messages[MSG_ROOM_TAKEN], &r->question_frag));
+
+    /* Recupera la sessione del giocatore attualmente in gioco in tale stanza */
+    r = &d->catalogue->rooms[d->room];
+    s = get_session_by_room(r->name);
+    if (s != NULL) {
+        analytics_count(r, AN_SABOTAGES, 1);
+    }
+    if (s == NULL) {
+        text = g_messages[MSG_PLAYER_LEFT];
+
+        log_event(LOG_INFO, "%d ha risposto alla domanda ma il giocatore precedente è già uscito", session->sd);
+    }
+    else if (strcmp(argv[0], r->answer) == 0) {
+        analytics_count(r, AN_SABOTAGE_HITS, 1);
+        sprintf(buffer, "Risposta corretta! Sono stati tolti %d"
+            " minuti a %s.", r->bonus, s->username);
+        delta = -(long)r->bonus * 60;
+        make_fragment(&text, buffer);
+        sprintf(notice, "%s ha risposto correttamente alla domanda della room, "
+            "ti sono stati tolti %d minuti!", session->username, r->bonus);
+
+        log_event(LOG_INFO, "%d ha risposto correttamente alla domanda, danneggiando %d", session->sd, s->sd);
+    }
+    else {
+        sprintf(buffer, "Risposta sbagliata! Sono stati aggiunti %d"
+            " minuti %s.", r->penalty, s->username);
+        delta = (long)r->penalty * 60;
+        make_fragment(&text, buffer);
+        sprintf(notice, "%s ha sbagliato la domanda della room, "
+            "hai %d minuti in più.", session->username, r->penalty);
+
+        log_event(LOG_INFO, "%d ha risposto in modo errato alla domanda, avvantaggiando %d", session->sd, s->sd);
+    }
+
+    /**
+     * Gli spettatori vedono subito l'effetto sul giocatore, che lo
+     *  subisce quando viene consegnato ENGINE_SABOTAGE (vedi engine_sabotage(...)).
+     */
+    if (s != NULL) {
+        struct engine_event ev;
+        struct fragment f;
+
+        publish(r->name, session, &text, NULL);
+        make_fragment(&f, notice);
+        ev.kind = ENGINE_SABOTAGE;
+        ev.session = s;
+        ev.action = NOTIFY;
+        ev.room = r->name;
+        ev.text = &f;
+        ev.suffix = NULL;
+        ev.delta = delta;
+        g_sink(g_sink_ctx, &ev);
+    }
+
+    ret = send_text_without_info(SERVER, &text, session);
+    CO_END(d->pc);
+    return ret;
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando START e dei suoi argomenti.
+ * Ritorna -1 in caso di errore.
+ */
+static int start_command(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    int room;
+    struct session *s;
+    const char *name;
+    char buffer[IO_BUFFER_SIZE];
+
+    if (argc < 1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_MISSING_PARAMETER], session);
+    }
+    
+    room = engine_parse_room(argv[0]);
+    if (room == -1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_NO_SUCH_ROOM], session);
+    }
+
+    /* Le room sono identificate dal nome, anche tra una versione del catalogo e l'altra */
+    name = g_catalogue->rooms[room].name;
+    if (session->room != -1 && strcmp(session_room(session)->name, name) == 0) {
+        return send_text_without_info(SERVER, &g_messages[MSG_ALREADY_IN_ROOM], session);
+    }
+
+    /* Vediamo se prima di far entrare il giocatore nuovo c'era qualcuno */
+    s = get_session_by_room(name);
+
+    /**
+     * Il client ha provato ad entrare in una room occupata: abbandona
+     *  comunque la partita in corso e risponde alla domanda da fuori.
+     */
+    if (s != NULL) {
+        log_event(LOG_INFO, "%d ha provato ad entrare nella room %d, già occupata", session->sd, room);
+
+        leave_room(session);
+        session->dialogue.room = room;
+        return begin_dialogue(session, entry_question);
+    }
+
+    enter_room(session, room);
+
+    /* Inizializzazione dei restanti campi della sessione, se la stanza era vuota */
+    session->start_time = (unsigned long)time(NULL);
+    session->entry_time = session->start_time;
+    session->token_time = session->start_time;
+    session->sabotages = 0;
+    session->warned = 0;
+    g_next_timer = 0;
+    if (load_statuses(session) == -1) {
+        log_event(LOG_WARNING, "Impossibile caricare gli oggetti "
+            "della room per %d, memoria esaurita", session->sd);
+        leave_room(session);
+        return -1;
+    }
+    
+    log_event(LOG_INFO, "%d ha iniziato a giocare nella room %d", session->sd, session->room);
+    analytics_count(session_room(session), AN_GAMES, 1);
+    if (engine_send_manifest(session) == -1) {
+        return -1;
+    }
+    sprintf(buffer, "Benvenuto nella room %s. Hai %d minuti a partire da ora!",
+        session_room(session)->name, session_room(session)->time_limit);
+    return send_string(buffer, session);
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando LOOK e dei suoi argomenti.
+ * Ritorna -1 in caso di errore.
+ */
+static int look_command(struct session *session, int argc, char *argv[ARGC_MAX]) {   
+    const struct fragment *text;
+    struct room *room;
+    int ref;
+
+    if (session->room == -1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_NOT_PLAYING], session);
+    }
+
+    room = session_room(session);
+    if (argc == 0) {
+        return send_text(&room->look_frag, session);
+    }
+
+    /* argc >= 1, una sola ricerca risolve sia le locazioni che gli oggetti */
+    ref = lookup_name(room, argv[0]);
+
+    /* Comando look eseguito su una locazione */
+    if (ref != -1 && NAME_KIND(ref) == NAME_LOCATION) {
+        text = &room->locations[NAME_INDEX(ref)].look_frag;
+    }
+    /* Comando look eseguito su un oggetto, la descrizione dipende dal suo stato */
+    else if (ref != -1) {
+        struct object_status *os = get_status(session, NAME_INDEX(ref));
+        text = &room->state_frags[os->state];
+    }
+    /* Comando look eseguito su qualcosa di inesistente */
+    else {
+        text = &g_messages[MSG_NO_SUCH_NAME];
+    }
+
+    return send_text(text, session);
+}
+
+/**
+ * Registra nelle statistiche i token che *session* ha appena raccolto,
+ *  se prima ne aveva *before*, ed il tempo trascorso dal precedente.
+ */
+static void count_tokens(struct session *session, int before) {
+    int n = session->game.n_tokens - before;
+    unsigned long now;
+
+    if (n <= 0) {
+        return;
+    }
+    now = (unsigned long)time(NULL);
+    analytics_count(session_room(session), AN_TOKENS, n);
+    analytics_count(session_room(session), AN_TOKEN_SECONDS, now - session->token_time);
+    session->token_time = now;
+}
+
+/**
+ * Vero se *session* ha raccolto tutti i token della stanza in cui sta giocando.
+ */
+static int all_tokens_collected(struct session *session) {
+    return session->game.n_tokens >= session_room(session)->n_tokens;
+}
+
+/**
+ * Registra in classifica il risultato di *session*, la fa uscire dalla
+ *  stanza appena risolta e lo comunica al client.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int send_solved(struct session *session) {
+    char buffer[STATUS_LENGTH_MAX];
+    struct fragment result;
+    struct lb_entry e;
+    long rank;
+    const char *room = session_room(session)->name;
+
+    memset(&e, 0, sizeof(e));
+    strcpy(e.username, session->username);
+    e.when = (unsigned long)time(NULL);
+    e.seconds = (int)(e.when - session->entry_time);
+    e.sabotages = session->sabotages;
+    rank = leaderboard_record(room, &e);
+    analytics_count(session_room(session), AN_SOLVED, 1);
+
+    log_event(LOG_INFO, "%d ha risolto la room %d in %ds, posizione in classifica: %ld",
+        session->sd, session->room, e.seconds, rank);
+
+    buffer[0] = '\0';
+    if (rank != -1) {
+        sprintf(buffer, "\n Tempo impiegato: %d:%02d, la tua posizione in classifica è %ld su %ld.",
+            e.seconds / 60, e.seconds % 60, rank, leaderboard_size(get_leaderboard(room)));
+    }
+    make_fragment(&result, buffer);
+
+    /* *room* appartiene al catalogo, che può essere liberato da leave_room(...) */
+    publish(room, session, &g_messages[MSG_SOLVED], &result);
+    leave_room(session);
+    return write_reply(session, SERVER, &g_messages[MSG_SOLVED], &result);
+}
+
+/**
+ * Ritorna il testo già codificato della risposta descritta da *out*,
+ *  oppure *fallback* se la transizione non ne prevede uno.
+ */
+static const struct fragment* outcome_text(struct room *room, struct outcome *out, const struct fragment *fallback) {
+    if (out->message == NULL) {
+        return fallback;
+    }
+    if (out->guard != -1) {
+        return &room->fail_frags[out->guard];
+    }
+    return &room->message_frags[out->transition];
+}
+
+/**
+ * Dialogo per l'enigma posto dalla transizione session->dialogue.transition
+ *  sull'oggetto session->dialogue.object: una risposta giusta può portare
+ *  ad un altro enigma, e allora il dialogo continua, una sbagliata lo chiude.
+ * Finisce anche se il client esce dalla room (vedi leave_room(...)).
+ */
+static int object_question(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    struct dialogue *d = &session->dialogue;
+    struct room *r = session_room(session);
+    struct outcome out;
+    int ret = 0, tokens;
+
+    CO_BEGIN(d->pc);
+    while (1) {
+        CO_YIELD(d->pc, send_text_without_info(QUESTION, &r->message_frags[d->transition], session));
+
+        if (strcmp(argv[0], r->puzzle.transitions[d->transition].answer) != 0) {
+            analytics_answer(r, d->object, d->transition, 0);
+            log_event(LOG_INFO, "%d ha risposto in modo errato ad un enigma", session->sd);
+            ret = send_text_without_info(SERVER, &g_messages[MSG_WRONG_ANSWER], session);
+            break;
+        }
+        analytics_answer(r, d->object, d->transition, 1);
+        log_event(LOG_INFO, "%d ha risposto correttamente ad un enigma", session->sd);
+
+        tokens = session->game.n_tokens;
+        fire_event(&r->puzzle, &session->game, d->object, EV_ANSWER, TARGET_NONE, &out);
+        count_tokens(session, tokens);
+        if (!out.asked) {
+            if (all_tokens_collected(session)) {
+                ret = send_solved(session);
+            }
+            else {
+                ret = send_text_without_info(SERVER, outcome_text(r, &out, &g_messages[MSG_RIGHT_ANSWER]), session);
+            }
+            break;
+        }
+        d->transition = out.transition;
+    }
+    CO_END(d->pc);
+    return ret;
+}
+
+/**
+ * Pone al client l'enigma della transizione eseguita in *out* sull'oggetto
+ *  *object*, la risposta verrà gestita da object_question(...).
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int send_question(struct session *session, int object, struct outcome *out) {
+    session->dialogue.object = object;
+    session->dialogue.transition = out->transition;
+    return begin_dialogue(session, object_question);
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando TAKE e dei suoi argomenti.
+ * Ritorna -1 in caso di errore.
+ */
+static int take_command(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    struct room *room;
+    int object, tokens;
+    struct object_status *os;
+    struct outcome out;
+
+    if (session->room == -1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_NOT_PLAYING], session);
+    }
+
+    if (argc < 1) {
+        return send_text(&g_messages[MSG_MISSING_PARAMETER], session);
+    }
+
+    room = session_room(session);
+    object = get_object(room, argv[0]);
+    if (object == -1) {
+        return send_text(&g_messages[MSG_NO_SUCH_OBJECT], session);
+    }
+
+    os = get_status(session, object);
+    if (os->in_inventory) {
+        return send_text(&g_messages[MSG_ALREADY_HELD], session);
+    }
+
+    if (session->game.n_objects == OBJECTS_PER_PLAYER_MAX) {
+        return send_text(&g_messages[MSG_HANDS_FULL], session);
+    }
+
+    /* Cosa succede dipende solo dallo stato dell'oggetto, vedi lib/server/puzzle.h */
+    tokens = session->game.n_tokens;
+    fire_event(&room->puzzle, &session->game, object, EV_TAKE, TARGET_NONE, &out);
+    count_tokens(session, tokens);
+    if (os->in_inventory) {
+        analytics_count(room, AN_TAKES, 1);
+    }
+    if (out.asked) {
+        return send_question(session, object, &out);
+    }
+    if (all_tokens_collected(session)) {
+        return send_solved(session);
+    }
+
+    return send_text(outcome_text(room, &out, &g_messages[MSG_LOCKED]), session);
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando USE e dei suoi argomenti.
+ * Ritorna -1 in caso di errore.
+ */
+static int use_command(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    struct room *room;
+    int object, target, tokens, state;
+    struct outcome out;
+
+    if (session->room == -1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_NOT_PLAYING], session);
+    }
+
+    if (argc < 1) {
+        return send_text(&g_messages[MSG_MISSING_PARAMETER], session);
+    }
+    
+    room = session_room(session);
+    object = get_object(room, argv[0]);
+    if (object == -1) {
+        return send_text(&g_messages[MSG_NO_SUCH_FIRST_OBJECT], session);
+    }
+
+    /* Il secondo oggetto è il bersaglio, se non esiste decide la transizione cosa rispondere */
+    if (argc < 2) {
+        target = TARGET_NONE;
+    }
+    else if ((target = get_object(room, argv[1])) == -1) {
+        target = TARGET_UNKNOWN;
+    }
+
+    tokens = session->game.n_tokens;
+    state = get_status(session, object)->state;
+    fire_event(&room->puzzle, &session->game, object, EV_USE, target, &out);
+    count_tokens(session, tokens);
+
+    /*
+     * Per le statistiche, gli oggetti posati senza essere serviti a nulla:
+     *  le transizioni che rispondono soltanto (ad esempio "Non sembra fare
+     *  nulla.") non contano come uso.
+     */
+    if (out.transition != -1 &&
+        (room->puzzle.transitions[out.transition].n_effects > 0 ||
+         get_status(session, object)->state != state)) {
+        get_status(session, object)->used = 1;
+        if (target >= 0) {
+            get_status(session, target)->used = 1;
+        }
+    }
+    if (out.asked) {
+        return send_question(session, object, &out);
+    }
+    if (all_tokens_collected(session)) {
+        return send_solved(session);
+    }
+
+    return send_text(outcome_text(room, &out, &g_messages[MSG_NOTHING_HAPPENS]), session);
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando OBJS e dei suoi argomenti.
+ * Ritorna -1 in caso di errore.
+ */
+static int objs_command(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    char buffer[IO_BUFFER_SIZE];
+    struct room *room;
+    int i, held = 0;
+
+    if (session->room == -1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_NOT_PLAYING], session);
+    }
+
+    if (session->game.n_objects == 0) {
+        return send_text(&g_messages[MSG_NO_OBJECTS], session);
+    }
+
+    room = session_room(session);
+    strcpy(buffer, "");
+    for (i = 0; i < room->tot_objects && held < session->game.n_objects; i++) {
+        if (session->game.objects[i].in_inventory) {
+            strcat(buffer, room->object_names[i]);
+            strcat(buffer, "\n ");
+            held++;
+        }
+    }
+    /* Rimuove l'ultimo '\\n ' */
+    buffer[strlen(buffer) - 2] = '\0';
+
+    return send_string(buffer, session);
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando DROP e dei suoi argomenti.
+ * Ritorna -1 in caso di errore.
+ */
+static int drop_command(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    const struct fragment *text;
+    int object;
+    struct object_status *os;
+
+    if (session->room == -1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_NOT_PLAYING], session);
+    }
+
+    if (argc < 1) {
+        return send_text(&g_messages[MSG_MISSING_PARAMETER], session);
+    }
+
+    object = get_object(session_room(session), argv[0]);
+    if (object == -1) {
+        return send_text(&g_messages[MSG_NO_SUCH_OBJECT], session);
+    }
+
+    os = get_status(session, object);
+    if (!os->in_inventory) {
+        text = &g_messages[MSG_NOT_HELD];
+    }
+    else {
+        os->in_inventory = 0;
+        session->game.n_objects--;
+        text = &g_messages[MSG_DROPPED];
+        analytics_count(session_room(session), AN_DROPS, 1);
+        if (!os->used) {
+            analytics_count(session_room(session), AN_USELESS_DROPS, 1);
+        }
+        os->used = 0;
+    }
+
+    return send_text(text, session);
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando RANK e dei suoi argomenti: senza argomenti riguarda
+ *  la room in cui il client sta giocando.
+ * Ritorna -1 in caso di errore.
+ */
+static int rank_command(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    char buffer[IO_BUFFER_SIZE - STATUS_LENGTH_MAX];
+    char line[CREDENTIALS_LENGTH_MAX + 64];
+    const struct lb_entry *top[LEADERBOARD_TOP];
+    const struct lb_entry *best;
+    struct leaderboard *lb;
+    const char *room;
+    int i, n, len;
+    long rank;
+
+    if (argc >= 1) {
+        int r = engine_parse_room(argv[0]);
+        if (r == -1) {
+            return send_text_without_info(SERVER, &g_messages[MSG_NO_SUCH_ROOM], session);
+        }
+        room = g_catalogue->rooms[r].name;
+    }
+    else if (session->room != -1) {
+        room = session_room(session)->name;
+    }
+    else {
+        return send_text_without_info(SERVER, &g_messages[MSG_MISSING_PARAMETER], session);
+    }
+
+    lb = get_leaderboard(room);
+    if (lb == NULL) {
+        sprintf(buffer, "Nessuno ha ancora risolto la room %.64s.", room);
+    }
+    else {
+        sprintf(buffer, "Classifica della room %.64s, giocatori: %ld", room, leaderboard_size(lb));
+        len = strlen(buffer);
+
+        /* Le righe che non entrano nel messaggio vengono tralasciate */
+        n = leaderboard_top(lb, LEADERBOARD_TOP, top);
+        for (i = 0; i < n; i++) {
+            sprintf(line, "\n  %d) %s %d:%02d (sabotaggi: %d)", i + 1, top[i]->username,
+                top[i]->seconds / 60, top[i]->seconds % 60, top[i]->sabotages);
+            if (len + strlen(line) + sizeof(line) >= sizeof(buffer)) {
+                break;
+            }
+            strcpy(buffer + len, line);
+            len += strlen(line);
+        }
+
+        rank = leaderboard_rank(lb, session->username, &best);
+        if (rank == 0) {
+            strcpy(line, "\n Non hai ancora risolto questa room.");
+        }
+        else {
+            sprintf(line, "\n La tua posizione: %ld (%d:%02d)", rank, best->seconds / 60, best->seconds % 60);
+        }
+        strcpy(buffer + len, line);
+    }
+
+    if (session->room == -1) {
+        struct fragment text;
+        make_fragment(&text, buffer);
+        return send_text_without_info(SERVER, &text, session);
+    }
+    return send_string(buffer, session);
+}
+
+/**
+ * Gestisce ricezione, interpretazione e risposta al client
+ *  del comando HINT: la prossima mossa di un percorso più breve
+ *  verso la vittoria, letta dalla tabella dei suggerimenti della room.
+ * Ritorna -1 in caso di errore.
+ */
+static int hint_command(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    char buffer[MOVE_STR_MAX + 128];
+    struct room *room;
+    int move, dist;
+
+    if (session->room == -1) {
+        return send_text_without_info(SERVER, &g_messages[MSG_NOT_PLAYING], session);
+    }
+
+    room = session_room(session);
+    if (room->hints == NULL ||
+        (move = hints_lookup(room->hints, room, &session->game, &dist)) == HINT_UNKNOWN) {
+        return send_text(&g_messages[MSG_NO_HINTS], session);
+    }
+    analytics_count(room, AN_HINTS, 1);
+    if (move == HINT_DEAD_END) {
+        return send_text(&g_messages[MSG_DEAD_END], session);
+    }
+
+    /* La risposta agli enigmi non viene mai rivelata */
+    strcpy(buffer, "Prova con: ");
+    move_to_str(room, move, buffer + strlen(buffer));
+    if (move & MOVE_ANSWERED) {
+        strcat(buffer, ", e rispondi bene all'enigma");
+    }
+    sprintf(buffer + strlen(buffer), dist == 1 ? " (manca una mossa)" : " (mancano %d mosse)", dist);
+
+    return send_string(buffer, session);
+}
+
+/**
+ * Gestisce la ricezione delle risposte del client alle domande,
+ *  riprendendo il dialogo in corso (vedi struct dialogue).
+ * Ritorna -1 in caso di errore, 0 altrimenti
+ */
+static int handle_answers(struct session *session, int argc, char *argv[ARGC_MAX]) {
+    if (argc <= 0 || session->dialogue.resume == NULL) {
+        log_event(LOG_INFO, "%d ha inviato una risposta senza che ci fosse una domanda", session->sd);
+        return -1;
+    }
+    return run_dialogue(session, argc, argv);
+}
+
+void engine_init(engine_sink sink, void *ctx) {
+    g_sink = sink;
+    g_sink_ctx = ctx;
+}
+
+int engine_command(struct session *session, enum ACTION action, int argc, char *argv[ARGC_MAX]) {
+    int ret = 0, i;
+
+    /* Il comando viene ricordato (troncato) per mostrarlo agli spettatori ed nel log */
+    strcpy(session->command, action_to_str[action]);
+    for (i = 0; i < argc; i++) {
+        int len = strlen(session->command);
+        if (len + 1 < COMMAND_LENGTH_MAX) {
+            session->command[len] = ' ';
+            strncpy(session->command + len + 1, argv[i], COMMAND_LENGTH_MAX - len - 2);
+            session->command[COMMAND_LENGTH_MAX - 1] = '\0';
+        }
+    }
+    log_event(LOG_DEBUG, "%d ha inviato il comando %s", session->sd, session->command);
+
+    if (action == ANSWER) {
+        return handle_answers(session, argc, argv);
+    }
+
+    /**
+     * Se il client è già in gioco, ed il comando che invia non è START, 
+     *  controlla se ha finito il tempo, in tal caso notifica il client
+     *  che ha perso e termina la partita (engine_check_timers(...) se ne
+     *  accorge entro un secondo, ma il comando può arrivare prima).
+     */
+    if (action != START && session->room != -1) {
+        int elapsed_time = (int)difftime(time(NULL), session->start_time);
+        if (elapsed_time > session_room(session)->time_limit * 60) {
+            time_over(session);
+            return send_text_without_info(SERVER, &g_messages[MSG_TIME_OVER], session);
+        }
+    }
+
+    /**
+     * A questo punto *action* contiene il comando scritto da client e
+     *  *argc* il numero di argomenti per il comando (memorizzati in *argv).
+     */
+    switch (action) {
+        case START:
+            ret = start_command(session, argc, argv);
+            break;
+        case LOOK:
+            ret = look_command(session, argc, argv);
+            break;
+        case TAKE:
+            ret = take_command(session, argc, argv);
+            break;
+        case USE:
+            ret = use_command(session, argc, argv);
+            break;
+        case OBJS:
+            ret = objs_command(session, argc, argv);
+            break;
+        case DROP:
+            ret = drop_command(session, argc, argv);
+            break;
+        case RANK:
+            ret = rank_command(session, argc, argv);
+            break;
+        case HINT:
+            ret = hint_command(session, argc, argv);
+            break;
+        default:    /* SPECTATE ed END riguardano la connessione, non il gioco */
+            break;
+    }
+
+    #ifdef MDEBUG
+    if (action != START && session->room != -1) {
+        printf("\t#Stato degli oggetti del giocatore %d\n", session->sd);
+        for (i = 0; i < session_room(session)->tot_objects; i++) {
+            printf("\t%-15s in_inventory: %d state: %s\n", session_room(session)->object_names[i], session->game.objects[i].in_inventory, session_room(session)->puzzle.state_names[session->game.objects[i].state]);
+        }
+    }
+    #endif
+
+    return ret;
+}
@@ -0,0 +1,153 @@
+#ifndef LIB_SERVER_ENGINE_H
+#define LIB_SERVER_ENGINE_H
+
+#include "../protocol.h"
+#include "session.h"
+
+/* Spazio per il riepilogo di tempo e token aggiunto alle risposte di chi gioca */
+#define STATUS_LENGTH_MAX 128
+
+/* Secondi prima della fine del tempo in cui il giocatore viene avvisato */
+#define NOTIFY_WARNING_SECONDS 60
+
+/* Nessun controllo dei tempi in programma, vedi engine_check_timers(...) */
+#define NO_TIMER ((unsigned long)-1)
+
+/**
+ * Motore di gioco.
+ *
+ * Esegue i comandi già decodificati dei giocatori sulle loro sessioni
+ *  e non sa nulla di socket: tutto quello che produce (risposte,
+ *  notifiche, eventi per gli spettatori) arriva a chi lo usa come una
+ *  sequenza di struct engine_event, passate una alla volta alla funzione
+ *  registrata con engine_init(...). Il server le traduce in messaggi
+ *  sui socket, un benchmark può limitarsi a contarle.
+ * I testi degli eventi restano validi solo durante la chiamata.
+ */
+
+enum ENGINE_EVENT {
+    ENGINE_REPLY,       /* Risposta al comando di *session*, con azione *action* */
+    ENGINE_MANIFEST,    /* Manifesto della room in cui *session* ha iniziato a giocare */
+    ENGINE_PUBLISH,     /* Evento per gli spettatori di *room*, causato dal comando di *session* */
+    ENGINE_NOTIFY,      /* Notifica per *session*, che non l'ha chiesta */
+    ENGINE_TIME_OVER,   /* *session* ha esaurito il tempo (nessun testo) */
+
+    /**
+     * Un altro giocatore ha risposto alla domanda per entrare nella room
+     *  di *session*, il cui tempo cambia di *delta* secondi; *text* è la
+     *  notifica per lei. Chi usa il motore lo applica con
+     *  engine_sabotage(...), subito o quando *session* non ha altri
+     *  comandi in corso.
+     */
+    ENGINE_SABOTAGE
+};
+
+struct engine_event {
+    enum ENGINE_EVENT kind;
+    struct session *session;
+    enum ACTION action;
+    const char *room;                   /* Solo per ENGINE_PUBLISH ed ENGINE_SABOTAGE */
+    const struct fragment *text;
+    const struct fragment *suffix;      /* Può essere NULL */
+    long delta;                         /* Solo per ENGINE_SABOTAGE */
+};
+
+/**
+ * Riceve gli eventi del motore, *ctx* è quello passato ad engine_init(...).
+ * Ritorna -1 se l'evento non può essere consegnato: per ENGINE_REPLY e
+ *  ENGINE_MANIFEST il comando in corso fallisce, per gli altri non conta.
+ */
+typedef int (*engine_sink)(void *ctx, const struct engine_event *ev);
+
+/**
+ * Risposte fisse del motore. Sono codificate a tempo di compilazione
+ *  (vedi struct fragment), come i testi delle room lo sono al caricamento.
+ */
+enum MESSAGE {
+    MSG_NOT_PLAYING,
+    MSG_MISSING_PARAMETER,
+    MSG_NO_SUCH_ROOM,
+    MSG_ALREADY_IN_ROOM,
+    MSG_ROOM_TAKEN,
+    MSG_NO_SUCH_NAME,
+    MSG_SOLVED,
+    MSG_NO_SUCH_OBJECT,
+    MSG_NO_SUCH_FIRST_OBJECT,
+    MSG_ALREADY_HELD,
+    MSG_HANDS_FULL,
+    MSG_LOCKED,
+    MSG_NOTHING_HAPPENS,
+    MSG_NO_OBJECTS,
+    MSG_NOT_HELD,
+    MSG_DROPPED,
+    MSG_PLAYER_LEFT,
+    MSG_RIGHT_ANSWER,
+    MSG_WRONG_ANSWER,
+    MSG_TIME_OVER,
+    MSG_SPECTATE_STOPPED,
+    MSG_SPECTATE_PLAYING,
+    MSG_TIME_WARNING,
+    MSG_NO_HINTS,
+    MSG_DEAD_END
+};
+
+extern const struct fragment g_messages[];
+
+/**
+ * Istante (Unix timestamp) del prossimo controllo dei tempi dei giocatori,
+ *  va azzerato quando cambia il tempo di qualcuno
+ *  o quando una sessione viene staccata o ripresa.
+ */
+extern unsigned long g_next_timer;
+
+/* Registra la funzione *sink* che riceverà gli eventi del motore */
+void engine_init(engine_sink sink, void *ctx);
+
+/**
+ * Esegue il comando di gioco *action* (SPECTATE ed END esclusi) di
+ *  *session*, con gli *argc* argomenti in *argv*; le risposte vengono
+ *  consegnate come eventi. Il comando viene anche ricordato in
+ *  session->command, per gli spettatori.
+ * Ritorna -1 se il comando non può essere eseguito e la sessione
+ *  va chiusa, 0 altrimenti.
+ */
+int engine_command(struct session *session, enum ACTION action, int argc, char *argv[ARGC_MAX]);
+
+/**
+ * Avvisa i giocatori a cui mancano meno di NOTIFY_WARNING_SECONDS secondi
+ *  e termina (notificandolo) la partita di chi ha esaurito il tempo.
+ * Ritorna l'istante in cui serve il prossimo controllo, NO_TIMER se nessuno gioca.
+ */
+unsigned long engine_check_timers(unsigned long now);
+
+/**
+ * Sposta di *delta* secondi il tempo di *session* e le invia la notifica
+ *  *text*, se sta ancora giocando nella room di nome *room* (vedi ENGINE_SABOTAGE).
+ */
+void engine_sabotage(struct session *session, const char *room, long delta, const struct fragment *text);
+
+/**
+ * Consegna il manifesto della room in cui *session* sta giocando,
+ *  se la room ne ha uno.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+int engine_send_manifest(struct session *session);
+
+/**
+ * Risponde a *session* con *text* come farebbe il motore, per i comandi
+ *  gestiti da chi lo usa: se *session* sta giocando la risposta viene
+ *  pubblicata per gli spettatori e porta con sé l'inventario.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+int engine_reply(struct session *session, enum ACTION action, const struct fragment *text);
+
+/* Secondi rimasti a *session* (che deve essere in gioco) per risolvere la room */
+unsigned long engine_remaining_time(struct session *session);
+
+/**
+ * Ritorna l'indice della room di numero *str* nella versione
+ *  corrente del catalogo, -1 se non esiste.
+ */
+int engine_parse_room(const char *str);
+
+#endif
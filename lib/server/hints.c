@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hints.h"
+
+/* Archi della visita in avanti, servono solo durante la costruzione */
+struct edges {
+    unsigned int *from, *to;
+    int *moves;
+    long n, capacity;
+};
+
+/* Slot di *words* in *h*: quello che lo contiene o quello vuoto dove andrebbe */
+static long find_slot(const struct hints *h, const uint64_t *words) {
+    size_t size = sizeof(uint64_t) * h->lay.words;
+    long slot = (long)(state_hash(words, h->lay.words) & (h->table_size - 1));
+
+    while (h->table[slot] != 0 &&
+        memcmp(&h->states[(long)(h->table[slot] - 1) * h->lay.words], words, size) != 0) {
+        slot = (slot + 1) & (h->table_size - 1);
+    }
+    return slot;
+}
+
+/* Raddoppia la tabella hash, reinserendo tutti gli stati */
+static int rehash(struct hints *h) {
+    long size = h->table_size == 0 ? 64 : 2 * h->table_size, i;
+    unsigned int *table = calloc(size, sizeof(unsigned int));
+
+    if (table == NULL) {
+        return -1;
+    }
+    free(h->table);
+    h->table = table;
+    h->table_size = size;
+    for (i = 0; i < h->n_states; i++) {
+        h->table[find_slot(h, &h->states[i * h->lay.words])] = i + 1;
+    }
+    return 0;
+}
+
+/**
+ * Ritorna la posizione di *words* in *h*, aggiungendolo se è uno stato
+ *  nuovo. Ritorna -1 se la memoria è esaurita o gli stati sono troppi.
+ */
+static long add_state(struct hints *h, const uint64_t *words, long *capacity, long states_max) {
+    long slot;
+
+    if (h->n_states * 2 >= h->table_size && rehash(h) == -1) {
+        return -1;
+    }
+    slot = find_slot(h, words);
+    if (h->table[slot] != 0) {
+        return h->table[slot] - 1;
+    }
+    if (h->n_states >= states_max) {
+        return -1;
+    }
+
+    if (h->n_states == *capacity) {
+        long cap = *capacity == 0 ? 64 : 2 * *capacity;
+        uint64_t *states = realloc(h->states, sizeof(uint64_t) * h->lay.words * cap);
+
+        if (states == NULL) {
+            return -1;
+        }
+        h->states = states;
+        *capacity = cap;
+    }
+    memcpy(&h->states[h->n_states * h->lay.words], words, sizeof(uint64_t) * h->lay.words);
+    h->table[slot] = h->n_states + 1;
+    return h->n_states++;
+}
+
+static int add_edge(struct edges *e, long from, long to, int move) {
+    if (e->n == e->capacity) {
+        long cap = e->capacity == 0 ? 256 : 2 * e->capacity;
+        unsigned int *f = realloc(e->from, sizeof(unsigned int) * cap);
+        unsigned int *t = f == NULL ? NULL : realloc(e->to, sizeof(unsigned int) * cap);
+        int *m = t == NULL ? NULL : realloc(e->moves, sizeof(int) * cap);
+
+        if (f != NULL) e->from = f;
+        if (t != NULL) e->to = t;
+        if (m == NULL) {
+            return -1;
+        }
+        e->moves = m;
+        e->capacity = cap;
+    }
+    e->from[e->n] = (unsigned int)from;
+    e->to[e->n] = (unsigned int)to;
+    e->moves[e->n] = move;
+    e->n++;
+    return 0;
+}
+
+/* Visita in ampiezza dallo stato iniziale: gli stati vanno in *h*, le mosse in *e* */
+static int explore(struct hints *h, const struct room *r, struct edges *e, long states_max) {
+    struct player_state cur, next;
+    uint64_t succ[HINTS_WORDS_MAX];
+    long capacity = 0, head, id;
+    int n = r->tot_objects, obj, k, ret = 0;
+
+    cur.objects = malloc(sizeof(struct object_status) * (n + 1));
+    next.objects = malloc(sizeof(struct object_status) * (n + 1));
+    if (cur.objects == NULL || next.objects == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        reset_player(&r->puzzle, n, &cur);
+        state_encode(&h->lay, r, &cur, succ);
+        ret = add_state(h, succ, &capacity, states_max) == -1 ? -1 : 0;
+    }
+
+    /* Gli stati sono nell'ordine in cui sono stati scoperti, che è quello della visita */
+    for (head = 0; ret == 0 && head < h->n_states; head++) {
+        if (state_is_win(&h->lay, r, &h->states[head * h->lay.words])) {
+            continue;
+        }
+        state_decode(&h->lay, r, &h->states[head * h->lay.words], &cur);
+
+        /* Le stesse mosse del risolutore, vedi expand(...) in solver.c */
+        for (obj = 0; obj < n && ret == 0; obj++) {
+            for (k = -2; k < n + 2 && ret == 0; k++) {
+                int move, applied;
+
+                if (k == -2) move = MOVE(MOVE_TAKE, obj, 0);
+                else if (k == -1) move = MOVE(MOVE_DROP, obj, 0);
+                else move = MOVE(MOVE_USE, obj, k - 2);
+
+                do {
+                    next.n_objects = cur.n_objects;
+                    next.n_tokens = cur.n_tokens;
+                    memcpy(next.objects, cur.objects, sizeof(struct object_status) * n);
+
+                    applied = apply_move(r, &next, move, NULL);
+                    if (applied != 0) {
+                        state_encode(&h->lay, r, &next, succ);
+                        if (memcmp(succ, &h->states[head * h->lay.words], sizeof(uint64_t) * h->lay.words) != 0) {
+                            id = add_state(h, succ, &capacity, states_max);
+                            if (id == -1 || add_edge(e, head, id, move) == -1) {
+                                ret = -1;
+                            }
+                        }
+                    }
+                    move |= MOVE_ANSWERED;
+                } while (applied == 2 && ret == 0);
+            }
+        }
+    }
+
+    free(cur.objects);
+    free(next.objects);
+    return ret;
+}
+
+/**
+ * Visita all'indietro dalle vittorie: ogni stato riceve la distanza dalla
+ *  vittoria più vicina e la mossa dell'arco con cui è stato raggiunto.
+ */
+static int assign_moves(struct hints *h, const struct room *r, const struct edges *e) {
+    long *first, *queue, head = 0, tail = 0, i, j;
+    unsigned int *sources;
+    int *moves;
+
+    first = calloc(h->n_states + 1, sizeof(long));
+    queue = malloc(sizeof(long) * (h->n_states + 1));
+    sources = malloc(sizeof(unsigned int) * (e->n + 1));
+    moves = malloc(sizeof(int) * (e->n + 1));
+    h->moves = malloc(sizeof(int) * (h->n_states + 1));
+    h->dists = malloc(sizeof(int) * (h->n_states + 1));
+    if (first == NULL || queue == NULL || sources == NULL || moves == NULL ||
+        h->moves == NULL || h->dists == NULL) {
+        free(first);
+        free(queue);
+        free(sources);
+        free(moves);
+        return -1;
+    }
+
+    /* Archi inversi in formato CSR: i padri di ogni figlio, con la mossa */
+    for (i = 0; i < e->n; i++) {
+        first[e->to[i] + 1]++;
+    }
+    for (i = 0; i < h->n_states; i++) {
+        first[i + 1] += first[i];
+    }
+    for (i = 0; i < e->n; i++) {
+        long pos = first[e->to[i]]++;
+        sources[pos] = e->from[i];
+        moves[pos] = e->moves[i];
+    }
+    /* Il riempimento ha spostato ogni inizio su quello successivo */
+    for (i = h->n_states; i > 0; i--) {
+        first[i] = first[i - 1];
+    }
+    first[0] = 0;
+
+    for (i = 0; i < h->n_states; i++) {
+        h->moves[i] = HINT_DEAD_END;
+        h->dists[i] = -1;
+        if (state_is_win(&h->lay, r, &h->states[i * h->lay.words])) {
+            h->dists[i] = 0;
+            queue[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        long child = queue[head++];
+        for (j = first[child]; j < first[child + 1]; j++) {
+            long parent = sources[j];
+            if (h->dists[parent] == -1) {
+                h->dists[parent] = h->dists[child] + 1;
+                h->moves[parent] = moves[j];
+                queue[tail++] = parent;
+            }
+        }
+    }
+
+    free(first);
+    free(queue);
+    free(sources);
+    free(moves);
+    return 0;
+}
+
+struct hints* hints_build(const struct room *r, long states_max) {
+    struct hints *h;
+    struct edges e;
+    int ret;
+
+    if (r->tot_objects > OBJECTS_MAX) {
+        return NULL;
+    }
+    h = calloc(1, sizeof(struct hints));
+    if (h == NULL) {
+        return NULL;
+    }
+    if (layout_init(&h->lay, r) == -1 || h->lay.words > HINTS_WORDS_MAX) {
+        hints_free(h);
+        return NULL;
+    }
+
+    memset(&e, 0, sizeof(e));
+    ret = explore(h, r, &e, states_max);
+    if (ret == 0) {
+        ret = assign_moves(h, r, &e);
+    }
+    free(e.from);
+    free(e.to);
+    free(e.moves);
+
+    if (ret == -1) {
+        hints_free(h);
+        return NULL;
+    }
+    return h;
+}
+
+int hints_lookup(const struct hints *h, const struct room *r, const struct player_state *ps, int *dist) {
+    uint64_t words[HINTS_WORDS_MAX];
+    long slot;
+
+    state_encode(&h->lay, r, ps, words);
+    slot = find_slot(h, words);
+    if (h->table[slot] == 0) {
+        return HINT_UNKNOWN;
+    }
+    *dist = h->dists[h->table[slot] - 1];
+    return h->moves[h->table[slot] - 1];
+}
+
+void hints_free(struct hints *h) {
+    if (h == NULL) {
+        return;
+    }
+    layout_free(&h->lay);
+    free(h->states);
+    free(h->moves);
+    free(h->dists);
+    free(h->table);
+    free(h);
+}
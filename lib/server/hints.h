@@ -0,0 +1,58 @@
+#ifndef LIB_SERVER_HINTS_H
+#define LIB_SERVER_HINTS_H
+
+#include "states.h"
+
+/* Oltre questo numero di stati raggiungibili la room non ha suggerimenti */
+#define HINTS_STATES_MAX (1L << 20)
+
+/* Parole di uno stato compatto (vedi struct layout) oltre cui la room non ha suggerimenti */
+#define HINTS_WORDS_MAX 16
+
+/* Risultati di hints_lookup(...) che non sono una mossa */
+#define HINT_DEAD_END -1    /* Dallo stato non si può più vincere */
+#define HINT_UNKNOWN -2     /* Lo stato non è nella tabella */
+
+/**
+ * Tabella dei suggerimenti di una room (comando HINT).
+ *
+ * Viene costruita al caricamento del catalogo: una visita in ampiezza
+ *  dallo stato iniziale trova tutti gli stati compatti raggiungibili
+ *  (vedi lib/server/states.h), una seconda visita all'indietro dalle
+ *  vittorie assegna ad ogni stato la distanza dalla vittoria più vicina
+ *  e la prima mossa di un percorso più breve. Gli archi servono solo
+ *  durante la costruzione: restano gli stati, in una tabella hash ad
+ *  indirizzamento aperto, con la loro mossa e la loro distanza.
+ * Durante il gioco un suggerimento costa la codifica dello stato della
+ *  sessione ed una ricerca nella tabella, che è di sola lettura e può
+ *  essere consultata da più thread.
+ */
+struct hints {
+    struct layout lay;
+    long n_states;
+    uint64_t *states;       /* lay.words parole per stato */
+    int *moves;             /* Prossima mossa, HINT_DEAD_END per vittorie e vicoli ciechi */
+    int *dists;             /* Mosse che mancano alla vittoria, -1 per i vicoli ciechi */
+
+    unsigned int *table;    /* Posizione + 1 degli stati, 0 se vuoto */
+    long table_size;
+};
+
+/**
+ * Costruisce la tabella dei suggerimenti di *r*.
+ * Ritorna NULL se la memoria è esaurita o se gli stati raggiungibili
+ *  sono più di *states_max*.
+ */
+struct hints* hints_build(const struct room *r, long states_max);
+
+/**
+ * Ritorna la prossima mossa per raccogliere tutti i token dallo stato *ps*,
+ *  e ne scrive in *dist* il numero di mosse che mancano, oppure
+ *  HINT_DEAD_END o HINT_UNKNOWN.
+ */
+int hints_lookup(const struct hints *h, const struct room *r, const struct player_state *ps, int *dist);
+
+/* Libera *h*, se è NULL non fa nulla */
+void hints_free(struct hints *h);
+
+#endif
@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "journal.h"
+#include "../mystdlib.h"
+
+static int g_fd = -1;
+static char g_buffers[2][JOURNAL_BUFFER_SIZE];
+static char *g_buffer = g_buffers[0];   /* Buffer in cui vengono aggiunti i record */
+static int g_used = 0;
+static time_t g_oldest;     /* Ricezione del primo record non ancora scritto */
+
+/**
+ * L'altro buffer, pieno, viene scritto nel file dal thread: il server lo
+ *  consegna in g_full (con i suoi g_full_used byte) e continua a registrare
+ *  nel primo, fermandosi solo se deve consegnarne un altro prima che il
+ *  thread abbia finito. Entrambi sono protetti da g_lock.
+ */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static char *g_full = NULL;
+static int g_full_used = 0;
+static int g_stop = 0;
+static int g_failed = 0;    /* Scrittura fallita, non si registra più nulla */
+static pthread_t g_thread;
+
+/* Scrive un intero a *bytes* byte in big endian */
+static void put_be(char *dst, unsigned long value, int bytes) {
+    int i;
+    for (i = bytes - 1; i >= 0; i--) {
+        dst[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+/**
+ * Scrive i *used* byte di *buffer* nel file, se non ci riesce smette di
+ *  registrare. Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+static int write_buffer(const char *buffer, int used) {
+    int done = 0;
+
+    while (done < used) {
+        int n = write(g_fd, buffer + done, used - done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            printf(ANSI_COLOR_YELLOW "[Warning]: impossibile scrivere il journal, "
+                "la registrazione dei comandi viene interrotta\n" ANSI_COLOR_RESET);
+            __atomic_store_n(&g_failed, 1, __ATOMIC_RELEASE);
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/* Corpo del thread: scrive i buffer consegnati finché il server non termina */
+static void* writer(void *arg) {
+    int failed = 0;
+    (void)arg;
+
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        const char *buffer;
+        int used;
+
+        while (g_full == NULL && !g_stop) {
+            pthread_cond_wait(&g_cond, &g_lock);
+        }
+        if (g_full == NULL) {
+            break;
+        }
+        buffer = g_full;
+        used = g_full_used;
+        pthread_mutex_unlock(&g_lock);
+
+        if (!failed) {
+            failed = write_buffer(buffer, used) == -1;
+        }
+
+        pthread_mutex_lock(&g_lock);
+        g_full = NULL;
+        pthread_cond_broadcast(&g_cond);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+/**
+ * Consegna al thread il buffer corrente e passa all'altro. Se il thread
+ *  sta ancora scrivendo il precedente lo aspetta, a meno che *wait* sia
+ *  falso: in quel caso non fa nulla e ritorna -1.
+ */
+static int hand_off(int wait) {
+    pthread_mutex_lock(&g_lock);
+    if (g_full != NULL && !wait) {
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+    while (g_full != NULL) {
+        pthread_cond_wait(&g_cond, &g_lock);
+    }
+    g_full = g_buffer;
+    g_full_used = g_used;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    g_buffer = g_buffer == g_buffers[0] ? g_buffers[1] : g_buffers[0];
+    g_used = 0;
+    return 0;
+}
+
+/* Consegna gli ultimi record e aspetta che il thread li abbia scritti */
+static void stop_writer(void) {
+    if (g_used > 0) {
+        hand_off(1);
+    }
+    pthread_mutex_lock(&g_lock);
+    g_stop = 1;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    pthread_join(g_thread, NULL);
+}
+
+int journal_open(const char *path) {
+    struct stat st;
+
+    g_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (g_fd == -1) {
+        return -1;
+    }
+
+    /* Un journal nuovo inizia con JOURNAL_MAGIC */
+    if ((fstat(g_fd, &st) == 0 && st.st_size == 0 && write_buffer(JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) == -1) ||
+        pthread_create(&g_thread, NULL, writer, NULL) != 0) {
+        close(g_fd);
+        g_fd = -1;
+        return -1;
+    }
+
+    atexit(stop_writer);
+    return 0;
+}
+
+/**
+ * Riserva in coda al buffer lo spazio per un record e ne scrive
+ *  l'intestazione, tranne la dimensione.
+ * Ritorna il puntatore al record.
+ */
+static char* begin_record(int sd) {
+    struct timeval tv;
+    char *record;
+
+    if (JOURNAL_BUFFER_SIZE - g_used < JOURNAL_HEADER_SIZE + IO_BUFFER_SIZE) {
+        hand_off(1);
+    }
+
+    gettimeofday(&tv, NULL);
+    if (g_used == 0) {
+        g_oldest = tv.tv_sec;
+    }
+
+    record = g_buffer + g_used;
+    put_be(record, (unsigned long)tv.tv_sec, 4);
+    put_be(record + 4, (unsigned long)tv.tv_usec, 4);
+    put_be(record + 8, (unsigned long)sd, 2);
+    return record;
+}
+
+void journal_record(int sd, enum ACTION action, int argc, char *argv[]) {
+    char *record;
+    int size;
+
+    if (g_fd == -1 || __atomic_load_n(&g_failed, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    /* Il messaggio viene ricodificato direttamente nel buffer */
+    record = begin_record(sd);
+    size = encode_message(record + JOURNAL_HEADER_SIZE, IO_BUFFER_SIZE, action, argc, argv);
+    if (size == -1) {
+        return;
+    }
+    put_be(record + 10, (unsigned long)size, 2);
+    g_used += JOURNAL_HEADER_SIZE + size;
+}
+
+void journal_close(int sd) {
+    char *record;
+
+    if (g_fd == -1 || __atomic_load_n(&g_failed, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    record = begin_record(sd);
+    put_be(record + 10, 0, 2);
+    g_used += JOURNAL_HEADER_SIZE;
+}
+
+int journal_pending(void) {
+    return g_fd != -1 && g_used > 0;
+}
+
+void journal_flush(int force) {
+    if (!journal_pending()) {
+        return;
+    }
+    if (force || time(NULL) - g_oldest >= JOURNAL_FLUSH_DELAY) {
+        hand_off(force);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef LIB_SERVER_JOURNAL_H
+#define LIB_SERVER_JOURNAL_H
+
+#include "../protocol.h"
+
+/* Primi byte di ogni journal, seguiti dai record */
+#define JOURNAL_MAGIC "ERJ1"
+#define JOURNAL_MAGIC_SIZE 4
+
+/* Secondi, microsecondi, socket descriptor e dimensione */
+#define JOURNAL_HEADER_SIZE 12
+
+/* I record vengono accumulati in memoria e scritti, da un thread, a blocchi di questa dimensione */
+#define JOURNAL_BUFFER_SIZE 65536
+
+/* Un record non resta in memoria (senza essere scritto) per più di tanti secondi */
+#define JOURNAL_FLUSH_DELAY 1
+
+/**
+ * Journal dei comandi ricevuti dal server.
+ *
+ * Un file binario in cui vengono aggiunti (in coda) tutti i messaggi
+ *  ricevuti dai client, login compresi, così che replay possa rigiocarli.
+ * Ogni record è formato da JOURNAL_HEADER_SIZE byte in big endian:
+ *  - 32 bit: secondi (Unix timestamp) della ricezione
+ *  - 32 bit: microsecondi della ricezione
+ *  - 16 bit: socket descriptor del client
+ *  - 16 bit: dimensione del messaggio
+ * seguiti dal messaggio codificato come in encode_message(...).
+ * Un record di dimensione 0 indica che la connessione è stata chiusa,
+ *  quindi il socket descriptor può essere riassegnato ad un altro client.
+ *
+ * Il file viene scritto da un thread separato, così che il server non
+ *  aspetti il disco; i record ancora in memoria vengono scritti all'uscita.
+ *
+ * Attenzione: il journal contiene anche le password usate nei login.
+ */
+
+/**
+ * Apre (o crea) il journal *path* e vi registrerà i prossimi messaggi.
+ * Ritorna -1 se il file non può essere aperto in scrittura, 0 altrimenti.
+ */
+int journal_open(const char *path);
+
+/* Registra il messaggio ricevuto da *sd*, se il journal è aperto */
+void journal_record(int sd, enum ACTION action, int argc, char *argv[]);
+
+/* Registra la chiusura della connessione con *sd*, se il journal è aperto */
+void journal_close(int sd);
+
+/* Vero se ci sono record non ancora consegnati al thread che scrive il file */
+int journal_pending(void);
+
+/**
+ * Consegna al thread i record in memoria se il più vecchio ha almeno
+ *  JOURNAL_FLUSH_DELAY secondi, a meno che il thread stia ancora scrivendo
+ *  i precedenti (verranno consegnati alla prossima chiamata). Se *force*
+ *  è vero li consegna sempre, aspettando il thread se necessario.
+ */
+void journal_flush(int force);
+
+#endif
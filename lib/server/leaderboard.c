@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "leaderboard.h"
+#include "../mystdlib.h"
+
+/**
+ * Con probabilità 1/4 di salire di livello, 16 livelli bastano
+ *  per qualche miliardo di risultati.
+ */
+#define LEVEL_MAX 16
+
+/* Lunghezza massima di una riga di LEADERBOARD_FILE */
+#define LEADERBOARD_LINE_MAX 1024
+
+struct link {
+    struct node *next;
+    long span;          /* Posizioni che si scavalcano seguendo *next* */
+};
+
+/* Un risultato in classifica, links ha *level* elementi */
+struct node {
+    struct lb_entry entry;
+    unsigned long seq;  /* Ordine di registrazione, rende unica la chiave */
+    int level;
+    struct link links[1];
+};
+
+struct leaderboard {
+    char *room;
+    struct node *head;  /* Sentinella con LEVEL_MAX collegamenti */
+    int level;          /* Livelli attualmente in uso */
+    long size;
+
+    /* Tabella hash (indirizzamento aperto) dal giocatore al suo risultato */
+    struct node **users;
+    long users_capacity;
+};
+
+static struct leaderboard **g_boards = NULL;
+static int g_n_boards = 0, g_boards_capacity = 0;
+
+static FILE *g_file = NULL;
+static unsigned long g_next_seq = 0;
+static unsigned long g_random = 2463534242UL;
+
+/* xorshift a 32 bit, basta per scegliere i livelli */
+static int random_level(void) {
+    int level = 1;
+
+    g_random ^= (g_random << 13) & 0xFFFFFFFFUL;
+    g_random ^= g_random >> 17;
+    g_random ^= (g_random << 5) & 0xFFFFFFFFUL;
+
+    while (level < LEVEL_MAX && ((g_random >> (2 * level)) & 3) == 0) {
+        level++;
+    }
+    return level;
+}
+
+/* Vero se *a* precede *b* in classifica */
+static int precedes(const struct node *a, const struct node *b) {
+    if (a->entry.seconds != b->entry.seconds) {
+        return a->entry.seconds < b->entry.seconds;
+    }
+    return a->seq < b->seq;
+}
+
+static struct node* new_node(int level) {
+    struct node *n = malloc(sizeof(struct node) + sizeof(struct link) * (level - 1));
+    if (n != NULL) {
+        memset(n, 0, sizeof(struct node) + sizeof(struct link) * (level - 1));
+        n->level = level;
+    }
+    return n;
+}
+
+/* FNV-1a */
+static unsigned long hash_name(const char *name) {
+    unsigned long h = 2166136261UL;
+    while (*name != '\0') {
+        h = ((h ^ (unsigned char)*name++) * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    return h;
+}
+
+/* Ritorna lo slot di *username* in lb->users, vuoto se non è in classifica */
+static struct node** user_slot(const struct leaderboard *lb, const char *username) {
+    long mask = lb->users_capacity - 1;
+    long i = hash_name(username) & mask;
+
+    while (lb->users[i] != NULL && strcmp(lb->users[i]->entry.username, username) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &lb->users[i];
+}
+
+/* Raddoppia la tabella dei giocatori, ritorna -1 se la memoria è esaurita */
+static int grow_users(struct leaderboard *lb) {
+    struct node **old = lb->users;
+    long old_capacity = lb->users_capacity, i;
+
+    lb->users_capacity = old_capacity == 0 ? 64 : 2 * old_capacity;
+    lb->users = calloc(lb->users_capacity, sizeof(struct node *));
+    if (lb->users == NULL) {
+        lb->users = old;
+        lb->users_capacity = old_capacity;
+        return -1;
+    }
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i] != NULL) {
+            *user_slot(lb, old[i]->entry.username) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/* Inserisce *n* nella skip list e ne ritorna la posizione */
+static long insert_node(struct leaderboard *lb, struct node *n) {
+    struct node *update[LEVEL_MAX];
+    long rank[LEVEL_MAX] = { 0 };
+    struct node *x = lb->head;
+    int i;
+
+    /**
+     * Per ogni livello cerca l'ultimo nodo che precede *n*, ricordando
+     *  in rank[i] la sua posizione (la sentinella ha posizione 0).
+     */
+    for (i = lb->level - 1; i >= 0; i--) {
+        rank[i] = i == lb->level - 1 ? 0 : rank[i + 1];
+        while (x->links[i].next != NULL && precedes(x->links[i].next, n)) {
+            rank[i] += x->links[i].span;
+            x = x->links[i].next;
+        }
+        update[i] = x;
+    }
+
+    if (n->level > lb->level) {
+        for (i = lb->level; i < n->level; i++) {
+            rank[i] = 0;
+            update[i] = lb->head;
+            update[i]->links[i].span = lb->size;
+        }
+        lb->level = n->level;
+    }
+
+    for (i = 0; i < n->level; i++) {
+        n->links[i].next = update[i]->links[i].next;
+        update[i]->links[i].next = n;
+        n->links[i].span = update[i]->links[i].span - (rank[0] - rank[i]);
+        update[i]->links[i].span = rank[0] - rank[i] + 1;
+    }
+    /* I collegamenti più alti ora scavalcano anche *n* */
+    for (i = n->level; i < lb->level; i++) {
+        update[i]->links[i].span++;
+    }
+
+    lb->size++;
+    return rank[0] + 1;
+}
+
+/* Toglie *n* dalla skip list (senza liberarlo) */
+static void remove_node(struct leaderboard *lb, struct node *n) {
+    struct node *x = lb->head;
+    int i;
+
+    for (i = lb->level - 1; i >= 0; i--) {
+        while (x->links[i].next != NULL && precedes(x->links[i].next, n)) {
+            x = x->links[i].next;
+        }
+        if (x->links[i].next == n) {
+            x->links[i].span += n->links[i].span - 1;
+            x->links[i].next = n->links[i].next;
+        }
+        else {
+            x->links[i].span--;
+        }
+    }
+
+    while (lb->level > 1 && lb->head->links[lb->level - 1].next == NULL) {
+        lb->level--;
+    }
+    lb->size--;
+}
+
+/* Posizione di *n*, che deve essere in classifica */
+static long node_rank(const struct leaderboard *lb, const struct node *n) {
+    const struct node *x = lb->head;
+    long rank = 0;
+    int i;
+
+    for (i = lb->level - 1; i >= 0; i--) {
+        while (x->links[i].next != NULL && !precedes(n, x->links[i].next)) {
+            rank += x->links[i].span;
+            x = x->links[i].next;
+        }
+        if (x == n) {
+            return rank;
+        }
+    }
+    return 0;
+}
+
+struct leaderboard* get_leaderboard(const char *room) {
+    int i;
+    for (i = 0; i < g_n_boards; i++) {
+        if (strcmp(g_boards[i]->room, room) == 0) {
+            return g_boards[i];
+        }
+    }
+    return NULL;
+}
+
+/* Come get_leaderboard(...), ma se la classifica non esiste la crea */
+static struct leaderboard* open_leaderboard(const char *room) {
+    struct leaderboard *lb = get_leaderboard(room);
+
+    if (lb != NULL) {
+        return lb;
+    }
+
+    if (g_n_boards == g_boards_capacity) {
+        int cap = g_boards_capacity == 0 ? 8 : 2 * g_boards_capacity;
+        struct leaderboard **bigger = realloc(g_boards, sizeof(struct leaderboard *) * cap);
+        if (bigger == NULL) {
+            return NULL;
+        }
+        g_boards = bigger;
+        g_boards_capacity = cap;
+    }
+
+    lb = malloc(sizeof(struct leaderboard));
+    if (lb == NULL) {
+        return NULL;
+    }
+    memset(lb, 0, sizeof(struct leaderboard));
+    lb->room = malloc(strlen(room) + 1);
+    lb->head = new_node(LEVEL_MAX);
+    if (lb->room == NULL || lb->head == NULL || grow_users(lb) == -1) {
+        free(lb->room);
+        free(lb->head);
+        free(lb);
+        return NULL;
+    }
+    strcpy(lb->room, room);
+    lb->level = 1;
+
+    g_boards[g_n_boards++] = lb;
+    return lb;
+}
+
+/* Registra *e* in memoria, vedi leaderboard_record(...) */
+static long add_entry(const char *room, const struct lb_entry *e) {
+    struct leaderboard *lb;
+    struct node *n, **slot;
+
+    lb = open_leaderboard(room);
+    if (lb == NULL) {
+        return -1;
+    }
+
+    /* La tabella viene tenuta piena al più per metà */
+    if (2 * (lb->size + 1) > lb->users_capacity && grow_users(lb) == -1) {
+        return -1;
+    }
+
+    n = new_node(random_level());
+    if (n == NULL) {
+        return -1;
+    }
+    n->entry = *e;
+    n->seq = g_next_seq++;
+
+    /* Se il giocatore ha già fatto meglio (o uguale) resta il risultato precedente */
+    slot = user_slot(lb, e->username);
+    if (*slot != NULL && !precedes(n, *slot)) {
+        free(n);
+        return node_rank(lb, *slot);
+    }
+    if (*slot != NULL) {
+        remove_node(lb, *slot);
+        free(*slot);
+    }
+    *slot = n;
+    return insert_node(lb, n);
+}
+
+/**
+ * Legge una riga di LEADERBOARD_FILE, nel formato
+ *  "secondi\tsabotaggi\ttimestamp\tgiocatore\troom".
+ * Ritorna -1 se è malformata.
+ */
+static int parse_record(char *line, struct lb_entry *e, char **room) {
+    char *field[5];
+    int i;
+
+    field[0] = line;
+    for (i = 1; i < 5; i++) {
+        field[i] = strchr(field[i - 1], '\t');
+        if (field[i] == NULL) {
+            return -1;
+        }
+        *field[i]++ = '\0';
+    }
+    if (ssstrlen(field[3], CREDENTIALS_LENGTH_MAX) == -1) {
+        return -1;
+    }
+
+    memset(e, 0, sizeof(struct lb_entry));
+    e->seconds = atoi(field[0]);
+    e->sabotages = atoi(field[1]);
+    e->when = strtoul(field[2], NULL, 10);
+    strcpy(e->username, field[3]);
+    *room = field[4];
+    return 0;
+}
+
+int leaderboard_init(const char *path) {
+    char line[LEADERBOARD_LINE_MAX];
+    FILE *f;
+    long n = 0, bad = 0;
+
+    f = fopen(path, "r");
+    if (f != NULL) {
+        while (fgetsnn(line, LEADERBOARD_LINE_MAX, f) != NULL) {
+            struct lb_entry e;
+            char *room;
+
+            if (line[0] == '\0') {
+                continue;
+            }
+            if (parse_record(line, &e, &room) == -1) {
+                bad++;
+                continue;
+            }
+            if (add_entry(room, &e) == -1) {
+                fclose(f);
+                return -1;
+            }
+            n++;
+        }
+        fclose(f);
+    }
+
+    if (bad > 0) {
+        printf(ANSI_COLOR_YELLOW "[Warning]: %ld righe malformate ignorate in %s\n"
+            ANSI_COLOR_RESET, bad, path);
+    }
+
+    g_file = fopen(path, "a");
+    return g_file == NULL ? -1 : 0;
+}
+
+long leaderboard_record(const char *room, const struct lb_entry *e) {
+    long rank = add_entry(room, e);
+
+    /* Il file è un registro: ad ogni avvio viene riletto da capo */
+    if (g_file != NULL) {
+        const char *c;
+
+        fprintf(g_file, "%d\t%d\t%lu\t", e->seconds, e->sabotages, e->when);
+        for (c = e->username; *c != '\0'; c++) {
+            fputc(*c == '\t' ? ' ' : *c, g_file);
+        }
+        fprintf(g_file, "\t%s\n", room);
+        fflush(g_file);
+    }
+    return rank;
+}
+
+long leaderboard_size(const struct leaderboard *lb) {
+    return lb->size;
+}
+
+int leaderboard_top(const struct leaderboard *lb, int k, const struct lb_entry *top[]) {
+    const struct node *x = lb->head->links[0].next;
+    int n = 0;
+
+    while (x != NULL && n < k) {
+        top[n++] = &x->entry;
+        x = x->links[0].next;
+    }
+    return n;
+}
+
+long leaderboard_rank(const struct leaderboard *lb, const char *username, const struct lb_entry **best) {
+    const struct node *n = *user_slot(lb, username);
+
+    if (n == NULL) {
+        return 0;
+    }
+    if (best != NULL) {
+        *best = &n->entry;
+    }
+    return node_rank(lb, n);
+}
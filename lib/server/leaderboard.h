@@ -0,0 +1,68 @@
+#ifndef LIB_SERVER_LEADERBOARD_H
+#define LIB_SERVER_LEADERBOARD_H
+
+#include "../protocol.h"
+
+/* File in cui vengono registrate (in coda) tutte le room risolte */
+#define LEADERBOARD_FILE "leaderboard.txt"
+
+/* Numero di posizioni inviate al client dal comando rank */
+#define LEADERBOARD_TOP 10
+
+/**
+ * Classifiche delle escape room.
+ *
+ * Ogni room (identificata dal nome, così sopravvive al ricaricamento del
+ *  catalogo) ha una classifica con il miglior risultato di ogni giocatore,
+ *  ordinata per tempo impiegato: a parità vale chi l'ha ottenuto prima.
+ * Le classifiche sono skip list indicizzabili, ogni collegamento ricorda
+ *  quante posizioni scavalca: inserimento, rimozione e calcolo della
+ *  posizione costano O(log n), le prime k posizioni O(log n + k).
+ * Ad ogni classifica è associata una tabella hash sui nomi dei giocatori,
+ *  per trovare in O(1) il loro miglior risultato.
+ */
+
+struct lb_entry {
+    char username[CREDENTIALS_LENGTH_MAX];
+    int seconds;            /* Tempo effettivamente impiegato */
+    int sabotages;          /* Domande indovinate da altri giocatori durante la partita */
+    unsigned long when;     /* Unix timestamp del completamento */
+};
+
+struct leaderboard;
+
+/**
+ * Carica le classifiche da *path* (se non esiste parte da classifiche
+ *  vuote) e vi registrerà i prossimi risultati.
+ * Ritorna -1 se il file non può essere aperto in scrittura o se la
+ *  memoria è esaurita.
+ */
+int leaderboard_init(const char *path);
+
+/**
+ * Registra un risultato nella classifica della room *room* e nel file.
+ * Il giocatore resta in classifica con il migliore dei suoi risultati.
+ * Ritorna la posizione (da 1) del giocatore in classifica, -1 se la
+ *  memoria è esaurita.
+ */
+long leaderboard_record(const char *room, const struct lb_entry *e);
+
+/* Ritorna la classifica della room *room*, NULL se nessuno l'ha ancora risolta */
+struct leaderboard* get_leaderboard(const char *room);
+
+/* Numero di giocatori nella classifica *lb* */
+long leaderboard_size(const struct leaderboard *lb);
+
+/**
+ * Scrive in *top* i primi (al più) *k* risultati di *lb* e ne ritorna il numero.
+ * I puntatori restano validi fino alla prossima registrazione.
+ */
+int leaderboard_top(const struct leaderboard *lb, int k, const struct lb_entry *top[]);
+
+/**
+ * Ritorna la posizione (da 1) di *username* in *lb*, 0 se non vi compare.
+ * Se *best* non è NULL vi scrive il suo miglior risultato.
+ */
+long leaderboard_rank(const struct leaderboard *lb, const char *username, const struct lb_entry **best);
+
+#endif
@@ -0,0 +1,377 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "logger.h"
+#include "../mystdlib.h"
+
+/* Lunghezza massima di una riga formattata */
+#define LOG_LINE_MAX 1024
+
+/* Il thread, se non ha nulla da scrivere, ricontrolla dopo tanti nanosecondi */
+#define LOG_IDLE_SLEEP 5000000L
+
+/* Call site (formati) di cui si tiene il conto dei messaggi al secondo */
+#define LOG_RATE_SLOTS 64
+
+union log_arg {
+    long l;
+    unsigned long u;
+    int s;              /* Posizione della stringa in text */
+};
+
+struct log_record {
+    long sec, usec;
+    const char *format;
+    int level;
+    union log_arg args[LOG_ARGS_MAX];
+    char text[LOG_TEXT_SIZE];
+};
+
+struct rate {
+    const char *format;
+    long sec;
+    int count;
+};
+
+const char* const log_level_to_str[] = {
+    "debug",
+    "info",
+    "warning",
+    "error"
+};
+
+static struct log_record g_ring[LOG_RING_SIZE];
+
+/**
+ * Record scritti dal produttore (head) e consumati dal thread (tail), sempre
+ *  crescenti: il record i occupa g_ring[i % LOG_RING_SIZE].
+ * Ognuno dei due scrive solo il proprio indice e legge l'altro con una
+ *  barriera acquire, pubblicando il proprio con una barriera release.
+ */
+static unsigned long g_head = 0, g_tail = 0;
+static unsigned long g_flushed = 0;     /* Record arrivati su stdout */
+static unsigned long g_dropped = 0, g_suppressed = 0;
+
+static int g_level = LOG_INFO;
+static int g_stop = 0;
+static int g_started = 0;
+static pthread_t g_thread;
+
+static struct rate g_rates[LOG_RATE_SLOTS];
+
+/* Vero se *r* (INFO o DEBUG) supera LOG_RATE_MAX messaggi al secondo */
+static int rate_limited(const char *format, long sec) {
+    struct rate *r = &g_rates[((unsigned long)format >> 3) % LOG_RATE_SLOTS];
+
+    if (r->format != format || r->sec != sec) {
+        r->format = format;
+        r->sec = sec;
+        r->count = 0;
+    }
+    return ++r->count > LOG_RATE_MAX;
+}
+
+/**
+ * Copia in *rec* gli argomenti di *ap* descritti da rec->format.
+ * Le conversioni non supportate interrompono la copia.
+ */
+static void copy_args(struct log_record *rec, va_list ap) {
+    const char *f = rec->format;
+    int n = 0, used = 0;
+
+    while (*f != '\0' && n < LOG_ARGS_MAX) {
+        int is_long = 0;
+
+        if (*f++ != '%') {
+            continue;
+        }
+        while (*f != '\0' && strchr("-+ #0123456789.", *f) != NULL) {
+            f++;
+        }
+        if (*f == 'l') {
+            is_long = 1;
+            f++;
+        }
+
+        switch (*f) {
+            case 'd':
+            case 'i':
+            case 'c':
+                rec->args[n++].l = is_long ? va_arg(ap, long) : va_arg(ap, int);
+                break;
+            case 'u':
+            case 'x':
+                rec->args[n++].u = is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                break;
+            case 's': {
+                const char *s = va_arg(ap, const char *);
+                int len = (int)strlen(s);
+
+                /* Finito lo spazio le stringhe restano vuote (l'ultimo '\\0') */
+                if (len > LOG_TEXT_SIZE - 1 - used) {
+                    len = LOG_TEXT_SIZE - 1 - used;
+                }
+                memcpy(rec->text + used, s, len);
+                rec->text[used + len] = '\0';
+                rec->args[n++].s = used;
+                used += len;
+                if (used < LOG_TEXT_SIZE - 1) {
+                    used++;
+                }
+                break;
+            }
+            case '%':
+                break;
+            default:
+                return;
+        }
+        if (*f != '\0') {
+            f++;
+        }
+    }
+}
+
+void log_event(enum LOG_LEVEL level, const char *format, ...) {
+    struct log_record *rec;
+    struct timeval tv;
+    unsigned long head;
+    va_list ap;
+
+    if ((int)level < g_level) {
+        return;
+    }
+
+    gettimeofday(&tv, NULL);
+    if (level <= LOG_INFO && rate_limited(format, tv.tv_sec)) {
+        __atomic_fetch_add(&g_suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    head = g_head;
+    if (head - __atomic_load_n(&g_tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        __atomic_fetch_add(&g_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec = &g_ring[head % LOG_RING_SIZE];
+    rec->sec = tv.tv_sec;
+    rec->usec = tv.tv_usec;
+    rec->format = format;
+    rec->level = level;
+    va_start(ap, format);
+    copy_args(rec, ap);
+    va_end(ap);
+
+    __atomic_store_n(&g_head, head + 1, __ATOMIC_RELEASE);
+}
+
+void logger_set_level(enum LOG_LEVEL level) {
+    g_level = level;
+}
+
+/* Scrive in *line* "HH:MM:SS", ricalcolandolo solo quando cambia il secondo */
+static void format_time(char *line, long sec) {
+    static long cached_sec = -1;
+    static char cached[16];
+
+    if (sec != cached_sec) {
+        time_t t = (time_t)sec;
+        strftime(cached, sizeof(cached), "%H:%M:%S", localtime(&t));
+        cached_sec = sec;
+    }
+    strcpy(line, cached);
+}
+
+/* Formatta *rec* in *line*, di LOG_LINE_MAX byte, e ritorna la lunghezza */
+static int format_record(const struct log_record *rec, char *line) {
+    const char *f = rec->format;
+    char spec[32];
+    int len, n = 0;
+
+    strcpy(line, " [");
+    format_time(line + 2, rec->sec);
+    len = strlen(line);
+    len += sprintf(line + len, ".%06ld] > ", rec->usec);
+    if (rec->level == LOG_WARNING) {
+        len += sprintf(line + len, ANSI_COLOR_YELLOW "[Warning]: ");
+    }
+    else if (rec->level == LOG_ERROR) {
+        len += sprintf(line + len, ANSI_COLOR_RED "[Errore]: ");
+    }
+
+    while (*f != '\0' && len < LOG_LINE_MAX - 16) {
+        const char *start = f;
+        int is_long = 0, k;
+
+        if (*f != '%') {
+            line[len++] = *f++;
+            continue;
+        }
+        f++;
+        while (*f != '\0' && strchr("-+ #0123456789.", *f) != NULL) {
+            f++;
+        }
+        if (*f == 'l') {
+            is_long = 1;
+            f++;
+        }
+        if (*f == '%') {
+            line[len++] = '%';
+            f++;
+            continue;
+        }
+        if (*f == '\0' || n == LOG_ARGS_MAX || f - start + 2 > (int)sizeof(spec)) {
+            break;
+        }
+
+        /* La singola conversione viene fatta da snprintf, con le sue opzioni */
+        memcpy(spec, start, f - start + 1);
+        spec[f - start + 1] = '\0';
+        switch (*f) {
+            case 'd':
+            case 'i':
+            case 'c':
+                k = is_long ? snprintf(line + len, LOG_LINE_MAX - 16 - len, spec, rec->args[n].l)
+                    : snprintf(line + len, LOG_LINE_MAX - 16 - len, spec, (int)rec->args[n].l);
+                break;
+            case 'u':
+            case 'x':
+                k = is_long ? snprintf(line + len, LOG_LINE_MAX - 16 - len, spec, rec->args[n].u)
+                    : snprintf(line + len, LOG_LINE_MAX - 16 - len, spec, (unsigned int)rec->args[n].u);
+                break;
+            case 's':
+                k = snprintf(line + len, LOG_LINE_MAX - 16 - len, spec, rec->text + rec->args[n].s);
+                break;
+            default:
+                k = 0;
+                break;
+        }
+        n++;
+        f++;
+        len += k < LOG_LINE_MAX - 16 - len ? k : LOG_LINE_MAX - 17 - len;
+    }
+
+    if (rec->level >= LOG_WARNING) {
+        len += sprintf(line + len, ANSI_COLOR_RESET);
+    }
+    line[len++] = '\n';
+    return len;
+}
+
+/* Scrive un avviso con il numero *count* di messaggi persi */
+static void report(const char *format, unsigned long count, char *line) {
+    struct log_record rec;
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    rec.sec = tv.tv_sec;
+    rec.usec = tv.tv_usec;
+    rec.format = format;
+    rec.level = LOG_WARNING;
+    rec.args[0].u = count;
+    fwrite(line, 1, format_record(&rec, line), stdout);
+}
+
+/**
+ * Riporta i record persi o scartati dall'ultima volta, al più una volta
+ *  al secondo (sempre se *final* è vero): sotto carico il thread passa
+ *  centinaia di volte al secondo, ed un avviso per ogni passata
+ *  sarebbe a sua volta troppo.
+ * Ritorna 1 se ha scritto qualcosa, 0 altrimenti.
+ */
+static int report_losses(char *line, int final) {
+    static unsigned long dropped = 0, suppressed = 0;
+    static time_t reported = 0;
+    unsigned long now;
+    time_t sec = time(NULL);
+    int wrote = 0;
+
+    if (!final && sec == reported) {
+        return 0;
+    }
+    reported = sec;
+
+    now = __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
+    if (now != dropped) {
+        report("%lu messaggi di log persi, il buffer era pieno", now - dropped, line);
+        dropped = now;
+        wrote = 1;
+    }
+    now = __atomic_load_n(&g_suppressed, __ATOMIC_RELAXED);
+    if (now != suppressed) {
+        report("%lu messaggi di log scartati, troppi al secondo", now - suppressed, line);
+        suppressed = now;
+        wrote = 1;
+    }
+    return wrote;
+}
+
+static void* writer(void *arg) {
+    char line[LOG_LINE_MAX];
+    unsigned long tail = 0;
+
+    (void)arg;
+    while (1) {
+        unsigned long head = __atomic_load_n(&g_head, __ATOMIC_ACQUIRE);
+        struct timespec idle;
+
+        if (tail == head) {
+            if (__atomic_load_n(&g_stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            if (report_losses(line, 0)) {
+                fflush(stdout);
+            }
+            idle.tv_sec = 0;
+            idle.tv_nsec = LOG_IDLE_SLEEP;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        while (tail != head) {
+            int len = format_record(&g_ring[tail % LOG_RING_SIZE], line);
+            fwrite(line, 1, len, stdout);
+            tail++;
+            __atomic_store_n(&g_tail, tail, __ATOMIC_RELEASE);
+        }
+        report_losses(line, 0);
+        fflush(stdout);
+        __atomic_store_n(&g_flushed, tail, __ATOMIC_RELEASE);
+    }
+
+    report_losses(line, 1);
+    fflush(stdout);
+    return NULL;
+}
+
+static void stop_writer(void) {
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(g_thread, NULL);
+}
+
+int logger_start(void) {
+    if (pthread_create(&g_thread, NULL, writer, NULL) != 0) {
+        return -1;
+    }
+    g_started = 1;
+    atexit(stop_writer);
+    return 0;
+}
+
+void logger_flush(void) {
+    unsigned long head = g_head;
+    struct timespec wait;
+
+    wait.tv_sec = 0;
+    wait.tv_nsec = LOG_IDLE_SLEEP / 5;
+    while (g_started && __atomic_load_n(&g_flushed, __ATOMIC_ACQUIRE) < head) {
+        nanosleep(&wait, NULL);
+    }
+}
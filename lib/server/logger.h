@@ -0,0 +1,66 @@
+#ifndef LIB_SERVER_LOGGER_H
+#define LIB_SERVER_LOGGER_H
+
+/* Record che possono essere in attesa di essere scritti, potenza di 2 */
+#define LOG_RING_SIZE 4096
+
+/* Massimo numero di argomenti di un record, ed il loro spazio per le stringhe */
+#define LOG_ARGS_MAX 8
+#define LOG_TEXT_SIZE 160
+
+/* Messaggi al secondo (per ogni formato) oltre i quali INFO e DEBUG vengono scartati */
+#define LOG_RATE_MAX 200
+
+enum LOG_LEVEL {
+    LOG_DEBUG,      /* Tutti i comandi ricevuti */
+    LOG_INFO,       /* Accessi, partite e connessioni */
+    LOG_WARNING,
+    LOG_ERROR
+};
+
+/* Converte gli elementi letterali del tipo LOG_LEVEL in stringhe (minuscole) */
+extern const char* const log_level_to_str[];
+
+/**
+ * Log asincrono del server.
+ *
+ * log_event(...) non formatta nulla e non fa chiamate di sistema (se non
+ *  per leggere l'orario): copia il formato (un puntatore, che deve quindi
+ *  essere una stringa letterale) e gli argomenti in un record di dimensione
+ *  fissa, in un buffer circolare lock-free. Un thread in background formatta
+ *  i record e li scrive su stdout a blocchi, ricalcolando l'orario
+ *  "HH:MM:SS" solo quando cambia il secondo.
+ * Se il buffer è pieno il record viene scartato invece di aspettare; lo
+ *  stesso vale per i messaggi INFO e DEBUG che superano LOG_RATE_MAX al
+ *  secondo con lo stesso formato. Il thread riporta quanti ne ha persi al
+ *  più una volta al secondo, ed all'uscita.
+ *
+ * Nel formato sono ammesse solo le conversioni d, i, c, u, x (anche con
+ *  l) ed s, con eventuali flag, ampiezza e precisione. Le stringhe vengono
+ *  copiate (troncate a LOG_TEXT_SIZE byte in tutto).
+ * Un solo thread alla volta può chiamare log_event(...).
+ */
+
+/**
+ * Avvia il thread che scrive i record. All'uscita del programma scrive
+ *  quelli rimasti e lo termina.
+ * Ritorna -1 se non è stato possibile avviare il thread, 0 altrimenti.
+ */
+int logger_start(void);
+
+/* Cambia il livello minimo dei record registrati (di default LOG_INFO) */
+void logger_set_level(enum LOG_LEVEL level);
+
+/**
+ * Registra un messaggio. Ad ogni riga vengono aggiunti l'orario ed il
+ *  livello (se superiore ad INFO), non va quindi terminata da '\\n'.
+ */
+void log_event(enum LOG_LEVEL level, const char *format, ...);
+
+/**
+ * Aspetta che tutti i record registrati siano stati scritti, da usare
+ *  prima di scrivere direttamente su stdout.
+ */
+void logger_flush(void);
+
+#endif
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "lowlatency.h"
+
+/* Valore di SO_BUSY_POLL, in microsecondi */
+#define BUSY_POLL_US 50
+
+#define NS_PER_US 1000UL
+#define NS_PER_SEC 1000000000UL
+
+static int g_enabled = 0;
+
+/* Istante dell'ultimo evento, per decidere se aspettare il prossimo attivamente */
+static unsigned long g_last_event = 0;
+
+static unsigned long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * NS_PER_SEC + (unsigned long)ts.tv_nsec;
+}
+
+int lowlatency_enable(int cpu) {
+    g_enabled = 1;
+    if (cpu != -1) {
+        cpu_set_t set;
+
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return -1;
+        }
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int lowlatency_enabled(void) {
+    return g_enabled;
+}
+
+void lowlatency_socket(int sd) {
+    int yes = 1;
+
+    if (!g_enabled) {
+        return;
+    }
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    setsockopt(sd, IPPROTO_TCP, TCP_QUICKACK, &yes, sizeof(yes));
+#ifdef SO_BUSY_POLL
+    {
+        /* Senza CAP_NET_ADMIN il kernel può rifiutarlo, e va bene lo stesso */
+        int usecs = BUSY_POLL_US;
+        setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+    }
+#endif
+}
+
+void lowlatency_quickack(int sd) {
+    int yes = 1;
+
+    if (g_enabled) {
+        setsockopt(sd, IPPROTO_TCP, TCP_QUICKACK, &yes, sizeof(yes));
+    }
+}
+
+int lowlatency_select(int n, fd_set *read_fds, fd_set *write_fds, struct timeval *timeout) {
+    unsigned long t, end;
+    int ret, expires = 0;
+
+    if (!g_enabled) {
+        return select(n, read_fds, write_fds, NULL, timeout);
+    }
+
+    /* Si aspetta attivamente fino alla fine della finestra, o prima se scade *timeout* */
+    t = now_ns();
+    end = g_last_event + LOWLATENCY_SPIN_US * NS_PER_US;
+    if (timeout != NULL) {
+        unsigned long limit = t + (unsigned long)timeout->tv_sec * NS_PER_SEC + (unsigned long)timeout->tv_usec * NS_PER_US;
+        if (limit <= end) {
+            end = limit;
+            expires = 1;
+        }
+    }
+    while (t < end) {
+        fd_set r = *read_fds, w = *write_fds;
+        struct timeval zero;
+
+        zero.tv_sec = 0;
+        zero.tv_usec = 0;
+        ret = select(n, &r, &w, NULL, &zero);
+        if (ret != 0) {
+            if (ret > 0) {
+                *read_fds = r;
+                *write_fds = w;
+                g_last_event = now_ns();
+            }
+            return ret;
+        }
+        t = now_ns();
+    }
+    if (expires && t >= end) {
+        FD_ZERO(read_fds);
+        FD_ZERO(write_fds);
+        return 0;
+    }
+
+    ret = select(n, read_fds, write_fds, NULL, timeout);
+    if (ret > 0) {
+        g_last_event = now_ns();
+    }
+    return ret;
+}
@@ -0,0 +1,48 @@
+#ifndef LIB_SERVER_LOWLATENCY_H
+#define LIB_SERVER_LOWLATENCY_H
+
+#include <sys/select.h>
+
+/* Microsecondi per cui il ciclo principale continua a controllare i socket dopo l'ultimo evento */
+#define LOWLATENCY_SPIN_US 2000
+
+/**
+ * Profilo a bassa latenza, per quando la regolarità dei tempi di
+ *  risposta conta più della CPU.
+ *
+ * Dopo ogni evento il ciclo principale non si addormenta in select(...)
+ *  per LOWLATENCY_SPIN_US: la chiama in continuazione senza attesa, così
+ *  il prossimo messaggio viene letto appena arriva, senza il risveglio
+ *  del thread. Se non arriva nulla torna ad aspettare normalmente, quindi
+ *  un server inattivo non consuma CPU.
+ * I socket dei client non usano l'algoritmo di Nagle (TCP_NODELAY),
+ *  confermano subito i segmenti ricevuti (TCP_QUICKACK, da riarmare dopo
+ *  ogni lettura) e chiedono al kernel di controllare la scheda di rete
+ *  senza aspettare le interruzioni (SO_BUSY_POLL, dove è permesso).
+ * Il thread principale può essere fissato ad un processore, da riservare
+ *  al server (ad esempio con isolcpus).
+ *
+ * Se il profilo non è attivo le funzioni si comportano come le chiamate
+ *  di sistema normali o non fanno nulla.
+ */
+
+/**
+ * Attiva il profilo e, se *cpu* non è -1, fissa il thread chiamante al
+ *  processore *cpu* (i thread creati dopo lo erediterebbero).
+ * Ritorna -1 se non è stato possibile fissare il thread, 0 altrimenti.
+ */
+int lowlatency_enable(int cpu);
+
+/* Vero se il profilo è attivo */
+int lowlatency_enabled(void);
+
+/* Imposta le opzioni del profilo sul socket di un client appena accettato */
+void lowlatency_socket(int sd);
+
+/* Riarma TCP_QUICKACK su *sd*, prima di leggerne un messaggio */
+void lowlatency_quickack(int sd);
+
+/* Come select(...), ma nel profilo attivo continua a controllare i socket per un po' prima di attendere */
+int lowlatency_select(int n, fd_set *read_fds, fd_set *write_fds, struct timeval *timeout);
+
+#endif
@@ -0,0 +1,387 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "session.h"
+#include "rooms.h"
+
+/* Soglie (le) esportate per gli istogrammi: da 2^HIST_LE_MIN a 2^HIST_LE_MAX ns */
+#define HIST_LE_MIN 10
+#define HIST_LE_MAX 34
+
+static struct histogram g_latency[ACTION_MAX];
+static unsigned long g_logins[RESUME_FAILED + 1];
+static unsigned long g_counters[COUNTERS_MAX];
+static long g_connected = 0;
+
+/* Comando in corso, vedi metrics_begin(...) */
+static int g_pending = 0;
+static enum ACTION g_action;
+static unsigned long g_begin;
+
+/* Richiesta HTTP in corso: la risposta viene inviata senza bloccarsi */
+struct metrics_client {
+    int sd;
+    unsigned long deadline;     /* Istante (in secondi) oltre il quale viene chiusa */
+    char *out;                  /* Risposta, NULL finché la richiesta non arriva */
+    int out_len, sent;
+};
+
+static struct metrics_client g_clients[METRICS_CLIENTS_MAX];
+static int g_n_clients = 0;
+
+unsigned long metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+void metrics_begin(enum ACTION action) {
+    g_action = action;
+    g_begin = metrics_now();
+    g_pending = 1;
+}
+
+void metrics_end(void) {
+    if (!g_pending) {
+        return;
+    }
+    g_pending = 0;
+    hist_record(&g_latency[g_action], metrics_now() - g_begin);
+}
+
+void metrics_login(enum RESPONSE response) {
+    g_logins[response]++;
+}
+
+void metrics_count(enum COUNTER counter) {
+    g_counters[counter]++;
+}
+
+void metrics_connected(int delta) {
+    g_connected += delta;
+}
+
+/* Testo che cresce man mano che viene scritto */
+struct text {
+    char *data;
+    int size, capacity;
+};
+
+static void append(struct text *t, const char *format, ...) {
+    va_list ap;
+    int n;
+
+    if (t->data == NULL) {
+        return;
+    }
+    while (1) {
+        char *bigger;
+
+        va_start(ap, format);
+        n = vsnprintf(t->data + t->size, t->capacity - t->size, format, ap);
+        va_end(ap);
+        if (n < t->capacity - t->size) {
+            break;
+        }
+        bigger = realloc(t->data, 2 * t->capacity + n);
+        if (bigger == NULL) {
+            free(t->data);
+            t->data = NULL;
+            return;
+        }
+        t->data = bigger;
+        t->capacity = 2 * t->capacity + n;
+    }
+    t->size += n;
+}
+
+/* Scrive *value* come valore di un'etichetta, con '\\', '"' e '\\n' protetti */
+static void append_label(struct text *t, const char *value) {
+    for (; *value != '\0'; value++) {
+        if (*value == '\\' || *value == '"') {
+            append(t, "\\%c", *value);
+        }
+        else if (*value == '\n') {
+            append(t, "\\n");
+        }
+        else {
+            append(t, "%c", *value);
+        }
+    }
+}
+
+static void export_latency(struct text *t) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    int a, i, k;
+
+    append(t, "# HELP escape_command_duration_seconds Tempo dalla ricezione completa di un messaggio all'invio della risposta.\n");
+    append(t, "# TYPE escape_command_duration_seconds histogram\n");
+    for (a = 0; a < ACTION_MAX; a++) {
+        const struct histogram *h = &g_latency[a];
+        unsigned long cumulative = 0;
+
+        if (h->count == 0) {
+            continue;
+        }
+        /* Le soglie sono potenze di 2, quindi coincidono con i bordi degli scaglioni */
+        i = 0;
+        for (k = HIST_LE_MIN; k <= HIST_LE_MAX; k++) {
+            double le = (double)(1UL << k);
+            while (i < HIST_BUCKETS && hist_bucket_limit(i) <= le) {
+                cumulative += h->buckets[i++];
+            }
+            append(t, "escape_command_duration_seconds_bucket{action=\"%s\",le=\"%g\"} %lu\n",
+                action_to_str[a], le / 1e9, cumulative);
+        }
+        append(t, "escape_command_duration_seconds_bucket{action=\"%s\",le=\"+Inf\"} %lu\n", action_to_str[a], h->count);
+        append(t, "escape_command_duration_seconds_sum{action=\"%s\"} %.9f\n", action_to_str[a], h->sum / 1e9);
+        append(t, "escape_command_duration_seconds_count{action=\"%s\"} %lu\n", action_to_str[a], h->count);
+    }
+
+    append(t, "# HELP escape_command_duration_quantile_seconds Quantili della latenza, con errore relativo al più 1/%lu.\n", 1UL << HIST_SUB_BITS);
+    append(t, "# TYPE escape_command_duration_quantile_seconds gauge\n");
+    for (a = 0; a < ACTION_MAX; a++) {
+        if (g_latency[a].count == 0) {
+            continue;
+        }
+        for (k = 0; k < (int)(sizeof(quantiles) / sizeof(quantiles[0])); k++) {
+            append(t, "escape_command_duration_quantile_seconds{action=\"%s\",quantile=\"%g\"} %g\n",
+                action_to_str[a], quantiles[k], hist_quantile(&g_latency[a], quantiles[k]) / 1e9);
+        }
+    }
+}
+
+static void export_gauges(struct text *t) {
+    struct session *s;
+    int n_sessions = 0, i;
+
+    for (s = g_sessions; s != NULL; s = s->next) {
+        n_sessions++;
+    }
+    append(t, "# HELP escape_connected_sockets Client connessi, autenticati o meno.\n");
+    append(t, "# TYPE escape_connected_sockets gauge\n");
+    append(t, "escape_connected_sockets %ld\n", g_connected);
+    append(t, "# HELP escape_sessions Client autenticati.\n");
+    append(t, "# TYPE escape_sessions gauge\n");
+    append(t, "escape_sessions %d\n", n_sessions);
+
+    /* Le room della versione corrente, anche se vuote */
+    append(t, "# HELP escape_room_players Giocatori in ogni room.\n");
+    append(t, "# TYPE escape_room_players gauge\n");
+    for (i = 0; i < g_catalogue->n_rooms; i++) {
+        const char *name = g_catalogue->rooms[i].name;
+        int players = 0;
+
+        for (s = g_sessions; s != NULL; s = s->next) {
+            if (s->room != -1 && strcmp(session_room(s)->name, name) == 0) {
+                players++;
+            }
+        }
+        append(t, "escape_room_players{room=\"");
+        append_label(t, name);
+        append(t, "\"} %d\n", players);
+    }
+}
+
+char* metrics_export(int *size) {
+    struct text t;
+    int i;
+
+    t.capacity = 16384;
+    t.size = 0;
+    t.data = malloc(t.capacity);
+
+    export_latency(&t);
+
+    append(&t, "# HELP escape_logins_total Tentativi di login e di ripresa di una sessione, per risultato.\n");
+    append(&t, "# TYPE escape_logins_total counter\n");
+    for (i = 0; i <= RESUME_FAILED; i++) {
+        append(&t, "escape_logins_total{response=\"%s\"} %lu\n", response_to_str[i], g_logins[i]);
+    }
+    append(&t, "# HELP escape_received_bytes_total Byte dei messaggi ricevuti.\n");
+    append(&t, "# TYPE escape_received_bytes_total counter\n");
+    append(&t, "escape_received_bytes_total %lu\n", g_protocol_stats.bytes_received);
+    append(&t, "# HELP escape_sent_bytes_total Byte inviati, eventi degli spettatori compresi.\n");
+    append(&t, "# TYPE escape_sent_bytes_total counter\n");
+    append(&t, "escape_sent_bytes_total %lu\n", g_protocol_stats.bytes_sent);
+    append(&t, "# HELP escape_decode_failures_total Messaggi che non è stato possibile decodificare.\n");
+    append(&t, "# TYPE escape_decode_failures_total counter\n");
+    append(&t, "escape_decode_failures_total %lu\n", g_protocol_stats.decode_failures);
+    append(&t, "# HELP escape_timeouts_total Partite perse per tempo scaduto.\n");
+    append(&t, "# TYPE escape_timeouts_total counter\n");
+    append(&t, "escape_timeouts_total %lu\n", g_counters[CNT_TIMEOUTS]);
+    append(&t, "# HELP escape_connections_total Connessioni accettate.\n");
+    append(&t, "# TYPE escape_connections_total counter\n");
+    append(&t, "escape_connections_total %lu\n", g_counters[CNT_CONNECTIONS]);
+
+    export_gauges(&t);
+
+    if (size != NULL) {
+        *size = t.size;
+    }
+    return t.data;
+}
+
+int metrics_listen(int port) {
+    struct sockaddr_in addr;
+    int sd, yes = 1;
+
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd == -1) {
+        return -1;
+    }
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(sd, METRICS_CLIENTS_MAX) == -1) {
+        close(sd);
+        return -1;
+    }
+    return sd;
+}
+
+int metrics_accept(int listener) {
+    int sd = accept(listener, NULL, NULL);
+
+    if (sd == -1) {
+        return -1;
+    }
+    if (g_n_clients == METRICS_CLIENTS_MAX || sd >= FD_SETSIZE ||
+        fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) == -1) {
+        close(sd);
+        return -1;
+    }
+    g_clients[g_n_clients].sd = sd;
+    g_clients[g_n_clients].deadline = (unsigned long)time(NULL) + METRICS_CLIENT_TIMEOUT;
+    g_clients[g_n_clients].out = NULL;
+    g_clients[g_n_clients].out_len = g_clients[g_n_clients].sent = 0;
+    g_n_clients++;
+    return sd;
+}
+
+static struct metrics_client* find_client(int sd) {
+    int i;
+    for (i = 0; i < g_n_clients; i++) {
+        if (g_clients[i].sd == sd) {
+            return &g_clients[i];
+        }
+    }
+    return NULL;
+}
+
+int metrics_client(int sd) {
+    return find_client(sd) != NULL;
+}
+
+static void drop_client(struct metrics_client *c) {
+    close(c->sd);
+    free(c->out);
+    *c = g_clients[--g_n_clients];
+}
+
+/**
+ * Invia quanto il socket accetta della risposta di *c*. Ritorna 1 se
+ *  la connessione è stata chiusa (risposta completa o errore), 0 altrimenti.
+ */
+static int flush_client(struct metrics_client *c) {
+    while (c->sent < c->out_len) {
+        int ret = send(c->sd, c->out + c->sent, c->out_len - c->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        c->sent += ret;
+    }
+    drop_client(c);
+    return 1;
+}
+
+int metrics_serve(int sd) {
+    struct metrics_client *c = find_client(sd);
+    char request[IO_BUFFER_SIZE], header[128];
+    char *body;
+    int ret, size = 0;
+
+    /* La richiesta non interessa, va solo letta */
+    ret = recv(sd, request, sizeof(request), MSG_DONTWAIT);
+    if (ret == 0 || (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        drop_client(c);
+        return 1;
+    }
+    if (c->out != NULL) {
+        return 0;
+    }
+
+    body = metrics_export(&size);
+    if (body != NULL) {
+        sprintf(header, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %d\r\n\r\n", size);
+        c->out_len = strlen(header) + size;
+        c->out = malloc(c->out_len);
+    }
+    if (c->out == NULL) {
+        free(body);
+        drop_client(c);
+        return 1;
+    }
+    memcpy(c->out, header, c->out_len - size);
+    memcpy(c->out + c->out_len - size, body, size);
+    free(body);
+    return flush_client(c);
+}
+
+int metrics_write(int sd) {
+    struct metrics_client *c = find_client(sd);
+    return c != NULL && c->out != NULL ? flush_client(c) : 0;
+}
+
+int metrics_fill(fd_set *fds, int sd_max) {
+    int i;
+    for (i = 0; i < g_n_clients; i++) {
+        if (g_clients[i].out != NULL) {
+            FD_SET(g_clients[i].sd, fds);
+            if (g_clients[i].sd > sd_max) sd_max = g_clients[i].sd;
+        }
+    }
+    return sd_max;
+}
+
+unsigned long metrics_expire(unsigned long now, fd_set *fds) {
+    unsigned long next = 0;
+    int i = 0;
+
+    while (i < g_n_clients) {
+        if (now >= g_clients[i].deadline) {
+            FD_CLR(g_clients[i].sd, fds);
+            drop_client(&g_clients[i]);
+            continue;
+        }
+        if (next == 0 || g_clients[i].deadline < next) {
+            next = g_clients[i].deadline;
+        }
+        i++;
+    }
+    return next;
+}
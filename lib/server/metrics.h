@@ -0,0 +1,105 @@
+#ifndef LIB_SERVER_METRICS_H
+#define LIB_SERVER_METRICS_H
+
+#include <sys/select.h>
+
+#include "../protocol.h"
+#include "../histogram.h"
+
+/* Le metriche vengono esposte su 127.0.0.1, alla porta del server più questa */
+#define METRICS_PORT_OFFSET 1
+
+/* Massimo numero di richieste HTTP alle metriche servite contemporaneamente */
+#define METRICS_CLIENTS_MAX 8
+
+/* Secondi entro cui una richiesta HTTP deve essere servita, poi viene chiusa */
+#define METRICS_CLIENT_TIMEOUT 2
+
+enum COUNTER {
+    CNT_CONNECTIONS,    /* Connessioni accettate */
+    CNT_TIMEOUTS,       /* Partite perse per tempo scaduto */
+    COUNTERS_MAX
+};
+
+/**
+ * Metriche del server.
+ *
+ * Registrare un valore costa un incremento (o poco più, per gli istogrammi
+ *  il calcolo dello scaglione è qualche operazione sui bit): tutto il resto
+ *  viene calcolato solo quando le metriche vengono lette, compresi gli
+ *  indicatori (sessioni, giocatori per room), ricavati dalle sessioni.
+ *
+ * La latenza di un comando va dalla ricezione completa del messaggio
+ *  all'invio della risposta: metrics_begin(...) e metrics_end() la
+ *  delimitano, e visto che il server esegue un comando alla volta non
+ *  serve ricordare altro.
+ *
+ * Le metriche sono esposte nel formato testuale di Prometheus, sia via
+ *  HTTP (GET su qualsiasi percorso) che tramite il comando metrics del server.
+ */
+
+/* Istante attuale in nanosecondi, da un orologio monotono */
+unsigned long metrics_now(void);
+
+/* Il messaggio con azione *action* è stato ricevuto completamente */
+void metrics_begin(enum ACTION action);
+
+/* Il server ha finito di rispondere al messaggio (non fa nulla senza metrics_begin) */
+void metrics_end(void);
+
+/* Registra il risultato di un tentativo di login */
+void metrics_login(enum RESPONSE response);
+
+void metrics_count(enum COUNTER counter);
+
+/* Aggiorna il numero di socket dei client connessi */
+void metrics_connected(int delta);
+
+/**
+ * Ritorna il testo (da deallocare con free) con tutte le metriche,
+ *  NULL se la memoria è esaurita. Se *size* non è NULL vi scrive la lunghezza.
+ */
+char* metrics_export(int *size);
+
+/**
+ * Si mette in ascolto su 127.0.0.1:*port* per le richieste HTTP.
+ * Ritorna il socket di ascolto, -1 in caso di errore.
+ */
+int metrics_listen(int port);
+
+/**
+ * Accetta una richiesta sul socket di ascolto *listener*, ritorna il
+ *  socket (non bloccante) della connessione, da aggiungere a quelli
+ *  controllati dalla select, o -1 se non è stato possibile accettarla.
+ */
+int metrics_accept(int listener);
+
+/* Vero se *sd* è una connessione accettata da metrics_accept(...) */
+int metrics_client(int sd);
+
+/**
+ * Legge la richiesta arrivata su *sd* e inizia a rispondere con le
+ *  metriche: quello che il socket non accetta subito viene inviato da
+ *  metrics_write(...). Ritorna 1 se la connessione è stata chiusa
+ *  (risposta completa o errore), 0 altrimenti.
+ */
+int metrics_serve(int sd);
+
+/* Prosegue l'invio della risposta su *sd*, ritorna come metrics_serve(...) */
+int metrics_write(int sd);
+
+/**
+ * Aggiunge a *fds* i socket con una risposta da finire di inviare.
+ * Ritorna il maggiore tra questi e *sd_max*.
+ */
+int metrics_fill(fd_set *fds, int sd_max);
+
+/**
+ * Chiude (e toglie da *fds*) le connessioni aperte da più di
+ *  METRICS_CLIENT_TIMEOUT secondi all'istante *now*: un client lento o
+ *  inattivo non può occupare un posto per sempre. Ritorna l'istante in
+ *  cui scade la prossima, 0 se non ce ne sono.
+ */
+unsigned long metrics_expire(unsigned long now, fd_set *fds);
+
+#endif
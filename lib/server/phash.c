@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "phash.h"
+
+/* Numero medio di nomi per bucket */
+#define PHASH_BUCKET_LOAD 2
+
+/* Tentativi con seed diversi prima di arrendersi */
+#define PHASH_SEEDS_MAX 16
+
+/* FNV-1a a 64 bit, con il seed mescolato nella base */
+static uint64_t hash_name(const char *name, uint32_t seed) {
+    uint64_t h = 14695981039346656037UL ^ ((uint64_t)seed * 0x9E3779B97F4A7C15UL);
+    while (*name != '\0') {
+        h ^= (unsigned char)*name++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+/* Finalizzatore di splitmix64, distribuisce i bit di *h* su tutta la parola */
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9UL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBUL;
+    h ^= h >> 31;
+    return h;
+}
+
+/**
+ * Dall'unico hash del nome ricava il bucket e i due valori *f1*, *f2*
+ *  da cui, dati gli spostamenti (d0, d1), si ottiene lo slot:
+ *  (f1 + d0 * f2 + d1) % n
+ */
+struct key_hash {
+    uint32_t bucket, f1, f2;
+};
+
+static void split_hash(uint64_t h, int n, int n_buckets, struct key_hash *kh) {
+    uint64_t g = mix(h);
+    kh->bucket = (uint32_t)(h >> 32) % n_buckets;
+    kh->f1 = (uint32_t)g % n;
+    kh->f2 = (uint32_t)(g >> 32) % n;
+}
+
+static uint32_t slot_of(const struct key_hash *kh, uint32_t d0, uint32_t d1, int n) {
+    return (uint32_t)(((uint64_t)kh->f1 + (uint64_t)d0 * kh->f2 + d1) % n);
+}
+
+/* Dati per ordinare i bucket dal più grande al più piccolo */
+struct bucket {
+    int size;
+    int first;  /* Indice del primo nome del bucket in *order* */
+    int id;
+};
+
+static int bucket_cmp(const void *a, const void *b) {
+    const struct bucket *x = a, *y = b;
+    if (x->size != y->size) {
+        return y->size - x->size;
+    }
+    return x->id - y->id;
+}
+
+/**
+ * Un tentativo di costruzione con il seed *ph->seed*.
+ * Ritorna 1 se è andato a buon fine, 0 se va cambiato seed.
+ */
+static int try_build(struct phash *ph, char *const *names, const int *refs,
+        struct key_hash *kh, struct bucket *buckets, int *order, char *taken) {
+
+    int n = ph->n, nb = ph->n_buckets;
+    int b, i, k;
+
+    for (i = 0; i < n; i++) {
+        split_hash(hash_name(names[i], ph->seed), n, nb, &kh[i]);
+    }
+
+    /* Raggruppa i nomi per bucket (counting sort) */
+    for (b = 0; b < nb; b++) {
+        buckets[b].size = 0;
+        buckets[b].id = b;
+    }
+    for (i = 0; i < n; i++) {
+        buckets[kh[i].bucket].size++;
+    }
+    k = 0;
+    for (b = 0; b < nb; b++) {
+        buckets[b].first = k;
+        k += buckets[b].size;
+        buckets[b].size = 0;
+    }
+    for (i = 0; i < n; i++) {
+        struct bucket *bk = &buckets[kh[i].bucket];
+        order[bk->first + bk->size] = i;
+        bk->size++;
+    }
+
+    qsort(buckets, nb, sizeof(struct bucket), bucket_cmp);
+
+    memset(taken, 0, n);
+    memset(ph->displacements, 0, sizeof(uint32_t) * 2 * nb);
+
+    /* I bucket più affollati vengono sistemati per primi, quando la tabella è vuota */
+    for (b = 0; b < nb && buckets[b].size > 0; b++) {
+        struct bucket *bk = &buckets[b];
+        uint32_t d0, d1;
+        int placed = 0;
+
+        for (d0 = 0; d0 < (uint32_t)n && !placed; d0++) {
+            for (d1 = 0; d1 < (uint32_t)n && !placed; d1++) {
+                int j;
+
+                for (j = 0; j < bk->size; j++) {
+                    uint32_t s = slot_of(&kh[order[bk->first + j]], d0, d1, n);
+                    if (taken[s]) {
+                        break;
+                    }
+                    taken[s] = 1;
+                }
+
+                /* Collisione: annulla le prenotazioni e prova lo spostamento successivo */
+                if (j < bk->size) {
+                    while (--j >= 0) {
+                        taken[slot_of(&kh[order[bk->first + j]], d0, d1, n)] = 0;
+                    }
+                    continue;
+                }
+
+                ph->displacements[2 * bk->id] = d0;
+                ph->displacements[2 * bk->id + 1] = d1;
+                for (j = 0; j < bk->size; j++) {
+                    int key = order[bk->first + j];
+                    uint32_t s = slot_of(&kh[key], d0, d1, n);
+                    ph->slots[s].name = names[key];
+                    ph->slots[s].ref = refs[key];
+                }
+                placed = 1;
+            }
+        }
+
+        if (!placed) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Due nomi uguali non verrebbero mai separati da nessun seed */
+static int has_duplicates(char *const *names, int n) {
+    char **sorted;
+    int i, ret = 0;
+
+    if (n < 2) {
+        return 0;
+    }
+
+    sorted = malloc(sizeof(char *) * n);
+    if (sorted == NULL) {
+        return 1;
+    }
+    memcpy(sorted, names, sizeof(char *) * n);
+    qsort(sorted, n, sizeof(char *), name_cmp);
+
+    for (i = 1; i < n && !ret; i++) {
+        ret = strcmp(sorted[i - 1], sorted[i]) == 0;
+    }
+
+    free(sorted);
+    return ret;
+}
+
+int phash_build(struct phash *ph, char *const *names, const int *refs, int n) {
+
+    struct key_hash *kh;
+    struct bucket *buckets;
+    int *order;
+    char *taken;
+    int ret = 0;
+
+    memset(ph, 0, sizeof(struct phash));
+
+    if (has_duplicates(names, n)) {
+        return -1;
+    }
+
+    ph->n = n;
+    ph->n_buckets = n / PHASH_BUCKET_LOAD + 1;
+    ph->displacements = malloc(sizeof(uint32_t) * 2 * ph->n_buckets);
+    ph->slots = malloc(sizeof(struct phash_entry) * (n > 0 ? n : 1));
+
+    kh = malloc(sizeof(struct key_hash) * (n > 0 ? n : 1));
+    buckets = malloc(sizeof(struct bucket) * ph->n_buckets);
+    order = malloc(sizeof(int) * (n > 0 ? n : 1));
+    taken = malloc(n > 0 ? n : 1);
+
+    if (ph->displacements == NULL || ph->slots == NULL ||
+        kh == NULL || buckets == NULL || order == NULL || taken == NULL) {
+        ret = -1;
+    }
+
+    for (ph->seed = 0; ret == 0 && ph->seed < PHASH_SEEDS_MAX; ph->seed++) {
+        ret = try_build(ph, names, refs, kh, buckets, order, taken);
+        if (ret == 1) {
+            break;
+        }
+    }
+
+    free(kh);
+    free(buckets);
+    free(order);
+    free(taken);
+
+    if (ret != 1) {
+        phash_free(ph);
+        return -1;
+    }
+    return 0;
+}
+
+int phash_find(const struct phash *ph, const char *name) {
+    struct key_hash kh;
+    const struct phash_entry *e;
+    uint32_t b;
+
+    if (ph->n == 0) {
+        return -1;
+    }
+
+    split_hash(hash_name(name, ph->seed), ph->n, ph->n_buckets, &kh);
+    b = kh.bucket;
+    e = &ph->slots[slot_of(&kh, ph->displacements[2 * b], ph->displacements[2 * b + 1], ph->n)];
+
+    /* Un nome mai inserito finisce comunque in uno slot: serve il confronto */
+    if (strcmp(e->name, name) != 0) {
+        return -1;
+    }
+    return e->ref;
+}
+
+void phash_free(struct phash *ph) {
+    free(ph->displacements);
+    free(ph->slots);
+    ph->displacements = NULL;
+    ph->slots = NULL;
+    ph->n = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef LIB_SERVER_PHASH_H
+#define LIB_SERVER_PHASH_H
+
+#include <stdint.h>
+
+/**
+ * Hash perfetto minimale su un insieme di nomi (schema hash-and-displace).
+ *
+ * Ogni nome viene associato ad un intero *ref* scelto dal chiamante.
+ * La ricerca calcola un solo hash del nome, legge lo spostamento del
+ *  suo bucket e confronta il nome con l'unico slot candidato: non viene
+ *  mai esaminato nessun altro nome.
+ */
+
+struct phash_entry {
+    const char *name;   /* Non viene copiato, deve sopravvivere alla tabella */
+    int ref;
+};
+
+struct phash {
+    int n;              /* Numero di nomi, coincide con il numero di slot */
+    int n_buckets;
+    uint32_t seed;
+
+    /* Coppie (d0, d1) di spostamenti, una per bucket */
+    uint32_t *displacements;
+
+    struct phash_entry *slots;
+};
+
+/**
+ * Costruisce in *ph* la tabella per gli *n* nomi in *names*,
+ *  associando a *names[i]* il valore *refs[i]*.
+ * I nomi devono essere tutti diversi.
+ * Ritorna -1 in caso di memoria esaurita o di nomi duplicati.
+ */
+int phash_build(struct phash *ph, char *const *names, const int *refs, int n);
+
+/* Ritorna il *ref* associato a *name*, -1 se il nome non è presente */
+int phash_find(const struct phash *ph, const char *name);
+
+/* Libera la memoria occupata da *ph* (che può essere azzerata) */
+void phash_free(struct phash *ph);
+
+#endif
@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "puzzle.h"
+
+/* Massima profondità di una catena di segnali tra oggetti (evita i cicli) */
+#define SIGNAL_DEPTH_MAX 16
+
+void reset_player(const struct puzzle *pz, int tot_objects, struct player_state *ps) {
+    int i;
+    for (i = 0; i < tot_objects; i++) {
+        ps->objects[i].state = pz->first_state[i];
+        ps->objects[i].in_inventory = 0;
+        ps->objects[i].used = 0;
+    }
+    ps->n_objects = 0;
+    ps->n_tokens = 0;
+}
+
+/* Ritorna l'indice della prima condizione di *tr* non soddisfatta, -1 se lo sono tutte */
+static int failed_guard(const struct puzzle *pz, const struct player_state *ps,
+        const struct transition *tr) {
+
+    int i;
+
+    for (i = tr->first_guard; i < tr->first_guard + tr->n_guards; i++) {
+        const struct guard *g = &pz->guards[i];
+        int ok = 0;
+
+        switch (g->kind) {
+            case GUARD_HELD:
+                ok = ps->objects[g->object].in_inventory;
+                break;
+            case GUARD_NOT_HELD:
+                ok = !ps->objects[g->object].in_inventory;
+                break;
+            case GUARD_STATE:
+                ok = ps->objects[g->object].state == g->value;
+                break;
+            case GUARD_TOKENS:
+                ok = ps->n_tokens >= g->value;
+                break;
+        }
+
+        if (!ok) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void fire(const struct puzzle *pz, struct player_state *ps, int obj,
+        enum EVENT event, int target, struct outcome *out, int depth);
+
+/* Applica gli effetti di *tr*, ritorna 1 se tra questi c'è un EFFECT_ASK */
+static int apply_effects(const struct puzzle *pz, struct player_state *ps,
+        const struct transition *tr, int depth) {
+
+    struct outcome ignored;
+    int i, asked = 0;
+
+    for (i = tr->first_effect; i < tr->first_effect + tr->n_effects; i++) {
+        const struct effect *e = &pz->effects[i];
+        struct object_status *os = &ps->objects[e->object];
+
+        switch (e->kind) {
+            case EFFECT_PICKUP:
+                if (!os->in_inventory) {
+                    os->in_inventory = 1;
+                    ps->n_objects++;
+                }
+                break;
+            case EFFECT_TOKEN:
+                ps->n_tokens++;
+                break;
+            case EFFECT_SIGNAL:
+                if (depth < SIGNAL_DEPTH_MAX) {
+                    fire(pz, ps, e->object, EV_SIGNAL, TARGET_NONE, &ignored, depth + 1);
+                }
+                break;
+            case EFFECT_SET:
+                os->state = e->value;
+                break;
+            case EFFECT_ASK:
+                asked = 1;
+                break;
+        }
+    }
+    return asked;
+}
+
+static void fire(const struct puzzle *pz, struct player_state *ps, int obj,
+        enum EVENT event, int target, struct outcome *out, int depth) {
+
+    int slot = ps->objects[obj].state * EV_MAX + event;
+    int i;
+
+    out->transition = -1;
+    out->message = NULL;
+    out->guard = -1;
+    out->asked = 0;
+
+    for (i = pz->dispatch[slot]; i < pz->dispatch[slot + 1]; i++) {
+        const struct transition *tr = &pz->transitions[i];
+        int g;
+
+        if (tr->target != TARGET_ANY && tr->target != target) {
+            continue;
+        }
+
+        /**
+         * Se le condizioni non sono soddisfatte si prova la transizione
+         *  successiva, ricordando il primo messaggio di errore incontrato.
+         */
+        g = failed_guard(pz, ps, tr);
+        if (g != -1) {
+            if (out->message == NULL) {
+                out->message = pz->guards[g].fail_msg;
+                out->guard = g;
+            }
+            continue;
+        }
+
+        /* Lo stato cambia prima degli effetti, così un segnale a se stessi vede quello nuovo */
+        ps->objects[obj].state = tr->next_state;
+        out->asked = apply_effects(pz, ps, tr, depth);
+        out->transition = i;
+        out->message = tr->message;
+        out->guard = -1;
+        return;
+    }
+}
+
+void fire_event(const struct puzzle *pz, struct player_state *ps, int obj,
+        enum EVENT event, int target, struct outcome *out) {
+    fire(pz, ps, obj, event, target, out, 0);
+}
+
+/**
+ * Porta la capacità di *array* (di elementi grandi *size*) ad almeno
+ *  *count* + 1 elementi, raddoppiandola se necessario.
+ * Ritorna -1 se la memoria è esaurita.
+ */
+static int reserve(void *array, int count, int *capacity, size_t size) {
+    void **ptr = array;
+    void *bigger;
+    int cap = *capacity == 0 ? 8 : 2 * *capacity;
+
+    if (count < *capacity) {
+        return 0;
+    }
+    bigger = realloc(*ptr, size * cap);
+    if (bigger == NULL) {
+        return -1;
+    }
+    *ptr = bigger;
+    *capacity = cap;
+    return 0;
+}
+
+/* Riduce *array* a *count* elementi, se fallisce lo lascia com'è */
+static void shrink(void *array, int count, size_t size) {
+    void **ptr = array;
+    void *smaller;
+
+    if (count > 0 && (smaller = realloc(*ptr, size * count)) != NULL) {
+        *ptr = smaller;
+    }
+}
+
+void puzzle_begin(struct puzzle_builder *b, struct puzzle *pz) {
+    memset(b, 0, sizeof(struct puzzle_builder));
+    memset(pz, 0, sizeof(struct puzzle));
+    b->pz = pz;
+}
+
+int puzzle_add_object(struct puzzle_builder *b) {
+    if (reserve(&b->pz->first_state, b->n_objects, &b->objects_capacity, sizeof(int)) == -1) {
+        return -1;
+    }
+    b->pz->first_state[b->n_objects] = b->pz->n_states;
+    return b->n_objects++;
+}
+
+int puzzle_add_state(struct puzzle_builder *b, const char *name, const char *look) {
+    struct puzzle *pz = b->pz;
+    int cap = b->states_capacity;   /* I due array crescono insieme */
+
+    if (reserve(&pz->state_names, pz->n_states, &cap, sizeof(char *)) == -1 ||
+        reserve(&pz->state_looks, pz->n_states, &b->states_capacity, sizeof(char *)) == -1) {
+        return -1;
+    }
+    pz->state_names[pz->n_states] = name;
+    pz->state_looks[pz->n_states] = look;
+    return pz->n_states++;
+}
+
+struct transition* puzzle_add_transition(struct puzzle_builder *b, int from, enum EVENT event) {
+    struct puzzle *pz = b->pz;
+    struct transition *tr;
+    int cap = b->transitions_capacity;  /* I due array crescono insieme */
+
+    if (reserve(&pz->transitions, pz->n_transitions, &cap, sizeof(struct transition)) == -1 ||
+        reserve(&b->slots, pz->n_transitions, &b->transitions_capacity, sizeof(int)) == -1) {
+        return NULL;
+    }
+
+    b->slots[pz->n_transitions] = from * EV_MAX + event;
+    tr = &pz->transitions[pz->n_transitions++];
+    memset(tr, 0, sizeof(struct transition));
+    tr->target = TARGET_ANY;
+    tr->next_state = from;
+    return tr;
+}
+
+int puzzle_add_guard(struct puzzle_builder *b, enum GUARD_KIND kind, int object, int value, const char *fail_msg) {
+    struct puzzle *pz = b->pz;
+    struct guard *g;
+
+    if (reserve(&pz->guards, pz->n_guards, &b->guards_capacity, sizeof(struct guard)) == -1) {
+        return -1;
+    }
+    g = &pz->guards[pz->n_guards];
+    g->kind = kind;
+    g->object = object;
+    g->value = value;
+    g->fail_msg = fail_msg;
+    return pz->n_guards++;
+}
+
+int puzzle_add_effect(struct puzzle_builder *b, enum EFFECT_KIND kind, int object, int value) {
+    struct puzzle *pz = b->pz;
+    struct effect *e;
+
+    if (reserve(&pz->effects, pz->n_effects, &b->effects_capacity, sizeof(struct effect)) == -1) {
+        return -1;
+    }
+    e = &pz->effects[pz->n_effects];
+    e->kind = kind;
+    e->object = object;
+    e->value = value;
+    return pz->n_effects++;
+}
+
+int puzzle_finish(struct puzzle_builder *b) {
+    struct puzzle *pz = b->pz;
+    struct transition *sorted;
+    int *next;
+    int n_slots = pz->n_states * EV_MAX;
+    int i;
+
+    if (reserve(&pz->first_state, b->n_objects, &b->objects_capacity, sizeof(int)) == -1) {
+        free(b->slots);
+        return -1;
+    }
+    pz->first_state[b->n_objects] = pz->n_states;
+
+    /**
+     * Ordinamento stabile delle transizioni per (stato, evento) con un
+     *  counting sort: dispatch[s] diventa l'indice della prima transizione
+     *  dello slot s, mentre *next* tiene il punto in cui inserire la prossima.
+     */
+    pz->dispatch = calloc(n_slots + 1, sizeof(int));
+    next = malloc(sizeof(int) * (n_slots + 1));
+    sorted = malloc(sizeof(struct transition) * (pz->n_transitions > 0 ? pz->n_transitions : 1));
+    if (pz->dispatch == NULL || next == NULL || sorted == NULL) {
+        free(next);
+        free(sorted);
+        free(b->slots);
+        return -1;
+    }
+
+    for (i = 0; i < pz->n_transitions; i++) {
+        pz->dispatch[b->slots[i] + 1]++;
+    }
+    for (i = 0; i < n_slots; i++) {
+        pz->dispatch[i + 1] += pz->dispatch[i];
+    }
+    memcpy(next, pz->dispatch, sizeof(int) * (n_slots + 1));
+    for (i = 0; i < pz->n_transitions; i++) {
+        sorted[next[b->slots[i]]++] = pz->transitions[i];
+    }
+
+    free(pz->transitions);
+    pz->transitions = sorted;
+    free(next);
+    free(b->slots);
+    b->slots = NULL;
+
+    shrink(&pz->first_state, b->n_objects + 1, sizeof(int));
+    shrink(&pz->state_names, pz->n_states, sizeof(char *));
+    shrink(&pz->state_looks, pz->n_states, sizeof(char *));
+    shrink(&pz->guards, pz->n_guards, sizeof(struct guard));
+    shrink(&pz->effects, pz->n_effects, sizeof(struct effect));
+
+    return 0;
+}
+
+void free_puzzle(struct puzzle *pz) {
+    free(pz->first_state);
+    free(pz->dispatch);
+    free(pz->transitions);
+    free(pz->guards);
+    free(pz->effects);
+    free(pz->state_names);
+    free(pz->state_looks);
+}
@@ -0,0 +1,195 @@
+#ifndef LIB_SERVER_PUZZLE_H
+#define LIB_SERVER_PUZZLE_H
+
+/**
+ * Macchina a stati degli oggetti di una room.
+ *
+ * Ogni oggetto ha un insieme di stati (il primo è quello iniziale) e
+ *  delle transizioni, ognuna innescata da un evento: il giocatore prende
+ *  l'oggetto, lo usa (da solo o con un altro), risponde correttamente
+ *  all'enigma che l'oggetto gli ha posto, oppure un altro oggetto gli
+ *  invia un segnale. Una transizione può avere delle condizioni (guard)
+ *  e degli effetti, e porta l'oggetto in un nuovo stato.
+ *
+ * Al caricamento della room le transizioni vengono compilate in tabelle
+ *  dense: gli stati di tutti gli oggetti sono numerati in un unico spazio
+ *  e dispatch[stato * EV_MAX + evento] indica le transizioni candidate,
+ *  per cui ogni comando si risolve con un solo accesso indicizzato.
+ */
+
+enum EVENT {
+    EV_TAKE,    /* take oggetto */
+    EV_USE,     /* use oggetto [bersaglio] */
+    EV_ANSWER,  /* Risposta corretta all'enigma posto dall'oggetto */
+    EV_SIGNAL,  /* Inviato da un effetto EFFECT_SIGNAL di un altro oggetto */
+    EV_MAX
+};
+
+/* Bersagli speciali di una transizione (altrimenti è l'indice di un oggetto) */
+#define TARGET_NONE -1      /* L'oggetto è stato usato da solo */
+#define TARGET_UNKNOWN -2   /* Il secondo argomento non è il nome di nessun oggetto */
+#define TARGET_ANY -3       /* Qualsiasi bersaglio, compresi i due precedenti */
+
+enum GUARD_KIND {
+    GUARD_HELD,         /* *object* è nell'inventario */
+    GUARD_NOT_HELD,     /* *object* non è nell'inventario */
+    GUARD_STATE,        /* *object* si trova nello stato *value* */
+    GUARD_TOKENS        /* Il giocatore ha almeno *value* token */
+};
+
+enum EFFECT_KIND {
+    EFFECT_PICKUP,      /* L'oggetto finisce nell'inventario */
+    EFFECT_TOKEN,       /* Il giocatore riceve un token */
+    EFFECT_SIGNAL,      /* Invia EV_SIGNAL a *object* */
+    EFFECT_SET,         /* Porta *object* nello stato *value* */
+    EFFECT_ASK          /* Pone l'enigma della transizione */
+};
+
+struct guard {
+    int kind;           /* enum GUARD_KIND */
+    int object;
+    int value;
+    const char *fail_msg;   /* Risposta se la condizione non è soddisfatta, può essere NULL */
+};
+
+struct effect {
+    int kind;           /* enum EFFECT_KIND */
+    int object;
+    int value;
+};
+
+struct transition {
+    int target;         /* Solo per EV_USE, uno dei TARGET_* o un oggetto */
+    int next_state;     /* Stato (globale) di arrivo */
+    int first_guard, n_guards;
+    int first_effect, n_effects;
+
+    /* Risposta al giocatore, se c'è un EFFECT_ASK è il testo dell'enigma */
+    const char *message;
+
+    /* Risposta attesa dall'enigma, NULL se non c'è un EFFECT_ASK */
+    const char *answer;
+};
+
+/**
+ * Tabelle compilate della macchina a stati di una room.
+ * Gli stati dell'oggetto i sono quelli di indice
+ *  [first_state[i], first_state[i + 1]), il primo è quello iniziale.
+ */
+struct puzzle {
+    int n_states;
+    int *first_state;           /* tot_objects + 1 elementi */
+
+    /**
+     * Le transizioni candidate per lo stato s e l'evento e sono quelle
+     *  di indice [dispatch[s * EV_MAX + e], dispatch[s * EV_MAX + e + 1])
+     *  e vengono provate nell'ordine in cui compaiono nel file.
+     */
+    int *dispatch;
+    struct transition *transitions;
+    struct guard *guards;
+    struct effect *effects;
+    int n_transitions, n_guards, n_effects;
+
+    /* Campi consultati solo per comporre le risposte */
+    const char **state_names;
+    const char **state_looks;
+};
+
+/* Lo stato di un oggetto per un giocatore, l'oggetto è identificato dalla posizione */
+struct object_status {
+    int state;                  /* Stato globale corrente */
+    unsigned char in_inventory; /* 0 o 1, indica se l'oggetto è attualmente nell'inventario o meno */
+
+    /* Vero se è stato usato (USE) dall'ultima volta che è stato posato, lo aggiorna il motore di gioco */
+    unsigned char used;
+};
+
+/* Tutto ciò su cui operano le transizioni */
+struct player_state {
+    struct object_status *objects;
+    int n_objects, n_tokens;    /* Numero di oggetti e di token attualmente posseduti */
+};
+
+/* Esito di fire_event(...) */
+struct outcome {
+    /* Transizione eseguita, -1 se nessuna è stata eseguita */
+    int transition;
+
+    /**
+     * Testo della risposta: il messaggio della transizione, quello della
+     *  condizione non soddisfatta, oppure NULL se nessuna transizione
+     *  era candidata (il chiamante risponde con un messaggio di default).
+     */
+    const char *message;
+
+    /* Se message viene da una condizione non soddisfatta è il suo indice, altrimenti -1 */
+    int guard;
+
+    /* 1 se la transizione ha posto un enigma (message è la domanda) */
+    int asked;
+};
+
+/* Porta tutti gli oggetti nel loro stato iniziale e svuota l'inventario */
+void reset_player(const struct puzzle *pz, int tot_objects, struct player_state *ps);
+
+/**
+ * Innesca l'evento *event* sull'oggetto *obj* (con bersaglio *target* per
+ *  EV_USE, altrimenti TARGET_NONE) ed esegue la prima transizione candidata
+ *  le cui condizioni sono soddisfatte, aggiornando *ps*.
+ */
+void fire_event(const struct puzzle *pz, struct player_state *ps, int obj,
+    enum EVENT event, int target, struct outcome *out);
+
+/**
+ * Costruzione delle tabelle di una room, usata dal caricamento.
+ * Gli oggetti vanno aggiunti in ordine, ognuno seguito dai suoi stati;
+ *  le transizioni possono essere aggiunte in qualsiasi ordine, quelle
+ *  con lo stesso stato di partenza e lo stesso evento verranno provate
+ *  nell'ordine in cui sono state aggiunte.
+ * I testi non vengono copiati, devono sopravvivere alle tabelle.
+ */
+struct puzzle_builder {
+    struct puzzle *pz;
+    int n_objects;
+    int *slots;     /* stato * EV_MAX + evento di ogni transizione aggiunta */
+    int objects_capacity, states_capacity, transitions_capacity;
+    int guards_capacity, effects_capacity;
+};
+
+void puzzle_begin(struct puzzle_builder *b, struct puzzle *pz);
+
+/* Ritorna l'indice del nuovo oggetto, -1 se la memoria è esaurita */
+int puzzle_add_object(struct puzzle_builder *b);
+
+/* Aggiunge uno stato all'ultimo oggetto, ritorna il suo indice globale o -1 */
+int puzzle_add_state(struct puzzle_builder *b, const char *name, const char *look);
+
+/**
+ * Aggiunge una transizione da *from* per l'evento *event*, con bersaglio
+ *  TARGET_ANY, senza condizioni ed effetti, che resta in *from*.
+ * Il puntatore ritornato (NULL se la memoria è esaurita) resta valido
+ *  fino alla prossima chiamata di puzzle_add_transition(...).
+ */
+struct transition* puzzle_add_transition(struct puzzle_builder *b, int from, enum EVENT event);
+
+/**
+ * Aggiungono una condizione o un effetto e ne ritornano l'indice (-1 se
+ *  la memoria è esaurita): il chiamante li assegna alle transizioni
+ *  tramite gli intervalli first_guard/n_guards e first_effect/n_effects,
+ *  che possono essere condivisi da più transizioni.
+ */
+int puzzle_add_guard(struct puzzle_builder *b, enum GUARD_KIND kind, int object, int value, const char *fail_msg);
+int puzzle_add_effect(struct puzzle_builder *b, enum EFFECT_KIND kind, int object, int value);
+
+/**
+ * Costruisce la tabella dispatch e riduce gli array alla dimensione esatta.
+ * Va chiamata anche in caso di errore, per liberare *b*.
+ * Ritorna -1 se la memoria è esaurita.
+ */
+int puzzle_finish(struct puzzle_builder *b);
+
+/* Libera le tabelle di *pz* (i testi appartengono al catalogo) */
+void free_puzzle(struct puzzle *pz);
+
+#endif
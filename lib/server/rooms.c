@@ -1,156 +1,1611 @@
-
-#include <string.h> 
-#include <stdlib.h> 
-#include <stdio.h> 
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #include "rooms.h"
+#include "hints.h"
+#include "../mystdlib.h"
 
-struct room *g_rooms;
+/* Lunghezza massima di una riga di ROOMS_FILE (i testi di look sono lunghi) */
+#define ROOM_LINE_MAX 4096
 
-int init_rooms(void) {
+struct catalogue *g_catalogue = NULL;
+
+static unsigned long g_next_version = 1;
+static int g_versions_alive = 0;
+
+/**
+ * Thread che costruisce le tabelle dei suggerimenti delle versioni
+ *  ricaricate (vedi rooms_builder_start(...)). g_builder_next è la
+ *  versione che aspetta di essere costruita, protetta da *g_builder_world*
+ *  come il resto del catalogo.
+ */
+static pthread_mutex_t *g_builder_world = NULL;
+static pthread_cond_t g_builder_cond = PTHREAD_COND_INITIALIZER;
+static struct catalogue *g_builder_next = NULL;
+static void (*g_builder_ready)(const struct catalogue *c);
+
+/* Numero di prese di un oggetto descritte dalla chiave take */
+#define TAKE_STEPS 3
+
+enum TAKE_STATUS {
+    OBJ_GIVE_TOKEN,         /* Quando l'oggetto viene preso rilascia un token */
+    OBJ_UNLOCKED,           /* L'oggetto non è bloccato da niente */
+    OBJ_LOCKED_BY_USE,      /* L'oggetto è bloccato dall'utilizzo di un altro oggetto */
+    OBJ_LOCKED_BY_Q         /* L'oggetto è bloccato da una domanda */
+};
+
+/**
+ * Un oggetto descritto dalla sequenza take viene compilato in una macchina
+ *  con (TAKE_STEPS + 1) * 2 stati: quante prese sono già avvenute (l'ultimo
+ *  passo ripete quello finale della sequenza) e se l'oggetto è già stato usato.
+ */
+#define TAKE_STATES ((TAKE_STEPS + 1) * 2)
+#define TAKE_STATE(step, used) ((step) * 2 + (used))
+
+static const char *g_take_state_names[TAKE_STATES] = {
+    "presa0", "presa0_usato", "presa1", "presa1_usato",
+    "presa2", "presa2_usato", "presa3", "presa3_usato"
+};
+
+/* Elemento a cui si riferiscono le chiavi lette dal file */
+enum PARSE_CONTEXT {
+    CTX_NONE,
+    CTX_ROOM,
+    CTX_LOCATION,
+    CTX_OBJECT
+};
+
+/* Chiavi con cui è descritto il comportamento di un oggetto */
+enum OBJECT_SYNTAX {
+    SYNTAX_NONE,        /* Nessuna, l'oggetto si può solo raccogliere */
+    SYNTAX_TAKE,        /* take, use_with, locked_look, ... */
+    SYNTAX_STATES       /* state, on, require, effect, ... */
+};
+
+/**
+ * Descrizione di un oggetto così come è scritta nel file. I riferimenti
+ *  ad altri oggetti ed ai loro stati sono nomi, che vengono risolti alla
+ *  chiusura della room (un oggetto può riferirsi ad uno definito dopo).
+ * Tutte le stringhe appartengono al catalogo.
+ */
+struct state_spec {
+    char *name;
+    char *look;
+};
+
+struct guard_spec {
+    int kind;           /* enum GUARD_KIND */
+    char *object;       /* Nome dell'oggetto, "self" per quello che definisce la transizione */
+    char *state;        /* Solo per GUARD_STATE */
+    int value;          /* Solo per GUARD_TOKENS */
+    char *fail_msg;
+};
+
+struct effect_spec {
+    int kind;           /* enum EFFECT_KIND */
+    char *object;
+    char *state;        /* Solo per EFFECT_SET */
+};
+
+struct transition_spec {
+    char *from;         /* "*" per tutti gli stati dell'oggetto */
+    char *to;           /* NULL se l'oggetto resta nello stato di partenza */
+    int event;          /* enum EVENT */
+    char *target;       /* Solo per use, NULL se l'oggetto va usato da solo */
+    int first_guard, n_guards;
+    int first_effect, n_effects;
+    char *message;
+    char *question, *answer;
+};
+
+struct object_spec {
+    int syntax;         /* enum OBJECT_SYNTAX */
+
+    /* SYNTAX_TAKE */
+    unsigned char take[TAKE_STEPS];
+    char *use_with;
+    char *locked_look, *unlocked_look, *use_msg, *take_q, *take_a;
+
+    /* SYNTAX_STATES, intervalli negli array del parser */
+    int first_state, n_states;
+    int first_transition, n_transitions;
+
+    int tokens;         /* Token che l'oggetto può assegnare */
+    int state_base;     /* Indice globale del primo stato, calcolato alla compilazione */
+};
+
+/**
+ * Stato del parser: la room aperta, gli indici dell'ultima locazione e
+ *  dell'ultimo oggetto letti, la capacità degli array della room (che
+ *  crescono durante la lettura) e la descrizione degli oggetti della
+ *  room, che viene compilata in struct puzzle alla sua chiusura.
+ */
+struct parser {
+    const char *path;
+    int line;
+    enum PARSE_CONTEXT ctx;
+    struct catalogue *catalogue;
+    struct room *room;
+    int location, object;
+    int locations_capacity, objects_capacity;
+
+    /* Valore della chiave tokens della room aperta, -1 se assente */
+    int tokens;
+
+    /* objects ha un elemento per ogni oggetto della room */
+    struct object_spec *objects;
+    struct state_spec *states;
+    struct transition_spec *transitions;
+    struct guard_spec *guards;
+    struct effect_spec *effects;
+    int n_states, n_transitions, n_guards, n_effects;
+    int states_capacity, transitions_capacity, guards_capacity, effects_capacity;
+};
+
+#define CUR_LOCATION(p) (&(p)->room->locations[(p)->location])
+#define CUR_OBJECT(p) (&(p)->objects[(p)->object])
+#define CUR_OBJECT_NAME(p) ((p)->room->object_names[(p)->object])
+
+static void parse_error(struct parser *p, const char *msg, const char *arg) {
+    printf(ANSI_COLOR_YELLOW "[Warning]: %s:%d: %s%s\n" ANSI_COLOR_RESET,
+        p->path, p->line, msg, arg);
+}
+
+/**
+ * Copia *src* in un nuovo buffer, traducendo le sequenze
+ *  di escape "\\n" e "\\\\". Ritorna NULL se la memoria è esaurita.
+ */
+static char* unescape_dup(const char *src) {
+    char *dst;
+    int i, j;
+
+    dst = malloc(strlen(src) + 1);
+    if (dst == NULL) {
+        return NULL;
+    }
+
+    for (i = 0, j = 0; src[i] != '\0'; i++, j++) {
+        if (src[i] == '\\' && src[i + 1] == 'n') {
+            dst[j] = '\n';
+            i++;
+        }
+        else if (src[i] == '\\' && src[i + 1] == '\\') {
+            dst[j] = '\\';
+            i++;
+        }
+        else {
+            dst[j] = src[i];
+        }
+    }
+    dst[j] = '\0';
+
+    return dst;
+}
+
+/**
+ * Porta la capacità di *array* (di elementi grandi *size*) ad
+ *  almeno *count* + 1 elementi, raddoppiandola se necessario.
+ * Ritorna -1 se la memoria è esaurita.
+ */
+static int grow(void *array, int count, int *capacity, size_t size) {
+    void **ptr = array;
+    void *bigger;
+    int cap = *capacity == 0 ? 4 : 2 * *capacity;
+
+    if (count < *capacity) {
+        return 0;
+    }
+    bigger = realloc(*ptr, size * cap);
+    if (bigger == NULL) {
+        return -1;
+    }
+    *ptr = bigger;
+    *capacity = cap;
+    return 0;
+}
+
+/**
+ * Registra *str* (allocata con malloc) tra i testi del catalogo *c*,
+ *  che la libererà. Ritorna *str*, NULL se la memoria è esaurita.
+ */
+static char* pool_add(struct catalogue *c, char *str) {
+    if (str == NULL) {
+        return NULL;
+    }
+    if (grow(&c->strings, c->n_strings, &c->strings_capacity, sizeof(char *)) == -1) {
+        free(str);
+        return NULL;
+    }
+    c->strings[c->n_strings++] = str;
+    return str;
+}
+
+/* Come unescape_dup(...), ma la copia appartiene al catalogo in costruzione */
+static char* pool_dup(struct parser *p, const char *src) {
+    return pool_add(p->catalogue, unescape_dup(src));
+}
+
+/**
+ * Termina la prima parola di *value* e ritorna il resto della riga
+ *  (senza spazi iniziali), una stringa vuota se non c'è.
+ */
+static char* split_word(char *value) {
+    char *rest;
+
+    for (rest = value; *rest != '\0' && *rest != ' ' && *rest != '\t'; rest++) ;
+    if (*rest != '\0') {
+        *rest = '\0';
+        for (rest++; *rest == ' ' || *rest == '\t'; rest++) ;
+    }
+    return rest;
+}
+
+static int parse_take_status(const char *word, enum TAKE_STATUS *ts) {
+    if (strcmp(word, "GIVE_TOKEN") == 0) {
+        *ts = OBJ_GIVE_TOKEN;
+    }
+    else if (strcmp(word, "UNLOCKED") == 0) {
+        *ts = OBJ_UNLOCKED;
+    }
+    else if (strcmp(word, "LOCKED_BY_USE") == 0) {
+        *ts = OBJ_LOCKED_BY_USE;
+    }
+    else if (strcmp(word, "LOCKED_BY_Q") == 0) {
+        *ts = OBJ_LOCKED_BY_Q;
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Interpreta la sequenza di stati "take" (separati da spazi).
+ * Gli stati non specificati ripetono l'ultimo, così un oggetto
+ *  che ha esaurito la sequenza resta nel suo stato finale (un token
+ *  però viene rilasciato una volta sola, dopo si resta UNLOCKED).
+ */
+static int parse_take(struct parser *p, char *value) {
+    unsigned char *take = CUR_OBJECT(p)->take;
+    enum TAKE_STATUS ts;
+    char *word;
+    int i = 0;
+
+    for (word = strtok(value, " "); word != NULL; word = strtok(NULL, " ")) {
+        if (i == TAKE_STEPS) {
+            parse_error(p, "troppi stati take, al massimo ", "3");
+            return -1;
+        }
+        if (parse_take_status(word, &ts) == -1) {
+            parse_error(p, "stato take sconosciuto: ", word);
+            return -1;
+        }
+        take[i] = ts;
+        i++;
+    }
+
+    if (i == 0) {
+        parse_error(p, "la chiave take richiede almeno uno stato", "");
+        return -1;
+    }
+
+    for (; i < TAKE_STEPS; i++) {
+        take[i] = take[i - 1] == OBJ_GIVE_TOKEN ? OBJ_UNLOCKED : take[i - 1];
+    }
+    return 0;
+}
+
+/* Aggiunge una locazione vuota alla room aperta */
+static int add_location(struct parser *p) {
+    struct room *r = p->room;
+
+    if (grow(&r->locations, r->n_locations, &p->locations_capacity, sizeof(struct location)) == -1) {
+        return -1;
+    }
+
+    p->location = r->n_locations;
+    memset(&r->locations[p->location], 0, sizeof(struct location));
+    r->locations[p->location].first_object = r->tot_objects;
+    r->n_locations++;
+    return 0;
+}
+
+/* Aggiunge un oggetto vuoto alla room aperta */
+static int add_object(struct parser *p) {
+    struct room *r = p->room;
+    struct object_spec *o;
+    int n = r->tot_objects;
+    int cap = p->objects_capacity;  /* I due array crescono insieme */
+    int i;
+
+    if (grow(&r->object_names, n, &cap, sizeof(char *)) == -1 ||
+        grow(&p->objects, n, &p->objects_capacity, sizeof(struct object_spec)) == -1) {
+        return -1;
+    }
+
+    p->object = n;
+    r->object_names[n] = NULL;
+    o = &p->objects[n];
+    memset(o, 0, sizeof(struct object_spec));
+    for (i = 0; i < TAKE_STEPS; i++) {
+        o->take[i] = OBJ_UNLOCKED;
+    }
+    o->first_state = p->n_states;
+    o->first_transition = p->n_transitions;
+
+    r->tot_objects++;
+    r->locations[p->location].n_objects++;
+    return 0;
+}
+
+/* Riduce gli array della room aperta alla dimensione esatta */
+static void shrink_room(struct room *r) {
+    void *ptr;
+
+    if (r->n_locations > 0 && (ptr = realloc(r->locations, sizeof(struct location) * r->n_locations)) != NULL) {
+        r->locations = ptr;
+    }
+    if (r->tot_objects > 0 && (ptr = realloc(r->object_names, sizeof(char *) * r->tot_objects)) != NULL) {
+        r->object_names = ptr;
+    }
+}
+
+/* Libera la descrizione degli oggetti della room aperta */
+static void free_specs(struct parser *p) {
+    free(p->objects);
+    free(p->states);
+    free(p->transitions);
+    free(p->guards);
+    free(p->effects);
+    p->objects = NULL;
+    p->states = NULL;
+    p->transitions = NULL;
+    p->guards = NULL;
+    p->effects = NULL;
+    p->n_states = p->n_transitions = p->n_guards = p->n_effects = 0;
+    p->objects_capacity = p->states_capacity = p->transitions_capacity = 0;
+    p->guards_capacity = p->effects_capacity = 0;
+}
+
+/**
+ * Le chiavi take/use_with e state/on descrivono lo stesso comportamento
+ *  in due modi diversi, un oggetto deve usarne uno solo.
+ */
+static int set_syntax(struct parser *p, enum OBJECT_SYNTAX syntax) {
+    struct object_spec *o = CUR_OBJECT(p);
+
+    if (o->syntax != SYNTAX_NONE && o->syntax != (int)syntax) {
+        parse_error(p, "chiavi take/use_with e state/on mescolate nell'oggetto ", CUR_OBJECT_NAME(p));
+        return -1;
+    }
+    o->syntax = syntax;
+    return 0;
+}
+
+static int parse_event(const char *word) {
+    if (strcmp(word, "take") == 0) return EV_TAKE;
+    if (strcmp(word, "use") == 0) return EV_USE;
+    if (strcmp(word, "answer") == 0) return EV_ANSWER;
+    if (strcmp(word, "signal") == 0) return EV_SIGNAL;
+    return -1;
+}
+
+/* state <nome> <descrizione> */
+static int parse_state(struct parser *p, char *value) {
+    struct state_spec *st;
+    char *look = split_word(value);
+
+    if (value[0] == '\0') {
+        parse_error(p, "la chiave state richiede un nome", "");
+        return -1;
+    }
+    if (grow(&p->states, p->n_states, &p->states_capacity, sizeof(struct state_spec)) == -1) {
+        return -1;
+    }
+
+    st = &p->states[p->n_states++];
+    CUR_OBJECT(p)->n_states++;
+    st->name = pool_dup(p, value);
+    st->look = pool_dup(p, look);
+    return st->name == NULL || st->look == NULL ? -1 : 0;
+}
+
+/* on <stato|*> <evento> [bersaglio] [-> <stato>] */
+static int parse_on(struct parser *p, char *value) {
+    struct transition_spec *tr;
+    char *words[5];
+    char *word, *target = NULL, *to = NULL;
+    int n = 0, event;
+
+    for (word = strtok(value, " \t"); word != NULL; word = strtok(NULL, " \t")) {
+        if (n == 5) {
+            parse_error(p, "troppi argomenti per la chiave on", "");
+            return -1;
+        }
+        words[n++] = word;
+    }
+
+    if (n < 2 || (event = parse_event(words[1])) == -1) {
+        parse_error(p, "la chiave on richiede uno stato ed un evento tra take, use, answer e signal", "");
+        return -1;
+    }
+
+    if (n == 3) {
+        target = words[2];
+    }
+    else if (n == 4 && strcmp(words[2], "->") == 0) {
+        to = words[3];
+    }
+    else if (n == 5 && strcmp(words[3], "->") == 0) {
+        target = words[2];
+        to = words[4];
+    }
+    else if (n != 2) {
+        parse_error(p, "sintassi: on <stato|*> <evento> [bersaglio] [-> <stato>]", "");
+        return -1;
+    }
+
+    if (target != NULL && event != EV_USE) {
+        parse_error(p, "il bersaglio è ammesso solo per l'evento use: ", target);
+        return -1;
+    }
+
+    if (grow(&p->transitions, p->n_transitions, &p->transitions_capacity, sizeof(struct transition_spec)) == -1) {
+        return -1;
+    }
+
+    tr = &p->transitions[p->n_transitions++];
+    CUR_OBJECT(p)->n_transitions++;
+    memset(tr, 0, sizeof(struct transition_spec));
+    tr->event = event;
+    tr->first_guard = p->n_guards;
+    tr->first_effect = p->n_effects;
+
+    if ((tr->from = pool_dup(p, words[0])) == NULL ||
+        (target != NULL && (tr->target = pool_dup(p, target)) == NULL) ||
+        (to != NULL && (tr->to = pool_dup(p, to)) == NULL)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* L'ultima transizione dell'oggetto aperto, NULL se non ne ha */
+static struct transition_spec* cur_transition(struct parser *p, const char *key) {
+    if (CUR_OBJECT(p)->n_transitions == 0) {
+        parse_error(p, "chiave prima di una transizione (on): ", key);
+        return NULL;
+    }
+    return &p->transitions[p->n_transitions - 1];
+}
+
+/**
+ * require held|not_held <oggetto> [messaggio]
+ * require state <oggetto> <stato> [messaggio]
+ * require tokens <n> [messaggio]
+ */
+static int parse_require(struct parser *p, char *value) {
+    struct transition_spec *tr = cur_transition(p, "require");
+    struct guard_spec *g;
+    char *arg, *state = NULL, *fail;
+
+    if (tr == NULL) {
+        return -1;
+    }
+    if (grow(&p->guards, p->n_guards, &p->guards_capacity, sizeof(struct guard_spec)) == -1) {
+        return -1;
+    }
+    g = &p->guards[p->n_guards];
+    memset(g, 0, sizeof(struct guard_spec));
+
+    arg = split_word(value);
+    fail = split_word(arg);
+
+    if (strcmp(value, "held") == 0) {
+        g->kind = GUARD_HELD;
+    }
+    else if (strcmp(value, "not_held") == 0) {
+        g->kind = GUARD_NOT_HELD;
+    }
+    else if (strcmp(value, "state") == 0) {
+        g->kind = GUARD_STATE;
+        state = fail;
+        fail = split_word(state);
+    }
+    else if (strcmp(value, "tokens") == 0) {
+        g->kind = GUARD_TOKENS;
+        g->value = atoi(arg);
+    }
+    else {
+        parse_error(p, "condizione sconosciuta: ", value);
+        return -1;
+    }
+
+    if (arg[0] == '\0' || (state != NULL && state[0] == '\0') || g->value < 0) {
+        parse_error(p, "argomenti mancanti o non validi per la condizione ", value);
+        return -1;
+    }
+
+    if ((g->kind != GUARD_TOKENS && (g->object = pool_dup(p, arg)) == NULL) ||
+        (state != NULL && (g->state = pool_dup(p, state)) == NULL) ||
+        (fail[0] != '\0' && (g->fail_msg = pool_dup(p, fail)) == NULL)) {
+        return -1;
+    }
+
+    p->n_guards++;
+    tr->n_guards++;
+    return 0;
+}
+
+/* effect pickup [oggetto] | token | signal <oggetto> | set <oggetto> <stato> */
+static int parse_effect(struct parser *p, char *value) {
+    struct transition_spec *tr = cur_transition(p, "effect");
+    struct effect_spec *e;
+    char *arg, *state;
+
+    if (tr == NULL) {
+        return -1;
+    }
+    if (grow(&p->effects, p->n_effects, &p->effects_capacity, sizeof(struct effect_spec)) == -1) {
+        return -1;
+    }
+    e = &p->effects[p->n_effects];
+    memset(e, 0, sizeof(struct effect_spec));
+
+    arg = split_word(value);
+    state = split_word(arg);
+
+    if (strcmp(value, "pickup") == 0) {
+        e->kind = EFFECT_PICKUP;
+        if (arg[0] == '\0') {
+            arg = "self";
+        }
+    }
+    else if (strcmp(value, "token") == 0) {
+        e->kind = EFFECT_TOKEN;
+        arg = "self";
+        CUR_OBJECT(p)->tokens++;
+    }
+    else if (strcmp(value, "signal") == 0) {
+        e->kind = EFFECT_SIGNAL;
+    }
+    else if (strcmp(value, "set") == 0) {
+        e->kind = EFFECT_SET;
+        if (state[0] == '\0') {
+            parse_error(p, "l'effetto set richiede un oggetto ed uno stato", "");
+            return -1;
+        }
+        if ((e->state = pool_dup(p, state)) == NULL) {
+            return -1;
+        }
+    }
+    else {
+        parse_error(p, "effetto sconosciuto: ", value);
+        return -1;
+    }
+
+    if (arg[0] == '\0') {
+        parse_error(p, "l'effetto richiede un oggetto: ", value);
+        return -1;
+    }
+    if ((e->object = pool_dup(p, arg)) == NULL) {
+        return -1;
+    }
+
+    p->n_effects++;
+    tr->n_effects++;
+    return 0;
+}
+
+/* message, ask ed expect: i testi dell'ultima transizione */
+static int parse_transition_text(struct parser *p, const char *key, char *value) {
+    struct transition_spec *tr = cur_transition(p, key);
+    char **str;
+
+    if (tr == NULL) {
+        return -1;
+    }
+    if (strcmp(key, "message") == 0) {
+        str = &tr->message;
+    }
+    else if (strcmp(key, "ask") == 0) {
+        str = &tr->question;
+    }
+    else {
+        str = &tr->answer;
+    }
+
+    *str = pool_dup(p, value);
+    return *str == NULL ? -1 : 0;
+}
+
+/**
+ * Interpreta una chiave dell'oggetto aperto.
+ * Ritorna -1 in caso di errore, 1 se la chiave non riguarda gli oggetti.
+ */
+static int parse_object_line(struct parser *p, char *key, char *value) {
+    struct object_spec *o = CUR_OBJECT(p);
+    char **str = NULL;
+
+    if (strcmp(key, "locked_look") == 0) str = &o->locked_look;
+    else if (strcmp(key, "unlocked_look") == 0) str = &o->unlocked_look;
+    else if (strcmp(key, "use_msg") == 0) str = &o->use_msg;
+    else if (strcmp(key, "take_q") == 0) str = &o->take_q;
+    else if (strcmp(key, "take_a") == 0) str = &o->take_a;
+    else if (strcmp(key, "use_with") == 0) str = &o->use_with;
+
+    if (str != NULL || strcmp(key, "take") == 0) {
+        if (set_syntax(p, SYNTAX_TAKE) == -1) {
+            return -1;
+        }
+        if (str == NULL) {
+            return parse_take(p, value);
+        }
+        *str = pool_dup(p, value);
+        return *str == NULL ? -1 : 0;
+    }
+
+    if (strcmp(key, "state") != 0 && strcmp(key, "on") != 0 &&
+        strcmp(key, "require") != 0 && strcmp(key, "effect") != 0 &&
+        strcmp(key, "message") != 0 && strcmp(key, "ask") != 0 &&
+        strcmp(key, "expect") != 0) {
+        return 1;
+    }
+    if (set_syntax(p, SYNTAX_STATES) == -1) {
+        return -1;
+    }
+
+    if (strcmp(key, "state") == 0) return parse_state(p, value);
+    if (strcmp(key, "on") == 0) return parse_on(p, value);
+    if (strcmp(key, "require") == 0) return parse_require(p, value);
+    if (strcmp(key, "effect") == 0) return parse_effect(p, value);
+    return parse_transition_text(p, key, value);
+}
+
+/**
+ * Costruisce l'hash perfetto sui nomi di locazioni ed oggetti della room.
+ * Ritorna -1 in caso di memoria esaurita o di nomi ripetuti.
+ */
+static int build_names(struct room *r) {
+    char **names;
+    int *refs;
+    int i, n = 0, ret;
+
+    names = malloc(sizeof(char *) * (r->n_locations + r->tot_objects + 1));
+    refs = malloc(sizeof(int) * (r->n_locations + r->tot_objects + 1));
+    if (names == NULL || refs == NULL) {
+        free(names);
+        free(refs);
+        return -1;
+    }
+
+    for (i = 0; i < r->n_locations; i++) {
+        names[n] = r->locations[i].name;
+        refs[n] = NAME_REF(NAME_LOCATION, i);
+        n++;
+    }
+    for (i = 0; i < r->tot_objects; i++) {
+        names[n] = r->object_names[i];
+        refs[n] = NAME_REF(NAME_OBJECT, i);
+        n++;
+    }
+
+    ret = phash_build(&r->names, names, refs, n);
+    free(names);
+    free(refs);
+    return ret;
+}
+
+/* Ritorna l'indice dell'oggetto *name* ("self" è *self*), -1 se non esiste */
+static int resolve_object(struct parser *p, int self, const char *name) {
+    int obj;
+
+    if (strcmp(name, "self") == 0) {
+        return self;
+    }
+    obj = get_object(p->room, name);
+    if (obj == -1) {
+        parse_error(p, "riferimento ad un oggetto inesistente: ", name);
+    }
+    return obj;
+}
+
+/* Ritorna l'indice globale dello stato *name* dell'oggetto *obj*, -1 se non esiste */
+static int resolve_state(struct parser *p, int obj, const char *name) {
+    struct object_spec *o = &p->objects[obj];
+    int i;
+
+    for (i = 0; i < o->n_states; i++) {
+        if (strcmp(p->states[o->first_state + i].name, name) == 0) {
+            return o->state_base + i;
+        }
+    }
+    parse_error(p, "riferimento ad uno stato inesistente: ", name);
+    return -1;
+}
+
+/* Risolve il bersaglio di *ts* in *target*, ritorna -1 se non esiste */
+static int resolve_target(struct parser *p, int self, const struct transition_spec *ts, int *target) {
+    if (ts->event != EV_USE) {
+        *target = TARGET_ANY;
+    }
+    else if (ts->target == NULL) {
+        *target = TARGET_NONE;
+    }
+    else if (strcmp(ts->target, "*") == 0) {
+        *target = TARGET_ANY;
+    }
+    else if (strcmp(ts->target, "?") == 0) {
+        *target = TARGET_UNKNOWN;
+    }
+    else if ((*target = resolve_object(p, self, ts->target)) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Aggiunge le condizioni e gli effetti di *ts* alle tabelle e ne
+ *  scrive gli intervalli in *proto*, che verrà copiata in tutte le
+ *  transizioni generate da *ts*.
+ */
+static int compile_guards_effects(struct parser *p, struct puzzle_builder *b, int obj,
+        const struct transition_spec *ts, struct transition *proto) {
+
+    int i, object, value;
+
+    proto->first_guard = b->pz->n_guards;
+    for (i = ts->first_guard; i < ts->first_guard + ts->n_guards; i++) {
+        struct guard_spec *g = &p->guards[i];
+
+        object = -1;
+        value = g->value;
+        if (g->object != NULL && (object = resolve_object(p, obj, g->object)) == -1) {
+            return -1;
+        }
+        if (g->kind == GUARD_STATE && (value = resolve_state(p, object, g->state)) == -1) {
+            return -1;
+        }
+        if (puzzle_add_guard(b, g->kind, object, value, g->fail_msg) == -1) {
+            return -1;
+        }
+    }
+    proto->n_guards = ts->n_guards;
+
+    proto->first_effect = b->pz->n_effects;
+    for (i = ts->first_effect; i < ts->first_effect + ts->n_effects; i++) {
+        struct effect_spec *e = &p->effects[i];
+
+        value = 0;
+        if ((object = resolve_object(p, obj, e->object)) == -1) {
+            return -1;
+        }
+        if (e->kind == EFFECT_SET && (value = resolve_state(p, object, e->state)) == -1) {
+            return -1;
+        }
+        if (puzzle_add_effect(b, e->kind, object, value) == -1) {
+            return -1;
+        }
+    }
+    proto->n_effects = ts->n_effects;
 
-    int size = sizeof(struct room) * N_ROOMS;
-
-    g_rooms = malloc(size);
-    if (g_rooms == NULL) {
-        return -1;
-    }
-    memset(g_rooms, 0, size);
-
-    /* 0) Red Teaming */
-    g_rooms[0].id = 0;
-    g_rooms[0].time_limit = 10;
-    g_rooms[0].penalty = 3;
-    g_rooms[0].bonus = 3;
-    g_rooms[0].name = "Red Teaming";
-    g_rooms[0].look_msg = "Sei parte di un gruppo di hacker in una missione di red teaming, siete appena entrati nell'edificio target. Ti trovi in uno degli uffici al secondo piano. Alla tua destra c'è una ++scrivania++ di legno con sopra un **computer** ed un **router**. Vicino all'ingresso c'è una ++scatola++ di cartone con dentro un **cavo** ed una **tastiera**. Dietro di te c'è una ++libreria++. Il tuo obbiettivo è quello di sbloccare il computer e connetterlo ad internet, i tuoi compagni si occuperanno del resto.";
-    g_rooms[0].question = "Come si chiama quel software o dispositivo hardware che osserva e filtra i pacchetti in ingresso o uscita da una rete?\n  a) Antivirus\n  b) Firewall\n  c) Cookie\n  d) Router";
-    g_rooms[0].answer = "b"; 
-    g_rooms[0].n_locations = 3;
-    g_rooms[0].n_tokens = 3;
-    g_rooms[0].tot_objects = 6;
-    {
-        /* scrivania */
-        g_rooms[0].locations[0].name = "scrivania";
-        g_rooms[0].locations[0].look_msg = "Si tratta di una moderna scrivania di legno con sopra un **computer** ed un **router**.";
-        {
-            g_rooms[0].locations[0].n_objects = 3;
-            {
-                /* computer */
-                g_rooms[0].locations[0].objects[0].name = "computer";
-                g_rooms[0].locations[0].objects[0].locked_look_msg = "Non ho niente con cui scrivere...";
-                g_rooms[0].locations[0].objects[0].unlocked_look_msg = "Mi chiede una **password** per entrare.";
-                g_rooms[0].locations[0].objects[0].take[0] = OBJ_LOCKED_BY_USE;
-                g_rooms[0].locations[0].objects[0].take[1] = OBJ_UNLOCKED;
-                g_rooms[0].locations[0].objects[0].use_with = NULL;
-                g_rooms[0].locations[0].objects[0].use_msg = "Non sembra fare nulla.";
-
-                /* router */
-                g_rooms[0].locations[0].objects[1].name = "router";
-                g_rooms[0].locations[0].objects[1].locked_look_msg = "Tutte le luci sono rosse, non è connesso ad internet. Sembra che manchi qualcosa...";
-                g_rooms[0].locations[0].objects[1].unlocked_look_msg = "Le luci sono diventate verdi, è connesso!";
-                g_rooms[0].locations[0].objects[1].take[0] = OBJ_LOCKED_BY_USE;
-                g_rooms[0].locations[0].objects[1].take[1] = OBJ_GIVE_TOKEN;
-                g_rooms[0].locations[0].objects[1].take[2] = OBJ_UNLOCKED;
-                g_rooms[0].locations[0].objects[1].use_with = NULL;
-                g_rooms[0].locations[0].objects[1].use_msg = "Non sembra fare nulla.";
-
-                /* password */
-                g_rooms[0].locations[0].objects[2].name = "password";
-                g_rooms[0].locations[0].objects[2].locked_look_msg = "Non c'è molto da osservare...";
-                g_rooms[0].locations[0].objects[2].unlocked_look_msg = "Hai completato il tuo obbiettivo in tempo. Bel lavoro!";
-                g_rooms[0].locations[0].objects[2].take[0] = OBJ_LOCKED_BY_Q;
-                g_rooms[0].locations[0].objects[2].take[1] = OBJ_GIVE_TOKEN;
-                g_rooms[0].locations[0].objects[2].take[2] = OBJ_UNLOCKED;
-                g_rooms[0].locations[0].objects[2].take_q = "La password è un codice numerico di 6 cifre...";
-                g_rooms[0].locations[0].objects[2].take_a = "250513";
-                g_rooms[0].locations[0].objects[2].use_with = NULL;
-                g_rooms[0].locations[0].objects[2].use_msg = "Non sembra fare nulla.";
+    /* L'enigma è l'ultimo effetto, dopo quelli scritti nel file */
+    if ((ts->question == NULL) != (ts->answer == NULL)) {
+        parse_error(p, "le chiavi ask ed expect vanno usate insieme nell'oggetto ", p->room->object_names[obj]);
+        return -1;
+    }
+    if (ts->question != NULL) {
+        if (puzzle_add_effect(b, EFFECT_ASK, obj, 0) == -1) {
+            return -1;
+        }
+        proto->n_effects++;
+        proto->message = ts->question;
+        proto->answer = ts->answer;
+    }
+    else {
+        proto->message = ts->message;
+    }
+    return 0;
+}
+
+/* Compila un oggetto descritto con le chiavi state/on */
+static int compile_states(struct parser *p, struct puzzle_builder *b, int obj) {
+    struct object_spec *o = &p->objects[obj];
+    int i, k, from, to;
+
+    if (o->n_states == 0) {
+        parse_error(p, "nessuno stato definito per l'oggetto ", p->room->object_names[obj]);
+        return -1;
+    }
+
+    for (i = o->first_state; i < o->first_state + o->n_states; i++) {
+        for (k = o->first_state; k < i; k++) {
+            if (strcmp(p->states[k].name, p->states[i].name) == 0) {
+                parse_error(p, "stato ripetuto: ", p->states[i].name);
+                return -1;
             }
         }
+        if (puzzle_add_state(b, p->states[i].name, p->states[i].look) == -1) {
+            return -1;
+        }
+    }
+
+    for (i = o->first_transition; i < o->first_transition + o->n_transitions; i++) {
+        struct transition_spec *ts = &p->transitions[i];
+        struct transition proto, *tr;
+        int any = strcmp(ts->from, "*") == 0;
+
+        memset(&proto, 0, sizeof(proto));
+        from = any ? o->state_base : resolve_state(p, obj, ts->from);
+        to = ts->to == NULL ? -1 : resolve_state(p, obj, ts->to);
+        if (from == -1 || (ts->to != NULL && to == -1) ||
+            resolve_target(p, obj, ts, &proto.target) == -1 ||
+            compile_guards_effects(p, b, obj, ts, &proto) == -1) {
+            return -1;
+        }
 
-        /* scatola */
-        g_rooms[0].locations[1].name = "scatola";
-        g_rooms[0].locations[1].look_msg = "Si tratta di una normale scatola di cartone, al suo interno vedi un vecchio **cavo** ed una **tastiera**.";
-        {
-            g_rooms[0].locations[1].n_objects = 2;
-            {
-                /* tastiera */
-                g_rooms[0].locations[1].objects[0].name = "tastiera";
-                g_rooms[0].locations[1].objects[0].locked_look_msg = "Sembra essere una comune tasiera USB.";
-                g_rooms[0].locations[1].objects[0].unlocked_look_msg = "Potrei usarla per scrivere qualcosa...";
-                g_rooms[0].locations[1].objects[0].take[0] = OBJ_LOCKED_BY_Q;
-                g_rooms[0].locations[1].objects[0].take[1] = OBJ_GIVE_TOKEN;
-                g_rooms[0].locations[1].objects[0].take[2] = OBJ_UNLOCKED;
-                g_rooms[0].locations[1].objects[0].take_q = "Completa la sequenza: 65 83 67 73 ?";
-                g_rooms[0].locations[1].objects[0].take_a = "73";
-                g_rooms[0].locations[1].objects[0].use_with = &g_rooms[0].locations[0].objects[0]; /* computer */
-                g_rooms[0].locations[1].objects[0].use_msg = "Hai connesso la tastiera al computer!";
-
-                /* cavo */
-                g_rooms[0].locations[1].objects[1].name = "cavo";
-                g_rooms[0].locations[1].objects[1].locked_look_msg = "Sembra essere un doppino telefonico.";
-                g_rooms[0].locations[1].objects[1].unlocked_look_msg = "Potrei usarlo per fare qualcosa...";
-                g_rooms[0].locations[1].objects[1].take[0] = OBJ_LOCKED_BY_Q;
-                g_rooms[0].locations[1].objects[1].take[1] = OBJ_UNLOCKED;
-                g_rooms[0].locations[1].objects[1].take_q = "Di che materiale sono i filamenti conduttrici di cui è composto un doppino telefonico?";
-                g_rooms[0].locations[1].objects[1].take_a = "rame";
-                g_rooms[0].locations[1].objects[1].use_with = &g_rooms[0].locations[0].objects[1]; /* router */
-                g_rooms[0].locations[1].objects[1].use_msg = "Hai connesso il router ad internet! Prendilo per riscattare la tua ricompensa.";
+        /* Una transizione da "*" viene replicata su tutti gli stati, con le stesse condizioni ed effetti */
+        for (k = from; k < (any ? o->state_base + o->n_states : from + 1); k++) {
+            tr = puzzle_add_transition(b, k, ts->event);
+            if (tr == NULL) {
+                return -1;
             }
+            proto.next_state = to == -1 ? k : to;
+            *tr = proto;
         }
+    }
+    return 0;
+}
+
+/* Aggiunge una transizione use (con bersaglio *target*) sorvegliata dalla condizione *held* */
+static int add_use(struct puzzle_builder *b, int from, int target, int held,
+        int to, int effect, const char *message) {
+
+    struct transition *tr = puzzle_add_transition(b, from, EV_USE);
+    if (tr == NULL) {
+        return -1;
+    }
+    tr->target = target;
+    tr->first_guard = held;
+    tr->n_guards = 1;
+    tr->next_state = to;
+    if (effect != -1) {
+        tr->first_effect = effect;
+        tr->n_effects = 1;
+    }
+    tr->message = message;
+    return 0;
+}
 
-        /* libreria */
-        g_rooms[0].locations[2].name = "libreria";
-        g_rooms[0].locations[2].look_msg = "Tra le decine di libri coglie la tua attenzione un piccolo **calendario**.";
-        {
-            g_rooms[0].locations[2].n_objects = 1;
-            {
-                /* calendario */
-                g_rooms[0].locations[2].objects[0].name = "calendario";
-                g_rooms[0].locations[2].objects[0].unlocked_look_msg = "Sfogliando le pagine del calendario noti che 25/05/2013 è segnata con una X rossa.";
-                g_rooms[0].locations[2].objects[0].take[0] = OBJ_UNLOCKED;
-                g_rooms[0].locations[2].objects[0].use_with = NULL;
-                g_rooms[0].locations[2].objects[0].use_msg = "Non sembra fare nulla.";
+#define OR_EMPTY(str) ((str) != NULL ? (str) : "")
+
+/**
+ * Compila un oggetto descritto dalla sequenza take: riproduce i
+ *  comandi take, use e le risposte agli enigmi come erano definiti
+ *  prima della macchina a stati.
+ */
+static int compile_take(struct parser *p, struct puzzle_builder *b, int obj) {
+    struct object_spec *o = &p->objects[obj];
+    unsigned char step[TAKE_STEPS + 1];
+    const char *question = NULL;
+    struct transition *tr;
+    int use_with = -1, has_q = 0;
+    int held, pickup, token, ask, signal = -1;
+    int t, used, s, next, base = o->state_base;
+
+    memcpy(step, o->take, TAKE_STEPS);
+    step[TAKE_STEPS] = step[TAKE_STEPS - 1] == OBJ_GIVE_TOKEN ? OBJ_UNLOCKED : step[TAKE_STEPS - 1];
+
+    if (o->use_with != NULL) {
+        use_with = get_object(p->room, o->use_with);
+        if (use_with == -1) {
+            parse_error(p, "use_with si riferisce ad un oggetto inesistente: ", o->use_with);
+            return -1;
+        }
+    }
+
+    for (t = 0; t < TAKE_STEPS; t++) {
+        has_q |= step[t] == OBJ_LOCKED_BY_Q;
+    }
+    if (has_q) {
+        char *str = malloc(strlen(OR_EMPTY(o->take_q)) + 64);
+        if (str != NULL) {
+            sprintf(str, "L'oggetto è bloccato da un enigma:\n %s", OR_EMPTY(o->take_q));
+        }
+        if ((question = pool_add(p->catalogue, str)) == NULL) {
+            return -1;
+        }
+    }
+
+    /* Condizioni ed effetti condivisi da tutte le transizioni dell'oggetto (pickup e token sono contigui) */
+    held = puzzle_add_guard(b, GUARD_HELD, obj, 0, "Devi avere l'oggetto in mano per poterlo utilizzare.");
+    pickup = puzzle_add_effect(b, EFFECT_PICKUP, obj, 0);
+    token = puzzle_add_effect(b, EFFECT_TOKEN, obj, 0);
+    ask = puzzle_add_effect(b, EFFECT_ASK, obj, 0);
+    if (use_with != -1) {
+        signal = puzzle_add_effect(b, EFFECT_SIGNAL, use_with, 0);
+    }
+    if (held == -1 || pickup == -1 || token == -1 || ask == -1 || (use_with != -1 && signal == -1)) {
+        return -1;
+    }
+
+    for (t = 0; t <= TAKE_STEPS; t++) {
+        for (used = 0; used < 2; used++) {
+            const char *look = step[t] == OBJ_UNLOCKED || step[t] == OBJ_GIVE_TOKEN ?
+                o->unlocked_look : o->locked_look;
+
+            s = base + TAKE_STATE(t, used);
+            next = base + TAKE_STATE(t < TAKE_STEPS ? t + 1 : t, used);
+
+            if (puzzle_add_state(b, g_take_state_names[TAKE_STATE(t, used)], OR_EMPTY(look)) == -1) {
+                return -1;
+            }
+
+            if ((tr = puzzle_add_transition(b, s, EV_TAKE)) == NULL) {
+                return -1;
+            }
+            switch (step[t]) {
+                case OBJ_UNLOCKED:
+                    tr->first_effect = pickup;
+                    tr->n_effects = 1;
+                    tr->message = "Oggetto raccolto.";
+                    break;
+                case OBJ_GIVE_TOKEN:
+                    tr->first_effect = pickup;
+                    tr->n_effects = 2;
+                    tr->next_state = next;
+                    tr->message = "Oggetto raccolto. Ti è stato assegnato un token!";
+                    break;
+                case OBJ_LOCKED_BY_Q:
+                    tr->first_effect = ask;
+                    tr->n_effects = 1;
+                    tr->message = question;
+                    tr->answer = OR_EMPTY(o->take_a);
+                    break;
+                default:
+                    tr->message = "L'oggetto è bloccato...";
+                    break;
+            }
+
+            if (has_q) {
+                if ((tr = puzzle_add_transition(b, s, EV_ANSWER)) == NULL) {
+                    return -1;
+                }
+                tr->next_state = next;
+                tr->message = "Risposta corretta! Adesso puoi raccogliere l'oggetto.";
+            }
+
+            /* L'oggetto use_with di un altro fa avanzare la sequenza di questo */
+            if ((tr = puzzle_add_transition(b, s, EV_SIGNAL)) == NULL) {
+                return -1;
+            }
+            tr->next_state = next;
+
+            if (used) {
+                if ((tr = puzzle_add_transition(b, s, EV_USE)) == NULL) {
+                    return -1;
+                }
+                tr->message = "Hai già usato questo oggetto.";
+                continue;
+            }
+
+            if (use_with == -1) {
+                if (add_use(b, s, TARGET_NONE, held, base + TAKE_STATE(t, 1), -1, OR_EMPTY(o->use_msg)) == -1) {
+                    return -1;
+                }
+            }
+            else if (add_use(b, s, TARGET_NONE, held, s, -1, "Non sembra fare nulla.") == -1 ||
+                add_use(b, s, TARGET_UNKNOWN, held, s, -1, "Il secondo oggetto specificato non esiste.") == -1 ||
+                add_use(b, s, use_with, held, base + TAKE_STATE(t, 1), signal, OR_EMPTY(o->use_msg)) == -1) {
+                return -1;
+            }
+            if (add_use(b, s, TARGET_ANY, held, s, -1, "Non sembra fare nulla.") == -1) {
+                return -1;
             }
         }
     }
+    return 0;
+}
+
+/* Compila il comportamento di tutti gli oggetti della room aperta */
+static int compile_puzzle(struct parser *p) {
+    struct room *r = p->room;
+    struct puzzle_builder b;
+    int i, base = 0, ret = 0;
+
+    /* Gli stati di un oggetto possono essere citati da quelli definiti prima */
+    for (i = 0; i < r->tot_objects; i++) {
+        p->objects[i].state_base = base;
+        base += p->objects[i].syntax == SYNTAX_STATES ? p->objects[i].n_states : TAKE_STATES;
+    }
 
-    /**
-     * SPOILER: Shortest path to win 
-     * take cavo (rame)
-     * take cavo
-     * use cavo router
-     * take router
-     * take tastiera (73)
-     * take tastiera  
-     * use tastiera computer
-     * drop cavo
-     * take password (250513)
-     * take password   
-     */
-    return 0;    
+    puzzle_begin(&b, &r->puzzle);
+    for (i = 0; i < r->tot_objects && ret == 0; i++) {
+        if (puzzle_add_object(&b) == -1) {
+            ret = -1;
+        }
+        else if (p->objects[i].syntax == SYNTAX_STATES) {
+            ret = compile_states(p, &b, i);
+        }
+        else {
+            ret = compile_take(p, &b, i);
+        }
+    }
+    if (puzzle_finish(&b) == -1) {
+        ret = -1;
+    }
+    return ret;
 }
 
-struct location* get_location(int room, const char *name) {
-    int i;
-    for (i = 0; i < g_rooms[room].n_locations; i++) {
-        if (strcmp(g_rooms[room].locations[i].name, name) == 0) {
-            return &g_rooms[room].locations[i];
+/* Token necessari per risolvere la room aperta */
+static int count_tokens(struct parser *p) {
+    int i, k, n = 0;
+
+    if (p->tokens != -1) {
+        return p->tokens;
+    }
+    for (i = 0; i < p->room->tot_objects; i++) {
+        struct object_spec *o = &p->objects[i];
+        if (o->syntax == SYNTAX_STATES) {
+            n += o->tokens;
+            continue;
+        }
+        for (k = 0; k < TAKE_STEPS; k++) {
+            n += o->take[k] == OBJ_GIVE_TOKEN;
         }
     }
+    return n;
+}
+
+/**
+ * Completa la room aperta: indicizza i nomi, compila il comportamento
+ *  degli oggetti e calcola il numero di token.
+ */
+static int close_room(struct parser *p) {
+    struct room *r = p->room;
+
+    if (r == NULL) {
+        return 0;
+    }
+
+    shrink_room(r);
+
+    if (build_names(r) == -1) {
+        parse_error(p, "nomi di locazioni od oggetti ripetuti nella room ", r->name);
+        return -1;
+    }
+
+    if (compile_puzzle(p) == -1) {
+        return -1;
+    }
+
+    r->n_tokens = count_tokens(p);
+    if (r->n_tokens == 0) {
+        parse_error(p, "la room non assegna nessun token: ", r->name);
+        return -1;
+    }
+
+    if (r->time_limit == 0) {
+        parse_error(p, "la room non ha un time_limit: ", r->name);
+        return -1;
+    }
+
+    free_specs(p);
+    p->room = NULL;
+    return 0;
+}
+
+/**
+ * Restituisce il campo testuale di nome *key* della room o della
+ *  locazione attualmente aperta, NULL se la chiave non le appartiene.
+ */
+static char** string_field(struct parser *p, const char *key) {
+    switch (p->ctx) {
+        case CTX_ROOM:
+            if (strcmp(key, "look") == 0) return &p->room->look_msg;
+            if (strcmp(key, "question") == 0) return &p->room->question;
+            if (strcmp(key, "answer") == 0) return &p->room->answer;
+            break;
+        case CTX_LOCATION:
+            if (strcmp(key, "look") == 0) return &CUR_LOCATION(p)->look_msg;
+            break;
+        default:
+            break;
+    }
     return NULL;
 }
 
-struct object* get_object(int room, const char *name) {
-    int i;
-    for (i = 0; i < g_rooms[room].n_locations; i++) {
-        int j;
-        for (j = 0; j < g_rooms[room].locations[i].n_objects; j++) {
-            if (strcmp(g_rooms[room].locations[i].objects[j].name, name) == 0) {
-                return &g_rooms[room].locations[i].objects[j];
+/**
+ * Restituisce il campo intero di nome *key* della room
+ *  attualmente aperta, NULL se la chiave non le appartiene.
+ */
+static int* int_field(struct parser *p, const char *key) {
+    if (p->ctx != CTX_ROOM) {
+        return NULL;
+    }
+    if (strcmp(key, "time_limit") == 0) return &p->room->time_limit;
+    if (strcmp(key, "penalty") == 0) return &p->room->penalty;
+    if (strcmp(key, "bonus") == 0) return &p->room->bonus;
+    if (strcmp(key, "tokens") == 0) return &p->tokens;
+    return NULL;
+}
+
+/* Interpreta una riga "chiave valore" del file, ritorna -1 in caso di errore */
+static int parse_line(struct parser *p, struct catalogue *c, char *key, char *value) {
+    char **str;
+    int *num, ret;
+
+    if (strcmp(key, "room") == 0) {
+        if (close_room(p) == -1) {
+            return -1;
+        }
+        if (c->n_rooms == ROOMS_MAX) {
+            parse_error(p, "troppe room, ignorata: ", value);
+            return -1;
+        }
+        p->room = &c->rooms[c->n_rooms];
+        p->room->id = c->n_rooms;
+        p->room->stats = -1;
+        p->room->name = pool_dup(p, value);
+        p->locations_capacity = 0;
+        p->tokens = -1;
+        c->n_rooms++;
+        p->ctx = CTX_ROOM;
+        return p->room->name == NULL ? -1 : 0;
+    }
+
+    if (p->room == NULL) {
+        parse_error(p, "chiave fuori da una room: ", key);
+        return -1;
+    }
+
+    if (strcmp(key, "location") == 0) {
+        if (add_location(p) == -1) {
+            return -1;
+        }
+        CUR_LOCATION(p)->name = pool_dup(p, value);
+        p->ctx = CTX_LOCATION;
+        return CUR_LOCATION(p)->name == NULL ? -1 : 0;
+    }
+
+    if (strcmp(key, "object") == 0) {
+        if (p->ctx != CTX_LOCATION && p->ctx != CTX_OBJECT) {
+            parse_error(p, "oggetto fuori da una locazione: ", value);
+            return -1;
+        }
+        if (add_object(p) == -1) {
+            return -1;
+        }
+        CUR_OBJECT_NAME(p) = pool_dup(p, value);
+        p->ctx = CTX_OBJECT;
+        return CUR_OBJECT_NAME(p) == NULL ? -1 : 0;
+    }
+
+    if (p->ctx == CTX_OBJECT && (ret = parse_object_line(p, key, value)) != 1) {
+        return ret;
+    }
+
+    num = int_field(p, key);
+    if (num != NULL) {
+        *num = atoi(value);
+        if (*num < 0) {
+            parse_error(p, "valore non valido per ", key);
+            return -1;
+        }
+        return 0;
+    }
+
+    str = string_field(p, key);
+    if (str != NULL) {
+        *str = pool_dup(p, value);
+        return *str == NULL ? -1 : 0;
+    }
+
+    parse_error(p, "chiave sconosciuta: ", key);
+    return -1;
+}
+
+/* Libera tutti i testi e le tabelle di una versione del catalogo e la versione stessa */
+static void free_catalogue(struct catalogue *c) {
+    int r, i;
+
+    for (r = 0; r < c->n_rooms; r++) {
+        struct room *room = &c->rooms[r];
+        phash_free(&room->names);
+        hints_free(room->hints);
+        free_puzzle(&room->puzzle);
+        free(room->locations);
+        free(room->object_names);
+        free(room->state_frags);
+        free(room->message_frags);
+        free(room->fail_frags);
+    }
+    for (i = 0; i < c->n_strings; i++) {
+        free(c->strings[i]);
+    }
+    free(c->strings);
+    free(c);
+}
+
+/* Sostituisce un campo testuale assente con una stringa vuota */
+static int fill_missing(struct catalogue *c, char **str) {
+    if (*str == NULL) {
+        *str = pool_add(c, unescape_dup(""));
+    }
+    return *str == NULL ? -1 : 0;
+}
+
+/**
+ * I campi testuali lasciati vuoti nel file vengono sostituiti
+ *  da una stringa vuota, così i comandi possono copiarli senza
+ *  ulteriori controlli. Ritorna -1 se la memoria è esaurita.
+ */
+static int fill_missing_strings(struct catalogue *c) {
+    int r, i, ret = 0;
+
+    for (r = 0; r < c->n_rooms; r++) {
+        struct room *room = &c->rooms[r];
+        ret |= fill_missing(c, &room->look_msg);
+        ret |= fill_missing(c, &room->question);
+        ret |= fill_missing(c, &room->answer);
+        for (i = 0; i < room->n_locations; i++) {
+            ret |= fill_missing(c, &room->locations[i].look_msg);
+        }
+    }
+    return ret == 0 ? 0 : -1;
+}
+
+/**
+ * Inizializza *f* con *text*, controllando che rientri in TEXT_LENGTH_MAX.
+ * Ritorna -1 se il testo è troppo lungo.
+ */
+static int text_fragment(struct room *r, struct fragment *f, const char *text) {
+    make_fragment(f, text);
+    if (f->size > TEXT_LENGTH_MAX) {
+        printf(ANSI_COLOR_YELLOW "[Warning]: un testo della room %s supera i %d "
+            "caratteri: \"%.32s...\"\n" ANSI_COLOR_RESET, r->name, TEXT_LENGTH_MAX, text);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Codifica una volta per tutte i testi che i comandi inviano così come
+ *  sono, vedi struct room. Ritorna -1 se la memoria è esaurita o se
+ *  un testo è troppo lungo per essere inviato.
+ */
+static int build_fragments(struct catalogue *c) {
+    int r, i, ret = 0;
+
+    for (r = 0; r < c->n_rooms; r++) {
+        struct room *room = &c->rooms[r];
+        struct puzzle *pz = &room->puzzle;
+
+        /* +1: malloc(0) può ritornare NULL */
+        room->state_frags = malloc(sizeof(struct fragment) * (pz->n_states + 1));
+        room->message_frags = malloc(sizeof(struct fragment) * (pz->n_transitions + 1));
+        room->fail_frags = malloc(sizeof(struct fragment) * (pz->n_guards + 1));
+        if (room->state_frags == NULL || room->message_frags == NULL || room->fail_frags == NULL) {
+            return -1;
+        }
+
+        ret |= text_fragment(room, &room->look_frag, room->look_msg);
+        ret |= text_fragment(room, &room->question_frag, room->question);
+        for (i = 0; i < room->n_locations; i++) {
+            ret |= text_fragment(room, &room->locations[i].look_frag, room->locations[i].look_msg);
+        }
+        for (i = 0; i < pz->n_states; i++) {
+            ret |= text_fragment(room, &room->state_frags[i], pz->state_looks[i]);
+        }
+        for (i = 0; i < pz->n_transitions; i++) {
+            ret |= text_fragment(room, &room->message_frags[i], pz->transitions[i].message);
+        }
+        for (i = 0; i < pz->n_guards; i++) {
+            ret |= text_fragment(room, &room->fail_frags[i], pz->guards[i].fail_msg);
+        }
+    }
+    return ret == 0 ? 0 : -1;
+}
+
+/* Ritorna le proprietà MANIFEST_USE_* dell'oggetto *obj*, in qualsiasi suo stato */
+static int use_flags(const struct puzzle *pz, int obj) {
+    int s, t, flags = 0;
+
+    for (s = pz->first_state[obj]; s < pz->first_state[obj + 1]; s++) {
+        for (t = pz->dispatch[s * EV_MAX + EV_USE]; t < pz->dispatch[s * EV_MAX + EV_USE + 1]; t++) {
+            int target = pz->transitions[t].target;
+
+            if (target == TARGET_ANY) {
+                flags |= MANIFEST_USE_ALONE | MANIFEST_USE_OBJECT | MANIFEST_USE_UNKNOWN;
+            }
+            else if (target == TARGET_NONE) {
+                flags |= MANIFEST_USE_ALONE;
             }
+            else if (target == TARGET_UNKNOWN) {
+                flags |= MANIFEST_USE_UNKNOWN;
+            }
+            else {
+                flags |= MANIFEST_USE_OBJECT;
+            }
+        }
+    }
+    return flags;
+}
+
+/* Termina in *dst* una lista di *n* elementi del manifesto, MANIFEST_EMPTY se è vuota */
+static void end_list(char *dst, int n) {
+    strcat(dst, n == 0 ? MANIFEST_EMPTY "~" : "~");
+}
+
+/**
+ * Costruisce il manifesto di ogni room (vedi struct room). Una room
+ *  troppo grande resta senza: i client manderanno tutti i comandi al
+ *  server. Ritorna -1 se la memoria è esaurita.
+ */
+static int build_manifests(struct catalogue *c) {
+    int r, i;
+
+    for (r = 0; r < c->n_rooms; r++) {
+        struct room *room = &c->rooms[r];
+        char *manifest;
+        size_t size;
+
+        room->manifest_frag.data = NULL;
+        room->manifest_frag.size = 0;
+
+        /* Capienza e separatori, nomi seguiti da uno spazio, una proprietà per oggetto */
+        size = 32 + room->tot_objects;
+        for (i = 0; i < room->n_locations; i++) {
+            size += strlen(room->locations[i].name) + 1;
+        }
+        for (i = 0; i < room->tot_objects; i++) {
+            size += strlen(room->object_names[i]) + 1;
+        }
+
+        /* Azione, manifesto, inventario e '\0' devono stare in un messaggio */
+        if (1 + size + INVENTORY_LENGTH_MAX + 1 > IO_BUFFER_SIZE) {
+            printf(ANSI_COLOR_YELLOW "[Warning]: la room %s è troppo grande per "
+                "inviarne il manifesto ai client\n" ANSI_COLOR_RESET, room->name);
+            continue;
+        }
+
+        manifest = pool_add(c, malloc(size));
+        if (manifest == NULL) {
+            return -1;
+        }
+        sprintf(manifest, "%d~", OBJECTS_PER_PLAYER_MAX);
+        for (i = 0; i < room->n_locations; i++) {
+            strcat(manifest, i > 0 ? " " : "");
+            strcat(manifest, room->locations[i].name);
+        }
+        end_list(manifest, room->n_locations);
+        for (i = 0; i < room->tot_objects; i++) {
+            strcat(manifest, i > 0 ? " " : "");
+            strcat(manifest, room->object_names[i]);
+        }
+        end_list(manifest, room->tot_objects);
+        for (i = 0; i < room->tot_objects; i++) {
+            char flag[2];
+
+            flag[0] = '0' + use_flags(&room->puzzle, i);
+            flag[1] = '\0';
+            strcat(manifest, flag);
+        }
+        end_list(manifest, room->tot_objects);
+        make_fragment(&room->manifest_frag, manifest);
+    }
+    return 0;
+}
+
+struct catalogue* load_catalogue(const char *path) {
+    struct catalogue *c;
+    struct parser p;
+    char line[ROOM_LINE_MAX];
+    FILE *f;
+    int ret = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        printf(ANSI_COLOR_YELLOW "[Warning]: impossibile aprire %s\n" ANSI_COLOR_RESET, path);
+        return NULL;
+    }
+
+    c = malloc(sizeof(struct catalogue));
+    if (c == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    memset(c, 0, sizeof(struct catalogue));
+    memset(&p, 0, sizeof(p));
+    p.path = path;
+    p.catalogue = c;
+
+    while (ret == 0 && fgetsnn(line, ROOM_LINE_MAX, f) != NULL) {
+        char *key, *value;
+        int len;
+
+        p.line++;
+
+        /* Rimuove spazi iniziali e finali (e l'eventuale '\\r') */
+        for (key = line; *key == ' ' || *key == '\t'; key++) ;
+        len = strlen(key);
+        while (len > 0 && (key[len - 1] == ' ' || key[len - 1] == '\t' || key[len - 1] == '\r')) {
+            key[--len] = '\0';
+        }
+
+        /* Righe vuote e commenti */
+        if (len == 0 || key[0] == '#') {
+            continue;
         }
+
+        value = split_word(key);
+        ret = parse_line(&p, c, key, value);
+    }
+    fclose(f);
+
+    if (ret == 0) {
+        ret = close_room(&p);
+    }
+    if (ret == 0 && c->n_rooms == 0) {
+        parse_error(&p, "nessuna room definita", "");
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = fill_missing_strings(c);
+    }
+    if (ret == 0) {
+        ret = build_fragments(c);
+    }
+    if (ret == 0) {
+        ret = build_manifests(c);
+    }
+
+    free_specs(&p);
+
+    if (ret == -1) {
+        free_catalogue(c);
+        return NULL;
+    }
+
+    c->version = g_next_version++;
+    c->refs = 1;
+    g_versions_alive++;
+    return c;
+}
+
+/* Costruisce le tabelle dei suggerimenti delle room di *c*, chi non ci riesce resta senza */
+static void build_hints(struct catalogue *c) {
+    int r;
+
+    for (r = 0; r < c->n_rooms; r++) {
+        c->rooms[r].hints = hints_build(&c->rooms[r], HINTS_STATES_MAX);
+        if (c->rooms[r].hints == NULL) {
+            printf(ANSI_COLOR_YELLOW "[Warning]: nessun suggerimento per la room %d, "
+                "troppi stati o memoria esaurita\n" ANSI_COLOR_RESET, c->rooms[r].id);
+        }
+    }
+}
+
+/* Rende *c* la versione corrente, il riferimento del chiamante passa al catalogo */
+static void publish_catalogue(struct catalogue *c) {
+    struct catalogue *old = g_catalogue;
+
+    g_catalogue = c;
+    catalogue_release(old);
+}
+
+int init_rooms(void) {
+    struct catalogue *c = load_catalogue(ROOMS_FILE);
+
+    if (c == NULL) {
+        return -1;
+    }
+    build_hints(c);
+    publish_catalogue(c);
+    return 0;
+}
+
+/**
+ * Corpo del thread dei suggerimenti: la visita degli stati non tiene
+ *  *g_builder_world*, perché nessun altro vede la versione finché non
+ *  diventa quella corrente.
+ */
+static void* builder(void *arg) {
+    struct catalogue *c;
+    (void)arg;
+
+    pthread_mutex_lock(g_builder_world);
+    for (;;) {
+        while (g_builder_next == NULL) {
+            pthread_cond_wait(&g_builder_cond, g_builder_world);
+        }
+        c = g_builder_next;
+        g_builder_next = NULL;
+        pthread_mutex_unlock(g_builder_world);
+
+        build_hints(c);
+
+        pthread_mutex_lock(g_builder_world);
+        publish_catalogue(c);
+        g_builder_ready(c);
     }
     return NULL;
 }
+
+int rooms_builder_start(pthread_mutex_t *world, void (*ready)(const struct catalogue *c)) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ret;
+
+    g_builder_world = world;
+    g_builder_ready = ready;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, builder, NULL) != 0 ? -1 : 0;
+    pthread_attr_destroy(&attr);
+    if (ret == -1) {
+        g_builder_world = NULL;
+    }
+    return ret;
+}
+
+int reload_rooms(void) {
+    struct catalogue *c;
+
+    c = load_catalogue(ROOMS_FILE);
+    if (c == NULL) {
+        return -1;
+    }
+    if (g_builder_world == NULL) {
+        build_hints(c);
+        publish_catalogue(c);
+        return 0;
+    }
+
+    /* Una versione ancora in attesa è già vecchia, si costruisce solo l'ultima */
+    catalogue_release(g_builder_next);
+    g_builder_next = c;
+    pthread_cond_signal(&g_builder_cond);
+    return 0;
+}
+
+struct catalogue* catalogue_acquire(void) {
+    g_catalogue->refs++;
+    return g_catalogue;
+}
+
+void catalogue_release(struct catalogue *c) {
+    if (c == NULL) {
+        return;
+    }
+    c->refs--;
+    if (c->refs == 0) {
+        free_catalogue(c);
+        g_versions_alive--;
+    }
+}
+
+int catalogue_versions_alive(void) {
+    return g_versions_alive;
+}
+
+int lookup_name(struct room *room, const char *name) {
+    return phash_find(&room->names, name);
+}
+
+struct location* get_location(struct room *room, const char *name) {
+    int ref = lookup_name(room, name);
+    if (ref == -1 || NAME_KIND(ref) != NAME_LOCATION) {
+        return NULL;
+    }
+    return &room->locations[NAME_INDEX(ref)];
+}
+
+int get_object(struct room *room, const char *name) {
+    int ref = lookup_name(room, name);
+    if (ref == -1 || NAME_KIND(ref) != NAME_OBJECT) {
+        return -1;
+    }
+    return NAME_INDEX(ref);
+}
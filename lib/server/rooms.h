@@ -1,51 +1,48 @@
-
 #ifndef ROOMS_H
 #define ROOMS_H
 
-#include "../protocol.h"
-
-#define N_ROOMS 1
-#define LOCATIONS_MAX 3
-#define OBJECTS_PER_LOCATION_MAX 3
-#define OBJECTS_PER_PLAYER_MAX 3
-
-extern struct room *g_rooms;
+#include <pthread.h>
 
-enum TAKE_STATUS {
-    OBJ_GIVE_TOKEN,         /* Quando l'oggetto viene preso rilascia un token */
-    OBJ_UNLOCKED,           /* L'oggetto non è bloccato da niente */
-    OBJ_LOCKED_BY_USE,      /* L'oggetto è bloccato dall'utilizzo di un altro oggetto */
-    OBJ_LOCKED_BY_Q         /* L'oggetto è bloccato da una domanda */
-};
+#include "../protocol.h"
+#include "phash.h"
+#include "puzzle.h"
 
-struct object {
-    /* Definiscono cosa succede quando si prova a prende l'oggetto */
-    enum TAKE_STATUS take[3];
+/* File da cui vengono caricate (e ricaricate) le escape room */
+#define ROOMS_FILE "rooms.txt"
 
-    /* NULL se va usato da solo, altrimenti un puntatore all'altro oggetto */
-    struct object *use_with;
+/* La lista delle room viene inviata al client in un unico messaggio */
+#define ROOMS_MAX ARGC_MAX
 
-    char *name;
+/* Numero massimo di oggetti che un giocatore può tenere in mano */
+#define OBJECTS_PER_PLAYER_MAX 3
 
-    /* Il messaggio di look può cambiare a seconda dello stato dell'oggetto */
-    char *locked_look_msg;
-    char *unlocked_look_msg;
+/**
+ * Lunghezza massima dei testi di una room, il resto del messaggio
+ *  (IO_BUFFER_SIZE) resta per ciò che il server vi aggiunge.
+ */
+#define TEXT_LENGTH_MAX 768
 
-    /* Il messaggio che l'utente riceve se utilizza l'oggetto come dovrebbe */
-    char *use_msg;
+/* Spazio riservato all'inventario che il server aggiunge al manifesto di una room */
+#define INVENTORY_LENGTH_MAX (OBJECTS_PER_PLAYER_MAX * 12)
 
-    /* Se l'oggetto è OBJ_LOCKED_BY_Q pone la domanda take_q e aspetta la risposta take_a */
-    char *take_q;
-    char *take_a;
-};
+/* Tabella dei suggerimenti di una room, vedi lib/server/hints.h */
+struct hints;
 
 struct location {
-    int n_objects;
     char *name;
     char *look_msg;
-    struct object objects[OBJECTS_PER_LOCATION_MAX];
+    struct fragment look_frag;
+
+    /* Gli oggetti della locazione sono quelli di indice [first_object, first_object + n_objects) */
+    int first_object, n_objects;
 };
 
+/**
+ * Le locazioni e gli oggetti di una room sono memorizzati in array piatti,
+ *  allocati della dimensione esatta al caricamento: la dimensione di una
+ *  room è limitata solo dalla memoria. Gli oggetti sono identificati dal
+ *  loro indice, che è lo stesso in tutti gli array che li riguardano.
+ */
 struct room {
     int id, n_locations, n_tokens, tot_objects;
     char *name;
@@ -55,7 +52,7 @@ struct room {
      * La domanda che verrà fatta ai giocatori che provano
      *  a connettersi quando ne è già in gioco uno.
      */
-    char *question; 
+    char *question;
 
     /* La risposta a tale domanda*/
     char *answer;
@@ -67,16 +64,156 @@ struct room {
      */
     int time_limit, penalty, bonus;
 
-    struct location locations[LOCATIONS_MAX];
+    struct location *locations;
+
+    /* Nomi degli oggetti */
+    char **object_names;
+
+    /**
+     * Comportamento degli oggetti, compilato al caricamento. Gli stati
+     *  dei giocatori (struct player_state) vi fanno riferimento.
+     */
+    struct puzzle puzzle;
+
+    /**
+     * Testi della room già codificati (vedi struct fragment), costruiti
+     *  al caricamento: look_frag e question_frag corrispondono a look_msg
+     *  e question, gli array ai testi di puzzle con lo stesso indice
+     *  (state_looks, il messaggio delle transizioni ed il fail_msg delle
+     *  condizioni). I testi assenti hanno data NULL.
+     */
+    struct fragment look_frag, question_frag;
+    struct fragment *state_frags;
+    struct fragment *message_frags;
+    struct fragment *fail_frags;
+
+    /**
+     * Manifesto della room (vedi MANIFEST), costruito al caricamento
+     *  e già terminato da '~': manca solo l'inventario del giocatore.
+     *  Ha data NULL se la room è troppo grande per inviarlo.
+     */
+    struct fragment manifest_frag;
+
+    /**
+     * Hash perfetto sui nomi di tutte le locazioni e di tutti gli oggetti,
+     *  costruito al caricamento della room. Ad ogni nome è associato un
+     *  riferimento NAME_REF(...) alla locazione o all'oggetto.
+     */
+    struct phash names;
+
+    /**
+     * Prossima mossa ottimale per ogni stato raggiungibile (comando HINT),
+     *  costruita da reload_rooms(...). NULL se la room è troppo grande.
+     */
+    struct hints *hints;
+
+    /* Indice della room nelle statistiche di gioco (vedi lib/server/analytics.h), -1 finché non serve */
+    int stats;
 };
 
+/* Riferimenti a locazioni ed oggetti restituiti da lookup_name(...) */
+#define NAME_LOCATION 0
+#define NAME_OBJECT 1
+#define NAME_REF(kind, index) (((index) << 1) | (kind))
+#define NAME_KIND(ref) ((ref) & 1)
+#define NAME_INDEX(ref) ((ref) >> 1)
+
 /**
- * Carica nella variabile globale *g_rooms* le escape room.
+ * Una versione del catalogo delle escape room.
+ *
+ * Il ricaricamento costruisce una nuova versione accanto a quella
+ *  corrente e la sostituisce con un singolo assegnamento di puntatore
+ *  (in stile RCU): le sessioni già in gioco continuano a usare la
+ *  versione con cui hanno iniziato, i nuovi start usano quella nuova.
+ * Una versione viene liberata quando nessuno vi fa più riferimento.
+ */
+struct catalogue {
+    int n_rooms;
+    struct room rooms[ROOMS_MAX];
+
+    /**
+     * Tutti i testi della versione (nomi, descrizioni, messaggi) sono
+     *  allocati al caricamento, registrati qui e liberati insieme.
+     */
+    char **strings;
+    int n_strings, strings_capacity;
+
+    /* Numero progressivo, 1 per la versione caricata all'avvio */
+    unsigned long version;
+
+    /**
+     * Numero di riferimenti alla versione: uno per ogni sessione
+     *  che ci sta giocando, più uno se è la versione corrente.
+     */
+    int refs;
+};
+
+/* La versione corrente del catalogo */
+extern struct catalogue *g_catalogue;
+
+/**
+ * Carica in *g_catalogue* le escape room descritte in ROOMS_FILE,
+ *  con le tabelle dei suggerimenti.
  * Ritorna -1 in caso di errore.
  */
 int init_rooms(void);
 
-struct location* get_location(int room, const char *name);
-struct object* get_object(int room, const char *name);
+/**
+ * Costruisce una nuova versione del catalogo a partire da ROOMS_FILE,
+ *  con le tabelle dei suggerimenti, e la rende quella corrente. In caso di errore (file mancante o
+ *  malformato) la versione corrente resta invariata e ritorna -1.
+ * Se è attivo il thread dei suggerimenti (vedi rooms_builder_start(...))
+ *  legge soltanto il file: la versione diventa corrente quando il thread
+ *  ne ha costruito le tabelle, ed un ricaricamento successivo sostituisce
+ *  quello che non è ancora stato iniziato.
+ */
+int reload_rooms(void);
+
+/**
+ * Avvia il thread che costruisce le tabelle dei suggerimenti delle versioni
+ *  ricaricate, che per le room grandi richiedono secondi, fuori dal thread
+ *  che chiama reload_rooms(...). *world* è il lock che protegge il catalogo
+ *  (da tenere quando si chiama reload_rooms(...)): il thread lo prende per
+ *  rendere corrente la versione pronta e, sempre tenendolo, chiama *ready*.
+ * Va avviato prima di lowlatency_enable(...), per non ereditarne il processore.
+ * Ritorna -1 se non è stato possibile avviarlo.
+ */
+int rooms_builder_start(pthread_mutex_t *world, void (*ready)(const struct catalogue *c));
+
+/**
+ * Costruisce una nuova versione del catalogo leggendo il file *path*,
+ *  senza renderla quella corrente e senza le tabelle dei suggerimenti
+ *  (la usano anche gli strumenti offline).
+ * Il chiamante ne possiede l'unico riferimento, da rilasciare con
+ *  catalogue_release(...). Ritorna NULL in caso di errore.
+ */
+struct catalogue* load_catalogue(const char *path);
+
+/**
+ * Acquisisce un riferimento alla versione corrente del catalogo.
+ * Va rilasciato con catalogue_release(...).
+ */
+struct catalogue* catalogue_acquire(void);
+
+/**
+ * Rilascia un riferimento a *c*, liberandone la memoria
+ *  se era l'ultimo. Se *c* è NULL non fa nulla.
+ */
+void catalogue_release(struct catalogue *c);
+
+/* Numero di versioni del catalogo ancora in memoria (corrente compresa) */
+int catalogue_versions_alive(void);
+
+/**
+ * Ritorna il riferimento NAME_REF(...) alla locazione o all'oggetto
+ *  di nome *name* nella stanza *room*, -1 se non esiste.
+ * Costa un solo hash ed un solo confronto tra stringhe.
+ */
+int lookup_name(struct room *room, const char *name);
+
+struct location* get_location(struct room *room, const char *name);
+
+/* Ritorna l'indice dell'oggetto di nome *name* nella stanza *room*, -1 se non esiste */
+int get_object(struct room *room, const char *name);
 
 #endif
@@ -1,6 +1,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #include "session.h"
 
@@ -15,7 +16,17 @@ struct session* init_session(int sd, const char *username) {
     }
 
     s->sd = sd;
+    s->token[0] = '\0';
+    s->detached_at = 0;
     s->room = -1;
+    s->catalogue = NULL;
+    s->dialogue.resume = NULL;
+    s->dialogue.catalogue = NULL;
+    s->sabotages = 0;
+    s->warned = 0;
+    s->command[0] = '\0';
+    s->game.objects = NULL;
+    s->objects_capacity = 0;
     strcpy(s->username, username); 
 
     s->next = g_sessions;
@@ -25,51 +36,122 @@ struct session* init_session(int sd, const char *username) {
 }
 
 void close_session(int sd) {
-    struct session *old;
+    struct session *s = get_session_by_sd(sd);
+
+    /* Elemento non trovato */
+    if (s == NULL) {
+        return;
+    }
+
+    destroy_session(s);
+}
+
+void destroy_session(struct session *session) {
     struct session **s = &g_sessions;
 
-    while((*s) != NULL && (*s)->sd != sd) {
+    while (*s != session) {
         s = &(*s)->next;
     }
+    *s = session->next;
+    leave_room(session);
+    free(session->game.objects);
+    free(session);
+}
 
-    /* Elemento non trovato */
-    if ((*s) == NULL) {
-        return;
+int new_token(struct session *session) {
+    static const char digits[] = "0123456789abcdef";
+    unsigned char bytes[TOKEN_LENGTH / 2];
+    FILE *f;
+    int i, ok;
+
+    session->token[0] = '\0';
+    f = fopen("/dev/urandom", "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    ok = fread(bytes, 1, sizeof(bytes), f) == sizeof(bytes);
+    fclose(f);
+    if (!ok) {
+        return -1;
     }
 
-    old = *s;
-    *s = old->next;
-    free(old);
+    for (i = 0; i < (int)sizeof(bytes); i++) {
+        session->token[2 * i] = digits[bytes[i] >> 4];
+        session->token[2 * i + 1] = digits[bytes[i] & 15];
+    }
+    session->token[TOKEN_LENGTH] = '\0';
+    return 0;
 }
 
-void load_statuses(struct session *session, int room) {
-    int i, j, k;
+int detach_session(int sd, unsigned long now) {
+    struct session *s = get_session_by_sd(sd);
 
-    memset(session->objects_statuses, 0, sizeof(session->objects_statuses));
-    
-    k = 0;
-    for (i = 0; i < g_rooms[room].n_locations; i++) {
-        for (j = 0; j < g_rooms[room].locations[i].n_objects; j++) {
-            session->objects_statuses[k].object = &g_rooms[room].locations[i].objects[j];
-            k++;
-        }
+    if (s == NULL || s->token[0] == '\0') {
+        return -1;
+    }
+    /* Un dialogo fuori da una partita (la domanda per entrare in una room occupata) non viene conservato */
+    if (s->room == -1) {
+        end_dialogue(s);
     }
+    s->sd = -1;
+    s->detached_at = now;
+    return 0;
+}
+
+void attach_session(struct session *session, int sd) {
+    session->sd = sd;
+    session->detached_at = 0;
+}
+
+void enter_room(struct session *session, int room) {
+    leave_room(session);
+    session->catalogue = catalogue_acquire();
+    session->room = room;
+}
+
+void leave_room(struct session *session) {
+    catalogue_release(session->catalogue);
+    session->catalogue = NULL;
+    session->room = -1;
+    end_dialogue(session);
+}
+
+void end_dialogue(struct session *session) {
+    catalogue_release(session->dialogue.catalogue);
+    session->dialogue.catalogue = NULL;
+    session->dialogue.resume = NULL;
 }
 
-struct object_status* get_status(struct session *session, struct object *obj) {
-    int i = 0;
-    while (i < g_rooms[session->room].tot_objects &&
-           session->objects_statuses[i].object != obj) {
-        i++;
+struct room* session_room(struct session *session) {
+    return &session->catalogue->rooms[session->room];
+}
+
+int load_statuses(struct session *session) {
+    struct room *room = session_room(session);
+    int n = room->tot_objects;
+
+    /* Il vettore viene riutilizzato tra una partita e l'altra */
+    if (n > session->objects_capacity) {
+        struct object_status *statuses = realloc(session->game.objects, sizeof(struct object_status) * n);
+        if (statuses == NULL) {
+            return -1;
+        }
+        session->game.objects = statuses;
+        session->objects_capacity = n;
     }
-    return &session->objects_statuses[i];
+
+    reset_player(&room->puzzle, n, &session->game);
+    return 0;
 }
 
-struct session* get_session_by_room(int room) {
+struct object_status* get_status(struct session *session, int obj) {
+    return &session->game.objects[obj];
+}
+
+struct session* get_session_by_room(const char *room) {
     struct session *s = g_sessions;
     while (s != NULL) {
-        if ((room == -1 && s->room != -1) || 
-            (room != -1 && s->room == room)) {
+        if (s->room != -1 && (room == NULL || strcmp(session_room(s)->name, room) == 0)) {
             return s;
         }
         s = s->next;
@@ -92,3 +174,23 @@ struct session* get_session_by_username(const char *username) {
     }
     return s;
 }
+
+struct session* get_session_by_token(const char *token) {
+    struct session *s;
+
+    if (strlen(token) != TOKEN_LENGTH) {
+        return NULL;
+    }
+    for (s = g_sessions; s != NULL; s = s->next) {
+        int i, diff = 0;
+
+        /* Il confronto non si ferma al primo carattere diverso, non si può indovinare un pezzo alla volta */
+        for (i = 0; i < TOKEN_LENGTH; i++) {
+            diff |= s->token[i] ^ token[i];
+        }
+        if (diff == 0 && s->token[0] != '\0') {
+            return s;
+        }
+    }
+    return NULL;
+}
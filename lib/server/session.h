@@ -5,40 +5,89 @@
 #include "../protocol.h"
 #include "rooms.h"
 
-struct object_status {
-    struct object *object;
-    int used;           /* 0 o 1, indica se l'oggetto è stato utilizzato o meno */
-    int in_inventory;   /* 0 o 1, indica se l'oggetto è attualmente nell'inventario o meno */
+/* Lunghezza massima del comando ricordato in una sessione, compreso '\\0' */
+#define COMMAND_LENGTH_MAX 64
 
-    /* 0, 1 o 2, indica quale TAKE_STATUS guardare quando si prova a raccogliere l'oggetto */
-    int times_taken;
+struct session;
+
+/**
+ * Dialogo in corso con il client: un comando che gli ha fatto una domanda
+ *  e che riprende quando arriva la risposta (ANSWER), scritto come
+ *  coroutine (vedi lib/server/coroutine.h). Gli altri campi sono lo stato
+ *  che la coroutine conserva tra una domanda e l'altra.
+ */
+struct dialogue {
+    /* La coroutine, riceve gli argomenti della risposta; NULL se non c'è un dialogo */
+    int (*resume)(struct session *session, int argc, char *argv[ARGC_MAX]);
+    int pc;
+
+    /* Versione del catalogo di cui il dialogo usa i testi, può essere NULL */
+    struct catalogue *catalogue;
+
+    int room;           /* La room occupata in cui il client vuole entrare */
+    int object;         /* L'oggetto a cui si riferisce l'enigma */
+    int transition;     /* La transizione che ha posto l'enigma */
 };
 
 struct session {
+    /* -1 se la connessione si è interrotta e la sessione aspetta di essere ripresa */
     int sd;
     char username[CREDENTIALS_LENGTH_MAX];
 
+    /* Token per riprendere la sessione, vuoto se non può essere ripresa */
+    char token[TOKEN_LENGTH + 1];
+
+    /* Unix timestamp in cui la connessione si è interrotta (se sd == -1) */
+    unsigned long detached_at;
+
     /* L'escape room in cui sta attualmente giocando, -1 se non sta giocando */
     int room;
 
-    /* Numero di oggetti e di token attualmente posseduti */
-    int n_objects, n_tokens; 
+    /**
+     * La versione del catalogo con cui è entrato in *room*, NULL se non
+     *  sta giocando. Resta la stessa fino alla fine della partita, anche
+     *  se nel frattempo le room vengono ricaricate.
+     */
+    struct catalogue *catalogue;
 
-    unsigned long start_time;  /* Unix timestamp */
+    /**
+     * Inventario, token e stato di tutti gli oggetti della stanza
+     *  (game.objects ha *objects_capacity* elementi, l'i-esimo
+     *  riguarda l'oggetto i)
+     */
+    struct player_state game;
+    int objects_capacity;
 
     /**
-     * Serve per discriminare a quale enigma di quale oggetto sta rispondendo 
-     *  il client, vale NULL se sta rispondendo alla domanda per entrare in una
-     *  room occupata.
+     * Unix timestamp di inizio partita, spostato indietro o avanti quando
+     *  altri giocatori rispondono alla domanda per entrare nella room.
      */
-    struct object *answer_to;
+    unsigned long start_time;
+
+    /* Unix timestamp di inizio partita, non viene mai spostato (per le classifiche) */
+    unsigned long entry_time;
+
+    /* Unix timestamp dell'ultimo token raccolto (o di inizio partita), per le statistiche */
+    unsigned long token_time;
 
-    /* Memorizza lo stato di tutti gli oggetti di una stanza */
-    struct object_status objects_statuses[OBJECTS_PER_LOCATION_MAX * OBJECTS_PER_PLAYER_MAX];
+    /* Quante volte un altro giocatore ha indovinato la domanda, togliendogli tempo */
+    int sabotages;
+
+    /* Vero se gli è già stato notificato che il tempo sta per scadere */
+    int warned;
+
+    /* La domanda a cui il client deve rispondere, se c'è */
+    struct dialogue dialogue;
+
+    /* L'ultimo comando ricevuto (troncato), per gli spettatori */
+    char command[COMMAND_LENGTH_MAX];
 
     struct session *next;
 };
 
+/* Tutte le sessioni aperte, in ordine inverso di apertura */
+extern struct session *g_sessions;
+
 /**
  * Inizializza una sessione per un nuovo client.
  * In caso di memoria piena o di identificatore già in uso ritorna NULL.
@@ -51,27 +100,75 @@ struct session* init_session(int sd, const char *username);
  */
 void close_session(int sd);
 
+/* Come close_session(...), per le sessioni staccate (con sd == -1) */
+void destroy_session(struct session *session);
+
 /**
- * Carica in *session* gli indirizzi degli oggetti nella
- *  stanza *room* e ne inizializza i valori di controllo.
+ * Assegna a *session* un nuovo token, preso da /dev/urandom (quello
+ *  precedente non vale più). Ritorna -1 se non è stato possibile
+ *  generarlo, in tal caso la sessione non può essere ripresa.
  */
-void load_statuses(struct session *session, int room);
+int new_token(struct session *session);
+
+/**
+ * Stacca *session* dal socket *sd* (la connessione si è interrotta)
+ *  all'istante *now*, se ha un token. Ritorna 0 se la sessione è stata
+ *  staccata, -1 se non esiste o non può essere ripresa.
+ */
+int detach_session(int sd, unsigned long now);
+
+/* Riattacca la sessione staccata *session* al socket *sd* */
+void attach_session(struct session *session, int sd);
 
 /**
- * Ritorna lo stato dell'oggetto *obj* per il client con sessione *session*
+ * Fa entrare *session* nella stanza *room* della versione corrente
+ *  del catalogo, acquisendone un riferimento. Se stava già giocando
+ *  in un'altra stanza la abbandona prima.
  */
-struct object_status* get_status(struct session *session, struct object *obj);
+void enter_room(struct session *session, int room);
 
 /**
- * Se almeno un giocatore sta giocando la stanza *room* ritorna
+ * Fa uscire *session* dalla stanza in cui sta giocando e rilascia il
+ *  riferimento alla versione del catalogo. Se non sta giocando non fa nulla.
+ * Il dialogo in corso, se c'è, termina.
+ */
+void leave_room(struct session *session);
+
+/* Termina il dialogo in corso con *session* (vedi struct dialogue), se c'è */
+void end_dialogue(struct session *session);
+
+/* Ritorna la stanza in cui sta giocando *session* (che deve avere room != -1) */
+struct room* session_room(struct session *session);
+
+/**
+ * Porta nel loro stato iniziale tutti gli oggetti della
+ *  stanza in cui sta giocando *session* e svuota l'inventario.
+ * Ritorna -1 se la memoria è esaurita.
+ */
+int load_statuses(struct session *session);
+
+/**
+ * Ritorna lo stato dell'oggetto di indice *obj* per il client con sessione *session*
+ */
+struct object_status* get_status(struct session *session, int obj);
+
+/**
+ * Se almeno un giocatore sta giocando la stanza di nome *room* ritorna
  *  un puntatore alla sessione del più recente, NULL altrimenti.
- * Se *room* == -1 la ricerca è globale (praticamente ritorna
+ * La stanza è identificata dal nome, come per classifiche e spettatori:
+ *  dopo una ricarica chi gioca ancora con una versione precedente del
+ *  catalogo occupa la stanza con lo stesso nome, non quella con lo
+ *  stesso indice.
+ * Se *room* è NULL la ricerca è globale (praticamente ritorna
  *  qualcosa != NULL se almeno un giocatore sta giocando a
  *  qualsiasi stanza)
  */ 
-struct session* get_session_by_room(int room);
+struct session* get_session_by_room(const char *room);
 
 struct session* get_session_by_sd(int sd);
 struct session* get_session_by_username(const char *username);
 
+/* Ritorna la sessione con token *token*, NULL se non esiste */
+struct session* get_session_by_token(const char *token);
+
 #endif
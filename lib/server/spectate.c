@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "spectate.h"
+
+/* Dimensione e azione precedono il testo, vedi send_msg(...) */
+#define EVENT_SIZE_MAX (2 + IO_BUFFER_SIZE)
+
+struct channel {
+    char *room;
+    int n_spectators;
+
+    /**
+     * L'evento numero i (contando dal primo pubblicato) occupa lo slot
+     *  i % CHANNEL_EVENTS di *events* ed è lungo sizes[i % CHANNEL_EVENTS].
+     * Gli slot vengono allocati all'arrivo del primo spettatore.
+     */
+    char *events;
+    int sizes[CHANNEL_EVENTS];
+    unsigned long next_event;
+};
+
+struct spectator {
+    int sd;
+    struct channel *channel;
+    unsigned long event;    /* Prossimo evento da inviare */
+    int sent;               /* Byte di *event* già inviati */
+    struct spectator *next;
+};
+
+static struct channel **g_channels = NULL;
+static int g_n_channels = 0, g_channels_capacity = 0;
+
+static struct spectator *g_spectators = NULL;
+
+static struct channel* get_channel(const char *room) {
+    int i;
+    for (i = 0; i < g_n_channels; i++) {
+        if (strcmp(g_channels[i]->room, room) == 0) {
+            return g_channels[i];
+        }
+    }
+    return NULL;
+}
+
+/* Come get_channel(...), ma se il canale non esiste lo crea */
+static struct channel* open_channel(const char *room) {
+    struct channel *ch = get_channel(room);
+
+    if (ch != NULL) {
+        return ch;
+    }
+
+    if (g_n_channels == g_channels_capacity) {
+        int cap = g_channels_capacity == 0 ? 8 : 2 * g_channels_capacity;
+        struct channel **bigger = realloc(g_channels, sizeof(struct channel *) * cap);
+        if (bigger == NULL) {
+            return NULL;
+        }
+        g_channels = bigger;
+        g_channels_capacity = cap;
+    }
+
+    ch = malloc(sizeof(struct channel));
+    if (ch == NULL) {
+        return NULL;
+    }
+    memset(ch, 0, sizeof(struct channel));
+    ch->room = malloc(strlen(room) + 1);
+    if (ch->room == NULL) {
+        free(ch);
+        return NULL;
+    }
+    strcpy(ch->room, room);
+
+    g_channels[g_n_channels++] = ch;
+    return ch;
+}
+
+static struct spectator** find_spectator(int sd) {
+    struct spectator **sp = &g_spectators;
+    while (*sp != NULL && (*sp)->sd != sd) {
+        sp = &(*sp)->next;
+    }
+    return sp;
+}
+
+int spectate_subscribe(const char *room, int sd) {
+    struct channel *ch;
+    struct spectator *sp;
+
+    ch = open_channel(room);
+    if (ch == NULL) {
+        return -1;
+    }
+    if (ch->events == NULL) {
+        ch->events = malloc(CHANNEL_EVENTS * EVENT_SIZE_MAX);
+        if (ch->events == NULL) {
+            return -1;
+        }
+    }
+
+    sp = malloc(sizeof(struct spectator));
+    if (sp == NULL) {
+        return -1;
+    }
+    sp->sd = sd;
+    sp->channel = ch;
+    sp->event = ch->next_event;
+    sp->sent = 0;
+    sp->next = g_spectators;
+    g_spectators = sp;
+
+    ch->n_spectators++;
+    return 0;
+}
+
+int spectate_watching(int sd) {
+    return *find_spectator(sd) != NULL;
+}
+
+/* Vero se l'evento numero *event* di *ch* è stato sovrascritto */
+static int overwritten(const struct channel *ch, unsigned long event) {
+    return ch->next_event - event > CHANNEL_EVENTS;
+}
+
+int spectate_stop(int sd, struct fragment *rest) {
+    struct spectator **link = find_spectator(sd);
+    struct spectator *sp = *link;
+    int ret = 0;
+
+    if (rest != NULL) {
+        make_fragment(rest, NULL);
+    }
+    if (sp == NULL) {
+        return 0;
+    }
+
+    /* Il resto dell'evento iniziato, che il chiamante invierà */
+    if (rest != NULL && sp->sent > 0) {
+        struct channel *ch = sp->channel;
+        int slot = sp->event % CHANNEL_EVENTS;
+
+        if (overwritten(ch, sp->event)) {
+            ret = -1;
+        }
+        else {
+            rest->data = ch->events + slot * EVENT_SIZE_MAX + sp->sent;
+            rest->size = ch->sizes[slot] - sp->sent;
+        }
+    }
+
+    sp->channel->n_spectators--;
+    *link = sp->next;
+    free(sp);
+    return ret;
+}
+
+void spectate_publish(const char *room, const struct fragment parts[], int n) {
+    struct channel *ch = get_channel(room);
+    char *event;
+    int i, size;
+
+    if (ch == NULL || ch->n_spectators == 0) {
+        return;
+    }
+
+    /* Dimensione (2 byte), azione, testo e '\\0', come in send_msg(...) */
+    event = ch->events + (ch->next_event % CHANNEL_EVENTS) * EVENT_SIZE_MAX;
+    size = 3;
+    for (i = 0; i < n; i++) {
+        int len = parts[i].size;
+        if (size + len > EVENT_SIZE_MAX - 1) {
+            len = EVENT_SIZE_MAX - 1 - size;
+        }
+        memcpy(event + size, parts[i].data, len);
+        size += len;
+    }
+    event[size++] = '\0';
+    event[0] = (uint8_t)((size - 2) >> 8);
+    event[1] = (uint8_t)(size - 2);
+    event[2] = (uint8_t)EVENT;
+
+    ch->sizes[ch->next_event % CHANNEL_EVENTS] = size;
+    ch->next_event++;
+}
+
+int spectate_fill(fd_set *fds, int sd_max) {
+    struct spectator *sp;
+
+    for (sp = g_spectators; sp != NULL; sp = sp->next) {
+        if (sp->event != sp->channel->next_event) {
+            FD_SET(sp->sd, fds);
+            if (sp->sd > sd_max) {
+                sd_max = sp->sd;
+            }
+        }
+    }
+    return sd_max;
+}
+
+int spectate_write(int sd) {
+    struct spectator *sp = *find_spectator(sd);
+    struct channel *ch;
+
+    if (sp == NULL) {
+        return 0;
+    }
+    ch = sp->channel;
+
+    while (sp->event != ch->next_event) {
+        int slot, n;
+
+        /* Lo spettatore è rimasto indietro */
+        if (overwritten(ch, sp->event)) {
+            if (sp->sent > 0) {
+                spectate_stop(sd, NULL);
+                return -1;
+            }
+            sp->event = ch->next_event - CHANNEL_EVENTS;
+        }
+
+        slot = sp->event % CHANNEL_EVENTS;
+        n = send(sd, ch->events + slot * EVENT_SIZE_MAX + sp->sent,
+            ch->sizes[slot] - sp->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            spectate_stop(sd, NULL);
+            return -1;
+        }
+
+        sp->sent += n;
+        g_protocol_stats.bytes_sent += n;
+        if (sp->sent == ch->sizes[slot]) {
+            sp->event++;
+            sp->sent = 0;
+        }
+    }
+    return 0;
+}
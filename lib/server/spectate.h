@@ -0,0 +1,68 @@
+#ifndef LIB_SERVER_SPECTATE_H
+#define LIB_SERVER_SPECTATE_H
+
+#include <sys/select.h>
+
+#include "../protocol.h"
+
+/* Eventi conservati per ogni room, uno spettatore può restare indietro al più di tanti */
+#define CHANNEL_EVENTS 128
+
+/**
+ * Spettatori delle escape room.
+ *
+ * Ogni room (identificata dal nome) ha un canale: un buffer circolare
+ *  di CHANNEL_EVENTS eventi, ognuno già codificato come un messaggio
+ *  EVENT completo. Un evento viene codificato una volta sola, qualunque
+ *  sia il numero degli spettatori, e ognuno di questi ricorda solo fin
+ *  dove lo ha ricevuto.
+ * Gli eventi vengono inviati agli spettatori dal ciclo principale del
+ *  server, quando i loro socket sono pronti in scrittura, e senza mai
+ *  bloccarsi: chi pubblica un evento non aspetta nessuno. Se uno
+ *  spettatore resta indietro di più di CHANNEL_EVENTS eventi salta a
+ *  quello più vecchio ancora disponibile; se però stava ricevendo un
+ *  evento che nel frattempo è stato sovrascritto non può più essere
+ *  risincronizzato e va disconnesso.
+ */
+
+/**
+ * Iscrive *sd* agli eventi della room *room*, a partire dal prossimo.
+ * Ritorna -1 se la memoria è esaurita.
+ */
+int spectate_subscribe(const char *room, int sd);
+
+/* Vero se *sd* sta guardando una room */
+int spectate_watching(int sd);
+
+/**
+ * Smette di inviare eventi a *sd* (se non stava guardando non fa nulla).
+ * Se *rest* non è NULL vi scrive la parte dell'evento in corso che *sd*
+ *  non ha ancora ricevuto (size 0 se nessuna): va inviata prima di ogni
+ *  altro messaggio, e copiata subito perché il prossimo evento pubblicato
+ *  può sovrascriverla. Ritorna -1 se l'evento in corso è già stato
+ *  sovrascritto e la connessione va chiusa, 0 altrimenti.
+ */
+int spectate_stop(int sd, struct fragment *rest);
+
+/**
+ * Pubblica per gli spettatori di *room* un evento il cui testo è la
+ *  concatenazione degli *n* frammenti in *parts* (troncata se non entra
+ *  in un messaggio). Se nessuno guarda la room non fa nulla.
+ */
+void spectate_publish(const char *room, const struct fragment parts[], int n);
+
+/**
+ * Aggiunge a *fds* i socket degli spettatori che hanno eventi da ricevere.
+ * Ritorna il maggiore tra questi e *sd_max*.
+ */
+int spectate_fill(fd_set *fds, int sd_max);
+
+/**
+ * Invia a *sd*, pronto in scrittura, quanto più possibile degli eventi
+ *  che deve ancora ricevere.
+ * Ritorna -1 se la connessione va chiusa (lo spettatore è già stato
+ *  rimosso), 0 altrimenti.
+ */
+int spectate_write(int sd);
+
+#endif
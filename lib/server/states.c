@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "states.h"
+
+/* Numero di bit necessari a rappresentare i valori [0, n] */
+static int bits_for(int n) {
+    int bits = 0;
+    while ((1L << bits) <= n) {
+        bits++;
+    }
+    return bits;
+}
+
+int layout_init(struct layout *lay, const struct room *r) {
+    const struct puzzle *pz = &r->puzzle;
+    int i, bit = 0;
+
+    lay->offset = malloc(sizeof(int) * (r->tot_objects + 1));
+    lay->bits = malloc(sizeof(int) * (r->tot_objects + 1));
+    if (lay->offset == NULL || lay->bits == NULL) {
+        layout_free(lay);
+        return -1;
+    }
+
+    for (i = 0; i < r->tot_objects; i++) {
+        int n = pz->first_state[i + 1] - pz->first_state[i];
+        int width = bits_for(n - 1) + 1;
+
+        if (bit / 64 != (bit + width - 1) / 64) {
+            bit = (bit / 64 + 1) * 64;
+        }
+        lay->offset[i] = bit;
+        lay->bits[i] = width - 1;
+        bit += width;
+    }
+
+    lay->tokens_bits = bits_for(r->n_tokens);
+    if (bit / 64 != (bit + lay->tokens_bits - 1) / 64) {
+        bit = (bit / 64 + 1) * 64;
+    }
+    lay->tokens_offset = bit;
+    bit += lay->tokens_bits;
+
+    lay->words = bit / 64 + 1;
+    return 0;
+}
+
+void layout_free(struct layout *lay) {
+    free(lay->offset);
+    free(lay->bits);
+    lay->offset = NULL;
+    lay->bits = NULL;
+}
+
+static void set_field(uint64_t *words, int offset, int bits, unsigned int value) {
+    uint64_t mask = ((uint64_t)1 << bits) - 1;
+    uint64_t *w = &words[offset / 64];
+    *w = (*w & ~(mask << (offset % 64))) | (((uint64_t)value & mask) << (offset % 64));
+}
+
+static unsigned int get_field(const uint64_t *words, int offset, int bits) {
+    uint64_t mask = ((uint64_t)1 << bits) - 1;
+    return (unsigned int)((words[offset / 64] >> (offset % 64)) & mask);
+}
+
+void state_encode(const struct layout *lay, const struct room *r, const struct player_state *ps, uint64_t *words) {
+    const int *first = r->puzzle.first_state;
+    int i;
+
+    memset(words, 0, sizeof(uint64_t) * lay->words);
+    for (i = 0; i < r->tot_objects; i++) {
+        set_field(words, lay->offset[i], lay->bits[i], ps->objects[i].state - first[i]);
+        set_field(words, lay->offset[i] + lay->bits[i], 1, ps->objects[i].in_inventory);
+    }
+    set_field(words, lay->tokens_offset, lay->tokens_bits,
+        ps->n_tokens < r->n_tokens ? ps->n_tokens : r->n_tokens);
+}
+
+void state_decode(const struct layout *lay, const struct room *r, const uint64_t *words, struct player_state *ps) {
+    const int *first = r->puzzle.first_state;
+    int i;
+
+    ps->n_objects = 0;
+    for (i = 0; i < r->tot_objects; i++) {
+        ps->objects[i].state = first[i] + get_field(words, lay->offset[i], lay->bits[i]);
+        ps->objects[i].in_inventory = get_field(words, lay->offset[i] + lay->bits[i], 1);
+        ps->n_objects += ps->objects[i].in_inventory;
+    }
+    ps->n_tokens = get_field(words, lay->tokens_offset, lay->tokens_bits);
+}
+
+int state_is_win(const struct layout *lay, const struct room *r, const uint64_t *words) {
+    return (int)get_field(words, lay->tokens_offset, lay->tokens_bits) >= r->n_tokens;
+}
+
+uint64_t state_hash(const uint64_t *words, int n) {
+    uint64_t h = 0x9E3779B97F4A7C15UL;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        h ^= words[i];
+        h *= 0xBF58476D1CE4E5B9UL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+int apply_move(const struct room *r, struct player_state *ps, int move, const char **answer) {
+    const struct puzzle *pz = &r->puzzle;
+    struct object_status *os = &ps->objects[MOVE_OBJECT(move)];
+    struct outcome out;
+    int i;
+
+    switch (MOVE_KIND_OF(move)) {
+        case MOVE_TAKE:
+            if (os->in_inventory || ps->n_objects == OBJECTS_PER_PLAYER_MAX) {
+                return 0;
+            }
+            fire_event(pz, ps, MOVE_OBJECT(move), EV_TAKE, TARGET_NONE, &out);
+            break;
+        case MOVE_USE:
+            fire_event(pz, ps, MOVE_OBJECT(move), EV_USE, MOVE_TARGET(move), &out);
+            break;
+        default:
+            if (!os->in_inventory) {
+                return 0;
+            }
+            os->in_inventory = 0;
+            ps->n_objects--;
+            return 1;
+    }
+
+    /* Nessuna transizione eseguita: lo stato non cambia */
+    if (out.transition == -1) {
+        return 0;
+    }
+    if (!out.asked) {
+        return (move & MOVE_ANSWERED) ? 0 : 1;
+    }
+    if (!(move & MOVE_ANSWERED)) {
+        return 2;
+    }
+
+    if (answer != NULL) {
+        *answer = pz->transitions[out.transition].answer;
+    }
+    for (i = 0; i < ANSWERS_MAX && out.asked; i++) {
+        fire_event(pz, ps, MOVE_OBJECT(move), EV_ANSWER, TARGET_NONE, &out);
+    }
+    return 1;
+}
+
+void move_to_str(const struct room *r, int move, char *buffer) {
+    const char *object = r->object_names[MOVE_OBJECT(move)];
+    int target = MOVE_TARGET(move);
+
+    switch (MOVE_KIND_OF(move)) {
+        case MOVE_TAKE:
+            sprintf(buffer, "take %.100s", object);
+            break;
+        case MOVE_USE:
+            if (target >= 0) {
+                sprintf(buffer, "use %.100s %.100s", object, r->object_names[target]);
+            }
+            else if (target == TARGET_UNKNOWN) {
+                sprintf(buffer, "use %.100s <inesistente>", object);
+            }
+            else {
+                sprintf(buffer, "use %.100s", object);
+            }
+            break;
+        default:
+            sprintf(buffer, "drop %.100s", object);
+            break;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef LIB_SERVER_STATES_H
+#define LIB_SERVER_STATES_H
+
+#include <stdint.h>
+
+#include "rooms.h"
+
+/**
+ * Spazio degli stati di gioco di una room, condiviso dal risolutore
+ *  offline (solver.c) e dai suggerimenti del server (lib/server/hints.h).
+ *
+ * Uno stato compatto contiene quello che conta per le transizioni: lo
+ *  stato di ogni oggetto, l'inventario ed i token raccolti, codificati
+ *  in poche parole da 64 bit. Le mosse sono le stesse dei comandi del
+ *  server (take, use con o senza bersaglio, drop), codificate in un
+ *  intero.
+ */
+
+/* Massimo numero di enigmi consecutivi posti da una sola mossa */
+#define ANSWERS_MAX 8
+
+/* Una mossa è codificata in un intero: tipo, oggetto e bersaglio (per use) */
+enum MOVE_KIND {
+    MOVE_TAKE,
+    MOVE_USE,
+    MOVE_DROP
+};
+#define MOVE_ANSWERED (1 << 30)     /* Il giocatore risponde correttamente agli enigmi posti */
+#define MOVE(kind, obj, target) (((kind) << 28) | ((obj) << 14) | ((target) + 2))
+#define MOVE_KIND_OF(m) (((m) >> 28) & 3)
+#define MOVE_OBJECT(m) (((m) >> 14) & 0x3FFF)
+#define MOVE_TARGET(m) (((m) & 0x3FFF) - 2)
+#define OBJECTS_MAX 0x3FF0
+
+/* Spazio per move_to_str(...), i nomi più lunghi di 100 caratteri vengono troncati */
+#define MOVE_STR_MAX 240
+
+/**
+ * Posizione dei campi di uno stato compatto: per ogni oggetto lo stato
+ *  locale (relativo a first_state) ed il bit dell'inventario, poi i token.
+ * Un campo non è mai diviso tra due parole.
+ */
+struct layout {
+    int words;
+    int *offset;        /* Primo bit del campo di ogni oggetto */
+    int *bits;          /* Bit dello stato locale di ogni oggetto */
+    int tokens_offset, tokens_bits;
+};
+
+/* Calcola il layout degli stati di *r*, ritorna -1 se la memoria è esaurita */
+int layout_init(struct layout *lay, const struct room *r);
+
+void layout_free(struct layout *lay);
+
+/* Codifica *ps* in *words* (lay->words parole) */
+void state_encode(const struct layout *lay, const struct room *r, const struct player_state *ps, uint64_t *words);
+
+/* Decodifica *words* in *ps*, che deve avere spazio per tutti gli oggetti */
+void state_decode(const struct layout *lay, const struct room *r, const uint64_t *words, struct player_state *ps);
+
+/* Vero se nello stato *words* sono stati raccolti tutti i token */
+int state_is_win(const struct layout *lay, const struct room *r, const uint64_t *words);
+
+uint64_t state_hash(const uint64_t *words, int n);
+
+/**
+ * Applica *move* a *ps* seguendo le stesse regole dei comandi del server.
+ * Ritorna 0 se la mossa non è ammessa, 2 se ha posto un enigma a cui non
+ *  si è risposto (la mossa con MOVE_ANSWERED è un successore diverso),
+ *  1 altrimenti. Se *answer* non è NULL vi scrive la risposta data.
+ */
+int apply_move(const struct room *r, struct player_state *ps, int move, const char **answer);
+
+/**
+ * Scrive in *buffer* (di almeno MOVE_STR_MAX byte) il comando che
+ *  corrisponde a *move*, ad esempio "use cavo porta".
+ */
+void move_to_str(const struct room *r, int move, char *buffer);
+
+#endif
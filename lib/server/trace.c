@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+struct span {
+    const char *name;
+    unsigned long start, end;   /* Nanosecondi, end == 0 se non ancora terminato */
+    int sd;
+    int request;                /* Vero per l'intervallo dell'intera richiesta */
+    unsigned long id;           /* Numero della richiesta */
+};
+
+static const char* const stage_to_str[] = {
+    "read",
+    "decode",
+    "dispatch",
+    "handler",
+    "publish",
+    "write"
+};
+
+static struct span *g_spans = NULL;
+static long g_n_spans = 0;
+
+static int g_every = 0;
+static unsigned long g_requests = 0, g_dropped = 0;
+
+/* Richiesta in corso, se tracciata, e le sue fasi aperte (-1 se nessuna) */
+static int g_traced = 0;
+static long g_request = -1, g_stage = -1, g_nested = -1;
+
+static unsigned long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/* Apre un nuovo intervallo e ne ritorna l'indice, -1 se non c'è spazio */
+static long open_span(const char *name, int sd, int request) {
+    struct span *s;
+
+    if (g_n_spans == TRACE_SPANS_MAX) {
+        return -1;
+    }
+    s = &g_spans[g_n_spans];
+    s->name = name;
+    s->sd = sd;
+    s->request = request;
+    s->id = g_requests;
+    s->end = 0;
+    s->start = now();
+    return g_n_spans++;
+}
+
+static void close_span(long *i) {
+    if (*i != -1) {
+        g_spans[*i].end = now();
+        *i = -1;
+    }
+}
+
+void trace_sample(int every) {
+    if (every > 0 && g_spans == NULL) {
+        g_spans = malloc(sizeof(struct span) * TRACE_SPANS_MAX);
+        if (g_spans == NULL) {
+            every = 0;
+        }
+    }
+    g_every = every;
+}
+
+void trace_request_begin(int sd) {
+    g_traced = 0;
+    if (g_every == 0 || g_requests++ % g_every != 0) {
+        return;
+    }
+
+    /* Una richiesta e le sue fasi occupano al più 6 intervalli */
+    if (g_n_spans + 6 > TRACE_SPANS_MAX) {
+        g_dropped++;
+        return;
+    }
+    g_traced = 1;
+    g_request = open_span("?", sd, 1);
+    g_stage = g_nested = -1;
+}
+
+void trace_request_name(const char *name) {
+    if (g_traced) {
+        g_spans[g_request].name = name;
+    }
+}
+
+void trace_request_end(void) {
+    if (!g_traced) {
+        return;
+    }
+    close_span(&g_nested);
+    close_span(&g_stage);
+    close_span(&g_request);
+    g_traced = 0;
+}
+
+void trace_request_cancel(void) {
+    /* Non conta per il campionamento, la richiesta vera è quella che leggerà il resto */
+    if (g_every > 0) {
+        g_requests--;
+    }
+    if (g_traced) {
+        g_n_spans = g_request;
+        g_traced = 0;
+    }
+}
+
+void trace_stage(enum TRACE_STAGE stage) {
+    if (!g_traced) {
+        return;
+    }
+    close_span(&g_nested);
+    close_span(&g_stage);
+    g_stage = open_span(stage_to_str[stage], g_spans[g_request].sd, 0);
+}
+
+void trace_span_begin(enum TRACE_STAGE stage) {
+    if (!g_traced) {
+        return;
+    }
+    close_span(&g_nested);
+    g_nested = open_span(stage_to_str[stage], g_spans[g_request].sd, 0);
+}
+
+void trace_span_end(void) {
+    if (g_traced) {
+        close_span(&g_nested);
+    }
+}
+
+long trace_dump(const char *path) {
+    FILE *f;
+    long i, n = 0;
+    int pid = (int)getpid();
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+
+    /* I tempi del formato sono in microsecondi */
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"escape room server\"}}", pid);
+    for (i = 0; i < g_n_spans; i++) {
+        const struct span *s = &g_spans[i];
+
+        if (s->end == 0) {
+            continue;
+        }
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%lu}}",
+            s->name, s->request ? "request" : "stage", s->start / 1e3,
+            (s->end - s->start) / 1e3, pid, s->sd, s->id);
+        n += s->request;
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"sample_every\":%d,\"dropped_requests\":%lu}}\n",
+        g_every, g_dropped);
+    fclose(f);
+
+    /* Le richieste in corso (se ce ne sono) non sono state scritte */
+    g_n_spans = 0;
+    g_dropped = 0;
+    g_traced = 0;
+    return n;
+}
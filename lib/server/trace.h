@@ -0,0 +1,63 @@
+#ifndef LIB_SERVER_TRACE_H
+#define LIB_SERVER_TRACE_H
+
+/* File in cui il comando "trace dump" del server scrive le tracce */
+#define TRACE_FILE "trace.json"
+
+/* Massimo numero di intervalli conservati tra un dump e l'altro */
+#define TRACE_SPANS_MAX 65536
+
+/* Fasi dell'esecuzione di un messaggio */
+enum TRACE_STAGE {
+    TRACE_READ,         /* Lettura del messaggio dal socket */
+    TRACE_DECODE,       /* Decodifica degli argomenti */
+    TRACE_DISPATCH,     /* Controlli comuni a tutti i comandi */
+    TRACE_HANDLER,      /* Esecuzione del comando */
+    TRACE_PUBLISH,      /* Pubblicazione per gli spettatori (dentro TRACE_HANDLER) */
+    TRACE_WRITE         /* Invio della risposta (dentro TRACE_HANDLER) */
+};
+
+/**
+ * Tracciamento a campione delle richieste.
+ *
+ * Una richiesta ogni *n* (vedi trace_sample(...)) viene tracciata: si
+ *  registrano con un orologio monotono l'intervallo dell'intera richiesta
+ *  e quelli delle sue fasi. Le fasi TRACE_READ, TRACE_DECODE, TRACE_DISPATCH
+ *  e TRACE_HANDLER si susseguono (iniziarne una termina la precedente),
+ *  TRACE_PUBLISH e TRACE_WRITE sono annidate nella fase in corso.
+ * Se la richiesta non è tracciata (o il tracciamento è spento) ogni
+ *  funzione costa un confronto.
+ *
+ * Le tracce vengono scritte nel formato JSON "trace event" di Chrome
+ *  (chrome://tracing, Perfetto), una riga per ogni client.
+ */
+
+/* Traccia una richiesta ogni *every*, 0 spegne il tracciamento */
+void trace_sample(int every);
+
+/* Inizia una richiesta del client *sd*, decidendo se tracciarla */
+void trace_request_begin(int sd);
+
+/* Dà un nome (una stringa che non verrà deallocata) alla richiesta in corso */
+void trace_request_name(const char *name);
+
+/* Termina la richiesta in corso e la sua ultima fase */
+void trace_request_end(void);
+
+/* Scarta la richiesta in corso, ad esempio perché il messaggio non era ancora arrivato tutto */
+void trace_request_cancel(void);
+
+/* Termina la fase in corso ed inizia *stage* */
+void trace_stage(enum TRACE_STAGE stage);
+
+/* Inizia e termina una fase annidata */
+void trace_span_begin(enum TRACE_STAGE stage);
+void trace_span_end(void);
+
+/**
+ * Scrive in *path* le tracce registrate fino ad ora e le scarta.
+ * Ritorna il numero di richieste scritte, -1 se il file non può essere aperto.
+ */
+long trace_dump(const char *path);
+
+#endif
@@ -0,0 +1,785 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/protocol.h"
+#include "lib/histogram.h"
+#include "lib/mystdlib.h"
+
+/**
+ * Generatore di carico per il server.
+ *
+ * Un solo processo apre *sessioni* connessioni non bloccanti, controllate
+ *  con poll: ognuna si registra (o accede) come *prefisso*N e gioca finché
+ *  non passano *durata* secondi, poi invia end ed aspetta che il server
+ *  chiuda la connessione.
+ * Ogni sessione segue lo script (di default il percorso più breve per
+ *  risolvere "Red Teaming", quello indicato come SPOILER in rooms.txt) e
+ *  lo ricomincia ogni volta che lo completa; con -r una parte delle
+ *  sessioni invia invece comandi casuali, con le parole dello script.
+ * Se la room è occupata la sessione risponde all'enigma della room e
+ *  riprova ad entrare.
+ *
+ * Lo script contiene un comando per riga, scritto come nel client, con
+ *  tra parentesi la risposta da dare se il server pone una domanda:
+ *      start 0
+ *      take cavo (rame)
+ * Le righe vuote e quelle che iniziano con '#' vengono ignorate.
+ *
+ * Al termine riporta il throughput e la latenza (media, p50, p99, p999,
+ *  massimo) per ogni azione, per tutte insieme (ALL) e per ogni fase di una sessione: connessione,
+ *  login, ingresso nella room (compresi i tentativi con la room occupata),
+ *  partita (dall'ingresso alla fine dello script) ed intera sessione.
+ *
+ * Uso: loadgen [-c sessioni] [-d durata] [-r percentuale] [-t ms] [-s script]
+ *              [-u prefisso] [-S seme] [porta]
+ * Esce con 0 se non ci sono stati errori, 1 altrimenti.
+ */
+
+#define SERVER_IP "127.0.0.1"
+#define DEFAULT_SERVER_PORT 4242
+#define DEFAULT_SESSIONS 100
+#define DEFAULT_DURATION 10
+#define PASSWORD "loadgen"
+
+/* Connessioni e login in corso contemporaneamente, per non riempire la coda del server */
+#define CONNECTING_MAX 64
+
+/* Secondi concessi al server per chiudere le connessioni dopo end */
+#define CLOSE_TIMEOUT 5
+
+#define SCRIPT_LINES_MAX 256
+#define WORDS_MAX 64
+
+/* Spazio per due messaggi del server, come in replay.c */
+#define CONN_BUFFER_SIZE (2 * (2 + IO_BUFFER_SIZE))
+
+#define NS_PER_SEC 1000000000UL
+
+/* Una riga dello script */
+struct line {
+    enum ACTION action;
+    int argc;
+    char *argv[ARGC_MAX];
+    char *answer;           /* Risposta alle domande, NULL se non indicata */
+};
+
+enum STATE {
+    ST_IDLE,        /* Non ancora connessa */
+    ST_CONNECTING,
+    ST_LOGIN,       /* Aspetta la risposta (4 byte) al login */
+    ST_ROOMS,       /* Aspetta la lista delle escape room */
+    ST_READY,       /* Può inviare il prossimo comando, da *next_at* */
+    ST_REPLY,       /* Aspetta la risposta ad un comando */
+    ST_CLOSING,     /* Ha inviato end, aspetta che il server chiuda */
+    ST_CLOSED
+};
+
+enum PHASE {
+    PH_CONNECT,
+    PH_LOGIN,
+    PH_ENTER,
+    PH_GAME,
+    PH_SESSION,
+    PHASES_MAX
+};
+
+static const char* const phase_to_str[] = {
+    "connect",
+    "login",
+    "enter",
+    "game",
+    "session"
+};
+
+struct session {
+    int fd;
+    int id;
+    int random;             /* Invia comandi casuali invece di seguire lo script */
+    enum STATE state;
+    int step;               /* Prossima riga dello script */
+    int in_room;
+    int must_answer;        /* Il server ha posto una domanda */
+    int room_question;      /* La domanda è quella di una room occupata */
+    char *answer;           /* Risposta da dare se il server pone una domanda */
+    enum ACTION pending;    /* Comando in attesa di risposta */
+    unsigned long sent_at, next_at;
+    unsigned long begin[PHASES_MAX];    /* Inizio delle fasi in corso, 0 se nessuna */
+
+    char in[CONN_BUFFER_SIZE];
+    int used;
+    char out[2 + IO_BUFFER_SIZE];
+    int out_size, out_done;
+};
+
+static struct line g_script[SCRIPT_LINES_MAX];
+static int g_n_lines = 0;
+
+/* Parole e risposte dello script, per i comandi casuali */
+static char *g_words[WORDS_MAX], *g_answers[WORDS_MAX];
+static int g_n_words = 0, g_n_answers = 0;
+
+/* Comandi di default, vedi lo SPOILER di "Red Teaming" in rooms.txt */
+static const char* const g_spoiler[] = {
+    "start 0",
+    "take cavo (rame)",
+    "take cavo",
+    "use cavo router",
+    "drop cavo",
+    "take password (250513)",
+    "take password",
+    "take tastiera (73)",
+    "take router",
+    "take tastiera"
+};
+
+static struct sockaddr_in g_addr;
+static const char *g_prefix = "load";
+static unsigned long g_think = 0;       /* Attesa tra due comandi, in ns */
+static int g_n_rooms = 1;
+
+static struct histogram g_actions[ACTION_MAX];
+static struct histogram g_phases[PHASES_MAX];
+static unsigned long g_commands = 0, g_games = 0, g_errors = 0;
+static int g_connecting = 0, g_alive = 0;
+
+static unsigned long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * NS_PER_SEC + (unsigned long)ts.tv_nsec;
+}
+
+static char* copy_string(const char *str) {
+    char *copy = malloc(strlen(str) + 1);
+    if (copy != NULL) {
+        strcpy(copy, str);
+    }
+    return copy;
+}
+
+/* Aggiunge *word* all'elenco *words* (di *n* parole) se non c'è già */
+static void add_word(char **words, int *n, const char *word) {
+    int i;
+    for (i = 0; i < *n; i++) {
+        if (strcmp(words[i], word) == 0) {
+            return;
+        }
+    }
+    if (*n < WORDS_MAX && (words[*n] = copy_string(word)) != NULL) {
+        (*n)++;
+    }
+}
+
+/**
+ * Interpreta una riga dello script (che viene modificata).
+ * Ritorna -1 se non è valida, 0 altrimenti.
+ */
+static int parse_line(char *text) {
+    struct line *l = &g_script[g_n_lines];
+    char *open, *end, *word;
+    int i;
+
+    if (g_n_lines == SCRIPT_LINES_MAX) {
+        return -1;
+    }
+    memset(l, 0, sizeof(struct line));
+
+    open = strchr(text, '(');
+    if (open != NULL) {
+        end = strchr(open, ')');
+        if (end == NULL) {
+            return -1;
+        }
+        *open = *end = '\0';
+        l->answer = copy_string(open + 1);
+        add_word(g_answers, &g_n_answers, open + 1);
+    }
+
+    word = strtok(text, " \t");
+    if (word == NULL || (l->action = str_to_action(word)) == HELP || l->action == END) {
+        return -1;
+    }
+    while ((word = strtok(NULL, " \t")) != NULL) {
+        if (l->argc == ARGC_MAX) {
+            return -1;
+        }
+        l->argv[l->argc++] = copy_string(word);
+    }
+    for (i = 0; i < l->argc && l->action != START && l->action != RANK; i++) {
+        add_word(g_words, &g_n_words, l->argv[i]);
+    }
+    g_n_lines++;
+    return 0;
+}
+
+/* Carica lo script da *path*, o quello di default se è NULL */
+static int load_script(const char *path) {
+    char buffer[IO_BUFFER_SIZE];
+    FILE *f;
+    int n = 0;
+
+    if (path == NULL) {
+        for (n = 0; n < (int)(sizeof(g_spoiler) / sizeof(g_spoiler[0])); n++) {
+            strcpy(buffer, g_spoiler[n]);
+            parse_line(buffer);
+        }
+        return 0;
+    }
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Impossibile leggere %s\n", path);
+        return -1;
+    }
+    while (fgetsnn(buffer, IO_BUFFER_SIZE, f) != NULL) {
+        char *p = buffer;
+
+        n++;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        if (parse_line(p) == -1) {
+            printf("%s:%d: riga non valida\n", path, n);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+
+    if (g_n_lines == 0) {
+        printf("%s non contiene comandi\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void begin_phase(struct session *s, enum PHASE phase) {
+    s->begin[phase] = now();
+}
+
+static void end_phase(struct session *s, enum PHASE phase) {
+    if (s->begin[phase] != 0) {
+        hist_record(&g_phases[phase], now() - s->begin[phase]);
+        s->begin[phase] = 0;
+    }
+}
+
+static void close_session(struct session *s, int error) {
+    if (s->state == ST_CONNECTING || s->state == ST_LOGIN || s->state == ST_ROOMS) {
+        g_connecting--;
+    }
+    if (error) {
+        g_errors++;
+    }
+    else {
+        end_phase(s, PH_SESSION);
+    }
+    close(s->fd);
+    s->state = ST_CLOSED;
+    g_alive--;
+}
+
+/* Prova ad inviare quello che resta del messaggio in uscita */
+static int flush(struct session *s) {
+    while (s->out_done < s->out_size) {
+        int n = send(s->fd, s->out + s->out_done, s->out_size - s->out_done, MSG_NOSIGNAL);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        s->out_done += n;
+    }
+    return 0;
+}
+
+/* Codifica ed invia un messaggio, la cui risposta verrà aspettata nello stato *state* */
+static int queue(struct session *s, enum ACTION action, int argc, char *argv[], enum STATE state) {
+    int size = encode_message(s->out + 2, IO_BUFFER_SIZE, action, argc, argv);
+
+    if (size == -1) {
+        return -1;
+    }
+    s->out[0] = (uint8_t)(size >> 8);
+    s->out[1] = (uint8_t)size;
+    s->out_size = 2 + size;
+    s->out_done = 0;
+
+    s->pending = action;
+    s->state = state;
+    s->sent_at = now();
+    g_commands++;
+    return flush(s);
+}
+
+static int start_session(struct session *s) {
+    s->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (s->fd == -1) {
+        g_errors++;
+        s->state = ST_CLOSED;
+        return -1;
+    }
+    fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+
+    begin_phase(s, PH_SESSION);
+    begin_phase(s, PH_CONNECT);
+    s->state = ST_CONNECTING;
+    g_connecting++;
+    g_alive++;
+    if (connect(s->fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) == -1 && errno != EINPROGRESS) {
+        close_session(s, 1);
+        return -1;
+    }
+    return 0;
+}
+
+/* La connessione è stata stabilita (o è fallita), invia il login */
+static int connected(struct session *s) {
+    char username[CREDENTIALS_LENGTH_MAX], password[] = PASSWORD;
+    char *argv[2];
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+        return -1;
+    }
+    end_phase(s, PH_CONNECT);
+
+    sprintf(username, "%.20s%d", g_prefix, s->id);
+    argv[0] = username;
+    argv[1] = password;
+    begin_phase(s, PH_LOGIN);
+    return queue(s, CLIENT, 2, argv, ST_LOGIN);
+}
+
+/* Passa alla riga successiva dello script, ricominciandolo se è finito */
+static void advance(struct session *s) {
+    if (s->random) {
+        return;
+    }
+    if (++s->step == g_n_lines) {
+        s->step = 0;
+        if (s->in_room) {
+            end_phase(s, PH_GAME);
+            s->in_room = 0;
+            g_games++;
+        }
+    }
+}
+
+/* Gestisce la risposta *action* al comando in attesa */
+static void handle_reply(struct session *s, enum ACTION action) {
+    hist_record(&g_actions[s->pending], now() - s->sent_at);
+    s->state = ST_READY;
+    s->next_at = now() + g_think;
+
+    if (s->pending == START) {
+        if (action == QUESTION) {
+            s->must_answer = s->room_question = 1;
+            return;
+        }
+        end_phase(s, PH_ENTER);
+        begin_phase(s, PH_GAME);
+        s->in_room = 1;
+        advance(s);
+    }
+    else if (action == QUESTION) {
+        s->must_answer = 1;
+    }
+    /* Dopo l'enigma di una room occupata si è di nuovo fuori: si riprova ad entrare */
+    else if (s->pending == ANSWER && s->room_question) {
+        s->room_question = 0;
+    }
+    else {
+        advance(s);
+    }
+}
+
+/* Sceglie un comando casuale, scrivendone gli argomenti in *argv* */
+static enum ACTION random_command(struct session *s, int *argc, char *argv[]) {
+    static char room[16];
+    char *first = g_n_words > 0 ? g_words[rand() % g_n_words] : "";
+    char *second = g_n_words > 0 ? g_words[rand() % g_n_words] : "";
+    int r = rand() % 100;
+
+    s->answer = g_n_answers > 0 && rand() % 2 ? g_answers[rand() % g_n_answers] : NULL;
+    argv[0] = first;
+    argv[1] = second;
+    *argc = 1;
+
+    if (r < 10) {
+        sprintf(room, "%d", rand() % g_n_rooms);
+        argv[0] = room;
+        return START;
+    }
+    if (r < 40) {
+        *argc = rand() % 2;
+        return LOOK;
+    }
+    if (r < 60) {
+        return TAKE;
+    }
+    if (r < 70) {
+        *argc = 2;
+        return USE;
+    }
+    if (r < 80) {
+        *argc = 0;
+        return OBJS;
+    }
+    if (r < 90) {
+        return DROP;
+    }
+    *argc = 0;
+    return RANK;
+}
+
+/* Invia il prossimo comando della sessione, o end se *stopping* */
+static int next_command(struct session *s, int stopping) {
+    char *argv[ARGC_MAX];
+    char unknown[] = "?";
+    enum ACTION action;
+    int argc;
+
+    if (stopping) {
+        return queue(s, END, 0, NULL, ST_CLOSING);
+    }
+    if (s->must_answer) {
+        s->must_answer = 0;
+        argv[0] = s->answer != NULL ? s->answer : unknown;
+        return queue(s, ANSWER, 1, argv, ST_REPLY);
+    }
+
+    if (s->random) {
+        action = random_command(s, &argc, argv);
+    }
+    else {
+        const struct line *l = &g_script[s->step];
+        action = l->action;
+        argc = l->argc;
+        memcpy(argv, l->argv, sizeof(argv));
+        s->answer = l->answer;
+    }
+    if (action == START && !s->in_room && s->begin[PH_ENTER] == 0) {
+        begin_phase(s, PH_ENTER);
+    }
+    return queue(s, action, argc, argv, ST_REPLY);
+}
+
+static unsigned long get_be(const unsigned char *src, int bytes) {
+    unsigned long value = 0;
+    int i;
+    for (i = 0; i < bytes; i++) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+/**
+ * Interpreta i byte ricevuti da *s* finché formano risposte complete.
+ * Ritorna -1 se la sessione va chiusa per errore, 0 altrimenti.
+ */
+static int consume(struct session *s) {
+    int done = 0;
+
+    while (1) {
+        int left = s->used - done, size;
+        const unsigned char *p = (const unsigned char *)s->in + done;
+
+        if (s->state == ST_LOGIN) {
+            unsigned long response;
+            if (left < 4) {
+                break;
+            }
+            response = get_be(p, 4);
+            done += 4;
+            if (response != LOGIN_SUCCESS && response != REGISTERED) {
+                printf("Login di %s%d fallito: %s\n", g_prefix, s->id,
+                    response <= RESUME_FAILED ? response_to_str[response] : "?");
+                return -1;
+            }
+            s->state = ST_ROOMS;
+            continue;
+        }
+
+        if (left < 2 || left < 2 + (size = (int)get_be(p, 2))) {
+            break;
+        }
+        done += 2 + size;
+        /* Il token per riprendere la sessione ed il manifesto delle room non servono */
+        if (size == 0 || p[2] == EVENT || p[2] == NOTIFY || p[2] == RESUME || p[2] == MANIFEST) {
+            continue;
+        }
+
+        if (s->state == ST_ROOMS) {
+            char *argv[ARGC_MAX];
+            int argc;
+
+            /* Il numero di room serve ai comandi casuali */
+            if (decode_message((const char *)p + 2, size, NULL, &argc, argv) == 0) {
+                if (argc > g_n_rooms) {
+                    g_n_rooms = argc;
+                }
+                free_argv(argv);
+            }
+            hist_record(&g_actions[CLIENT], now() - s->sent_at);
+            end_phase(s, PH_LOGIN);
+            g_connecting--;
+            s->state = ST_READY;
+            s->next_at = now();
+        }
+        else if (s->state == ST_REPLY) {
+            handle_reply(s, (enum ACTION)p[2]);
+        }
+    }
+
+    memmove(s->in, s->in + done, s->used - done);
+    s->used -= done;
+    return 0;
+}
+
+/* Gestisce gli eventi *revents* di poll sul socket di *s* */
+static void session_ready(struct session *s, short revents) {
+    int n;
+
+    if (s->state == ST_CONNECTING) {
+        if (connected(s) == -1) {
+            close_session(s, 1);
+        }
+        return;
+    }
+    if ((revents & POLLOUT) && flush(s) == -1) {
+        close_session(s, 1);
+        return;
+    }
+    if (!(revents & (POLLIN | POLLHUP | POLLERR))) {
+        return;
+    }
+
+    n = recv(s->fd, s->in + s->used, CONN_BUFFER_SIZE - s->used, 0);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        /* Dopo end il server chiude la connessione, negli altri casi è un errore */
+        close_session(s, s->state != ST_CLOSING);
+        return;
+    }
+    s->used += n;
+    if (consume(s) == -1) {
+        close_session(s, 1);
+    }
+}
+
+static void print_histogram(const char *name, const struct histogram *h) {
+    printf(" %-10s %9lu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, h->count,
+        h->sum / h->count / 1e3, hist_quantile(h, 0.5) / 1e3, hist_quantile(h, 0.99) / 1e3,
+        hist_quantile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+static void report(int n_sessions, int n_random, double elapsed) {
+    struct histogram all;
+    int i;
+
+    printf("%d sessioni (%d con comandi casuali), %.2f s\n", n_sessions, n_random, elapsed);
+    printf("%lu comandi, %.0f comandi/s, %lu percorsi completati, %lu errori\n",
+        g_commands, elapsed > 0 ? g_commands / elapsed : 0, g_games, g_errors);
+
+    printf("\n %-10s %9s %9s %9s %9s %9s %9s\n", "azione", "numero", "media us", "p50", "p99", "p999", "max");
+    memset(&all, 0, sizeof(all));
+    for (i = 0; i < ACTION_MAX; i++) {
+        if (g_actions[i].count > 0) {
+            print_histogram(action_to_str[i], &g_actions[i]);
+            hist_merge(&all, &g_actions[i]);
+        }
+    }
+    if (all.count > 0) {
+        print_histogram("ALL", &all);
+    }
+    printf("\n %-10s %9s %9s %9s %9s %9s %9s\n", "fase", "numero", "media ms", "p50", "p99", "p999", "max");
+    for (i = 0; i < PHASES_MAX; i++) {
+        if (g_phases[i].count > 0) {
+            /* Le fasi durano millisecondi o più */
+            struct histogram h = g_phases[i];
+            printf(" %-10s %9lu %9.2f %9.2f %9.2f %9.2f %9.2f\n", phase_to_str[i], h.count,
+                h.sum / h.count / 1e6, hist_quantile(&h, 0.5) / 1e6, hist_quantile(&h, 0.99) / 1e6,
+                hist_quantile(&h, 0.999) / 1e6, h.max / 1e6);
+        }
+    }
+}
+
+/* Alza il limite dei file aperti per poter avere *n* connessioni */
+static int raise_fd_limit(int n) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
+        return -1;
+    }
+    if (rl.rlim_cur < (rlim_t)n + 16) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur < (rlim_t)n + 16) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct session *sessions;
+    struct pollfd *fds;
+    struct session **ready;
+    const char *script = NULL;
+    int n_sessions = DEFAULT_SESSIONS, random_pct = 0, port = DEFAULT_SERVER_PORT;
+    int i, launched = 0, n_random = 0, stopping = 0;
+    unsigned long start, deadline, close_deadline = 0;
+    double duration = DEFAULT_DURATION;
+    unsigned int seed = (unsigned int)time(NULL);
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            n_sessions = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            random_pct = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            g_think = (unsigned long)atoi(argv[++i]) * 1000000UL;
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            script = argv[++i];
+        }
+        else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            g_prefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            seed = (unsigned int)atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-') {
+            port = atoi(argv[i]);
+        }
+        else {
+            port = -1;
+            break;
+        }
+    }
+    if (n_sessions <= 0 || duration <= 0 || random_pct < 0 || random_pct > 100 ||
+        port <= 0 || port > 65535 || strlen(g_prefix) < CREDENTIALS_LENGTH_MIN) {
+        printf("Uso: %s [-c sessioni] [-d durata] [-r percentuale] [-t ms] [-s script] "
+            "[-u prefisso] [-S seme] [porta]\n", argv[0]);
+        return 1;
+    }
+    if (load_script(script) == -1) {
+        return 1;
+    }
+    if (raise_fd_limit(n_sessions) == -1) {
+        printf("Il limite di file aperti non permette %d sessioni\n", n_sessions);
+        return 1;
+    }
+    srand(seed);
+
+    sessions = calloc(n_sessions, sizeof(struct session));
+    fds = malloc(n_sessions * sizeof(struct pollfd));
+    ready = malloc(n_sessions * sizeof(struct session *));
+    if (sessions == NULL || fds == NULL || ready == NULL) {
+        printf("Memoria esaurita\n");
+        return 1;
+    }
+    for (i = 0; i < n_sessions; i++) {
+        sessions[i].id = i;
+        sessions[i].random = (i * 100 / n_sessions) < random_pct;
+        n_random += sessions[i].random;
+    }
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(port);
+    inet_pton(AF_INET, SERVER_IP, &g_addr.sin_addr);
+
+    start = now();
+    deadline = start + (unsigned long)(duration * NS_PER_SEC);
+
+    while (launched < n_sessions || g_alive > 0) {
+        unsigned long t = now(), wake;
+        int n_fds = 0, timeout;
+
+        if (!stopping && t >= deadline) {
+            stopping = 1;
+            close_deadline = t + CLOSE_TIMEOUT * NS_PER_SEC;
+            launched = n_sessions;
+        }
+        if (stopping && t >= close_deadline) {
+            break;
+        }
+
+        while (launched < n_sessions && g_connecting < CONNECTING_MAX) {
+            start_session(&sessions[launched++]);
+        }
+
+        /* Invia i comandi delle sessioni pronte e prepara la poll */
+        wake = stopping ? close_deadline : deadline;
+        for (i = 0; i < n_sessions; i++) {
+            struct session *s = &sessions[i];
+
+            if (s->state == ST_READY && (stopping || s->next_at <= t)) {
+                if (next_command(s, stopping) == -1) {
+                    close_session(s, 1);
+                }
+            }
+            else if (s->state == ST_READY && s->next_at < wake) {
+                wake = s->next_at;
+            }
+            if (s->state == ST_IDLE || s->state == ST_CLOSED) {
+                continue;
+            }
+            fds[n_fds].fd = s->fd;
+            fds[n_fds].events = POLLIN;
+            if (s->state == ST_CONNECTING || s->out_done < s->out_size) {
+                fds[n_fds].events |= POLLOUT;
+            }
+            fds[n_fds].revents = 0;
+            ready[n_fds++] = s;
+        }
+
+        timeout = wake > t ? (int)((wake - t + 999999) / 1000000) : 0;
+        if (poll(fds, n_fds, timeout) == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (i = 0; i < n_fds; i++) {
+            if (fds[i].revents != 0 && ready[i]->state != ST_CLOSED) {
+                session_ready(ready[i], fds[i].revents);
+            }
+        }
+    }
+
+    /* Sessioni che il server non ha chiuso in tempo */
+    for (i = 0; i < n_sessions; i++) {
+        if (sessions[i].state != ST_IDLE && sessions[i].state != ST_CLOSED) {
+            close_session(&sessions[i], 1);
+        }
+    }
+
+    report(n_sessions, n_random, (now() - start) / 1e9);
+    free(sessions);
+    free(fds);
+    free(ready);
+    return g_errors > 0;
+}
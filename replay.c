@@ -0,0 +1,413 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "lib/protocol.h"
+#include "lib/server/journal.h"
+
+/**
+ * Rigioca un journal del server (vedi lib/server/journal.h).
+ *
+ * Ogni connessione registrata nel journal viene riaperta verso il server
+ *  ed i suoi messaggi vengono reinviati nello stesso ordine in cui erano
+ *  stati ricevuti, anche tra connessioni diverse: prima di inviare un
+ *  messaggio si aspetta la risposta al precedente, così il server li
+ *  esegue nello stesso ordine dell'originale (dopo end si aspetta
+ *  invece che il server chiuda la connessione).
+ * Di default i messaggi vengono inviati il più velocemente possibile,
+ *  con -p rispettando invece gli intervalli originali (divisi per
+ *  *velocità*, se specificata).
+ * Gli eventi ricevuti dagli spettatori e le notifiche vengono letti e scartati.
+ *
+ * Uso: replay [-p] [-s velocità] journal [porta]
+ * Esce con 0 se tutto il journal è stato rigiocato, 1 altrimenti.
+ */
+
+#define SERVER_IP "127.0.0.1"
+#define DEFAULT_SERVER_PORT 4242
+
+/* I socket descriptor registrati sono a 16 bit */
+#define SD_MAX 65536
+
+/* Spazio per due messaggi del server, vedi struct conn */
+#define CONN_BUFFER_SIZE (2 * (2 + IO_BUFFER_SIZE))
+
+/* Cosa aspetta una connessione dal server */
+enum WAITING {
+    WAIT_NOTHING,
+    WAIT_LOGIN,     /* La risposta (4 byte) ad un tentativo di login */
+    WAIT_ROOMS,     /* La lista delle escape room, dopo un login riuscito */
+    WAIT_REPLY,     /* La risposta ad un comando */
+    WAIT_CLOSE      /* Che il server chiuda la connessione, dopo end */
+};
+
+struct conn {
+    int sd;             /* Socket descriptor registrato */
+    int fd;
+    int logged_in;
+    enum WAITING waiting;
+    int spectate;       /* Il comando in attesa di risposta è spectate <room> */
+
+    /* Byte ricevuti e non ancora interpretati */
+    char buffer[CONN_BUFFER_SIZE];
+    int used;
+};
+
+/* Connessioni aperte, indicizzate dal socket descriptor registrato ed in elenco */
+static struct conn *g_conns[SD_MAX];
+static struct conn *g_open[SD_MAX];
+static int g_n_open = 0;
+static int g_port = DEFAULT_SERVER_PORT;
+
+static unsigned long g_sent = 0, g_replies = 0, g_events = 0, g_connections = 0;
+
+static unsigned long get_be(const unsigned char *src, int bytes) {
+    unsigned long value = 0;
+    int i;
+    for (i = 0; i < bytes; i++) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static struct conn* open_conn(int sd) {
+    struct sockaddr_in addr;
+    struct conn *c;
+
+    c = malloc(sizeof(struct conn));
+    if (c == NULL) {
+        return NULL;
+    }
+    memset(c, 0, sizeof(struct conn));
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd == -1) {
+        free(c);
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(c->fd);
+        free(c);
+        return NULL;
+    }
+
+    c->sd = sd;
+    g_conns[sd] = c;
+    g_open[g_n_open++] = c;
+    g_connections++;
+    return c;
+}
+
+static void close_conn(int sd) {
+    struct conn *c = g_conns[sd];
+    int i;
+
+    if (c == NULL) {
+        return;
+    }
+    for (i = 0; g_open[i] != c; i++);
+    g_open[i] = g_open[--g_n_open];
+
+    close(c->fd);
+    free(c);
+    g_conns[sd] = NULL;
+}
+
+/* Interpreta i byte ricevuti da *c* finché formano risposte complete */
+static void consume(struct conn *c) {
+    int done = 0;
+
+    while (1) {
+        int left = c->used - done;
+        const unsigned char *p = (const unsigned char *)c->buffer + done;
+
+        if (c->waiting == WAIT_LOGIN) {
+            unsigned long response;
+            if (left < 4) {
+                break;
+            }
+            response = get_be(p, 4);
+            done += 4;
+            if (response == LOGIN_SUCCESS || response == REGISTERED || response == RESUMED) {
+                c->logged_in = 1;
+                c->waiting = WAIT_ROOMS;
+            }
+            else {
+                c->waiting = WAIT_NOTHING;
+                g_replies++;
+            }
+        }
+        else {
+            int size;
+            if (left < 2 || left < 2 + (size = (int)get_be(p, 2))) {
+                break;
+            }
+            done += 2 + size;
+
+            /* Il token ed il manifesto precedono le risposte, non lo sono */
+            if (size > 0 && (p[2] == RESUME || p[2] == MANIFEST)) {
+                continue;
+            }
+
+            /* Eventi e notifiche non sono risposte, tranne l'evento che inizia uno spettacolo */
+            if (size > 0 && ((p[2] == EVENT && !(c->waiting == WAIT_REPLY && c->spectate)) || p[2] == NOTIFY)) {
+                g_events++;
+            }
+            else if (c->waiting != WAIT_NOTHING && c->waiting != WAIT_CLOSE) {
+                c->waiting = WAIT_NOTHING;
+                g_replies++;
+            }
+        }
+    }
+
+    memmove(c->buffer, c->buffer + done, c->used - done);
+    c->used -= done;
+}
+
+/**
+ * Legge quanto ricevuto da tutte le connessioni finché *until* non
+ *  aspetta più nulla (se non è NULL) e non è passato l'istante *deadline*
+ *  (se positivo). Ritorna -1 se *until* viene chiusa dal server mentre
+ *  aspettava una risposta.
+ */
+static int pump(struct conn *until, double deadline) {
+    while ((until != NULL && until->waiting != WAIT_NOTHING) || (deadline > 0 && now() < deadline)) {
+        struct timeval timeout, *p_timeout = NULL;
+        fd_set fds;
+        int i, fd_max = -1;
+
+        FD_ZERO(&fds);
+        for (i = 0; i < g_n_open; i++) {
+            FD_SET(g_open[i]->fd, &fds);
+            if (g_open[i]->fd > fd_max) {
+                fd_max = g_open[i]->fd;
+            }
+        }
+        if (deadline > 0) {
+            double wait = deadline - now();
+            if (wait < 0) {
+                wait = 0;
+            }
+            timeout.tv_sec = (long)wait;
+            timeout.tv_usec = (long)((wait - (long)wait) * 1e6);
+            p_timeout = &timeout;
+        }
+
+        if (select(fd_max + 1, &fds, NULL, NULL, p_timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        /* Al contrario, così chiudere una connessione non ne salta altre */
+        for (i = g_n_open - 1; i >= 0; i--) {
+            struct conn *c = g_open[i];
+            int n;
+
+            if (!FD_ISSET(c->fd, &fds)) {
+                continue;
+            }
+            n = recv(c->fd, c->buffer + c->used, CONN_BUFFER_SIZE - c->used, 0);
+            if (n <= 0) {
+                /* Il server ha chiuso la connessione (ad esempio dopo end) */
+                if (c == until) {
+                    int waited = c->waiting != WAIT_NOTHING && c->waiting != WAIT_CLOSE;
+                    until = NULL;
+                    close_conn(c->sd);
+                    if (waited) {
+                        return -1;
+                    }
+                }
+                else {
+                    close_conn(c->sd);
+                }
+                continue;
+            }
+            c->used += n;
+            consume(c);
+        }
+    }
+    return 0;
+}
+
+/* Invia a *c* il messaggio codificato *msg* di *size* byte */
+static int send_record(struct conn *c, const unsigned char *msg, int size) {
+    char frame[2 + IO_BUFFER_SIZE];
+    int done = 0;
+
+    frame[0] = (uint8_t)(size >> 8);
+    frame[1] = (uint8_t)size;
+    memcpy(frame + 2, msg, size);
+
+    while (done < 2 + size) {
+        int n = send(c->fd, frame + done, 2 + size - done, MSG_NOSIGNAL);
+        if (n == -1) {
+            return -1;
+        }
+        done += n;
+    }
+
+    if (!c->logged_in) {
+        c->waiting = WAIT_LOGIN;
+    }
+    else if (msg[0] == END) {
+        c->waiting = WAIT_CLOSE;
+    }
+    else {
+        c->waiting = WAIT_REPLY;
+        c->spectate = msg[0] == SPECTATE && size > 1;
+    }
+    g_sent++;
+    return 0;
+}
+
+/* Carica in memoria tutto il file *path*, scrivendone la dimensione in *size* */
+static unsigned char* load_file(const char *path, long *size) {
+    unsigned char *data;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data = malloc(*size > 0 ? *size : 1);
+    if (data != NULL && fread(data, 1, *size, f) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    unsigned char *journal;
+    long size, pos, records = 0;
+    int paced = 0, i, failed = 0;
+    double speed = 1, first = -1, start, elapsed;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0) {
+            paced = 1;
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            paced = 1;
+            speed = atof(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        }
+        else if (argv[i][0] != '-') {
+            g_port = atoi(argv[i]);
+        }
+        else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL || speed <= 0 || g_port <= 0 || g_port > 65535) {
+        printf("Uso: %s [-p] [-s velocità] journal [porta]\n", argv[0]);
+        return 1;
+    }
+
+    journal = load_file(path, &size);
+    if (journal == NULL) {
+        printf("Impossibile leggere %s\n", path);
+        return 1;
+    }
+    if (size < JOURNAL_MAGIC_SIZE || memcmp(journal, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0) {
+        printf("%s non è un journal\n", path);
+        return 1;
+    }
+
+    start = now();
+    for (pos = JOURNAL_MAGIC_SIZE; pos + JOURNAL_HEADER_SIZE <= size; records++) {
+        const unsigned char *r = journal + pos;
+        double when = get_be(r, 4) + get_be(r + 4, 4) / 1e6;
+        int sd = (int)get_be(r + 8, 2);
+        int length = (int)get_be(r + 10, 2);
+        struct conn *c;
+
+        if (length > IO_BUFFER_SIZE || pos + JOURNAL_HEADER_SIZE + length > size) {
+            break;
+        }
+        pos += JOURNAL_HEADER_SIZE + length;
+
+        if (paced) {
+            if (first < 0) {
+                first = when;
+            }
+            pump(NULL, start + (when - first) / speed);
+        }
+
+        /**
+         * Chiusura della connessione: se è ancora aperta la chiude e
+         *  aspetta che se ne accorga anche il server, così le chiusure
+         *  avvengono nello stesso ordine dell'originale.
+         */
+        if (length == 0) {
+            c = g_conns[sd];
+            if (c != NULL) {
+                shutdown(c->fd, SHUT_WR);
+                c->waiting = WAIT_CLOSE;
+                pump(c, 0);
+                close_conn(sd);
+            }
+            continue;
+        }
+
+        c = g_conns[sd];
+        if (c == NULL && (c = open_conn(sd)) == NULL) {
+            printf("Impossibile connettersi al server sulla porta %d\n", g_port);
+            failed = 1;
+            break;
+        }
+        if (send_record(c, r + JOURNAL_HEADER_SIZE, length) == -1 || pump(c, 0) == -1) {
+            /* Il server ha chiuso la connessione, come poteva succedere anche nell'originale */
+            close_conn(sd);
+        }
+    }
+    elapsed = now() - start;
+
+    if (pos != size) {
+        printf("Journal troncato o malformato dopo %ld record\n", records);
+        failed = 1;
+    }
+
+    while (g_n_open > 0) {
+        close_conn(g_open[0]->sd);
+    }
+    free(journal);
+
+    printf("%ld record, %lu connessioni, %lu messaggi inviati, %lu risposte, %lu eventi\n",
+        records, g_connections, g_sent, g_replies, g_events);
+    printf("%.3f s, %.0f messaggi/s\n", elapsed, elapsed > 0 ? g_sent / elapsed : 0);
+    return failed;
+}
@@ -11,6 +11,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 #include "lib/protocol.h"
@@ -18,25 +20,53 @@
 #include "lib/server/database.h"
 #include "lib/server/session.h"
 #include "lib/server/rooms.h"
+#include "lib/server/leaderboard.h"
+#include "lib/server/spectate.h"
+#include "lib/server/journal.h"
+#include "lib/server/logger.h"
+#include "lib/server/metrics.h"
+#include "lib/server/trace.h"
+#include "lib/server/engine.h"
+#include "lib/server/analytics.h"
+#include "lib/server/lowlatency.h"
 
 #define SERVER_IP "127.0.0.1"
 #define DEFAULT_SERVER_PORT 4242
 #define QUEUE_LENGTH 64
 
+/* Byte di risposte che un client può lasciare da leggere prima che la sua connessione venga chiusa */
+#define CLIENT_OUTPUT_MAX (64 * IO_BUFFER_SIZE)
+
+/* Per quanti secondi una sessione la cui connessione si è interrotta può essere ripresa */
+#define RESUME_GRACE_SECONDS 120
+
 /**
- * Stampa l'orario attuale nel formato "[HH:MM:SS.ssssss] > "
+ * Il thread dei suggerimenti (vedi rooms_builder_start(...)) rende
+ *  corrente una versione ricaricata del catalogo delle room: il thread
+ *  principale tiene g_world, che lo esclude, tranne che durante select(...).
  */
-void print_current_time(void) {
-    struct timeval tv;
-    struct tm *tm_info;
-    /* 16 è una dimensione sufficiente per contenere HH:MM:SS\\0 */
-    char buffer[16];
-
-    gettimeofday(&tv, 0);
-    tm_info = localtime(&tv.tv_sec);
-    strftime(buffer, 9, "%H:%M:%S", tm_info);
-    printf(" [%s.%06ld] > ", buffer, tv.tv_usec);
-}
+pthread_mutex_t g_world = PTHREAD_MUTEX_INITIALIZER;
+
+/* Profilo a bassa latenza (vedi lib/server/lowlatency.h) e processore del thread principale, -1 nessuno */
+int g_lowlatency = 0;
+int g_lowlatency_cpu = -1;
+
+/**
+ * I socket dei client non vengono mai letti o scritti bloccandosi, così
+ *  un client lento o bloccato a metà messaggio non ferma gli altri: un
+ *  messaggio viene ricomposto in *in* un pezzo alla volta, man mano che
+ *  select(...) segnala il socket pronto in lettura, e quanto il socket
+ *  non accetta subito resta in *out*, da inviare quando è pronto in
+ *  scrittura. Ogni client ha la sua, indicizzata dal socket descriptor.
+ */
+struct connection {
+    char in[2 + IO_BUFFER_SIZE];    /* Dimensione (su 2 byte) e messaggio */
+    int in_len;
+    char *out;
+    int out_len, out_capacity;
+};
+
+struct connection *g_connections[FD_SETSIZE];
 
 /**
  * Se *username* esiste già nel database allora controlla che la password
@@ -46,18 +76,14 @@ void print_current_time(void) {
 enum RESPONSE db_check(const char *username, const char *password) {
 
     enum DB_RESPONSE db_response;
-    int username_len, password_len;
-
-    username_len = ssstrlen(username, CREDENTIALS_LENGTH_MAX);
-    password_len = ssstrlen(password, CREDENTIALS_LENGTH_MAX);
-
-    if (username_len == -1 || password_len == -1) {
-        return CREDENTIALS_TOO_LONG;
-    }
 
-    if (username_len < CREDENTIALS_LENGTH_MIN - 1 ||
-        password_len < CREDENTIALS_LENGTH_MIN - 1) {
-        return CREDENTIALS_TOO_SHORT;
+    switch (db_validate(username, password)) {
+        case DB_CREDENTIALS_TOO_LONG:
+            return CREDENTIALS_TOO_LONG;
+        case DB_CREDENTIALS_TOO_SHORT:
+            return CREDENTIALS_TOO_SHORT;
+        default: /* DB_CREDENTIALS_VALID */
+            break;
     }
 
     db_response = db_read(username, password);
@@ -82,19 +108,51 @@ enum RESPONSE db_check(const char *username, const char *password) {
 
 }
 
+/**
+ * Importa gli utenti di *path* (vedi db_import(...)) e scrive in *rate*
+ *  quanti utenti al secondo sono stati aggiunti.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
+ */
+int import_users(const char *path, struct db_import_stats *stats, unsigned long *rate) {
+    unsigned long begin = metrics_now(), elapsed;
+
+    if (db_import(path, stats) == -1) {
+        return -1;
+    }
+    elapsed = metrics_now() - begin;
+    *rate = elapsed > 0 ? (unsigned long)((double)stats->imported * 1e9 / elapsed) : 0;
+    return 0;
+}
+
 /* Possibili comandi per il server */
 enum COMMAND {
     CMD_NONE,
     CMD_START,
-    CMD_STOP
+    CMD_STOP,
+    CMD_RELOAD,
+    CMD_METRICS,
+    CMD_TRACE,          /* "trace n", con n in *value* */
+    CMD_TRACE_DUMP,
+    CMD_IMPORT,         /* "import file", con il file in *arg* */
+    CMD_LOWLATENCY,     /* "lowlatency [cpu]", con cpu (o -1) in *value* */
+
+    /* "log livello", nello stesso ordine di LOG_LEVEL */
+    CMD_LOG_DEBUG,
+    CMD_LOG_INFO,
+    CMD_LOG_WARNING,
+    CMD_LOG_ERROR
 };
 
 /**
  * Legge lo standard input interpretandone i caretteri 
  *  come un comando per il server.
+ * Se il comando ha un argomento numerico lo scrive in *value*,
+ *  se ne ha uno testuale lo copia in *arg* (di IO_BUFFER_SIZE byte).
  */ 
-enum COMMAND parse_command(void) {
+enum COMMAND parse_command(int *value, char *arg) {
     char buffer[IO_BUFFER_SIZE];
+    char *end;
+    int level;
 
     fgetsnn(buffer, IO_BUFFER_SIZE, stdin);
     if (strncmp(buffer, "start", IO_BUFFER_SIZE) == 0) {
@@ -103,6 +161,40 @@ enum COMMAND parse_command(void) {
     if (strncmp(buffer, "stop", IO_BUFFER_SIZE) == 0) {
         return CMD_STOP;
     }
+    if (strncmp(buffer, "reload", IO_BUFFER_SIZE) == 0) {
+        return CMD_RELOAD;
+    }
+    if (strncmp(buffer, "metrics", IO_BUFFER_SIZE) == 0) {
+        return CMD_METRICS;
+    }
+    if (strncmp(buffer, "trace ", 6) == 0) {
+        if (strcmp(buffer + 6, "dump") == 0) {
+            return CMD_TRACE_DUMP;
+        }
+        *value = (int)strtol(buffer + 6, &end, 10);
+        if (end != buffer + 6 && *end == '\0' && *value >= 0) {
+            return CMD_TRACE;
+        }
+    }
+    if (strcmp(buffer, "lowlatency") == 0) {
+        *value = -1;
+        return CMD_LOWLATENCY;
+    }
+    if (strncmp(buffer, "lowlatency ", 11) == 0) {
+        *value = (int)strtol(buffer + 11, &end, 10);
+        if (end != buffer + 11 && *end == '\0' && *value >= 0) {
+            return CMD_LOWLATENCY;
+        }
+    }
+    if (strncmp(buffer, "import ", 7) == 0 && buffer[7] != '\0') {
+        strcpy(arg, buffer + 7);
+        return CMD_IMPORT;
+    }
+    for (level = LOG_DEBUG; level <= LOG_ERROR; level++) {
+        if (strncmp(buffer, "log ", 4) == 0 && strcmp(buffer + 4, log_level_to_str[level]) == 0) {
+            return CMD_LOG_DEBUG + level;
+        }
+    }
     return CMD_NONE;
 }
 
@@ -110,9 +202,13 @@ enum COMMAND parse_command(void) {
  * Aspetta ciclicamente che venga inserito il comando start.
  */
 void wait_for_start(void) {
+    struct db_import_stats stats;
+    char arg[IO_BUFFER_SIZE];
     enum COMMAND command;
+    unsigned long rate;
+    int value;
     do {
-        command = parse_command();
+        command = parse_command(&value, arg);
         switch (command) {
             case CMD_NONE:
                 printf("\n Comando inesistente\n\n > ");
@@ -120,711 +216,823 @@ void wait_for_start(void) {
             case CMD_START:
                 break;
             case CMD_STOP:
+            case CMD_RELOAD:
+            case CMD_METRICS:
+            case CMD_TRACE_DUMP:
                 printf("\n Il server non è in esecuzione\n\n > ");
                 break;
+            case CMD_TRACE:
+                trace_sample(value);
+                printf("\n Tracciamento: %s%d\n\n > ", value == 0 ? "spento " : "una richiesta ogni ", value);
+                break;
+            case CMD_LOWLATENCY:
+                g_lowlatency = 1;
+                g_lowlatency_cpu = value;
+                if (value == -1) {
+                    printf("\n Profilo a bassa latenza attivo\n\n > ");
+                }
+                else {
+                    printf("\n Profilo a bassa latenza attivo, processore %d\n\n > ", value);
+                }
+                break;
+            case CMD_IMPORT:
+                if (import_users(arg, &stats, &rate) == -1) {
+                    printf("\n Impossibile importare gli utenti da %s\n\n > ", arg);
+                    break;
+                }
+                printf("\n %ld utenti importati da %s (%ld duplicati, %ld già registrati, %ld non validi), "
+                    "%lu utenti/s\n\n > ", stats.imported, arg, stats.duplicates, stats.existing, stats.invalid, rate);
+                break;
+            default:
+                logger_set_level(command - CMD_LOG_DEBUG);
+                printf("\n Livello del log: %s\n\n > ", log_level_to_str[command - CMD_LOG_DEBUG]);
+                break;
         }
     }
     while (command != CMD_START);
 }
 
+/**
+ * Chiamata dal thread dei suggerimenti, tenendo g_world, quando la
+ *  versione *c* caricata dal comando reload diventa quella corrente.
+ */
+void rooms_ready(const struct catalogue *c) {
+    log_event(LOG_INFO, "Escape room ricaricate (versione %lu, %d versioni in memoria)",
+        c->version, catalogue_versions_alive());
+}
+
 /**
  * Se il comando inserito è quello di stop, e nessun 
  *  client è in gioco, allora termina il server.
+ * Il comando reload ricarica le escape room da ROOMS_FILE senza
+ *  interrompere le partite in corso, il comando log cambia il livello
+ *  minimo dei messaggi mostrati ed il comando metrics stampa le metriche.
+ * Il comando trace n traccia una richiesta ogni n (0 smette di tracciare),
+ *  trace dump scrive le tracce raccolte in TRACE_FILE.
+ * Il comando import registra in blocco gli utenti di un file.
  */ 
 void stdin_ready(void) {
+    struct db_import_stats stats;
+    char arg[IO_BUFFER_SIZE];
     enum COMMAND command;
+    unsigned long rate;
+    char *text;
+    int size, value;
+    long n;
 
-    command = parse_command();
+    command = parse_command(&value, arg);
     switch (command) {
         case CMD_NONE:
-            print_current_time();
-            printf("Comando inesistente\n");
+            log_event(LOG_INFO, "Comando inesistente");
             break;
         case CMD_START:
-            print_current_time();
-            printf("Il server è già in esecuzione\n");
+            log_event(LOG_INFO, "Il server è già in esecuzione");
             break;
         case CMD_STOP:
-            if (get_session_by_room(-1) != NULL) {
-                print_current_time();
-                printf("Impossibile arrestare il server, almeno un client è in gioco\n");
+            if (get_session_by_room(NULL) != NULL) {
+                log_event(LOG_INFO, "Impossibile arrestare il server, almeno un client è in gioco");
                 break;
             }
+            if (analytics_flush(ANALYTICS_FILE) == -1) {
+                log_event(LOG_WARNING, "Impossibile scrivere le statistiche di gioco in %s", ANALYTICS_FILE);
+            }
+            logger_flush();
             printf("\n################################################################################\n\n");
             exit(0);
+        case CMD_RELOAD:
+            /* Eventuali errori nel file vengono stampati direttamente */
+            logger_flush();
+            if (reload_rooms() == -1) {
+                log_event(LOG_INFO, "Impossibile ricaricare le escape room, resta in uso la versione %lu",
+                    g_catalogue->version);
+                break;
+            }
+            /* La nuova versione sostituisce quella corrente quando i suggerimenti sono pronti */
+            log_event(LOG_INFO, "Escape room lette, resta in uso la versione %lu finché "
+                "non sono pronti i suggerimenti", g_catalogue->version);
+            break;
+        case CMD_METRICS:
+            text = metrics_export(&size);
+            if (text == NULL) {
+                log_event(LOG_WARNING, "Impossibile esportare le metriche, memoria esaurita");
+                break;
+            }
+            logger_flush();
+            fwrite(text, 1, size, stdout);
+            fflush(stdout);
+            free(text);
+            break;
+        case CMD_TRACE:
+            trace_sample(value);
+            if (value == 0) {
+                log_event(LOG_INFO, "Tracciamento spento");
+            }
+            else {
+                log_event(LOG_INFO, "Tracciamento di una richiesta ogni %d", value);
+            }
+            break;
+        case CMD_TRACE_DUMP:
+            n = trace_dump(TRACE_FILE);
+            if (n == -1) {
+                log_event(LOG_WARNING, "Impossibile scrivere le tracce in %s", TRACE_FILE);
+                break;
+            }
+            log_event(LOG_INFO, "%ld richieste tracciate scritte in %s", n, TRACE_FILE);
+            break;
+        case CMD_LOWLATENCY:
+            log_event(LOG_INFO, "Il profilo a bassa latenza si può attivare solo prima di start");
+            break;
+        case CMD_IMPORT:
+            /* Le righe non valide vengono stampate direttamente */
+            logger_flush();
+            if (import_users(arg, &stats, &rate) == -1) {
+                log_event(LOG_WARNING, "Impossibile importare gli utenti da %s", arg);
+                break;
+            }
+            log_event(LOG_INFO, "%ld utenti importati da %s (%ld duplicati, %ld già registrati, "
+                "%ld non validi), %lu utenti/s, %ld in tutto", stats.imported, arg, stats.duplicates,
+                stats.existing, stats.invalid, rate, db_size());
+            break;
+        default:
+            logger_set_level(command - CMD_LOG_DEBUG);
+            log_event(LOG_INFO, "Livello del log: %s", log_level_to_str[command - CMD_LOG_DEBUG]);
+            break;
     }
 }
 
 /**
- * Accetta la connessione da parte di un nuovo client.
- * In caso di errore (o disconnessione) ritorna -1, altrimenti
- *  ritorna il socket descriptor di comunicazione col client.
- */ 
-int listener_ready(int sd) {
-
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    char client_ip[INET_ADDRSTRLEN];
-    int client_port, new_sd;
-
-    new_sd = accept(sd, (struct sockaddr*)&client_addr, &client_len);
-    if (new_sd == -1) {
-        print_current_time();
-        printf("Impossibile inizializzare una connessione con %d\n", sd);
+ * Prepara lo stato della connessione con il client *sd* e rende il suo
+ *  socket non bloccante. Ritorna -1 se la memoria è esaurita o se *sd*
+ *  non può essere controllato da select(...).
+ */
+int connection_open(int sd) {
+    if (sd >= FD_SETSIZE || fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) == -1) {
         return -1;
     }
+    g_connections[sd] = calloc(1, sizeof(struct connection));
+    return g_connections[sd] == NULL ? -1 : 0;
+}
 
-    inet_ntop(AF_INET, (void *)&client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-    client_port = ntohs(client_addr.sin_port);
-
-    print_current_time();
-    printf("Client %s:%i connesso con ID %d\n", client_ip, client_port, new_sd);  
+void connection_close(int sd) {
+    if (g_connections[sd] != NULL) {
+        free(g_connections[sd]->out);
+        free(g_connections[sd]);
+        g_connections[sd] = NULL;
+    }
+}
 
-    return new_sd;
+/* Vero se *sd* ha risposte che il socket non ha ancora accettato */
+int connection_pending(int sd) {
+    return g_connections[sd] != NULL && g_connections[sd]->out_len > 0;
 }
 
 /**
- * Completa la procedura di login con un client e inizializza una sessione.
- * Se è andata a buon fine invia anche la lista delle escape room.
- * In caso di errore (o disconnessione) ritorna -1, altrimenti 0.
+ * Invia quanti più byte di *data* il socket accetta senza bloccarsi.
+ * Ritorna i byte inviati, -1 se la connessione è interrotta.
  */
-int login_and_send_rooms(int sd) {
+int send_some(int sd, const char *data, int size) {
+    int done = 0;
 
-    enum RESPONSE n_response, h_response;
-    struct session *session;
-    int argc, ret, i;
-    char *argv[ARGC_MAX];
-    char username[CREDENTIALS_LENGTH_MAX];
+    while (done < size) {
+        int ret = send(sd, data + done, size - done, MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        done += ret;
+    }
+    return done;
+}
 
-    ret = recv_msg(sd, NULL, &argc, argv);
-    /* Voglio esattamente 2 argomenti, argv[0] = username, argv[1] = password */
-    if (ret == -1 || argc != 2) {
-        print_current_time();
-        printf("Connessione con %d interrotta\n", sd);
+/**
+ * Invia a *sd* i *size* byte di *data*, dopo quelli ancora in attesa:
+ *  la parte che il socket non accetta subito viene conservata ed inviata
+ *  da connection_flush(...). Ritorna -1 se la connessione è interrotta
+ *  o se il client ha lasciato da leggere più di CLIENT_OUTPUT_MAX byte.
+ */
+int connection_send(int sd, const void *data, int size) {
+    struct connection *c = sd >= 0 ? g_connections[sd] : NULL;
+    int sent = 0;
+
+    if (c == NULL) {
         return -1;
     }
-
-    /* Controllo nel database e nella lista delle sessioni */
-    h_response = db_check(argv[0], argv[1]);
-    session = get_session_by_username(argv[0]);
-    if (h_response == LOGIN_SUCCESS && session != NULL) {
-        h_response = ALREADY_LOGGED_IN;
+    if (c->out_len == 0) {
+        sent = send_some(sd, data, size);
+        if (sent == -1) {
+            return -1;
+        }
     }
-    n_response = htonl(h_response);
 
-    /* Ricopio l'username, che mi servirà dopo, e dealloco gli *argv* */
-    strcpy(username, argv[0]);
-    free_argv(argv);
+    if (sent < size) {
+        int rest = size - sent;
 
-    print_current_time();
-    printf("%d ha effettuato un tentativo di login, "
-        "con risultato: %s\n", sd, response_to_str[h_response]);
-    
-    /* Invio della risposta (dimensione nota) */
-    ret = send(sd, &n_response, sizeof(n_response), MSG_NOSIGNAL);
-    if (ret == -1) {
-        print_current_time();
-        printf("Connessione con %d interrotta\n", sd);
-        return -1;
+        if (c->out_len + rest > CLIENT_OUTPUT_MAX) {
+            log_event(LOG_INFO, "%d non legge le risposte", sd);
+            return -1;
+        }
+        if (c->out_len + rest > c->out_capacity) {
+            int capacity = c->out_capacity == 0 ? IO_BUFFER_SIZE : c->out_capacity;
+            char *out;
+
+            while (capacity < c->out_len + rest) {
+                capacity *= 2;
+            }
+            out = realloc(c->out, capacity);
+            if (out == NULL) {
+                return -1;
+            }
+            c->out = out;
+            c->out_capacity = capacity;
+        }
+        memcpy(c->out + c->out_len, (const char*)data + sent, rest);
+        c->out_len += rest;
     }
+    g_protocol_stats.bytes_sent += size;
+    return 0;
+}
 
-    /* Casi in cui viene consentito riprovare l'accesso */
-    if (h_response == LOGIN_FAIL ||
-        h_response == ALREADY_LOGGED_IN ||
-        h_response == CREDENTIALS_TOO_SHORT ||
-        h_response == CREDENTIALS_TOO_LONG) {
+/**
+ * Invia a *sd* quanto più possibile delle risposte in attesa.
+ * Ritorna -1 se la connessione è interrotta, 0 altrimenti.
+ */
+int connection_flush(int sd) {
+    struct connection *c = g_connections[sd];
+    int sent;
+
+    if (c == NULL || c->out_len == 0) {
         return 0;
     }
-
-    if (h_response == SERVER_FULL) {
-        printf(ANSI_COLOR_YELLOW  "[Warning]: Impossibile creare un nuovo "
-            "record per %d, memoria esaurita\n" ANSI_COLOR_RESET, sd);
+    sent = send_some(sd, c->out, c->out_len);
+    if (sent == -1) {
         return -1;
     }
+    memmove(c->out, c->out + sent, c->out_len - sent);
+    c->out_len -= sent;
+    return 0;
+}
 
-    /**
-     * Il login è andato a buon fine. Crea una sessione che ha come
-     *  ID il socket descriptor del client appena autenticato.
-     */
-    session = init_session(sd, username);
-    if (session == NULL) {
-        printf(ANSI_COLOR_YELLOW "[Warning]: Impossibile creare una nuova "
-            "sessione per %d, memoria esaurita\n" ANSI_COLOR_RESET, sd);
-        return -1;
+/**
+ * Legge da *sd* quanto è arrivato del prossimo messaggio, senza bloccarsi
+ *  e senza andare oltre la sua fine. Quando il messaggio è completo ne
+ *  scrive in *frame* l'indirizzo (valido fino alla prossima chiamata) e
+ *  ne ritorna la dimensione, come recv_frame(...).
+ * Ritorna 0 se il messaggio non è ancora completo, -1 in caso di errore,
+ *  di connessione chiusa o di dimensione non valida.
+ */
+int connection_recv(int sd, const char **frame) {
+    struct connection *c = g_connections[sd];
+    int length = 0, ret;
+
+    while (1) {
+        /* Prima la dimensione, poi il resto del messaggio */
+        if (c->in_len >= 2) {
+            length = ((uint8_t)c->in[0] << 8) | (uint8_t)c->in[1];
+            if (length == 0 || length > IO_BUFFER_SIZE) {
+                g_protocol_stats.decode_failures++;
+                return -1;
+            }
+            if (c->in_len == 2 + length) {
+                break;
+            }
+        }
+        ret = recv(sd, c->in + c->in_len, (c->in_len < 2 ? 2 : 2 + length) - c->in_len, 0);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        c->in_len += ret;
     }
 
-    /* Codifica delle escape room, riutilizza il contenitore *argv* */
-    argc = N_ROOMS;
-    for (i = 0; i < N_ROOMS; i++) {
-        argv[i] = g_rooms[i].name;
+    c->in_len = 0;
+    *frame = c->in + 2;
+    g_protocol_stats.bytes_received += 2 + length;
+    return length;
+}
+
+/**
+ * Accetta la connessione da parte di un nuovo client.
+ * In caso di errore (o disconnessione) ritorna -1, altrimenti
+ *  ritorna il socket descriptor di comunicazione col client.
+ */ 
+int listener_ready(int sd) {
+
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    char client_ip[INET_ADDRSTRLEN];
+    int client_port, new_sd;
+
+    new_sd = accept(sd, (struct sockaddr*)&client_addr, &client_len);
+    if (new_sd == -1) {
+        log_event(LOG_INFO, "Impossibile inizializzare una connessione con %d", sd);
+        return -1;
     }
 
-    ret = send_msg(sd, SERVER, argc, argv);
-    if (ret == -1) {
-        print_current_time();
-        printf("Connessione con %d interrotta\n", sd);
+    if (connection_open(new_sd) == -1) {
+        log_event(LOG_WARNING, "Impossibile gestire la connessione con %d", new_sd);
+        close(new_sd);
         return -1;
     }
+    lowlatency_socket(new_sd);
 
-    print_current_time();
-    printf("%d ha ricevuto la lista delle escape room\n", sd);
+    inet_ntop(AF_INET, (void *)&client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+    client_port = ntohs(client_addr.sin_port);
 
-    return 0;
+    log_event(LOG_INFO, "Client %s:%i connesso con ID %d", client_ip, client_port, new_sd);  
+
+    return new_sd;
 }
 
 /**
- * Invia il messaggio testuale contenuto in *str* al client. 
- * Appende alla risposta il tempo rimasto ed i token raccolti.
- * Ritorna -1 in caso di errore, 0 altrimenti.
+ * Invia un messaggio formato dai frammenti, come send_fragments(...),
+ *  tramite connection_send(...) e registrato come fase TRACE_WRITE.
  */
-int send_text(int sd, char *str, struct session *session) {
-    char buffer[IO_BUFFER_SIZE];
-    char *argv[ARGC_MAX];
-    unsigned long end_time, remaining_time;
+int write_fragments(int sd, enum ACTION action, const struct fragment *text, const struct fragment *suffix) {
+    char buffer[2 + IO_BUFFER_SIZE];
+    int ret;
 
-    end_time = session->start_time + g_rooms[session->room].time_limit * 60;
-    remaining_time = end_time - (unsigned long)time(NULL);
+    trace_span_begin(TRACE_WRITE);
+    ret = frame_fragments(buffer, sizeof(buffer), action, text, suffix);
+    if (ret != -1) {
+        ret = connection_send(sd, buffer, ret);
+    }
+    trace_span_end();
+    return ret;
+}
 
-    sprintf(buffer, "%s\n [Tempo rimasto: %lus, Token raccolti: %d/%d]", 
-        str, remaining_time, session->n_tokens, g_rooms[session->room].n_tokens); 
+/* Come send_msg(...), ma il messaggio passa per connection_send(...) */
+int write_msg(int sd, enum ACTION action, int argc, char *argv[]) {
+    char buffer[2 + IO_BUFFER_SIZE];
+    int ret;
 
-    argv[0] = buffer;
-    return send_msg(sd, SERVER, 1, argv);
+    ret = encode_message(buffer + 2, IO_BUFFER_SIZE, action, argc, argv);
+    if (ret == -1) {
+        return -1;
+    }
+    buffer[0] = (uint8_t)(ret >> 8);
+    buffer[1] = (uint8_t)ret;
+    return connection_send(sd, buffer, 2 + ret);
 }
 
 /**
- * Invia il messaggio testuale contenuto in *str* al client.
- * Ritorna -1 in caso di errore, 0 altrimenti.
+ * Riceve gli eventi del motore di gioco (vedi lib/server/engine.h) e li
+ *  traduce in messaggi: risposte e notifiche vanno al socket della
+ *  sessione, gli eventi della partita agli spettatori della room.
  */
-int send_text_without_info(int sd, enum ACTION action, char *str, struct session *session) {
-    char buffer[IO_BUFFER_SIZE];
-    char *argv[ARGC_MAX];
+int engine_event_ready(void *ctx, const struct engine_event *ev) {
+    char buffer[CREDENTIALS_LENGTH_MAX + COMMAND_LENGTH_MAX + 8];
+    struct fragment parts[3];
+
+    switch (ev->kind) {
+        case ENGINE_REPLY:
+        case ENGINE_MANIFEST:
+            return write_fragments(ev->session->sd, ev->action, ev->text, ev->suffix);
+        case ENGINE_NOTIFY:
+            /* Una sessione staccata scoprirà com'è andata quando verrà ripresa */
+            if (ev->session->sd != -1) {
+                write_fragments(ev->session->sd, ev->action, ev->text, NULL);
+            }
+            return 0;
+        case ENGINE_PUBLISH:
+            trace_span_begin(TRACE_PUBLISH);
+            sprintf(buffer, "%s > %s\n ", ev->session->username, ev->session->command);
+            make_fragment(&parts[0], buffer);
+            parts[1] = *ev->text;
+            if (ev->suffix != NULL) {
+                parts[2] = *ev->suffix;
+            }
+            else {
+                make_fragment(&parts[2], "");
+            }
+            spectate_publish(ev->room, parts, 3);
+            trace_span_end();
+            return 0;
+        case ENGINE_SABOTAGE:
+            engine_sabotage(ev->session, ev->room, ev->delta, ev->text);
+            return 0;
+        default:    /* ENGINE_TIME_OVER */
+            metrics_count(CNT_TIMEOUTS);
+            return 0;
+    }
+}
 
-    strcpy(buffer, str);
-    argv[0] = buffer;
-    return send_msg(sd, action, 1, argv);
+/**
+ * Controlla i tempi dei giocatori (vedi engine_check_timers(...)) e chiude
+ *  le sessioni staccate da più di RESUME_GRACE_SECONDS secondi.
+ * Ritorna l'istante in cui serve il prossimo controllo, NO_TIMER se nessuno
+ *  gioca e nessuna sessione è staccata.
+ */
+unsigned long check_timers(unsigned long now) {
+    struct session *s, *s_next;
+    unsigned long next = engine_check_timers(now);
+
+    for (s = g_sessions; s != NULL; s = s_next) {
+        s_next = s->next;
+        if (s->sd != -1) {
+            continue;
+        }
+        if (now >= s->detached_at + RESUME_GRACE_SECONDS) {
+            log_event(LOG_INFO, "La sessione di %s non è stata ripresa ed è stata chiusa", s->username);
+            destroy_session(s);
+            continue;
+        }
+        if (s->detached_at + RESUME_GRACE_SECONDS < next) {
+            next = s->detached_at + RESUME_GRACE_SECONDS;
+        }
+    }
+    return next;
 }
 
 /**
- * Gestisce ricezione, interpretazione e risposta al client
- *  del comando START e dei suoi argomenti.
- * Ritorna -1 in caso di errore.
+ * Invia al client appena autenticato la lista delle escape room e
+ *  poi, in un messaggio RESUME, un nuovo token per riprendere *session*.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
  */
-int start_command(int sd, struct session* session, int argc, char *argv[ARGC_MAX]) {
-    int room;
-    struct session *s;
-    char buffer[IO_BUFFER_SIZE];
+int send_rooms(int sd, struct session *session) {
 
-    if (argc < 1) {
-        strcpy(buffer, "Questo comando necessita di almeno un parametro.");
-        return send_text_without_info(sd, SERVER, buffer, session);
-    }
-    
-    /** 
-     * atoi ritorna 0 in caso di errore, va differenziato dal caso
-     *  in cui è stato effettivamente tradotto il numero 0.
-     */
-    room = atoi(argv[0]);
-    if ((room == 0 && argv[0][0] != '0') ||
-        room < 0 || 
-        room >= N_ROOMS) {
-        strcpy(buffer, "La room inserita non esiste.");
-        return send_text_without_info(sd, SERVER, buffer, session);
+    int argc, ret, i;
+    char *argv[ARGC_MAX];
+
+    /* Codifica delle escape room */
+    argc = g_catalogue->n_rooms;
+    for (i = 0; i < argc; i++) {
+        argv[i] = g_catalogue->rooms[i].name;
     }
 
-    if (session->room == room) {
-        strcpy(buffer, "Sei già in questa stanza.");
-        return send_text_without_info(sd, SERVER, buffer, session);
+    trace_span_begin(TRACE_WRITE);
+    ret = write_msg(sd, SERVER, argc, argv);
+    trace_span_end();
+    if (ret == -1) {
+        log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+        return -1;
     }
 
-    /* Vediamo se prima di far entrare il giocatore nuovo c'era qualcuno */
-    s = get_session_by_room(room);
+    log_event(LOG_INFO, "%d ha ricevuto la lista delle escape room", sd);
 
-    /** 
-     * Servono, se il client prova ad entrare in una stanza occupata, a 
-     *  riconoscere dove voleva entrare quando invierà la risposta.
-     */
-    session->room = room;
-    session->answer_to = NULL;
+    /* Senza token si gioca lo stesso, ma la sessione non potrà essere ripresa */
+    argc = 0;
+    if (new_token(session) == 0) {
+        argv[argc++] = session->token;
+    }
+    else {
+        log_event(LOG_WARNING, "Impossibile generare il token per %d", sd);
+    }
 
-    /* Il client ha provato ad entrare in una room occupata */
-    if (s != NULL) {
-        print_current_time();
-        printf("%d ha provato ad entrare nella room %d, già occupata\n", sd, room);
+    trace_span_begin(TRACE_WRITE);
+    ret = write_msg(sd, RESUME, argc, argv);
+    trace_span_end();
+    if (ret == -1) {
+        log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+        return -1;
+    }
 
-        strcpy(buffer, "C'è già un giocatore in questa stanza. Se rispondi bene alla seguente domanda gli verrà tolto del tempo, altrimenti gliene verrà aggiunto! ");
-        strcat(buffer, g_rooms[room].question);
-        return send_text_without_info(sd, QUESTION, buffer, session);
+    /* Una sessione ripresa può essere in gioco, il client ha bisogno del manifesto */
+    if (session->room != -1) {
+        return engine_send_manifest(session);
     }
-    
-    /* Inizializzazione dei restanti campi della sessione, se la stanza era vuota */
-    session->n_objects = 0;
-    session->n_tokens = 0;
-    session->start_time = (unsigned long)time(NULL);
-    load_statuses(session, room);
-    
-    print_current_time();
-    printf("%d ha iniziato a giocare nella room %d\n", sd, session->room);
-    sprintf(buffer, "Benvenuto nella room %s. Hai %d minuti a partire da ora!",
-        g_rooms[room].name, g_rooms[room].time_limit);
-    return send_text(sd, buffer, session);
+
+    return 0;
 }
 
 /**
- * Gestisce ricezione, interpretazione e risposta al client
- *  del comando LOOK e dei suoi argomenti.
- * Ritorna -1 in caso di errore.
+ * Riattacca al client *sd* la sessione staccata con token *token*.
+ * Il client riceve RESUMED (seguito dalla lista delle escape room e dal
+ *  nuovo token) o RESUME_FAILED, in tal caso può ancora fare il login.
+ * Ritorna -1 in caso di errore, 0 altrimenti.
  */
-int look_command(int sd, struct session* session, int argc, char *argv[ARGC_MAX]) {   
-    char buffer[IO_BUFFER_SIZE];
-    struct location *location;
-    struct object *object;
+int resume(int sd, const char *token) {
 
-    if (session->room == -1) {
-        strcpy(buffer, "Attualmente non sei in nessuna stanza");
-        return send_text_without_info(sd, SERVER, buffer, session);
-    }
+    enum RESPONSE n_response, h_response;
+    struct session *session;
+    int ret;
 
-    if (argc == 0) {
-        strcpy(buffer, g_rooms[session->room].look_msg);
-        return send_text(sd, buffer, session);
-    }
+    session = get_session_by_token(token);
+    h_response = session != NULL && session->sd == -1 ? RESUMED : RESUME_FAILED;
+    n_response = htonl(h_response);
+    metrics_login(h_response);
 
-    /* argc >= 1 */
-    location = get_location(session->room, argv[0]);
-    object = get_object(session->room, argv[0]);
+    log_event(LOG_INFO, "%d ha tentato di riprendere una sessione, "
+        "con risultato: %s", sd, response_to_str[h_response]);
 
-    /* Comando look eseguito su una locazione */
-    if (location != NULL) {
-        strcpy(buffer, location->look_msg);
+    trace_span_begin(TRACE_WRITE);
+    ret = connection_send(sd, &n_response, sizeof(n_response));
+    trace_span_end();
+    if (ret == -1) {
+        log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+        return -1;
     }
-    /* Comando look eseguito su un oggetto */
-    else if (object != NULL) {
-        struct object_status *os = get_status(session, object);
-        enum TAKE_STATUS ts = object->take[os->times_taken];
 
-        /* Il client lo ha già sbloccato */
-        if (ts == OBJ_UNLOCKED || ts == OBJ_GIVE_TOKEN) {
-            strcpy(buffer, object->unlocked_look_msg);
-        }
-        /* Il client non lo ha ancora sbloccato */
-        else {
-            strcpy(buffer, object->locked_look_msg);
-        }
-    }
-    /* Comando look eseguito su qualcosa di inesistente */
-    else {
-        strcpy(buffer, "Non c'è nessuna locazione od oggetto con questo nome.");
+    if (h_response == RESUME_FAILED) {
+        return 0;
     }
 
-    return send_text(sd, buffer, session);
+    /* Il tempo rimasto viene ricontrollato, chi è stato via potrebbe non essere stato avvisato */
+    attach_session(session, sd);
+    g_next_timer = 0;
+    return send_rooms(sd, session);
 }
 
 /**
- * Gestisce ricezione, interpretazione e risposta al client
- *  del comando TAKE e dei suoi argomenti.
- * Ritorna -1 in caso di errore.
+ * Completa la procedura di login con un client, di cui *frame* è il
+ *  messaggio ricevuto (*size* byte), e inizializza una sessione.
+ * Se è andata a buon fine invia anche la lista delle escape room.
+ * In caso di errore (o disconnessione) ritorna -1, altrimenti 0.
  */
-int take_command(int sd, struct session* session, int argc, char *argv[ARGC_MAX]) {
-    char buffer[IO_BUFFER_SIZE];
-    struct object *object;
-    struct object_status *os;
-    enum TAKE_STATUS ts;
+int login_and_send_rooms(int sd, const char *frame, int size) {
 
-    if (session->room == -1) {
-        strcpy(buffer, "Attualmente non sei in nessuna stanza.");
-        return send_text_without_info(sd, SERVER, buffer, session);
-    }
+    enum RESPONSE n_response, h_response;
+    enum ACTION action;
+    struct session *session;
+    int argc, ret;
+    char *argv[ARGC_MAX];
+    char username[CREDENTIALS_LENGTH_MAX];
 
-    if (argc < 1) {
-        strcpy(buffer, "Questo comando richiede almeno un parametro.");
-        return send_text(sd, buffer, session);
+    trace_request_name(action_to_str[CLIENT]);
+    trace_stage(TRACE_DECODE);
+    ret = decode_frame(frame, size, &action, &argc, argv);
+    trace_stage(TRACE_HANDLER);
+    if (ret == 0) {
+        metrics_begin(action);
+        journal_record(sd, action, argc, argv);
+    }
+    /* Ripresa di una sessione la cui connessione si è interrotta */
+    if (ret == 0 && action == RESUME && argc == 1) {
+        ret = resume(sd, argv[0]);
+        free_argv(argv);
+        return ret;
     }
 
-    object = get_object(session->room, argv[0]);
-    if (object == NULL) {
-        strcpy(buffer, "L'oggetto specificato non esiste.");
-        return send_text(sd, buffer, session); 
+    /* Voglio esattamente 2 argomenti, argv[0] = username, argv[1] = password */
+    if (ret == -1 || argc != 2) {
+        log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+        free_argv(argv);
+        return -1;
     }
 
-    os = get_status(session, object);
-    if (os->in_inventory) {
-        strcpy(buffer, "Hai già questo oggetto in mano.");
-        return send_text(sd, buffer, session);   
+    /* Controllo nel database e nella lista delle sessioni */
+    h_response = db_check(argv[0], argv[1]);
+    session = get_session_by_username(argv[0]);
+    if (h_response == LOGIN_SUCCESS && session != NULL && session->sd != -1) {
+        h_response = ALREADY_LOGGED_IN;
     }
+    n_response = htonl(h_response);
+    metrics_login(h_response);
 
-    if (session->n_objects == OBJECTS_PER_PLAYER_MAX) {
-        strcpy(buffer, "Hai troppi oggetti in mano, devi posarne qualcuno.");
-        return send_text(sd, buffer, session);   
-    }
+    /* Ricopio l'username, che mi servirà dopo, e dealloco gli *argv* */
+    strcpy(username, argv[0]);
+    free_argv(argv);
 
-    ts = object->take[os->times_taken];
-    if (ts == OBJ_UNLOCKED) {
-        strcpy(buffer, "Oggetto raccolto.");
-        session->n_objects++;
-        os->in_inventory = 1;
+    log_event(LOG_INFO, "%d ha effettuato un tentativo di login, "
+        "con risultato: %s", sd, response_to_str[h_response]);
+    
+    /* Invio della risposta (dimensione nota) */
+    trace_span_begin(TRACE_WRITE);
+    ret = connection_send(sd, &n_response, sizeof(n_response));
+    trace_span_end();
+    if (ret == -1) {
+        log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+        return -1;
     }
-    else if (ts == OBJ_GIVE_TOKEN) {
-        session->n_tokens++;
-        session->n_objects++;
-        os->in_inventory = 1;
-        os->times_taken++;
 
-        if (g_rooms[session->room].n_tokens == session->n_tokens) {
-            print_current_time();
-            printf("%d ha risolto la room %d\n", sd, session->room);
+    /* Casi in cui viene consentito riprovare l'accesso */
+    if (h_response == LOGIN_FAIL ||
+        h_response == ALREADY_LOGGED_IN ||
+        h_response == CREDENTIALS_TOO_SHORT ||
+        h_response == CREDENTIALS_TOO_LONG) {
+        return 0;
+    }
 
-            session->room = -1;
-            strcpy(buffer, "Hai raccolto tutti i token in tempo! Bel lavoro.");
-            return send_text_without_info(sd, SERVER, buffer, session);
-        }
-        else {
-            strcpy(buffer, "Oggetto raccolto. Ti è stato assegnato un token!");
-        }
+    if (h_response == SERVER_FULL) {
+        log_event(LOG_WARNING, "Impossibile creare un nuovo "
+            "record per %d, memoria esaurita", sd);
+        return -1;
     }
-    else if (ts == OBJ_LOCKED_BY_Q) {
-        session->answer_to = object;
-        strcpy(buffer, "L'oggetto è bloccato da un enigma:\n ");
-        strcat(buffer, object->take_q);
-        return send_text_without_info(sd, QUESTION, buffer, session);
+
+    /**
+     * Il login è andato a buon fine. Se la sessione era rimasta staccata
+     *  (connessione interrotta) la riprende, altrimenti ne crea una che
+     *  ha come ID il socket descriptor del client appena autenticato.
+     */
+    if (session != NULL) {
+        log_event(LOG_INFO, "%d ha ripreso la sessione di %s con la password", sd, username);
+        attach_session(session, sd);
+        g_next_timer = 0;
+        return send_rooms(sd, session);
     }
-    /* OBJ_LOCKED_BY_USE */
-    else {
-        strcpy(buffer, "L'oggetto è bloccato...");
+    session = init_session(sd, username);
+    if (session == NULL) {
+        log_event(LOG_WARNING, "Impossibile creare una nuova "
+            "sessione per %d, memoria esaurita", sd);
+        return -1;
     }
 
-    return send_text(sd, buffer, session);
+    return send_rooms(sd, session);
 }
 
 /**
- * Gestisce ricezione, interpretazione e risposta al client
- *  del comando USE e dei suoi argomenti.
+ * Gestisce ricezione, interpretazione e risposta al client del comando
+ *  SPECTATE e dei suoi argomenti: iscrive il client agli eventi della
+ *  room e gli invia un'istantanea della partita in corso, gli eventi
+ *  successivi gli verranno inviati dal ciclo principale.
  * Ritorna -1 in caso di errore.
  */
-int use_command(int sd, struct session* session, int argc, char *argv[ARGC_MAX]) {
-    char buffer[IO_BUFFER_SIZE];
-    struct object *object1, *object2;
-    struct object_status *os1, *os2;
-
-    if (session->room == -1) {
-        strcpy(buffer, "Attualmente non sei in nessuna stanza");
-        return send_text_without_info(sd, SERVER, buffer, session);
-    }
+int spectate_command(int sd, struct session* session, int argc, char *argv[ARGC_MAX]) {
+    char buffer[IO_BUFFER_SIZE - STATUS_LENGTH_MAX];
+    struct fragment text;
+    struct session *player;
+    struct room *room;
+    int r, i, len;
 
     if (argc < 1) {
-        strcpy(buffer, "Questo comando richiede almeno un parametro.");
-        return send_text(sd, buffer, session);
-    }
-    
-    object1 = get_object(session->room, argv[0]);
-    if (object1 == NULL) {
-        strcpy(buffer, "Il primo oggetto specificato non esiste.");
-        return send_text(sd, buffer, session); 
+        return engine_reply(session, SERVER, &g_messages[MSG_MISSING_PARAMETER]);
     }
-    os1 = get_status(session, object1);
 
-    if (os1->used) {
-        strcpy(buffer, "Hai già usato questo oggetto.");
-        return send_text(sd, buffer, session); 
+    if (session->room != -1) {
+        return engine_reply(session, SERVER, &g_messages[MSG_SPECTATE_PLAYING]);
     }
 
-    if (!os1->in_inventory) {
-        strcpy(buffer, "Devi avere l'oggetto in mano per poterlo utilizzare.");
-        return send_text(sd, buffer, session); 
+    r = engine_parse_room(argv[0]);
+    if (r == -1) {
+        return engine_reply(session, SERVER, &g_messages[MSG_NO_SUCH_ROOM]);
     }
+    room = &g_catalogue->rooms[r];
 
-    /* L'oggetto deve essere utilizzato da solo */
-    if (object1->use_with == NULL) {
-        /* Viene effettivamente usato da solo */
-        if (argc == 1) {
-            os1->used = 1;
-            strcpy(buffer, object1->use_msg);
-        }
-        /* Viene utilizzato con un altro oggetto */
-        else {
-            strcpy(buffer, "Non sembra fare nulla.");
-        }
+    if (spectate_subscribe(room->name, sd) == -1) {
+        log_event(LOG_WARNING, "Impossibile iscrivere %d agli eventi "
+            "della room %d, memoria esaurita", sd, r);
+        return -1;
     }
-    /* L'oggetto deve essere utilizzato con un'altro */
-    else {
-        if (argc < 2) {
-            strcpy(buffer, "Non sembra fare nulla.");
-            return send_text(sd, buffer, session); 
-        }
-        
-        object2 = get_object(session->room, argv[1]);
-        if (object2 == NULL) {
-            strcpy(buffer, "Il secondo oggetto specificato non esiste.");
-            return send_text(sd, buffer, session); 
-        }
 
-        if (object1->use_with != object2) {
-            strcpy(buffer, "Non sembra fare nulla.");
-        }
-        else {
-            os1->used = 1;
-            os2 = get_status(session, object2);
-            os2->times_taken++;
-            strcpy(buffer, object1->use_msg);
-        }
+    player = get_session_by_room(room->name);
+    if (player == NULL) {
+        sprintf(buffer, "Stai guardando la room %.64s, al momento nessuno sta giocando.", room->name);
     }
+    else {
+        struct room *pr = session_room(player);
 
-    return send_text(sd, buffer, session); 
-}
-
-/**
- * Gestisce ricezione, interpretazione e risposta al client
- *  del comando OBJS e dei suoi argomenti.
- * Ritorna -1 in caso di errore.
- */
-int objs_command(int sd, struct session* session, int argc, char *argv[ARGC_MAX]) {
-    char buffer[IO_BUFFER_SIZE];
-
-    if (session->room == -1) {
-        strcpy(buffer, "Attualmente non sei in nessuna stanza");
-        return send_text_without_info(sd, SERVER, buffer, session);
-    }
+        sprintf(buffer, "Stai guardando %s nella room %.64s.\n Tempo rimasto: %lus, "
+            "Token raccolti: %d/%d\n Oggetti in mano:", player->username, pr->name,
+            engine_remaining_time(player), player->game.n_tokens, pr->n_tokens);
 
-    if (session->n_objects == 0) {
-        strcpy(buffer, "Non hai nessun oggetto.");
-    }
-    else {
-        int i;
-        strcpy(buffer, "");
-        for (i = 0; i < g_rooms[session->room].tot_objects; i++) {
-            if (session->objects_statuses[i].in_inventory) {
-                strcat(buffer, session->objects_statuses[i].object->name);
-                strcat(buffer, "\n ");
+        /* Gli oggetti che non entrano nel messaggio vengono tralasciati */
+        len = strlen(buffer);
+        for (i = 0; i < pr->tot_objects; i++) {
+            int name_len = strlen(pr->object_names[i]);
+            if (!player->game.objects[i].in_inventory || len + name_len + 2 > sizeof(buffer)) {
+                continue;
             }
+            buffer[len++] = ' ';
+            strcpy(buffer + len, pr->object_names[i]);
+            len += name_len;
         }
-        /* Rimuove l'ultimo '\\n ' */
-        buffer[strlen(buffer) - 2] = '\0';
     }
 
-    return send_text(sd, buffer, session);
+    log_event(LOG_INFO, "%d ha iniziato a guardare la room %d", sd, r);
+
+    /* L'azione EVENT dice al client che da ora riceverà gli eventi della partita */
+    make_fragment(&text, buffer);
+    return write_fragments(sd, EVENT, &text, NULL);
+}
+
+/* Vero se *action* è un comando che il client può inviare durante il gioco */
+int is_command(enum ACTION action) {
+    return (action >= ANSWER && action <= END) || action == RANK || action == SPECTATE || action == HINT;
 }
 
 /**
- * Gestisce ricezione, interpretazione e risposta al client
- *  del comando DROP e dei suoi argomenti.
- * Ritorna -1 in caso di errore.
+ * Decodifica il comando di gioco *frame* (*size* byte) ricevuto da *sd*,
+ *  scrivendone l'azione e gli argomenti in *action*, *argc* e *argv*.
+ * In caso di errore ritorna -1, altrimenti 0.
  */
-int drop_command(int sd, struct session* session, int argc, char *argv[ARGC_MAX]) {
-    char buffer[IO_BUFFER_SIZE];
-    struct object *object;
-    struct object_status *os;
+int decode_command(int sd, const char *frame, int size, enum ACTION *action, int *argc, char *argv[ARGC_MAX]) {
 
-    if (session->room == -1) {
-        strcpy(buffer, "Attualmente non sei in nessuna stanza");
-        return send_text_without_info(sd, SERVER, buffer, session);
-    }
+    int ret;
 
-    if (argc < 1) {
-        strcpy(buffer, "Questo comando richiede almeno un parametro.");
-        return send_text(sd, buffer, session);
+    trace_stage(TRACE_DECODE);
+    ret = decode_frame(frame, size, action, argc, argv);
+    trace_stage(TRACE_DISPATCH);
+    if (ret == 0) {
+        trace_request_name(*action < ACTION_MAX ? action_to_str[*action] : "?");
+        journal_record(sd, *action, *argc, argv);
     }
-
-    object = get_object(session->room, argv[0]);
-    if (object == NULL) {
-        strcpy(buffer, "L'oggetto specificato non esiste.");
-        return send_text(sd, buffer, session);
+    if (ret == 0 && !is_command(*action)) {
+        g_protocol_stats.decode_failures++;
     }
-
-    os = get_status(session, object);
-    if (!os->in_inventory) {
-        strcpy(buffer, "Puoi posare solamente oggetti che hai in mano.");
-    }
-    else {
-        os->in_inventory = 0;
-        session->n_objects--;
-        strcpy(buffer, "Oggetto posato.");       
+    if (ret == -1 || !is_command(*action)) { 
+        log_event(LOG_WARNING, "impossibile decodificare il messaggio "
+            "ricevuto da %d. Connessione terminata", sd);
+        free_argv(argv);
+        return -1;
     }
-
-    return send_text(sd, buffer, session);
+    return 0;
 }
 
 /**
- * Gestisce la ricezione delle risposte del client agli enigmi.
- * Ritorna -1 in caso di errore, 0 altrimenti
+ * Esegue il comando di gioco *action* ricevuto da *sd*, con gli *argc*
+ *  argomenti in *argv* (che restano di chi chiama).
+ * In caso di errore (o se il client esce) ritorna -1, altrimenti 0.
  */
-int handle_answers(int sd, struct session *session, int argc, char *argv[ARGC_MAX]) {
-    char buffer[IO_BUFFER_SIZE];
-
-    if (argc <= 0 || session->room == -1) {
-        print_current_time();
-        printf("Connessione con %d interrotta\n", sd);
-        return -1;
-    }
+int execute(int sd, struct session *session, enum ACTION action, int argc, char *argv[ARGC_MAX]) {
 
-    /* Il client sta rispondedo all'enigma per entrare in una room occupata */
-    if (session->answer_to == NULL) {
-        
-        struct session *s;
-        int room;
+    int ret;
 
-        /** 
-         * Resetta la room del giocatore che risponde alla domanda
-         *  (così get_session_by_room(...) ritorna quella dell'altro).
-         */
-        room = session->room;
-        session->room = -1;
+    /* Qualsiasi messaggio di uno spettatore interrompe la visione della partita */
+    if (spectate_watching(sd)) {
+        struct fragment rest;
 
-        /* Recupera la sessione del giocatore attualmente in gioco in tale stanza */
-        s = get_session_by_room(room);
-        if (s == NULL) {
-            strcpy(buffer, "Il giocatore è uscito dalla stanza prima che tu rispondessi.");
-            
-            print_current_time();
-            printf("%d ha risposto alla domanda ma il giocatore precedente è già uscito\n", sd);
+        log_event(LOG_INFO, "%d ha smesso di guardare una room", sd);
+        if (spectate_stop(sd, &rest) == -1 ||
+            (rest.size > 0 && connection_send(sd, rest.data, rest.size) == -1)) {
+            return -1;
         }
-        else if (strcmp(argv[0], g_rooms[room].answer) == 0) {
-            sprintf(buffer, "Risposta corretta! Sono stati tolti %d"
-                " minuti a %s.", g_rooms[room].bonus, s->username);
-            s->start_time -= g_rooms[room].bonus * 60;
-            
-            print_current_time();
-            printf("%d ha risposto correttamente alla domanda, danneggiando %d\n", sd, s->sd);
+        if (action == SPECTATE && argc == 0) {
+            return engine_reply(session, SERVER, &g_messages[MSG_SPECTATE_STOPPED]);
         }
-        else {
-            sprintf(buffer, "Risposta sbagliata! Sono stati aggiunti %d"
-                " minuti %s.", g_rooms[room].penalty, s->username);
-            s->start_time += g_rooms[room].penalty * 60;
+    }
 
-            print_current_time();
-            printf("%d ha risposto in modo errato alla domanda, avvantaggiando %d\n", sd, s->sd);
-        }
+    if (action == END) {
+        log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+        /* Uscita volontaria, la sessione non potrà essere ripresa */
+        session->token[0] = '\0';
+        return -1;
+    }
 
+    /* Tutto il resto è gioco, le risposte arrivano a engine_event_ready(...) */
+    if (action == SPECTATE) {
+        ret = spectate_command(sd, session, argc, argv);
     }
-    
-    /* Il client sta rispondendo ad un enigma per sbloccare un oggetto */
     else {
-        if (strcmp(argv[0], session->answer_to->take_a) == 0) {
-            struct object_status *os = get_status(session, session->answer_to);
-            os->times_taken++;
-            strcpy(buffer, "Risposta corretta! Adesso puoi raccogliere l'oggetto.");
-
-            print_current_time();
-            printf("%d ha risposto correttamente ad un enigma\n", sd);
-        }
-        else {
-            strcpy(buffer, "Risposta sbagliata.");
+        ret = engine_command(session, action, argc, argv);
+    }
 
-            print_current_time();
-            printf("%d ha risposto in modo errato ad un enigma\n", sd);
-        }
+    if (ret == -1) {
+        log_event(LOG_WARNING, "Impossibile eseguire il comando ricevuto da %d. Connessione terminata", sd);
+        return -1;
     }
 
-    return send_text_without_info(sd, SERVER, buffer, session);
+    return 0;
 }
 
 /**
- * Gestisce i comandi di gioco ricevuti dal client.
- * In caso di errore (o disconnessione) ritorna -1, altrimenti 0.
+ * Gestisce il comando di gioco *frame* ricevuto dal client.
+ * In caso di errore (o se il client esce) ritorna -1, altrimenti 0.
  */
-int play(int sd, struct session *session) {
+int play(int sd, struct session *session, const char *frame, int size) {
 
-    int ret, argc, i;
+    int ret, argc;
     enum ACTION action;
-    char buffer[IO_BUFFER_SIZE];
     char *argv[ARGC_MAX];
 
-    /* Ricezione del messaggio */
-    ret = recv_msg(sd, &action, &argc, argv);
-    if (ret == -1 || action < ANSWER || action > END) { 
-        printf(ANSI_COLOR_YELLOW "[Warning]: impossibile decodificare il messaggio "
-            "ricevuto da %d. Connessione terminata\n" ANSI_COLOR_RESET, sd);
-        free_argv(argv);
-        return -1;
-    }
-
-    print_current_time();
-    printf("%d ha inviato il comando %s", sd, action_to_str[action]); 
-    for (i = 0; i < argc; i++) {
-        printf(" %s", argv[i]);
-    }
-    printf("\n");
-
-    if (action == ANSWER) {
-        ret = handle_answers(sd, session, argc, argv);
-        free_argv(argv);
-        return ret;
-    }
-
-    if (action == END) {
-        print_current_time();
-        printf("Connessione con %d interrotta\n", sd);
-        free_argv(argv);
+    if (decode_command(sd, frame, size, &action, &argc, argv) == -1) {
         return -1;
     }
 
-    /**
-     * Se il client è già in gioco, ed il comando che invia non è START, 
-     *  controlla se ha finito il tempo, in tal caso notifica il client
-     *  che ha perso e termina la partita.
-     */
-    if (action != START && session->room != -1) {
-        int elapsed_time = (int)difftime(time(NULL), session->start_time);
-        if (elapsed_time > g_rooms[session->room].time_limit * 60) {
-            print_current_time();
-            printf("%d ha esaurito il tempo nella room %d\n", sd, session->room);
-            session->room = -1;
-            free_argv(argv);
-            strcpy(buffer, "Il tempo è scaduto, hai perso!");
-            return send_text_without_info(sd, SERVER, buffer, session);
-        }
-    }
-
-    /**
-     * A questo punto *action* contiene il comando scritto da client e
-     *  *argc* il numero di argomenti per il comando (memorizzati in *argv).
-     */
-    switch (action) {
-        case START:
-            ret = start_command(sd, session, argc, argv);
-            break;
-        case LOOK:
-            ret = look_command(sd, session, argc, argv);
-            break;
-        case TAKE:
-            ret = take_command(sd, session, argc, argv);
-            break;
-        case USE:
-            ret = use_command(sd, session, argc, argv);
-            break;
-        case OBJS:
-            ret = objs_command(sd, session, argc, argv);
-            break;
-        case DROP:
-            ret = drop_command(sd, session, argc, argv);
-            break;
-        default:    /* Mai utilizzato (controlliamo action prima) */
-            break;
-    }
-
-    #ifdef MDEBUG
-    if (action != START) {
-        printf("\t#Stato degli oggetti del giocatore %d\n", sd);
-        for (i = 0; i < g_rooms[session->room].tot_objects; i++) {
-            printf("\t%-15s in_inventory: %d used: %d times_taken: %d\n", session->objects_statuses[i].object->name, session->objects_statuses[i].in_inventory, session->objects_statuses[i].used, session->objects_statuses[i].times_taken);
-        }
-    }
-    #endif
-
+    metrics_begin(action);
+    trace_stage(TRACE_HANDLER);
+    ret = execute(sd, session, action, argc, argv);
     free_argv(argv);
+    return ret;
+}
 
-    if (ret == -1) {
-        printf("Impossibile eseguire il comando ricevuto da %d. Connessione terminata\n", sd);
-        return -1;
+/**
+ * Chiude la connessione con *sd*. La sessione resta staccata per
+ *  RESUME_GRACE_SECONDS secondi se ha un token (non ce l'ha se il
+ *  client è uscito o non l'ha mai ricevuto).
+ */
+void disconnect(int sd, unsigned long now) {
+    metrics_connected(-1);
+    spectate_stop(sd, NULL);
+
+    /* Ultimo tentativo per le risposte che il client non ha ancora letto */
+    connection_flush(sd);
+    connection_close(sd);
+    close(sd);
+    if (detach_session(sd, now) == 0) {
+        log_event(LOG_INFO, "La sessione di %d è stata staccata, può essere ripresa", sd);
+        g_next_timer = 0;
     }
-
-    return 0;
+    else {
+        close_session(sd);
+    }
+    journal_close(sd);
 }
 
 int main(int argc, char *argv[]) {
 
-    int server_port, listener, ret, sd_max;
+    int server_port, listener, metrics_sd, ret, sd_max;
+    unsigned long next_analytics = (unsigned long)time(NULL) + ANALYTICS_FLUSH_SECONDS;
     struct sockaddr_in server_addr;    
-    fd_set master_read, read_fds;
+    fd_set master_read, read_fds, write_fds;
 
     printf("\n############################## INTERFACCIA SERVER ##############################\n\n");
 
@@ -843,10 +1051,29 @@ int main(int argc, char *argv[]) {
         server_port = DEFAULT_SERVER_PORT;
     }
 
+    /* Il secondo argomento (facoltativo) è il file in cui registrare i comandi */
+    if (argc >= 3) {
+        if (journal_open(argv[2]) == -1) {
+            printf(" Impossibile aprire il journal %s\n\n", argv[2]);
+            printf("################################################################################\n\n");
+            exit(-1);
+        }
+        printf(" I comandi ricevuti verranno registrati in %s\n\n", argv[2]);
+    }
+
     printf(
         " Comandi disponibili:\n"
         " > start\t# Avvia il server\n"
         " > stop \t# Termina il server\n"
+        " > reload\t# Ricarica le escape room da " ROOMS_FILE "\n"
+        " > metrics\t# Stampa le metriche del server\n"
+        " > log livello\t# Livello dei messaggi: debug, info (default), warning, error\n"
+        " > trace n\t# Traccia una richiesta ogni n (0 per smettere)\n"
+        " > trace dump\t# Scrive le tracce raccolte in " TRACE_FILE "\n"
+    );
+    printf(
+        " > import file\t# Registra gli utenti del file, una riga \"username password\" ciascuno\n"
+        " > lowlatency [cpu]\t# Risposte più regolari al costo di più CPU, col ciclo principale su cpu\n"
         "\n"
         " > "
     );
@@ -901,19 +1128,144 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
-    print_current_time();
-    printf("Server in ascolto su %s:%i\n", SERVER_IP, server_port);
+    if (leaderboard_init(LEADERBOARD_FILE) == -1) {
+        printf(ANSI_COLOR_RED "[Errore]: impossibile caricare "
+            "le classifiche da " LEADERBOARD_FILE "\n" ANSI_COLOR_RESET);
+        exit(-1);
+    }
+
+    /* Le risposte del motore di gioco diventano messaggi sui socket */
+    engine_init(engine_event_ready, NULL);
+
+    /* Da qui i messaggi passano per il log asincrono */
+    if (logger_start() == -1) {
+        printf(ANSI_COLOR_RED "[Errore]: impossibile avviare il thread del log\n" ANSI_COLOR_RESET);
+        exit(-1);
+    }
+
+    /**
+     * Da qui il thread principale tiene sempre g_world, tranne che durante
+     *  select(...), così il thread dei suggerimenti può rendere corrente
+     *  una versione ricaricata delle room.
+     */
+    pthread_mutex_lock(&g_world);
+    if (rooms_builder_start(&g_world, rooms_ready) == -1) {
+        printf(ANSI_COLOR_RED "[Errore]: impossibile avviare il thread dei suggerimenti\n" ANSI_COLOR_RESET);
+        exit(-1);
+    }
+
+    log_event(LOG_INFO, "Server in ascolto su %s:%i", SERVER_IP, server_port);
+
+    /* Dopo l'avvio degli altri thread, che non devono ereditare il processore */
+    if (g_lowlatency) {
+        if (lowlatency_enable(g_lowlatency_cpu) == -1) {
+            log_event(LOG_WARNING, "Impossibile fissare il thread principale al processore %d", g_lowlatency_cpu);
+        }
+        log_event(LOG_INFO, "Profilo a bassa latenza attivo");
+    }
+
+    /* Le metriche sono un extra: se la porta è occupata il server funziona lo stesso */
+    metrics_sd = server_port + METRICS_PORT_OFFSET <= 65535 ? metrics_listen(server_port + METRICS_PORT_OFFSET) : -1;
+    if (metrics_sd == -1) {
+        log_event(LOG_WARNING, "Impossibile esporre le metriche sulla porta %d", server_port + METRICS_PORT_OFFSET);
+    }
+    else {
+        log_event(LOG_INFO, "Metriche disponibili su http://127.0.0.1:%d/metrics", server_port + METRICS_PORT_OFFSET);
+        FD_SET(metrics_sd, &master_read);
+        if (metrics_sd > sd_max) sd_max = metrics_sd;
+    }
 
     while(1) {
 
         int sd;
+        struct timeval timeout, *p_timeout = NULL;
+        unsigned long now = (unsigned long)time(NULL), next_metrics;
+
+        /* Le richieste delle metriche troppo lente vengono chiuse */
+        next_metrics = metrics_expire(now, &master_read);
         read_fds = master_read;
 
-        /* No timeout (il server non deve effettuare operazioni asincrone) */
-        select(sd_max + 1, &read_fds, NULL, NULL, NULL);
+        /* I client con risposte arretrate e gli spettatori che hanno eventi da ricevere aspettano di poter scrivere */
+        FD_ZERO(&write_fds);
+        spectate_fill(&write_fds, sd_max);
+        metrics_fill(&write_fds, sd_max);
+        for (sd = 0; sd <= sd_max; sd++) {
+            if (connection_pending(sd)) {
+                FD_SET(sd, &write_fds);
+            }
+        }
+
+        /* Notifiche sul tempo dei giocatori */
+        if (now >= g_next_timer) {
+            g_next_timer = check_timers(now);
+        }
+
+        /* Riepiloghi delle statistiche di gioco, per chi progetta le room */
+        if (now >= next_analytics) {
+            if (analytics_flush(ANALYTICS_FILE) == -1) {
+                log_event(LOG_WARNING, "Impossibile scrivere le statistiche di gioco in %s", ANALYTICS_FILE);
+            }
+            next_analytics = now + ANALYTICS_FLUSH_SECONDS;
+        }
+
+        /**
+         * Al più fino alla prossima scrittura delle statistiche, o meno se
+         *  il journal ha record da scrivere (vengono scritti a blocchi, ma
+         *  non devono restare in memoria a lungo) o se qualcuno sta giocando.
+         */
+        timeout.tv_sec = (long)(next_analytics - now);
+        timeout.tv_usec = 0;
+        p_timeout = &timeout;
+        if (journal_pending() && JOURNAL_FLUSH_DELAY < timeout.tv_sec) {
+            timeout.tv_sec = JOURNAL_FLUSH_DELAY;
+        }
+        if (next_metrics != 0 && (long)(next_metrics - now) < timeout.tv_sec) {
+            timeout.tv_sec = (long)(next_metrics - now);
+        }
+        if (g_next_timer != NO_TIMER && (p_timeout == NULL || (long)(g_next_timer - now) < timeout.tv_sec)) {
+            timeout.tv_sec = (long)(g_next_timer - now);
+            timeout.tv_usec = 0;
+            p_timeout = &timeout;
+        }
+        pthread_mutex_unlock(&g_world);
+        ret = lowlatency_select(sd_max + 1, &read_fds, &write_fds, p_timeout);
+        pthread_mutex_lock(&g_world);
+        journal_flush(0);
+        if (ret <= 0) {
+            continue;
+        }
 
         for (sd = 0; sd <= sd_max; sd++) {
 
+            /* Risposte delle metriche ancora da inviare */
+            if (FD_ISSET(sd, &write_fds) && metrics_client(sd)) {
+                if (metrics_write(sd)) {
+                    FD_CLR(sd, &master_read);
+                }
+                continue;
+            }
+
+            /* Invio delle risposte arretrate, senza bloccarsi */
+            if (FD_ISSET(sd, &write_fds) && connection_flush(sd) == -1) {
+                log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+                FD_CLR(sd, &master_read);
+                disconnect(sd, now);
+                continue;
+            }
+
+            /* Gli eventi vengono dopo le risposte, per non mescolarne i byte */
+            if (FD_ISSET(sd, &write_fds) && !connection_pending(sd) && spectate_write(sd) == -1) {
+                struct session *session = get_session_by_sd(sd);
+
+                log_event(LOG_INFO, "Connessione con %d interrotta, lo spettatore è rimasto troppo indietro", sd);
+                if (session != NULL) {
+                    session->token[0] = '\0';
+                }
+                FD_CLR(sd, &master_read);
+                disconnect(sd, now);
+                continue;
+            }
+
             /* Socket inesistente o non pronto per la lettura */
             if (!FD_ISSET(sd, &read_fds)) {
                 continue;
@@ -935,31 +1287,64 @@ int main(int argc, char *argv[]) {
                 if (new_sd == -1) {
                     continue;
                 }
+                metrics_count(CNT_CONNECTIONS);
+                metrics_connected(1);
+
+                FD_SET(new_sd, &master_read);
+                if (new_sd > sd_max) sd_max = new_sd;
+            }
 
+            /* Richiesta HTTP delle metriche */
+            else if (sd == metrics_sd) {
+                int new_sd = metrics_accept(sd);
+                if (new_sd == -1) {
+                    continue;
+                }
                 FD_SET(new_sd, &master_read);
                 if (new_sd > sd_max) sd_max = new_sd;
             }
+            else if (metrics_client(sd)) {
+                if (metrics_serve(sd)) {
+                    FD_CLR(sd, &master_read);
+                }
+            }
 
             /* Sono stati scritti dei byte su un socket di comunicazione */
             else {
                 struct session *session;
-                int ret;
+                const char *frame;
+                int ret, size;
+
+                lowlatency_quickack(sd);
+
+                trace_request_begin(sd);
+                trace_stage(TRACE_READ);
+                size = connection_recv(sd, &frame);
+                if (size == 0) {
+                    /* Il resto del messaggio arriverà, la lettura riprende quando il socket è di nuovo pronto */
+                    trace_request_cancel();
+                    continue;
+                }
 
                 /* Recupera la sessione del client */
                 session = get_session_by_sd(sd);
-                
-                if (session == NULL) {
-                    ret = login_and_send_rooms(sd);
+                if (size == -1) {
+                    log_event(LOG_INFO, "Connessione con %d interrotta", sd);
+                    ret = -1;
+                }
+                else if (session == NULL) {
+                    ret = login_and_send_rooms(sd, frame, size);
                 }
                 else {
-                    ret = play(sd ,session);
+                    ret = play(sd, session, frame, size);
                 }
+                metrics_end();
+                trace_request_end();
 
-                /* In caso di errore chiudi la connessione e la sessione */
+                /* In caso di errore chiudi la connessione */
                 if (ret == -1) {
                     FD_CLR(sd, &master_read);
-                    close(sd);
-                    close_session(sd);
+                    disconnect(sd, now);
                 }
             }
 
@@ -0,0 +1,754 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "lib/server/rooms.h"
+#include "lib/server/states.h"
+#include "lib/mystdlib.h"
+
+/**
+ * Risolutore offline delle escape room.
+ *
+ * Esplora con una visita in ampiezza tutti gli stati di gioco raggiungibili
+ *  di ogni room (lo stato di ogni oggetto, l'inventario ed i token raccolti,
+ *  codificati in poche parole da 64 bit) e riporta se la room è risolvibile,
+ *  la soluzione più breve, i vicoli ciechi (stati da cui non si può più
+ *  vincere) e la dimensione dello spazio degli stati.
+ *
+ * Ogni livello della visita è diviso in due fasi parallele:
+ *  1. i thread si dividono la frontiera e ne generano i successori,
+ *     smistandoli in SHARDS gruppi in base al loro hash;
+ *  2. i thread si dividono i gruppi ed inseriscono i successori nella
+ *     tabella hash del gruppo, che in questa fase appartiene ad un solo
+ *     thread.
+ * Non servono lock ed il risultato non dipende dal numero di thread.
+ *
+ * Uso: solver [-t thread] [-m max_stati] [file delle room]
+ * Esce con 0 se tutte le room sono risolvibili e senza vicoli ciechi,
+ *  con 1 altrimenti e con 2 se non è stato possibile completare l'analisi.
+ */
+
+/* Numero di gruppi in cui è divisa la tabella degli stati */
+#define SHARDS 64
+
+/* Limite predefinito al numero di stati esplorati per room */
+#define STATES_MAX_DEFAULT (1L << 24)
+
+/* Identificatore di uno stato: posizione nel gruppo e gruppo */
+#define ID(shard, local) ((unsigned int)(local) * SHARDS + (shard))
+#define ID_SHARD(id) ((id) % SHARDS)
+#define ID_LOCAL(id) ((id) / SHARDS)
+#define NO_PARENT 0xFFFFFFFFU
+
+/* Successori generati nella prima fase, uno per thread e per gruppo */
+struct bucket {
+    uint64_t *states;
+    uint64_t *hashes;
+    unsigned int *parents;
+    int *moves;
+    int n, capacity;
+};
+
+/* Un gruppo della tabella degli stati */
+struct shard {
+    uint64_t *states;           /* layout.words parole per stato */
+    unsigned int *parents;
+    int *moves;                 /* Mossa che porta dal padre allo stato */
+    unsigned short *depths;
+    unsigned char *wins;
+    int n, capacity;
+
+    unsigned int *table;        /* Indirizzamento aperto, posizione + 1 (0 se vuoto) */
+    int table_size;
+
+    unsigned int *next;         /* Stati nuovi del livello, che non sono vittorie */
+    int n_next, next_capacity;
+
+    unsigned int *edges;        /* Coppie (padre, figlio) di tutte le mosse */
+    long n_edges, edges_capacity;
+
+    int overflow;               /* Memoria esaurita o troppi stati */
+};
+
+struct solver {
+    struct room *room;
+    struct layout lay;
+    int n_threads;
+    long states_max;
+
+    struct shard shards[SHARDS];
+    struct bucket *buckets;     /* n_threads * SHARDS, bucket[t * SHARDS + s] */
+
+    unsigned int *frontier;
+    int n_frontier, frontier_capacity;
+};
+
+struct worker {
+    pthread_t thread;
+    struct solver *s;
+    int id;
+    int error;
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Porta la capacità di *array* ad almeno *count* + 1 elementi */
+static int grow(void *array, long count, long *capacity, size_t size) {
+    void **ptr = array;
+    void *bigger;
+    long cap = *capacity == 0 ? 16 : 2 * *capacity;
+
+    if (count < *capacity) {
+        return 0;
+    }
+    bigger = realloc(*ptr, size * cap);
+    if (bigger == NULL) {
+        return -1;
+    }
+    *ptr = bigger;
+    *capacity = cap;
+    return 0;
+}
+
+/* Come grow(...), per i contatori di tipo int */
+static int grow_int(void *array, int count, int *capacity, size_t size) {
+    long cap = *capacity;
+    if (grow(array, count, &cap, size) == -1) {
+        return -1;
+    }
+    *capacity = (int)cap;
+    return 0;
+}
+
+/* Ridimensiona *array* a *n* elementi grandi *size* */
+static int resize(void *array, long n, size_t size) {
+    void **ptr = array;
+    void *resized = realloc(*ptr, size * n);
+    if (resized == NULL) {
+        return -1;
+    }
+    *ptr = resized;
+    return 0;
+}
+
+static int push_candidate(struct solver *s, int thread, const uint64_t *words, unsigned int parent, int move) {
+    uint64_t h = state_hash(words, s->lay.words);
+    struct bucket *b = &s->buckets[thread * SHARDS + (int)(h % SHARDS)];
+
+    /* Gli array crescono insieme */
+    if (b->n == b->capacity) {
+        int cap = b->capacity == 0 ? 16 : 2 * b->capacity;
+        if (resize(&b->states, (long)cap * s->lay.words, sizeof(uint64_t)) == -1 ||
+            resize(&b->hashes, cap, sizeof(uint64_t)) == -1 ||
+            resize(&b->parents, cap, sizeof(unsigned int)) == -1 ||
+            resize(&b->moves, cap, sizeof(int)) == -1) {
+            return -1;
+        }
+        b->capacity = cap;
+    }
+
+    memcpy(&b->states[(long)b->n * s->lay.words], words, sizeof(uint64_t) * s->lay.words);
+    b->hashes[b->n] = h;
+    b->parents[b->n] = parent;
+    b->moves[b->n] = move;
+    b->n++;
+    return 0;
+}
+
+/* Prima fase: genera i successori di una parte della frontiera */
+static void* expand(void *arg) {
+    struct worker *w = arg;
+    struct solver *s = w->s;
+    struct room *r = s->room;
+    int n = r->tot_objects;
+    struct player_state cur, next;
+    uint64_t *words, *succ;
+    int from = (int)((long)s->n_frontier * w->id / s->n_threads);
+    int to = (int)((long)s->n_frontier * (w->id + 1) / s->n_threads);
+    int i, k, obj, ret;
+
+    cur.objects = malloc(sizeof(struct object_status) * (n + 1));
+    next.objects = malloc(sizeof(struct object_status) * (n + 1));
+    succ = malloc(sizeof(uint64_t) * s->lay.words);
+    if (cur.objects == NULL || next.objects == NULL || succ == NULL) {
+        w->error = 1;
+    }
+
+    for (i = from; i < to && !w->error; i++) {
+        unsigned int id = s->frontier[i];
+        struct shard *sh = &s->shards[ID_SHARD(id)];
+
+        words = &sh->states[(long)ID_LOCAL(id) * s->lay.words];
+        state_decode(&s->lay, s->room, words, &cur);
+
+        /* take e drop di ogni oggetto, use con ogni bersaglio (compresi nessuno ed uno inesistente) */
+        for (obj = 0; obj < n && !w->error; obj++) {
+            for (k = -2; k < n + 2; k++) {
+                int move;
+
+                if (k == -2) move = MOVE(MOVE_TAKE, obj, 0);
+                else if (k == -1) move = MOVE(MOVE_DROP, obj, 0);
+                else move = MOVE(MOVE_USE, obj, k - 2);
+
+                do {
+                    next.n_objects = cur.n_objects;
+                    next.n_tokens = cur.n_tokens;
+                    memcpy(next.objects, cur.objects, sizeof(struct object_status) * n);
+
+                    ret = apply_move(r, &next, move, NULL);
+                    if (ret != 0) {
+                        state_encode(&s->lay, s->room, &next, succ);
+                        if (memcmp(succ, words, sizeof(uint64_t) * s->lay.words) != 0 &&
+                            push_candidate(s, w->id, succ, id, move) == -1) {
+                            w->error = 1;
+                        }
+                    }
+                    move |= MOVE_ANSWERED;
+                } while (ret == 2);
+            }
+        }
+    }
+
+    free(cur.objects);
+    free(next.objects);
+    free(succ);
+    return NULL;
+}
+
+static int shard_add_edge(struct shard *sh, unsigned int parent, unsigned int child) {
+    if (grow(&sh->edges, sh->n_edges * 2 + 1, &sh->edges_capacity, sizeof(unsigned int)) == -1) {
+        return -1;
+    }
+    sh->edges[sh->n_edges * 2] = parent;
+    sh->edges[sh->n_edges * 2 + 1] = child;
+    sh->n_edges++;
+    return 0;
+}
+
+/* Raddoppia la tabella hash del gruppo, reinserendo tutti i suoi stati */
+static int shard_rehash(struct solver *s, struct shard *sh) {
+    int size = sh->table_size == 0 ? 64 : 2 * sh->table_size;
+    unsigned int *table = calloc(size, sizeof(unsigned int));
+    int i;
+
+    if (table == NULL) {
+        return -1;
+    }
+    for (i = 0; i < sh->n; i++) {
+        uint64_t h = state_hash(&sh->states[(long)i * s->lay.words], s->lay.words);
+        int slot = (int)((h / SHARDS) & (size - 1));
+        while (table[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+    free(sh->table);
+    sh->table = table;
+    sh->table_size = size;
+    return 0;
+}
+
+/* Inserisce un successore nel gruppo *shard*, se è uno stato nuovo */
+static int shard_insert(struct solver *s, int shard, const uint64_t *words, uint64_t h,
+        unsigned int parent, int move, int depth) {
+
+    struct shard *sh = &s->shards[shard];
+    size_t size = sizeof(uint64_t) * s->lay.words;
+    int slot, local;
+
+    if (sh->n * 2 >= sh->table_size && shard_rehash(s, sh) == -1) {
+        return -1;
+    }
+
+    slot = (int)((h / SHARDS) & (sh->table_size - 1));
+    while (sh->table[slot] != 0) {
+        local = sh->table[slot] - 1;
+        if (memcmp(&sh->states[(long)local * s->lay.words], words, size) == 0) {
+            return shard_add_edge(sh, parent, ID(shard, local));
+        }
+        slot = (slot + 1) & (sh->table_size - 1);
+    }
+
+    if (sh->n >= s->states_max / SHARDS + 1) {
+        sh->overflow = 1;
+        return -1;
+    }
+
+    /* Gli array crescono insieme */
+    if (sh->n == sh->capacity) {
+        int cap = sh->capacity == 0 ? 16 : 2 * sh->capacity;
+        if (resize(&sh->states, (long)cap * s->lay.words, sizeof(uint64_t)) == -1 ||
+            resize(&sh->parents, cap, sizeof(unsigned int)) == -1 ||
+            resize(&sh->moves, cap, sizeof(int)) == -1 ||
+            resize(&sh->depths, cap, sizeof(unsigned short)) == -1 ||
+            resize(&sh->wins, cap, 1) == -1) {
+            return -1;
+        }
+        sh->capacity = cap;
+    }
+
+    local = sh->n++;
+    memcpy(&sh->states[(long)local * s->lay.words], words, size);
+    sh->parents[local] = parent;
+    sh->moves[local] = move;
+    sh->depths[local] = depth;
+    sh->wins[local] = state_is_win(&s->lay, s->room, words);
+    sh->table[slot] = local + 1;
+
+    if (!sh->wins[local]) {
+        if (grow_int(&sh->next, sh->n_next, &sh->next_capacity, sizeof(unsigned int)) == -1) {
+            return -1;
+        }
+        sh->next[sh->n_next++] = ID(shard, local);
+    }
+
+    return parent == NO_PARENT ? 0 : shard_add_edge(sh, parent, ID(shard, local));
+}
+
+/* Seconda fase: inserisce i successori nei gruppi che spettano al thread */
+static void* insert(void *arg) {
+    struct worker *w = arg;
+    struct solver *s = w->s;
+    int shard, t, i;
+
+    for (shard = w->id; shard < SHARDS && !w->error; shard += s->n_threads) {
+        int depth = s->n_frontier > 0 ?
+            s->shards[ID_SHARD(s->frontier[0])].depths[ID_LOCAL(s->frontier[0])] + 1 : 0;
+
+        for (t = 0; t < s->n_threads && !w->error; t++) {
+            struct bucket *b = &s->buckets[t * SHARDS + shard];
+            for (i = 0; i < b->n && !w->error; i++) {
+                if (shard_insert(s, shard, &b->states[(long)i * s->lay.words], b->hashes[i],
+                        b->parents[i], b->moves[i], depth) == -1) {
+                    w->error = 1;
+                }
+            }
+            b->n = 0;
+        }
+    }
+    return NULL;
+}
+
+/* Esegue *fn* su tutti i thread, ritorna -1 se almeno uno ha fallito */
+static int run_phase(struct solver *s, struct worker *workers, void *(*fn)(void *)) {
+    int t, ret = 0;
+
+    for (t = 0; t < s->n_threads; t++) {
+        workers[t].s = s;
+        workers[t].id = t;
+        workers[t].error = 0;
+        if (t > 0 && pthread_create(&workers[t].thread, NULL, fn, &workers[t]) != 0) {
+            workers[t].error = 1;
+        }
+    }
+    /* Il thread principale fa la parte del thread 0 */
+    fn(&workers[0]);
+
+    for (t = 0; t < s->n_threads; t++) {
+        if (t > 0 && !workers[t].error) {
+            pthread_join(workers[t].thread, NULL);
+        }
+        ret |= workers[t].error;
+    }
+    return ret ? -1 : 0;
+}
+
+/* Rende frontiera gli stati nuovi di tutti i gruppi, in ordine di gruppo */
+static int next_frontier(struct solver *s) {
+    int shard, n = 0;
+
+    for (shard = 0; shard < SHARDS; shard++) {
+        n += s->shards[shard].n_next;
+    }
+    if (n > s->frontier_capacity) {
+        unsigned int *bigger = realloc(s->frontier, sizeof(unsigned int) * n);
+        if (bigger == NULL) {
+            return -1;
+        }
+        s->frontier = bigger;
+        s->frontier_capacity = n;
+    }
+
+    s->n_frontier = 0;
+    for (shard = 0; shard < SHARDS; shard++) {
+        struct shard *sh = &s->shards[shard];
+        if (sh->n_next > 0) {
+            memcpy(&s->frontier[s->n_frontier], sh->next, sizeof(unsigned int) * sh->n_next);
+            s->n_frontier += sh->n_next;
+        }
+        sh->n_next = 0;
+    }
+    return 0;
+}
+
+/**
+ * Visita in ampiezza a partire dallo stato iniziale della room.
+ * Ritorna -1 se la memoria è esaurita o gli stati sono troppi.
+ */
+static int explore(struct solver *s) {
+    struct worker *workers;
+    struct player_state ps;
+    uint64_t *words;
+    int ret = 0;
+
+    workers = calloc(s->n_threads, sizeof(struct worker));
+    s->buckets = calloc(s->n_threads * SHARDS, sizeof(struct bucket));
+    ps.objects = malloc(sizeof(struct object_status) * (s->room->tot_objects + 1));
+    words = malloc(sizeof(uint64_t) * s->lay.words);
+    if (workers == NULL || s->buckets == NULL || ps.objects == NULL || words == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        uint64_t h;
+
+        reset_player(&s->room->puzzle, s->room->tot_objects, &ps);
+        state_encode(&s->lay, s->room, &ps, words);
+        h = state_hash(words, s->lay.words);
+        ret = shard_insert(s, (int)(h % SHARDS), words, h, NO_PARENT, 0, 0);
+    }
+
+    while (ret == 0 && (ret = next_frontier(s)) == 0 && s->n_frontier > 0) {
+        ret = run_phase(s, workers, expand);
+        if (ret == 0) {
+            ret = run_phase(s, workers, insert);
+        }
+    }
+
+    free(workers);
+    free(ps.objects);
+    free(words);
+    return ret;
+}
+
+/* Indici densi degli stati: base[shard] + posizione nel gruppo */
+static long dense(const long *base, unsigned int id) {
+    return base[ID_SHARD(id)] + ID_LOCAL(id);
+}
+
+/**
+ * Marca in *alive* gli stati da cui si può raggiungere una vittoria,
+ *  visitando all'indietro le mosse a partire dalle vittorie.
+ */
+static int mark_alive(struct solver *s, const long *base, long n_states, unsigned char *alive) {
+    long *first, *queue, *pos;
+    unsigned int *sources;
+    long n_edges = 0, head = 0, tail = 0, e, i;
+    int shard;
+
+    for (shard = 0; shard < SHARDS; shard++) {
+        n_edges += s->shards[shard].n_edges;
+    }
+
+    first = calloc(n_states + 1, sizeof(long));
+    pos = malloc(sizeof(long) * (n_states + 1));
+    sources = malloc(sizeof(unsigned int) * (n_edges + 1));
+    queue = malloc(sizeof(long) * (n_states + 1));
+    if (first == NULL || pos == NULL || sources == NULL || queue == NULL) {
+        free(first);
+        free(pos);
+        free(sources);
+        free(queue);
+        return -1;
+    }
+
+    /* Archi inversi in formato CSR: i padri di ogni figlio */
+    for (shard = 0; shard < SHARDS; shard++) {
+        struct shard *sh = &s->shards[shard];
+        for (e = 0; e < sh->n_edges; e++) {
+            first[dense(base, sh->edges[2 * e + 1]) + 1]++;
+        }
+    }
+    for (i = 0; i < n_states; i++) {
+        first[i + 1] += first[i];
+    }
+    memcpy(pos, first, sizeof(long) * (n_states + 1));
+    for (shard = 0; shard < SHARDS; shard++) {
+        struct shard *sh = &s->shards[shard];
+        for (e = 0; e < sh->n_edges; e++) {
+            sources[pos[dense(base, sh->edges[2 * e + 1])]++] = sh->edges[2 * e];
+        }
+    }
+
+    for (shard = 0; shard < SHARDS; shard++) {
+        struct shard *sh = &s->shards[shard];
+        for (i = 0; i < sh->n; i++) {
+            if (sh->wins[i]) {
+                alive[base[shard] + i] = 1;
+                queue[tail++] = base[shard] + i;
+            }
+        }
+    }
+    while (head < tail) {
+        long child = queue[head++];
+        for (e = first[child]; e < first[child + 1]; e++) {
+            long parent = dense(base, sources[e]);
+            if (!alive[parent]) {
+                alive[parent] = 1;
+                queue[tail++] = parent;
+            }
+        }
+    }
+
+    free(first);
+    free(pos);
+    free(sources);
+    free(queue);
+    return 0;
+}
+
+/* Stampa la sequenza di mosse che porta dallo stato iniziale a *id* */
+static void print_path(struct solver *s, unsigned int id) {
+    struct room *r = s->room;
+    struct player_state ps;
+    int *moves, n = 0, i;
+    unsigned int cur;
+
+    for (cur = id; s->shards[ID_SHARD(cur)].parents[ID_LOCAL(cur)] != NO_PARENT;
+        cur = s->shards[ID_SHARD(cur)].parents[ID_LOCAL(cur)]) {
+        n++;
+    }
+
+    moves = malloc(sizeof(int) * (n + 1));
+    ps.objects = malloc(sizeof(struct object_status) * (r->tot_objects + 1));
+    if (moves == NULL || ps.objects == NULL) {
+        free(moves);
+        free(ps.objects);
+        return;
+    }
+
+    i = n;
+    for (cur = id; s->shards[ID_SHARD(cur)].parents[ID_LOCAL(cur)] != NO_PARENT;
+        cur = s->shards[ID_SHARD(cur)].parents[ID_LOCAL(cur)]) {
+        moves[--i] = s->shards[ID_SHARD(cur)].moves[ID_LOCAL(cur)];
+    }
+
+    /* Le mosse vengono rigiocate per recuperare le risposte agli enigmi */
+    reset_player(&r->puzzle, r->tot_objects, &ps);
+    for (i = 0; i < n; i++) {
+        const char *answer = NULL;
+        char move[MOVE_STR_MAX];
+
+        apply_move(r, &ps, moves[i], &answer);
+        move_to_str(r, moves[i], move);
+        printf("    %3d. %s", i + 1, move);
+        if (answer != NULL) {
+            printf(" (risposta: %s)", answer);
+        }
+        printf("\n");
+    }
+
+    free(moves);
+    free(ps.objects);
+}
+
+/* Stampa lo stato degli oggetti che non sono nello stato iniziale */
+static void print_state(struct solver *s, unsigned int id) {
+    struct room *r = s->room;
+    struct player_state ps;
+    int i;
+
+    ps.objects = malloc(sizeof(struct object_status) * (r->tot_objects + 1));
+    if (ps.objects == NULL) {
+        return;
+    }
+    state_decode(&s->lay, s->room, &s->shards[ID_SHARD(id)].states[(long)ID_LOCAL(id) * s->lay.words], &ps);
+
+    printf("    token: %d, inventario:", ps.n_tokens);
+    for (i = 0; i < r->tot_objects; i++) {
+        if (ps.objects[i].in_inventory) {
+            printf(" %s", r->object_names[i]);
+        }
+    }
+    printf("\n");
+    for (i = 0; i < r->tot_objects; i++) {
+        if (ps.objects[i].state != r->puzzle.first_state[i]) {
+            printf("    %s: %s\n", r->object_names[i], r->puzzle.state_names[ps.objects[i].state]);
+        }
+    }
+    free(ps.objects);
+}
+
+static void free_solver(struct solver *s) {
+    int i;
+
+    for (i = 0; i < SHARDS; i++) {
+        struct shard *sh = &s->shards[i];
+        free(sh->states);
+        free(sh->parents);
+        free(sh->moves);
+        free(sh->depths);
+        free(sh->wins);
+        free(sh->table);
+        free(sh->next);
+        free(sh->edges);
+    }
+    if (s->buckets != NULL) {
+        for (i = 0; i < s->n_threads * SHARDS; i++) {
+            free(s->buckets[i].states);
+            free(s->buckets[i].hashes);
+            free(s->buckets[i].parents);
+            free(s->buckets[i].moves);
+        }
+    }
+    free(s->buckets);
+    free(s->frontier);
+    layout_free(&s->lay);
+}
+
+/**
+ * Analizza la room *r* e stampa il resoconto.
+ * Ritorna 0 se è risolvibile e senza vicoli ciechi, 1 se non lo è, 2 in caso di errore.
+ */
+static int solve_room(struct room *r, int n_threads, long states_max) {
+    struct solver s;
+    long base[SHARDS], n_states = 0, n_edges = 0, n_dead = 0, i;
+    unsigned char *alive;
+    unsigned int best_win = NO_PARENT, best_dead = NO_PARENT;
+    int shard, overflow = 0, depth_max = 0, ret = 0;
+    double start = now_ms();
+
+    printf("Room %d \"%s\": %d oggetti, %d stati degli oggetti, %d token\n",
+        r->id, r->name, r->tot_objects, r->puzzle.n_states, r->n_tokens);
+
+    if (r->tot_objects > OBJECTS_MAX) {
+        printf("  troppi oggetti per il risolutore\n");
+        return 2;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.room = r;
+    s.n_threads = n_threads;
+    s.states_max = states_max;
+
+    if (layout_init(&s.lay, r) == -1 || explore(&s) == -1) {
+        for (shard = 0; shard < SHARDS; shard++) {
+            overflow |= s.shards[shard].overflow;
+        }
+        printf(overflow ? "  più di %ld stati, analisi interrotta (vedi -m)\n" :
+            "  memoria esaurita (%ld)\n", states_max);
+        free_solver(&s);
+        return 2;
+    }
+
+    for (shard = 0; shard < SHARDS; shard++) {
+        struct shard *sh = &s.shards[shard];
+        base[shard] = n_states;
+        n_states += sh->n;
+        n_edges += sh->n_edges;
+    }
+
+    alive = calloc(n_states, 1);
+    if (alive == NULL || mark_alive(&s, base, n_states, alive) == -1) {
+        printf("  memoria esaurita\n");
+        free(alive);
+        free_solver(&s);
+        return 2;
+    }
+
+    /* Vittoria e vicolo cieco più vicini allo stato iniziale (a parità, il primo in ordine di gruppo) */
+    for (shard = 0; shard < SHARDS; shard++) {
+        struct shard *sh = &s.shards[shard];
+        for (i = 0; i < sh->n; i++) {
+            unsigned int id = ID(shard, i);
+            if (sh->depths[i] > depth_max) {
+                depth_max = sh->depths[i];
+            }
+            if (sh->wins[i] && (best_win == NO_PARENT ||
+                sh->depths[i] < s.shards[ID_SHARD(best_win)].depths[ID_LOCAL(best_win)])) {
+                best_win = id;
+            }
+            if (!alive[base[shard] + i]) {
+                n_dead++;
+                if (best_dead == NO_PARENT ||
+                    sh->depths[i] < s.shards[ID_SHARD(best_dead)].depths[ID_LOCAL(best_dead)]) {
+                    best_dead = id;
+                }
+            }
+        }
+    }
+
+    printf("  stati raggiungibili: %ld (%d byte ciascuno), mosse: %ld, profondità: %d\n",
+        n_states, (int)(s.lay.words * sizeof(uint64_t)), n_edges, depth_max);
+
+    if (best_win == NO_PARENT) {
+        printf(ANSI_COLOR_RED "  non risolvibile" ANSI_COLOR_RESET "\n");
+        ret = 1;
+    }
+    else {
+        printf("  risolvibile in %d mosse:\n", s.shards[ID_SHARD(best_win)].depths[ID_LOCAL(best_win)]);
+        print_path(&s, best_win);
+    }
+
+    if (n_dead > 0 && best_win != NO_PARENT) {
+        printf(ANSI_COLOR_YELLOW "  vicoli ciechi: %ld, il più vicino:" ANSI_COLOR_RESET "\n", n_dead);
+        print_path(&s, best_dead);
+        print_state(&s, best_dead);
+        ret = 1;
+    }
+    else if (best_win != NO_PARENT) {
+        printf("  vicoli ciechi: 0\n");
+    }
+
+    printf("  tempo: %.1f ms con %d thread\n", now_ms() - start, n_threads);
+
+    free(alive);
+    free_solver(&s);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    struct catalogue *c;
+    const char *path = ROOMS_FILE;
+    long states_max = STATES_MAX_DEFAULT;
+    int n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int i, r, ret = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            n_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            states_max = atol(argv[++i]);
+        }
+        else if (argv[i][0] != '-') {
+            path = argv[i];
+        }
+        else {
+            printf("Uso: %s [-t thread] [-m max_stati] [file delle room]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+    if (n_threads > SHARDS) {
+        n_threads = SHARDS;
+    }
+
+    c = load_catalogue(path);
+    if (c == NULL) {
+        printf(ANSI_COLOR_RED "[Errore]: impossibile caricare %s" ANSI_COLOR_RESET "\n", path);
+        return 2;
+    }
+
+    for (r = 0; r < c->n_rooms; r++) {
+        int res = solve_room(&c->rooms[r], n_threads, states_max);
+        if (res > ret) {
+            ret = res;
+        }
+    }
+
+    catalogue_release(c);
+    return ret;
+}